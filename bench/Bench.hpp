@@ -0,0 +1,61 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <vector>
+/**@file
+ * Minimal micro-benchmark harness for "make bench".
+ *
+ * Benchmarks are defined with the BENCHMARK macro, and are given a State with the number of
+ * iterations to run. The runner increases the iteration count until a run takes long enough to
+ * time reliably, then repeats it and reports the median, as JSON.
+ */
+namespace bench
+{
+    /**Passed to a benchmark, which must run its operation iterations() times.*/
+    class State
+    {
+    public:
+        explicit State(uint64_t iterations)
+            : _iterations(iterations), _bytes(0), _items(1)
+        {}
+        /**Number of times to run the measured operation.*/
+        uint64_t iterations()const { return _iterations; }
+        /**Bytes processed by each iteration, to also report throughput in bytes.*/
+        void set_bytes(uint64_t bytes) { _bytes = bytes; }
+        uint64_t bytes()const { return _bytes; }
+        /**Operations done by each iteration, if it does several, so the time is per operation.*/
+        void set_items(uint64_t items) { _items = items; }
+        uint64_t items()const { return _items; }
+    private:
+        uint64_t _iterations;
+        uint64_t _bytes;
+        uint64_t _items;
+    };
+
+    typedef std::function<void(State&)> Function;
+
+    /**Registers a benchmark when constructed. Use BENCHMARK rather than directly.*/
+    struct Registrar
+    {
+        Registrar(const char *name, Function func);
+    };
+
+    /**Prevent the compiler from optimising away a value that is otherwise unused.*/
+    template<typename T> inline void do_not_optimize(const T &value)
+    {
+#if defined(__GNUC__)
+        asm volatile("" : : "r,m"(value) : "memory");
+#else
+        const volatile char *p = reinterpret_cast<const volatile char*>(&value);
+        (void)*p;
+#endif
+    }
+}
+
+/**Define and register a benchmark function taking a bench::State &state.*/
+#define BENCHMARK(name) \
+    static void bench_##name(bench::State &state); \
+    static bench::Registrar bench_registrar_##name(#name, bench_##name); \
+    static void bench_##name(bench::State &state)
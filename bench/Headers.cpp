@@ -0,0 +1,69 @@
+#include "Bench.hpp"
+#include "Headers.hpp"
+#include <vector>
+
+using namespace http;
+
+namespace
+{
+    const char *const NAMES[] = {
+        "Host", "User-Agent", "Accept", "Accept-Language", "Accept-Encoding", "Cookie",
+        "Connection", "Referer", "If-None-Match", "If-Modified-Since"
+    };
+    const size_t NAME_COUNT = sizeof(NAMES) / sizeof(NAMES[0]);
+
+    Headers make_headers()
+    {
+        Headers headers;
+        for (auto name : NAMES) headers.add(name, "value of a typical length");
+        return headers;
+    }
+}
+
+BENCHMARK(Headers_add)
+{
+    std::vector<std::string> names(NAMES, NAMES + NAME_COUNT);
+    const std::string value = "value of a typical length";
+    state.set_items(NAME_COUNT);
+    for (uint64_t i = 0; i < state.iterations(); ++i)
+    {
+        Headers headers;
+        for (auto &name : names) headers.add(name, value);
+        bench::do_not_optimize(headers);
+    }
+}
+
+BENCHMARK(Headers_get)
+{
+    auto headers = make_headers();
+    std::vector<std::string> names(NAMES, NAMES + NAME_COUNT);
+    names.push_back("Content-Length"); // A miss
+    state.set_items(names.size());
+    for (uint64_t i = 0; i < state.iterations(); ++i)
+    {
+        for (auto &name : names) bench::do_not_optimize(headers.get(name));
+    }
+}
+
+BENCHMARK(Headers_set_remove)
+{
+    auto headers = make_headers();
+    const std::string name = "Content-Length", value = "1234";
+    state.set_items(2);
+    for (uint64_t i = 0; i < state.iterations(); ++i)
+    {
+        headers.set(name, value);
+        headers.remove(name);
+    }
+    bench::do_not_optimize(headers);
+}
+
+BENCHMARK(Headers_copy)
+{
+    auto headers = make_headers();
+    for (uint64_t i = 0; i < state.iterations(); ++i)
+    {
+        Headers copy = headers;
+        bench::do_not_optimize(copy);
+    }
+}
@@ -0,0 +1,222 @@
+#include "Bench.hpp"
+#include "Time.hpp"
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <stdexcept>
+
+namespace bench
+{
+    namespace
+    {
+        struct Benchmark
+        {
+            std::string name;
+            Function func;
+        };
+        struct Result
+        {
+            std::string name;
+            uint64_t iterations;
+            double ns_per_op;
+            double min_ns_per_op;
+            double max_ns_per_op;
+            uint64_t bytes;
+        };
+        struct Options
+        {
+            Options() : filter(), min_time(0.1), repetitions(5), out() {}
+            /**Only run benchmarks with names containing this.*/
+            std::string filter;
+            /**Minimum seconds for each timed run.*/
+            double min_time;
+            unsigned repetitions;
+            /**File to write the JSON results to, else stdout.*/
+            std::string out;
+        };
+
+        /**Function local, so registrars in other translation units can use it during static
+         * initialisation.
+         */
+        std::vector<Benchmark> &registry()
+        {
+            static std::vector<Benchmark> benchmarks;
+            return benchmarks;
+        }
+
+        /**Run func for a number of iterations.
+         * @return Elapsed seconds.
+         */
+        double run_once(const Function &func, State &state)
+        {
+            auto start = std::chrono::steady_clock::now();
+            func(state);
+            auto end = std::chrono::steady_clock::now();
+            return std::chrono::duration<double>(end - start).count();
+        }
+
+        Result run(const Benchmark &benchmark, const Options &options)
+        {
+            // Find an iteration count that takes at least min_time, which also warms caches
+            uint64_t iterations = 1;
+            while (true)
+            {
+                State state(iterations);
+                auto elapsed = run_once(benchmark.func, state);
+                if (elapsed >= options.min_time || iterations >= 1000000000) break;
+                uint64_t next = iterations * 10;
+                if (elapsed > options.min_time / 100)
+                    next = (uint64_t)((double)iterations * options.min_time * 1.2 / elapsed) + 1;
+                iterations = std::max(next, iterations + 1);
+            }
+
+            std::vector<double> times;
+            uint64_t items = 1, bytes = 0;
+            for (unsigned i = 0; i < std::max(options.repetitions, 1U); ++i)
+            {
+                State state(iterations);
+                auto elapsed = run_once(benchmark.func, state);
+                items = state.items();
+                bytes = state.bytes();
+                times.push_back(elapsed * 1e9 / (double)(iterations * items));
+            }
+            std::sort(times.begin(), times.end());
+            Result result;
+            result.name = benchmark.name;
+            result.iterations = iterations * items;
+            result.ns_per_op = times[times.size() / 2];
+            result.min_ns_per_op = times.front();
+            result.max_ns_per_op = times.back();
+            result.bytes = items ? bytes / items : bytes;
+            return result;
+        }
+
+        std::string json_string(const std::string &str)
+        {
+            std::string out = "\"";
+            for (auto c : str)
+            {
+                if (c == '"' || c == '\\') (out += '\\') += c;
+                else if ((unsigned char)c < 0x20)
+                {
+                    char buffer[8];
+                    snprintf(buffer, sizeof(buffer), "\\u%04x", (unsigned)c);
+                    out += buffer;
+                }
+                else out += c;
+            }
+            return out += "\"";
+        }
+
+        std::string compiler()
+        {
+            std::stringstream ss;
+#if defined(__clang__)
+            ss << "clang " << __clang_version__;
+#elif defined(__GNUC__)
+            ss << "gcc " << __VERSION__;
+#elif defined(_MSC_VER)
+            ss << "msvc " << _MSC_FULL_VER;
+#else
+            ss << "unknown";
+#endif
+            return ss.str();
+        }
+
+        void write_json(std::ostream &os, const std::vector<Result> &results, const Options &options)
+        {
+            os << "{\n";
+            os << "  \"context\": {\n";
+            os << "    \"date\": " << json_string(http::format_time(time(nullptr))) << ",\n";
+            os << "    \"compiler\": " << json_string(compiler()) << ",\n";
+            os << "    \"min_time\": " << options.min_time << ",\n";
+            os << "    \"repetitions\": " << options.repetitions << "\n";
+            os << "  },\n";
+            os << "  \"benchmarks\": [";
+            for (size_t i = 0; i < results.size(); ++i)
+            {
+                auto &result = results[i];
+                os << (i ? "," : "") << "\n    {";
+                os << "\"name\": " << json_string(result.name);
+                os << ", \"iterations\": " << result.iterations;
+                os << ", \"ns_per_op\": " << result.ns_per_op;
+                os << ", \"min_ns_per_op\": " << result.min_ns_per_op;
+                os << ", \"max_ns_per_op\": " << result.max_ns_per_op;
+                os << ", \"ops_per_second\": " << (1e9 / result.ns_per_op);
+                if (result.bytes)
+                {
+                    os << ", \"bytes_per_op\": " << result.bytes;
+                    os << ", \"bytes_per_second\": " << ((double)result.bytes * 1e9 / result.ns_per_op);
+                }
+                os << "}";
+            }
+            os << "\n  ]\n}\n";
+        }
+
+        Options parse_args(int argc, char *argv[])
+        {
+            Options options;
+            for (int i = 1; i < argc; ++i)
+            {
+                std::string arg = argv[i];
+                if (i + 1 >= argc) throw std::runtime_error("Missing value for " + arg);
+                std::string value = argv[++i];
+                if (arg == "--filter") options.filter = value;
+                else if (arg == "--min-time") options.min_time = std::atof(value.c_str());
+                else if (arg == "--repetitions") options.repetitions = (unsigned)std::atoi(value.c_str());
+                else if (arg == "--out") options.out = value;
+                else throw std::runtime_error("Unknown argument " + arg);
+            }
+            return options;
+        }
+    }
+
+    Registrar::Registrar(const char *name, Function func)
+    {
+        Benchmark benchmark = { name, func };
+        registry().push_back(benchmark);
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    using namespace bench;
+    try
+    {
+        auto options = parse_args(argc, argv);
+        auto benchmarks = registry();
+        std::sort(benchmarks.begin(), benchmarks.end(),
+            [](const Benchmark &a, const Benchmark &b) { return a.name < b.name; });
+
+        std::vector<Result> results;
+        for (auto &benchmark : benchmarks)
+        {
+            if (benchmark.name.find(options.filter) == std::string::npos) continue;
+            auto result = run(benchmark, options);
+            // Progress on stderr, so stdout is only the JSON
+            fprintf(stderr, "%-40s %12.1f ns/op\n", result.name.c_str(), result.ns_per_op);
+            results.push_back(result);
+        }
+
+        if (options.out.empty()) write_json(std::cout, results, options);
+        else
+        {
+            std::ofstream file(options.out);
+            if (!file) throw std::runtime_error("Failed to open " + options.out);
+            write_json(file, results, options);
+        }
+        return 0;
+    }
+    catch (const std::exception &e)
+    {
+        fprintf(stderr, "%s\n", e.what());
+        fprintf(stderr, "Usage: bench [--filter NAME] [--min-time SECONDS] [--repetitions N] [--out FILE]\n");
+        return 1;
+    }
+}
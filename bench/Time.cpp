@@ -0,0 +1,42 @@
+#include "Bench.hpp"
+#include "Time.hpp"
+
+using namespace http;
+
+BENCHMARK(format_time)
+{
+    time_t t = 784111777; // Sun, 06 Nov 1994 08:49:37 GMT
+    for (uint64_t i = 0; i < state.iterations(); ++i)
+    {
+        auto str = format_time(t + (time_t)i);
+        bench::do_not_optimize(str);
+    }
+}
+
+BENCHMARK(format_time_buffer)
+{
+    time_t t = 784111777;
+    char buffer[TIME_STR_LEN];
+    for (uint64_t i = 0; i < state.iterations(); ++i)
+    {
+        format_time(t + (time_t)i, buffer);
+        bench::do_not_optimize(buffer);
+    }
+}
+
+BENCHMARK(format_current_time)
+{
+    char buffer[TIME_STR_LEN];
+    for (uint64_t i = 0; i < state.iterations(); ++i)
+    {
+        format_current_time(buffer);
+        bench::do_not_optimize(buffer);
+    }
+}
+
+BENCHMARK(parse_time)
+{
+    const std::string str = "Sun, 06 Nov 1994 08:49:37 GMT";
+    for (uint64_t i = 0; i < state.iterations(); ++i)
+        bench::do_not_optimize(parse_time(str));
+}
@@ -0,0 +1,49 @@
+#include "Bench.hpp"
+#include "Url.hpp"
+
+using namespace http;
+
+BENCHMARK(Url_parse_request)
+{
+    const std::string uri = "/api/v1/search?q=http+server&page=2&sort=relevance&lang=en-GB&filter=a&filter=b";
+    state.set_bytes(uri.size());
+    for (uint64_t i = 0; i < state.iterations(); ++i)
+    {
+        auto url = Url::parse_request(uri);
+        bench::do_not_optimize(url);
+    }
+}
+
+BENCHMARK(Url_parse_request_path)
+{
+    const std::string uri = "/assets/images/logo.png";
+    state.set_bytes(uri.size());
+    for (uint64_t i = 0; i < state.iterations(); ++i)
+    {
+        auto url = Url::parse_request(uri);
+        bench::do_not_optimize(url);
+    }
+}
+
+BENCHMARK(url_decode)
+{
+    const std::string encoded = "/files/Annual%20Report%202024%20%28final%29/summary%2Bnotes.pdf";
+    state.set_bytes(encoded.size());
+    for (uint64_t i = 0; i < state.iterations(); ++i)
+    {
+        auto decoded = url_decode(encoded);
+        bench::do_not_optimize(decoded);
+    }
+}
+
+BENCHMARK(url_decode_plain)
+{
+    // The common case of a segment with nothing to decode
+    const std::string plain = "application.js";
+    state.set_bytes(plain.size());
+    for (uint64_t i = 0; i < state.iterations(); ++i)
+    {
+        auto decoded = url_decode(plain);
+        bench::do_not_optimize(decoded);
+    }
+}
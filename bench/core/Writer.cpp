@@ -0,0 +1,28 @@
+#include "../Bench.hpp"
+#include "core/Writer.hpp"
+#include "Response.hpp"
+#include <sstream>
+
+using namespace http;
+
+BENCHMARK(write_response_header)
+{
+    Response response;
+    response.status_code(SC_OK);
+    response.headers.add("Date", "Sun, 06 Nov 1994 08:49:37 GMT");
+    response.headers.add("Server", "cpphttp");
+    response.headers.add("Content-Type", "text/html; charset=utf-8");
+    response.headers.add("Content-Length", "4096");
+    response.headers.add("Cache-Control", "max-age=60");
+    response.headers.add("ETag", "\"5e1f-17a3c\"");
+    response.headers.add("Vary", "Accept-Encoding");
+    std::stringstream ss;
+    write_response_header(ss, response);
+    state.set_bytes(ss.str().size());
+    for (uint64_t i = 0; i < state.iterations(); ++i)
+    {
+        std::stringstream out;
+        write_response_header(out, response);
+        bench::do_not_optimize(out);
+    }
+}
@@ -0,0 +1,26 @@
+#include "../Bench.hpp"
+#include "headers/Accept.hpp"
+
+using namespace http;
+
+BENCHMARK(Accept_parse)
+{
+    const std::string value = "text/html,application/xhtml+xml,application/xml;q=0.9,image/avif,image/webp,*/*;q=0.8";
+    state.set_bytes(value.size());
+    for (uint64_t i = 0; i < state.iterations(); ++i)
+    {
+        Accept accept(value);
+        bench::do_not_optimize(accept);
+    }
+}
+
+BENCHMARK(Accept_preferred)
+{
+    const Accept accept("text/html,application/xhtml+xml,application/xml;q=0.9,image/avif,image/webp,*/*;q=0.8");
+    const std::vector<std::string> types = { "application/json", "application/xml", "text/html" };
+    for (uint64_t i = 0; i < state.iterations(); ++i)
+    {
+        auto type = accept.preferred(types);
+        bench::do_not_optimize(type);
+    }
+}
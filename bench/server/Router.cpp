@@ -0,0 +1,71 @@
+#include "../Bench.hpp"
+#include "server/Router.hpp"
+#include "Response.hpp"
+
+using namespace http;
+
+namespace
+{
+    const int RESOURCE_COUNT = 250;
+
+    /**About 1500 routes, shaped like a REST API plus static pages and assets.*/
+    void add_routes(Router &router)
+    {
+        RequestHandler handler = [](Request&, PathParams&) { return Response(); };
+        router.add("GET", "/", handler);
+        router.add("GET", "/assets/*", handler);
+        for (int i = 0; i < RESOURCE_COUNT; ++i)
+        {
+            auto base = "/api/v1/resource" + std::to_string(i);
+            router.add("GET", base, handler);
+            router.add("POST", base, handler);
+            router.add("GET", base + "/:id", handler);
+            router.add("PUT", base + "/:id", handler);
+            router.add("GET", base + "/:id/items/:item", handler);
+            router.add("GET", "/pages/page" + std::to_string(i) + ".html", handler);
+        }
+    }
+    struct Lookup
+    {
+        std::string method;
+        std::string path;
+    };
+}
+
+BENCHMARK(Router_get)
+{
+    Router router;
+    add_routes(router);
+    const std::vector<Lookup> lookups = {
+        { "GET", "/" },
+        { "GET", "/pages/page200.html" },
+        { "GET", "/api/v1/resource17" },
+        { "POST", "/api/v1/resource123" },
+        { "GET", "/api/v1/resource42/8f3a2b" },
+        { "PUT", "/api/v1/resource249/1234" },
+        { "GET", "/api/v1/resource99/1234/items/5678" },
+        { "GET", "/assets/js/application.js" },
+        { "GET", "/not/found" }
+    };
+    state.set_items(lookups.size());
+    for (uint64_t i = 0; i < state.iterations(); ++i)
+    {
+        for (auto &lookup : lookups)
+        {
+            auto route = router.get(lookup.method, lookup.path);
+            bench::do_not_optimize(route);
+        }
+    }
+}
+
+BENCHMARK(Router_get_params)
+{
+    Router router;
+    add_routes(router);
+    const std::string method = "GET", path = "/api/v1/resource99/1234/items/5678";
+    for (uint64_t i = 0; i < state.iterations(); ++i)
+    {
+        auto route = router.get(method, path);
+        bench::do_not_optimize(route);
+    }
+}
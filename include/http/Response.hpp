@@ -2,11 +2,15 @@
 #include "Headers.hpp"
 #include "Status.hpp"
 #include <cstdint>
+#include <memory>
 #include <string>
 #include <vector>
 
 namespace http
 {
+    class EventStream;
+    class File;
+    class WebSocket;
     /**HTTP Response message.*/
     class Response
     {
@@ -17,6 +21,18 @@ namespace http
         Headers headers;
         /**Response body. Allthough this is an std::string, it may also contain binary data.*/
         std::string body;
+        /**If set, the response body is the entire contents of this file, and body must be empty.
+         * Servers may send the file directly from the OS, rather than copying it into memory.
+         */
+        std::shared_ptr<const File> body_file;
+        /**If set on a "101 Switching Protocols" response, the server switches the connection to
+         * this WebSocket once the response is sent. See websocket_upgrade.
+         */
+        std::shared_ptr<WebSocket> websocket;
+        /**If set on a "200 OK" response, the server keeps the connection open after sending the
+         * header, to send this stream's events as the body. See event_stream.
+         */
+        std::shared_ptr<EventStream> event_stream;
 
         /**Set the status code and message.*/
         void status_code(StatusCode sc)
@@ -4,8 +4,23 @@
 
 namespace http
 {
+    /**Length of a formatted HTTP date and time, e.g. "Sun, 06 Nov 1994 08:49:37 GMT".*/
+    static const size_t TIME_STR_LEN = sizeof("DDD, DD MMM YYYY HH:MM:SS GMT") - 1;
+
     /**Format date and time for using in HTTP headers such as Date and Last-Modified.*/
     std::string format_time(time_t utc);
+    /**Format date and time for using in HTTP headers such as Date and Last-Modified.
+     * Does not allocate or use the C locale functions. Exactly TIME_STR_LEN characters are
+     * written and no null terminator is added.
+     * @return buffer + TIME_STR_LEN
+     */
+    char *format_time(time_t utc, char *buffer);
+    /**Copies the current date and time formatted as by format_time into buffer.
+     * The formatted value is shared between threads and is only regenerated when the second
+     * changes, making this suitable for the Date header of every message.
+     * @return buffer + TIME_STR_LEN
+     */
+    char *format_current_time(char *buffer);
 
     /**Parses date and time as specified by HTTP headers such as Date and Last-Modified.*/
     time_t parse_time(const std::string &time);
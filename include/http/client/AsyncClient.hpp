@@ -10,6 +10,7 @@
 #include "../Request.hpp"
 #include "../Response.hpp"
 #include "../Headers.hpp"
+#include "../util/Coroutine.hpp"
 namespace http
 {
     class AsyncClient;
@@ -91,6 +92,10 @@ namespace http
             std::future<Response*> future;
             /**The client performing this request.*/
             std::atomic<AsyncClient*> client;
+            /**If set, called once promise is fulfilled, as the client's last use of the request.
+             * Used by AsyncClient::co_queue.
+             */
+            std::function<void()> on_done;
 
             /**Storage for the response, intended for the async implementations benefit.
              * Client should get the response from the callback or future, and this field is not
@@ -99,7 +104,7 @@ namespace http
             Response response;
         private:
             friend class http::AsyncRequest;
-            Detail() : promise(), future(), client(nullptr), response() {}
+            Detail() : promise(), future(), client(nullptr), on_done(), response() {}
 
             Detail(const Detail&) = delete;
             Detail& operator = (const Detail&) = delete;
@@ -108,6 +113,7 @@ namespace http
                 : promise(std::move(mv.promise))
                 , future(std::move(mv.future))
                 , client(mv.client.load())
+                , on_done(std::move(mv.on_done))
             {
                 mv.client = nullptr;
             }
@@ -116,6 +122,7 @@ namespace http
                 promise = std::move(mv.promise);
                 future = std::move(mv.future);
                 client = mv.client.load();
+                on_done = std::move(mv.on_done);
                 mv.client = nullptr;
                 return *this;
             }
@@ -123,6 +130,26 @@ namespace http
         /**Implementation details. See Detail.*/
         Detail detail;
     };
+#ifdef HTTP_USE_COROUTINES
+    /**Awaitable returned by AsyncClient::co_queue.*/
+    class AsyncRequestAwaiter
+    {
+    public:
+        AsyncRequestAwaiter(AsyncClient &client, AsyncRequest &request)
+            : client(client), request(request)
+        {}
+        bool await_ready()const noexcept { return false; }
+        void await_suspend(std::coroutine_handle<> awaiting);
+        /**@return As for AsyncRequest::wait.*/
+        Response *await_resume()
+        {
+            return request.wait();
+        }
+    private:
+        AsyncClient &client;
+        AsyncRequest &request;
+    };
+#endif
     /**Params for AsyncClient.*/
     struct AsyncClientParams
     {
@@ -178,6 +205,16 @@ namespace http
          * request included callbacks.
          */
         std::future<Response*>& queue(AsyncRequest *request);
+#ifdef HTTP_USE_COROUTINES
+        /**Queue a request, and await its response, which is as for AsyncRequest::wait.
+         * The coroutine is resumed by the client thread that completed the request, so like
+         * on_completion should not block it for long.
+         */
+        AsyncRequestAwaiter co_queue(AsyncRequest &request)
+        {
+            return AsyncRequestAwaiter(*this, request);
+        }
+#endif
         /**Abort a pending request.*/
         void abort(AsyncRequest *request);
         /**Stop processing requests and wait for all internal threads to exit.
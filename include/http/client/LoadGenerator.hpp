@@ -0,0 +1,121 @@
+#pragma once
+#include "../net/SocketOptions.hpp"
+#include "../util/LatencyHistogram.hpp"
+#include "../Request.hpp"
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <vector>
+namespace http
+{
+    /**Settings for a LoadGenerator run.*/
+    struct LoadOptions
+    {
+        LoadOptions()
+            : host("localhost"), port(80), tls(false), socket_options(), requests()
+            , connections(1), pipeline(1), rate(0)
+            , duration(std::chrono::seconds(10)), warmup(std::chrono::seconds(0))
+        {
+            // Pipelined requests are already combined, so should not wait for earlier ones
+            socket_options.no_delay = true;
+        }
+        /**Server to connect to. Requests without a Host header are sent with this host.*/
+        std::string host;
+        uint16_t port;
+        /**Connect with TLS. The server certificate must be trusted. Only supported with OpenSSL.*/
+        bool tls;
+        /**Options set on each client socket. no_delay is set by default.*/
+        SocketOptions socket_options;
+        /**Requests to send, in turn on each connection. Each is serialized once, before the run.
+         * If empty, "GET /" is sent.
+         */
+        std::vector<Request> requests;
+        /**Number of connections, opened before the run starts.*/
+        unsigned connections;
+        /**Most requests sent on a connection before their responses are received. Requests
+         * sent together are combined into one write.
+         */
+        unsigned pipeline;
+        /**Requests per second over all connections, for an open loop run. If 0, the run is
+         * closed loop, and each connection sends its next request as soon as a response
+         * completes, keeping pipeline requests outstanding.
+         */
+        double rate;
+        /**Length of the run, after the warmup.*/
+        std::chrono::milliseconds duration;
+        /**Time at the start of the run for which latencies are not recorded.*/
+        std::chrono::milliseconds warmup;
+    };
+
+    /**Results of a LoadGenerator run.*/
+    struct LoadResult
+    {
+        LoadResult()
+            : completed(0), status_errors(0), errors(0), incomplete(0), bytes_received(0)
+            , elapsed(0), latency()
+        {}
+        /**Responses received for requests started after the warmup.*/
+        uint64_t completed;
+        /**Completed responses with a status of 400 or more.*/
+        uint64_t status_errors;
+        /**Requests that failed because their connection closed or failed, or a response could
+         * not be parsed. Connections are not reopened, so this is also the number of requests
+         * lost with each failed connection.
+         */
+        uint64_t errors;
+        /**Requests that were due or in progress when the run ended.*/
+        uint64_t incomplete;
+        /**Response bytes received after the warmup, including headers.*/
+        uint64_t bytes_received;
+        /**Seconds from the end of the warmup to the end of the run.*/
+        double elapsed;
+        /**Latency of each completed request in nanoseconds.
+         * In an open loop run this is from the time the request was due to be sent, rather
+         * than when it was actually sent, so time spent waiting behind a slow response is
+         * included rather than hidden ("coordinated omission").
+         */
+        LatencyHistogram latency;
+
+        /**Completed requests per second.*/
+        double throughput()const { return elapsed > 0 ? (double)completed / elapsed : 0; }
+    };
+
+    /**HTTP/1.1 load generator for measuring server throughput and latency.
+     *
+     * All connections are driven by a single AsyncIo thread, so the generator itself uses
+     * little CPU per request, and many connections with pipelining can be kept busy. In an
+     * open loop run, a scheduling thread releases requests at a constant rate, and each is
+     * sent on the connection with the fewest requests outstanding, or queued if every
+     * connection has pipeline requests outstanding.
+     */
+    class LoadGenerator
+    {
+    public:
+        explicit LoadGenerator(const LoadOptions &options);
+        LoadGenerator(const LoadGenerator&) = delete;
+        LoadGenerator& operator = (const LoadGenerator&) = delete;
+
+        /**Connect, run for the warmup and duration, and return the results. Blocks until the
+         * run is complete or stop is called.
+         * @throws NetworkError If a connection could not be opened.
+         */
+        LoadResult run();
+        /**End the current run early, from any thread. The results so far are returned.*/
+        void stop();
+    private:
+        class Run;
+
+        LoadOptions options;
+        std::mutex stop_mutex;
+        std::condition_variable stop_cv;
+        /**Requires stop_mutex.*/
+        bool stopping;
+
+        /**Wait until time or stop.
+         * @return False if stopped.
+         */
+        bool wait_until(std::chrono::steady_clock::time_point time);
+    };
+}
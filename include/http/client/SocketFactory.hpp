@@ -1,4 +1,5 @@
 #pragma once
+#include "../net/SocketOptions.hpp"
 #include <memory>
 #include <string>
 #include <cstdint>
@@ -24,6 +25,29 @@ namespace http
     class DefaultSocketFactory : public SocketFactory
     {
     public:
+        /**@param options Options set on each new socket, e.g. to tune buffer sizes or use
+         * TCP Fast Open.
+         */
+        explicit DefaultSocketFactory(const SocketOptions &options = SocketOptions())
+            : options(options)
+        {}
+        const SocketOptions &socket_options()const { return options; }
+        virtual std::unique_ptr<Socket> connect(const std::string &host, uint16_t port, bool tls)override;
+    private:
+        SocketOptions options;
+    };
+
+    /**Factory connecting to a local server over a Unix domain socket, whatever the host and
+     * port. Not supported on Windows.
+     * The URL host is still sent in the Host header as normal. TLS is not supported.
+     */
+    class UnixSocketFactory : public SocketFactory
+    {
+    public:
+        /**@param path File system path of the servers socket.*/
+        explicit UnixSocketFactory(const std::string &path) : path(path) {}
         virtual std::unique_ptr<Socket> connect(const std::string &host, uint16_t port, bool tls)override;
+    private:
+        std::string path;
     };
 }
@@ -0,0 +1,127 @@
+#pragma once
+#include "Http2.hpp"
+#include <cstdint>
+#include <deque>
+#include <string>
+#include <utility>
+#include <vector>
+namespace http
+{
+    namespace http2
+    {
+        /**A header name and value. HTTP/2 header names are always lower case.*/
+        struct HeaderField
+        {
+            std::string name;
+            std::string value;
+        };
+        typedef std::vector<HeaderField> HeaderList;
+
+        /**Appends the HPACK Huffman encoding of a string (RFC7541 5.2) to out.*/
+        void huffman_encode(const std::string &str, std::string *out);
+        /**Number of bytes huffman_encode would produce for str.*/
+        size_t huffman_encoded_len(const std::string &str);
+        /**Decodes a HPACK Huffman encoded string, appending to out.
+         * @throws Http2Error ERR_COMPRESSION_ERROR if the data is not a valid encoding.
+         */
+        void huffman_decode(const uint8_t *begin, const uint8_t *end, std::string *out);
+
+        /**The HPACK static and dynamic tables (RFC7541 2.3).*/
+        class HpackTable
+        {
+        public:
+            /**Number of entries in the static table.*/
+            static const size_t STATIC_SIZE = 61;
+            /**Overhead for each entry when calculating the table size.*/
+            static const size_t ENTRY_OVERHEAD = 32;
+
+            explicit HpackTable(uint32_t max_size = DEFAULT_HEADER_TABLE_SIZE);
+
+            /**Get a field by index, where 1 to STATIC_SIZE is the static table and the dynamic
+             * table follows, newest first.
+             * @throws Http2Error ERR_COMPRESSION_ERROR if the index is not valid.
+             */
+            const HeaderField &get(size_t index)const;
+            /**Find an entry for a header.
+             * @param value_match Set to true if the entry also matched the value.
+             * @return The index, or 0 if none has the name.
+             */
+            size_t find(const std::string &name, const std::string &value, bool *value_match)const;
+            /**Add an entry to the dynamic table, evicting older entries to make space.*/
+            void add(const std::string &name, const std::string &value);
+            /**Change the maximum size, evicting entries if needed.*/
+            void set_max_size(uint32_t max_size);
+            uint32_t max_size()const { return _max_size; }
+            /**Current size of the dynamic table, including ENTRY_OVERHEAD for each entry.*/
+            size_t size()const { return _size; }
+        private:
+            std::deque<HeaderField> dynamic;
+            size_t _size;
+            uint32_t _max_size;
+
+            void evict(size_t max_size);
+        };
+
+        /**Decodes HPACK header blocks. Each connection has one decoder for all blocks the peer
+         * sends, since the dynamic table persists between blocks.
+         */
+        class HpackDecoder
+        {
+        public:
+            /**@param max_table_size The SETTINGS_HEADER_TABLE_SIZE sent to the peer.
+             * @param max_header_list_size Limit on the decoded header list size, as measured by
+             * SETTINGS_MAX_HEADER_LIST_SIZE.
+             */
+            explicit HpackDecoder(uint32_t max_table_size = DEFAULT_HEADER_TABLE_SIZE,
+                size_t max_header_list_size = 65536);
+
+            /**Decode a complete header block, appending the fields to headers.
+             * Fields beyond max_header_list_size are still decoded to keep the dynamic table
+             * consistent, but are not added to headers.
+             * @return False if max_header_list_size was exceeded.
+             * @throws Http2Error ERR_COMPRESSION_ERROR on any decoding error.
+             */
+            bool decode(const uint8_t *begin, const uint8_t *end, HeaderList *headers);
+        private:
+            HpackTable table;
+            uint32_t max_table_size;
+            size_t max_header_list_size;
+        };
+
+        /**Encodes HPACK header blocks for sending to a peer.*/
+        class HpackEncoder
+        {
+        public:
+            explicit HpackEncoder(uint32_t max_table_size = DEFAULT_HEADER_TABLE_SIZE);
+
+            /**Set the table size from the peers SETTINGS_HEADER_TABLE_SIZE. The encoder may use
+             * a smaller table. Any change is signalled at the start of the next block.
+             */
+            void set_max_table_size(uint32_t max_table_size);
+            /**Encode a complete header block, appending it to out.
+             * Header names must already be lower case.
+             */
+            void encode(const HeaderList &headers, std::string *out);
+        private:
+            HpackTable table;
+            /**Upper limit on the table size regardless of peer settings.*/
+            uint32_t limit;
+            /**A dynamic table size update must be sent at the start of the next block.*/
+            bool size_update;
+            /**Smallest size set since the last block, which must also be signalled.*/
+            uint32_t min_size;
+
+            void encode_string(const std::string &str, std::string *out);
+        };
+
+        /**Append a HPACK integer with a prefix_bits bit prefix (RFC7541 5.1).
+         * @param first The bits of the first octet above the prefix.
+         */
+        void hpack_write_int(std::string *out, uint8_t first, int prefix_bits, uint64_t value);
+        /**Read a HPACK integer with a prefix_bits bit prefix.
+         * @return The end of the integer.
+         * @throws Http2Error ERR_COMPRESSION_ERROR if truncated or overflows.
+         */
+        const uint8_t *hpack_read_int(const uint8_t *begin, const uint8_t *end, int prefix_bits, uint64_t *value);
+    }
+}
@@ -0,0 +1,140 @@
+#pragma once
+#include <cstdint>
+#include <stdexcept>
+#include <string>
+namespace http
+{
+    /**HTTP/2 protocol definitions (RFC7540).*/
+    namespace http2
+    {
+        /**The client connection preface, sent before the client SETTINGS frame.*/
+        static const char PREFACE[] = "PRI * HTTP/2.0\r\n\r\nSM\r\n\r\n";
+        static const size_t PREFACE_LEN = sizeof(PREFACE) - 1;
+        /**Size of the frame header preceding every frame payload.*/
+        static const size_t FRAME_HEADER_LEN = 9;
+        /**Default and minimum SETTINGS_MAX_FRAME_SIZE.*/
+        static const uint32_t DEFAULT_MAX_FRAME_SIZE = 16384;
+        /**Largest allowed SETTINGS_MAX_FRAME_SIZE.*/
+        static const uint32_t MAX_MAX_FRAME_SIZE = 16777215;
+        /**Default SETTINGS_INITIAL_WINDOW_SIZE, and the initial connection window.*/
+        static const int32_t DEFAULT_WINDOW_SIZE = 65535;
+        /**Largest allowed flow control window.*/
+        static const int64_t MAX_WINDOW_SIZE = 2147483647;
+        /**Default SETTINGS_HEADER_TABLE_SIZE.*/
+        static const uint32_t DEFAULT_HEADER_TABLE_SIZE = 4096;
+
+        enum FrameType : uint8_t
+        {
+            DATA = 0x0,
+            HEADERS = 0x1,
+            PRIORITY = 0x2,
+            RST_STREAM = 0x3,
+            SETTINGS = 0x4,
+            PUSH_PROMISE = 0x5,
+            PING = 0x6,
+            GOAWAY = 0x7,
+            WINDOW_UPDATE = 0x8,
+            CONTINUATION = 0x9
+        };
+        /**Frame header flags. Each is only valid for some frame types.*/
+        enum Flags : uint8_t
+        {
+            FLAG_END_STREAM = 0x1,
+            FLAG_ACK = 0x1,
+            FLAG_END_HEADERS = 0x4,
+            FLAG_PADDED = 0x8,
+            FLAG_PRIORITY = 0x20
+        };
+        enum SettingsId : uint16_t
+        {
+            SETTINGS_HEADER_TABLE_SIZE = 0x1,
+            SETTINGS_ENABLE_PUSH = 0x2,
+            SETTINGS_MAX_CONCURRENT_STREAMS = 0x3,
+            SETTINGS_INITIAL_WINDOW_SIZE = 0x4,
+            SETTINGS_MAX_FRAME_SIZE = 0x5,
+            SETTINGS_MAX_HEADER_LIST_SIZE = 0x6
+        };
+        /**Error codes for RST_STREAM and GOAWAY. Prefixed to avoid macros such as Windows NO_ERROR.*/
+        enum ErrorCode : uint32_t
+        {
+            ERR_NO_ERROR = 0x0,
+            ERR_PROTOCOL_ERROR = 0x1,
+            ERR_INTERNAL_ERROR = 0x2,
+            ERR_FLOW_CONTROL_ERROR = 0x3,
+            ERR_SETTINGS_TIMEOUT = 0x4,
+            ERR_STREAM_CLOSED = 0x5,
+            ERR_FRAME_SIZE_ERROR = 0x6,
+            ERR_REFUSED_STREAM = 0x7,
+            ERR_CANCEL = 0x8,
+            ERR_COMPRESSION_ERROR = 0x9,
+            ERR_CONNECT_ERROR = 0xa,
+            ERR_ENHANCE_YOUR_CALM = 0xb,
+            ERR_INADEQUATE_SECURITY = 0xc,
+            ERR_HTTP_1_1_REQUIRED = 0xd
+        };
+
+        /**A HTTP/2 protocol error.
+         * If stream_id is zero this is a connection error that must close the connection,
+         * else a stream error that only resets that stream.
+         */
+        class Http2Error : public std::runtime_error
+        {
+        public:
+            Http2Error(ErrorCode code, const std::string &msg, uint32_t stream_id = 0)
+                : std::runtime_error(msg), _code(code), _stream_id(stream_id)
+            {}
+            ErrorCode code()const { return _code; }
+            uint32_t stream_id()const { return _stream_id; }
+        private:
+            ErrorCode _code;
+            uint32_t _stream_id;
+        };
+
+        /**Read a big endian 32bit integer.*/
+        inline uint32_t read_u32(const uint8_t *p)
+        {
+            return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | p[3];
+        }
+        /**Append a big endian 32bit integer.*/
+        inline void write_u32(std::string *out, uint32_t value)
+        {
+            out->push_back((char)(value >> 24));
+            out->push_back((char)(value >> 16));
+            out->push_back((char)(value >> 8));
+            out->push_back((char)value);
+        }
+        /**The fixed 9 octet header of each frame.*/
+        struct FrameHeader
+        {
+            /**Payload length, 24 bits.*/
+            uint32_t length;
+            FrameType type;
+            uint8_t flags;
+            /**31 bit stream identifier.*/
+            uint32_t stream_id;
+
+            /**Read a frame header from FRAME_HEADER_LEN bytes.*/
+            static FrameHeader read(const uint8_t *p)
+            {
+                FrameHeader header;
+                header.length = ((uint32_t)p[0] << 16) | ((uint32_t)p[1] << 8) | p[2];
+                header.type = (FrameType)p[3];
+                header.flags = p[4];
+                header.stream_id = read_u32(p + 5) & 0x7FFFFFFF;
+                return header;
+            }
+            /**Append the FRAME_HEADER_LEN bytes for this header to out.*/
+            void write(std::string *out)const
+            {
+                uint8_t p[FRAME_HEADER_LEN] =
+                {
+                    (uint8_t)(length >> 16), (uint8_t)(length >> 8), (uint8_t)length,
+                    (uint8_t)type, flags,
+                    (uint8_t)(stream_id >> 24), (uint8_t)(stream_id >> 16),
+                    (uint8_t)(stream_id >> 8), (uint8_t)stream_id
+                };
+                out->append((const char*)p, sizeof(p));
+            }
+        };
+    }
+}
@@ -7,6 +7,17 @@
 
 namespace http
 {
+    /**Configurable limits enforced by BaseParser.*/
+    struct ParserLimits
+    {
+        ParserLimits();
+        /**Max number of headers, including trailers.*/
+        size_t max_header_count;
+        /**Max combined size of the header lines, including trailers.*/
+        size_t max_headers_size;
+        /**Max size of the message body, or 0 for no limit.*/
+        size_t max_body_size;
+    };
     /**HTTP parser base for server and client side messages.
      * Provides the base implementation for RequestParser and ResponseParser, which provide
      * some key functionality.
@@ -54,6 +65,12 @@ namespace http
         BaseParser();
         /**Reset the parser so it is ready to read another message.*/
         void reset();
+        /**Set the limits for following messages. Exceeding the header limits throws a ParserError
+         * with status 431, and exceeding max_body_size throws one with status 413, as soon as
+         * the Content-Length header or chunk length is read.
+         */
+        void set_limits(const ParserLimits &limits) { _limits = limits; }
+        const ParserLimits &limits()const { return _limits; }
 
         /**Reading the entire HTTP request or response message is complete.*/
         bool is_completed()const { return _state == COMPLETED; }
@@ -93,7 +110,10 @@ namespace http
     protected:
 
         State _state;
+        ParserLimits _limits;
         Headers _headers;
+        /**Size of the header and trailer lines read so far.*/
+        size_t headers_size;
         Version _version;
         size_t _content_length;
         size_t remaining_content_length;
@@ -104,6 +124,12 @@ namespace http
          * @param end The end of str, does not include the trailing \r\n.
          */
         void read_header(const char *str, const char *end);
+        /**Throw if adding len to a body of size would exceed max_body_size.*/
+        void check_body_size(size_t size, size_t len)const
+        {
+            if (_limits.max_body_size && (len > _limits.max_body_size || size > _limits.max_body_size - len))
+                throw ParserError("Message body too large", SC_PAYLOAD_TOO_LARGE);
+        }
         /**Start reading the body.
          * Transfer-Encoding: chunked is supported, but no others are.
          */
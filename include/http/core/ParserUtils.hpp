@@ -47,6 +47,13 @@ namespace http
          */
         const char *read_list_sep(const char *begin, const char *end);
 
+        /**Reads a qvalue as used by Accept headers (RFC7231 5.3.1).
+         * qvalue = ( "0" [ "." 0*3DIGIT ] ) / ( "1" [ "." 0*3("0") ] )
+         * @return The end of the qvalue.
+         * @throws ParserError If begin is not the start of a valid qvalue.
+         */
+        const char *read_qvalue(const char *begin, const char *end, float *out);
+
         /**Reads the HTTP method from the request line.
          * @return The end of the method (SP).
          * @throws ParserError An invalid octet, or end is encountered.
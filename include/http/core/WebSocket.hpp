@@ -0,0 +1,100 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <stdexcept>
+#include <string>
+namespace http
+{
+    /**WebSocket protocol (RFC6455) framing, independent of any connection.*/
+    namespace websocket
+    {
+        /**Frame opcodes.*/
+        enum Opcode
+        {
+            OP_CONTINUATION = 0x0,
+            OP_TEXT = 0x1,
+            OP_BINARY = 0x2,
+            OP_CLOSE = 0x8,
+            OP_PING = 0x9,
+            OP_PONG = 0xA
+        };
+        /**Status codes for close frames.*/
+        enum CloseCode
+        {
+            CLOSE_NORMAL = 1000,
+            CLOSE_GOING_AWAY = 1001,
+            CLOSE_PROTOCOL_ERROR = 1002,
+            CLOSE_UNSUPPORTED_DATA = 1003,
+            /**Never sent, reported if a close frame had no status.*/
+            CLOSE_NO_STATUS = 1005,
+            /**Never sent, reported if the connection closed without a close frame.*/
+            CLOSE_ABNORMAL = 1006,
+            CLOSE_INVALID_DATA = 1007,
+            CLOSE_POLICY_VIOLATION = 1008,
+            CLOSE_MESSAGE_TOO_BIG = 1009,
+            CLOSE_INTERNAL_ERROR = 1011
+        };
+        /**Largest possible frame header, with a 64bit length and masking key.*/
+        static const size_t MAX_HEADER_LEN = 14;
+        /**Largest payload for control frames.*/
+        static const size_t MAX_CONTROL_PAYLOAD = 125;
+        /**Value of the Sec-WebSocket-Version header.*/
+        static const char VERSION[] = "13";
+
+        /**A protocol error, failing the connection with a close code.*/
+        class WebSocketError : public std::runtime_error
+        {
+        public:
+            WebSocketError(CloseCode code, const std::string &msg)
+                : std::runtime_error(msg), _code(code)
+            {}
+            CloseCode code()const { return _code; }
+        private:
+            CloseCode _code;
+        };
+
+        /**True for the close, ping and pong opcodes.*/
+        inline bool is_control(Opcode opcode)
+        {
+            return (opcode & 0x8) != 0;
+        }
+
+        /**The variable length header of each frame.*/
+        struct FrameHeader
+        {
+            bool fin;
+            /**RSV1, set on the first frame of a compressed message with permessage-deflate.*/
+            bool rsv1;
+            /**RSV2 and RSV3, which no supported extension uses.*/
+            uint8_t rsv23;
+            Opcode opcode;
+            bool masked;
+            uint8_t mask[4];
+            uint64_t length;
+
+            /**Read a frame header.
+             * @return The header length, or 0 if len is not yet enough for the entire header.
+             * @throws WebSocketError If the length is not minimally encoded.
+             */
+            static size_t read(const uint8_t *p, size_t len, FrameHeader *header);
+            /**Write the header to out, which must have MAX_HEADER_LEN bytes.
+             * @return The header length.
+             */
+            size_t write(uint8_t *out)const;
+            /**Append the header to out.*/
+            void write(std::string *out)const;
+        };
+
+        /**XOR data with a masking key, in place. Masking and unmasking are the same operation.
+         * @param offset Position of data within the payload, for payloads processed in parts.
+         */
+        void apply_mask(uint8_t *data, size_t len, const uint8_t key[4], uint64_t offset = 0);
+        /**Append a complete unmasked frame, as sent by servers.*/
+        void write_frame(std::string *out, Opcode opcode, const void *data, size_t len,
+            bool fin = true, bool rsv1 = false);
+        /**Sec-WebSocket-Accept value for a client's Sec-WebSocket-Key.*/
+        std::string accept_key(const std::string &key);
+        /**True if data is valid UTF-8, as required for text messages and close reasons.*/
+        bool valid_utf8(const char *data, size_t len);
+    }
+}
@@ -19,23 +19,44 @@ namespace http
         }
         os << "\r\n";
     }
-    /**Writes the HTTP request first line and headers to the output stream.*/
+    /**Writes the "Date" header line for the current time, unless headers already contains one.
+     * The value is copied from the format_current_time cache rather than being stored in headers.
+     */
+    inline void write_date_header(std::ostream &os, const Headers &headers)
+    {
+        if (headers.has("Date")) return;
+        char buffer[sizeof("Date: ") - 1 + TIME_STR_LEN + 2] = "Date: ";
+        auto p = format_current_time(buffer + sizeof("Date: ") - 1);
+        *p++ = '\r';
+        *p++ = '\n';
+        os.write(buffer, p - buffer);
+    }
+    /**Writes the HTTP request first line and headers to the output stream.
+     * A "Date" header is included if the request does not have one.
+     */
     inline void write_request_header(std::ostream &os, const Request &request)
     {
         os << to_string(request.method) << " ";
         if (!request.raw_url.empty()) os << request.raw_url;
         else request.url.encode_request(os);
         os << " HTTP/1.1\r\n";
+        write_date_header(os, request.headers);
         write_headers(os, request.headers);
     }
-    /**Writes the HTTP response first line and headers to the output stream.*/
+    /**Writes the HTTP response first line and headers to the output stream.
+     * A "Date" header is included if the response does not have one.
+     */
     inline void write_response_header(std::ostream &os, const Response &response)
     {
         os << "HTTP/1.1 " << response.status.code << " " << response.status.msg << "\r\n";
+        write_date_header(os, response.headers);
         write_headers(os, response.headers);
     }
+
     /**Adds basic default headers to a request or response to be sent.
      * Currently this is just the "Date" header.
+     * @deprecated write_request_header and write_response_header now write the Date header
+     * when the message does not have one, so this is no longer needed.
      */
     template<class T> void add_default_headers(T &message)
     {
@@ -75,7 +96,6 @@ namespace http
             throw std::runtime_error("HTTP forbids this response from having a body");
         }
 
-        add_default_headers(response);
         std::stringstream ss;
         write_response_header(ss, response);
         auto ss_str = ss.str();
@@ -0,0 +1,54 @@
+#pragma once
+#include <string>
+#include <vector>
+#include "Error.hpp"
+namespace http
+{
+    /**Represents a HTTP Accept-Encoding request header (RFC7231 5.3.4).*/
+    class AcceptEncoding
+    {
+    public:
+        /**An acceptable content coding.*/
+        struct Coding
+        {
+            /**Lower case content coding name, e.g. "gzip" or "identity". May be '*' for match all.*/
+            std::string coding;
+            /**Quality level. 0 means the coding is not acceptable.*/
+            float quality;
+        };
+
+        AcceptEncoding() : codings() {}
+        /**Constructor from Accept-Encoding header value.*/
+        explicit AcceptEncoding(const std::string &value)
+            : AcceptEncoding(value.c_str(), value.c_str() + value.size())
+        {}
+        /**Constructor from Accept-Encoding header value.*/
+        AcceptEncoding(const char *begin, const char *end);
+
+        /**Get the quality of a content coding, taking account of '*'.
+         * "identity" is acceptable unless explicitly excluded by "identity;q=0" or "*;q=0", but
+         * if not listed is given the lowest possible quality.
+         *
+         * Note that a request without an Accept-Encoding header accepts any coding, but an
+         * empty header or default constructed AcceptEncoding only accepts "identity".
+         * @return The quality, or 0 if not acceptable.
+         */
+        float quality(const std::string &coding)const;
+        /**Return true if coding is accepted for any non-zero quality.*/
+        bool accepts(const std::string &coding)const
+        {
+            return quality(coding) > 0;
+        }
+        /**Return which of a list of codings is most preferred, or the first of equal quality.
+         * @throws NotAcceptable if none of the codings are accepted.
+         */
+        std::string preferred(const std::vector<std::string> &codings)const;
+
+        /**Gets the list of content codings in the header.*/
+        const std::vector<Coding>& accepts()const { return codings; }
+    private:
+        std::vector<Coding> codings;
+
+        void parse(const char *begin, const char *end);
+    };
+}
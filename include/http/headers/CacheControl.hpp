@@ -0,0 +1,50 @@
+#pragma once
+#include <string>
+#include "Error.hpp"
+namespace http
+{
+    /**Represents a HTTP Cache-Control request or response header.
+     * Only the directives relevant to a shared cache are stored, others are ignored.
+     */
+    class CacheControl
+    {
+    public:
+        CacheControl()
+            : no_store(false), no_cache(false), is_private(false), is_public(false)
+            , max_age(-1), s_maxage(-1)
+        {}
+        /**Constructor from Cache-Control header value.
+         * @throws ParserError if the value is not a valid directive list.
+         */
+        explicit CacheControl(const std::string &value)
+            : CacheControl(value.c_str(), value.c_str() + value.size())
+        {}
+        /**Constructor from Cache-Control header value.
+         * @throws ParserError if the value is not a valid directive list.
+         */
+        CacheControl(const char *begin, const char *end);
+
+        /**"no-store" directive.*/
+        bool no_store;
+        /**"no-cache" directive.*/
+        bool no_cache;
+        /**"private" directive.*/
+        bool is_private;
+        /**"public" directive.*/
+        bool is_public;
+        /**"max-age" directive in seconds, or -1 if not present.*/
+        int max_age;
+        /**"s-maxage" directive in seconds, or -1 if not present.*/
+        int s_maxage;
+
+        /**The freshness lifetime for a shared cache in seconds, or -1 if not specified.
+         * s-maxage takes priority over max-age.
+         */
+        int shared_max_age()const
+        {
+            return s_maxage >= 0 ? s_maxage : max_age;
+        }
+    private:
+        void parse(const char *begin, const char *end);
+    };
+}
@@ -1,5 +1,6 @@
 #pragma once
 #include "Os.hpp"
+#include "../util/File.hpp"
 #include <atomic>
 #include <functional>
 #include <list>
@@ -33,9 +34,28 @@ namespace http
         void exit();
 
         void accept(SOCKET sock, AcceptHandler handler, ErrorHandler error);
+        /**Receive up to len bytes.
+         * If len is 0, no data is read, and handler is called with 0 once the socket is readable
+         * or the remote closed it. This allows waiting for data without holding a buffer.
+         */
         void recv(SOCKET sock, void *buffer, size_t len, RecvHandler handler, ErrorHandler error);
         void send(SOCKET sock, const void *buffer, size_t len, SendHandler handler, ErrorHandler error);
         void send_all(SOCKET sock, const void *buffer, size_t len, SendHandler handler, ErrorHandler error);
+        /**Sends len bytes of a file starting at offset, like send_all.
+         * Where supported the data is sent directly by the OS (`sendfile` or `TransmitFile`)
+         * without being copied through a user space buffer.
+         */
+        void send_file(SOCKET sock, FileHandle file, uint64_t offset, size_t len,
+            SendHandler handler, ErrorHandler error);
+        /**Calls func from the thread in run(). If exiting, func is not called.
+         * func must not throw.
+         */
+        void post(std::function<void()> func);
+        /**Aborts all in-progress operations for a socket. Their error handlers are called with
+         * AsyncAborted, possibly before cancel returns.
+         * Must only be called from within a function passed to post.
+         */
+        void cancel(SOCKET sock);
     private:
         /**Held by the main run thread to block exit() until run() is done. Much like a thread join
          * but allowing the run() thread to return and live on.
@@ -81,10 +101,19 @@ namespace http
             size_t sent;
             SendHandler handler;
             ErrorHandler error;
+            /**If not INVALID_FILE, send from this file starting at file_offset rather than buffer.*/
+            FileHandle file;
+            uint64_t file_offset;
         };
 
         SignalSocket signal;
         bool exiting;
+        /**run() has returned, so new operations are aborted immediately rather than being left
+         * queued, as with IOCP. Requires mutex.
+         */
+        bool stopped;
+        /**Sends part of a send_file operation. Returns the number of bytes sent.*/
+        size_t send_file_some(Send &op, int len);
         std::mutex mutex;
         /**In-progress operations.
          * If a single socket has multiple read or write operations, they are processed in order.
@@ -101,6 +130,7 @@ namespace http
             std::vector<Accept> accept;
             std::vector<Recv> recv;
             std::vector<Send> send;
+            std::vector<std::function<void()>> post;
         }new_operations;
         #elif defined(HTTP_USE_IOCP)
         struct CompletionPort
@@ -113,7 +143,7 @@ namespace http
         {
             enum Type
             {
-                ACCEPT,RECV,SEND,SEND_ALL
+                ACCEPT,RECV,SEND,SEND_ALL,SEND_FILE,POST
             };
             struct Deleter
             {
@@ -175,6 +205,29 @@ namespace http
                 , len(len), sent(0)
             {}
         };
+        struct SendFile : public Operation
+        {
+            SendHandler handler;
+            FileHandle file;
+            uint64_t offset;
+            size_t len;
+            size_t sent;
+
+            SendFile(SOCKET sock, FileHandle file, uint64_t offset, size_t len,
+                SendHandler handler, ErrorHandler error)
+                : Operation(sock, SEND_FILE, nullptr, 0, error)
+                , handler(handler), file(file)
+                , offset(offset), len(len), sent(0)
+            {}
+        };
+        struct Post : public Operation
+        {
+            std::function<void()> func;
+
+            explicit Post(std::function<void()> func)
+                : Operation(INVALID_SOCKET, POST, nullptr, 0, nullptr), func(func)
+            {}
+        };
         CompletionPort iocp;
         std::mutex mutex;
         std::atomic<bool> running;
@@ -186,6 +239,7 @@ namespace http
          */
         bool start_operation(SOCKET socket, ErrorHandler error);
         void send_all_next(std::unique_ptr<SendAll, Operation::Deleter> send, size_t sent);
+        void send_file_next(std::unique_ptr<SendFile, Operation::Deleter> send, size_t sent);
         #else
             #error No AsyncIo method defined
         #endif
@@ -0,0 +1,91 @@
+#pragma once
+#ifdef HTTP_USE_COROUTINES
+#include "AsyncIo.hpp"
+#include "Socket.hpp"
+#include "../util/Coroutine.hpp"
+namespace http
+{
+    /**Awaits an AsyncIo operation on a Socket, resuming the coroutine from the completion
+     * handler on the AsyncIo thread. See co_recv, co_wait_recv and co_send_all.
+     *
+     * The handlers only capture this awaiter, which lives in the coroutine frame, so they are
+     * stored by std::function without allocating.
+     */
+    class SocketAwaiter
+    {
+    public:
+        enum Operation { RECV, WAIT_RECV, SEND_ALL };
+
+        SocketAwaiter(Operation op, AsyncIo &aio, Socket &socket, const void *buffer, size_t len)
+            : op(op), aio(aio), socket(socket), buffer(buffer), len(len), handle(), result(0), error()
+        {}
+
+        bool await_ready()const noexcept { return false; }
+        void await_suspend(std::coroutine_handle<> awaiting)
+        {
+            handle = awaiting;
+            // The coroutine may be resumed, and this destroyed, before the call returns
+            switch (op)
+            {
+            case RECV:
+                socket.async_recv(aio, const_cast<void*>(buffer), len,
+                    [this](size_t n) { complete(n); }, [this]() { fail(); });
+                break;
+            case WAIT_RECV:
+                socket.async_wait_recv(aio, [this]() { complete(0); }, [this]() { fail(); });
+                break;
+            case SEND_ALL:
+                socket.async_send_all(aio, buffer, len,
+                    [this](size_t n) { complete(n); }, [this]() { fail(); });
+                break;
+            }
+        }
+        /**@return Bytes received or sent.
+         * @throws The operation's error, such as AsyncAborted if AsyncIo exited.
+         */
+        size_t await_resume()
+        {
+            if (error) std::rethrow_exception(error);
+            return result;
+        }
+    private:
+        Operation op;
+        AsyncIo &aio;
+        Socket &socket;
+        const void *buffer;
+        size_t len;
+        std::coroutine_handle<> handle;
+        size_t result;
+        std::exception_ptr error;
+
+        void complete(size_t n)
+        {
+            result = n;
+            handle.resume();
+        }
+        void fail()
+        {
+            error = std::current_exception();
+            handle.resume();
+        }
+    };
+
+    /**Receive up to len bytes, like Socket::async_recv.
+     * The awaited result is the length received, or 0 if the connection was closed.
+     */
+    inline SocketAwaiter co_recv(AsyncIo &aio, Socket &socket, void *buffer, size_t len)
+    {
+        return SocketAwaiter(SocketAwaiter::RECV, aio, socket, buffer, len);
+    }
+    /**Wait until the socket has data or was closed, like Socket::async_wait_recv.*/
+    inline SocketAwaiter co_wait_recv(AsyncIo &aio, Socket &socket)
+    {
+        return SocketAwaiter(SocketAwaiter::WAIT_RECV, aio, socket, nullptr, 0);
+    }
+    /**Send all len bytes, like Socket::async_send_all.*/
+    inline SocketAwaiter co_send_all(AsyncIo &aio, Socket &socket, const void *buffer, size_t len)
+    {
+        return SocketAwaiter(SocketAwaiter::SEND_ALL, aio, socket, buffer, len);
+    }
+}
+#endif
@@ -49,7 +49,9 @@ namespace http
     PrivateCert load_pfx_cert(const std::string &file, const std::string &password);
 
     /**Load a certificate with private key from a pair of pem files.
-     * NOT COMPLETE
+     * Any further certificates in crt_file after the first are used as the chain.
+     * The key must not be encrypted.
+     * NOT COMPLETE for Schannel.
      */
     PrivateCert load_pem_priv_cert(const std::string &crt_file, const std::string &key_file);
 }
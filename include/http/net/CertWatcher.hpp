@@ -0,0 +1,88 @@
+#pragma once
+#include "Cert.hpp"
+#include "../util/File.hpp"
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+namespace http
+{
+    /**The files a certificate is loaded from, and the function that loads it.*/
+    struct CertSource
+    {
+        std::vector<std::string> files;
+        std::function<PrivateCert()> load;
+    };
+    /**Load with load_pem_priv_cert.*/
+    CertSource pem_cert_source(const std::string &crt_file, const std::string &key_file);
+    /**Load with load_pfx_cert.*/
+    CertSource pfx_cert_source(const std::string &file, const std::string &password);
+
+    /**Reloads a certificate when its files change, so it can be rotated without a restart.
+     *
+     * A background thread checks the size and modification time of the files at each interval.
+     * When any have changed, the certificate is loaded again and passed to the handler,
+     * typically to replace a listeners certificate:
+     * @code
+     * CertWatcher watcher(pem_cert_source("server.crt", "server.key"),
+     *     [&server](const PrivateCert &cert) { server.set_tls_cert("0.0.0.0", 443, cert); });
+     * @endcode
+     *
+     * If loading fails, such as a certificate that was replaced but not yet its key, the error
+     * is reported and the previous certificate remains in use. The files are loaded again the
+     * next time any of them changes.
+     */
+    class CertWatcher
+    {
+    public:
+        /**Called with each reloaded certificate, on the background thread or by check.*/
+        typedef std::function<void(const PrivateCert &cert)> Handler;
+        /**Called when reloading fails, including if the handler throws.*/
+        typedef std::function<void(const std::exception &e)> ErrorHandler;
+
+        /**Start watching. The current files are assumed to already be in use, so handler is
+         * not called until they change.
+         * @param interval Time between checks.
+         */
+        CertWatcher(const CertSource &source, Handler handler, ErrorHandler error = nullptr,
+            std::chrono::milliseconds interval = std::chrono::seconds(10));
+        /**Stops the background thread, waiting for any reload in progress.*/
+        ~CertWatcher();
+        CertWatcher(const CertWatcher&) = delete;
+        CertWatcher& operator = (const CertWatcher&) = delete;
+
+        /**Check the files now, rather than waiting for the interval. e.g. on SIGHUP.
+         * @return True if the files changed and the certificate was reloaded.
+         */
+        bool check();
+        /**Number of successful reloads.*/
+        uint64_t reloads()const { return reload_count.load(std::memory_order_relaxed); }
+    private:
+        CertSource source;
+        Handler handler;
+        ErrorHandler error;
+        std::chrono::milliseconds interval;
+        std::atomic<uint64_t> reload_count;
+
+        /**Held while checking, so background and explicit checks do not overlap.*/
+        std::mutex check_mutex;
+        /**Info of each file when last loaded, or a zero size and time if it did not exist.
+         * Requires check_mutex.
+         */
+        std::vector<FileInfo> seen;
+
+        std::mutex mutex;
+        std::condition_variable cv;
+        bool exiting;
+        std::thread thread;
+
+        std::vector<FileInfo> stat_files()const;
+        void run();
+    };
+}
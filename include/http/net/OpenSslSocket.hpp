@@ -4,6 +4,8 @@
 #include "TcpSocket.hpp"
 #include "OpenSsl.hpp"
 #include <memory>
+#include <string>
+#include <vector>
 
 namespace http
 {
@@ -15,7 +17,7 @@ namespace http
     public:
         OpenSslSocket();
         /**Establish a client connection to a specific host and port.*/
-        OpenSslSocket(const std::string &host, uint16_t port);
+        OpenSslSocket(const std::string &host, uint16_t port, const SocketOptions &options = SocketOptions());
         OpenSslSocket(const OpenSslSocket&)=delete;
         OpenSslSocket(OpenSslSocket &&mv)=default;
         virtual ~OpenSslSocket();
@@ -24,9 +26,16 @@ namespace http
 
         virtual SOCKET get()override { return tcp.get(); }
         /**Establish a client connection to a specific host and port.*/
-        void connect(const std::string &host, uint16_t port);
+        void connect(const std::string &host, uint16_t port, const SocketOptions &options = SocketOptions());
+        /**Start a client connection over an already connected TCP socket, doing the handshake
+         * with aio so the socket can then be used asynchronously. The certificate is verified as
+         * by connect.
+         */
+        void async_connect(AsyncIo &aio, TcpSocket &&socket,
+            std::function<void()> handler, AsyncIo::ErrorHandler error);
 
         virtual std::string address_str()const override;
+        virtual std::string alpn_protocol()const override;
         virtual void close()override;
         virtual void disconnect()override;
         virtual bool recv_pending()const override;
@@ -38,6 +47,7 @@ namespace http
             std::function<void()> handler, AsyncIo::ErrorHandler error)override;
         virtual void async_recv(AsyncIo &aio, void *buffer, size_t len,
             AsyncIo::RecvHandler handler, AsyncIo::ErrorHandler error)override;
+        virtual void async_wait_recv(AsyncIo &aio, std::function<void()> handler, AsyncIo::ErrorHandler error)override;
         virtual void async_send(AsyncIo &aio, const void *buffer, size_t len,
             AsyncIo::SendHandler handler, AsyncIo::ErrorHandler error)override;
         virtual void async_send_all(AsyncIo &aio, const void *buffer, size_t len,
@@ -49,11 +59,23 @@ namespace http
         BIO *in_bio;
         /**Outgoing encrypted data ready to send to the remote. Owned by ssl.*/
         BIO *out_bio;
-        char bio_buffer[4096];
+        /**Encrypted data being received by tcp, before writing to in_bio.
+         * Seperate from send_buffer so a receive and a send may be in progress at once.
+         */
+        char recv_buffer[4096];
+        /**Encrypted data read from out_bio being sent by tcp.
+         * All pending data is sent at once, since many small sends interact badly with Nagle's
+         * algorithm and delayed acknowledgements.
+         */
+        std::vector<char> send_buffer;
 
         void async_send_next(AsyncIo &aio, const void *buffer, size_t len, size_t sent,
             AsyncIo::SendHandler handler, AsyncIo::ErrorHandler error);
         void async_send_bio(AsyncIo &aio, std::function<void()> handler, AsyncIo::ErrorHandler error);
+        /**Use memory BIOs, so the handshake and IO can be done with AsyncIo.*/
+        void create_bios();
+        /**Continue an asynchronous handshake, calling handler once it completes.*/
+        void async_handshake(AsyncIo &aio, std::function<void()> handler, AsyncIo::ErrorHandler error);
     };
     /**Server side OpenSSL socket. Presents a certificate on connection.*/
     class OpenSslServerSocket : public OpenSslSocket
@@ -66,12 +88,19 @@ namespace http
         OpenSslServerSocket& operator =(const OpenSslServerSocket&)=delete;
         OpenSslServerSocket& operator =(OpenSslServerSocket&&)=default;
 
+        /**Set the protocols to offer for ALPN, most preferred first. e.g. "h2" and "http/1.1".
+         * Must be called before async_create. The clients preference is not considered.
+         */
+        void set_alpn_protocols(const std::vector<std::string> &protocols);
         void async_create(AsyncIo &aio, TcpSocket &&socket, const PrivateCert &cert,
             std::function<void()> handler, AsyncIo::ErrorHandler error);
     private:
         std::unique_ptr<SSL_CTX, detail::OpenSslDeleter> openssl_ctx;
+        /**ALPN protocol list in wire format. Heap allocated, since the OpenSSL callback holds a
+         * pointer to it and this socket may be moved.
+         */
+        std::unique_ptr<std::string> alpn_protocols;
 
         void setup(TcpSocket &&socket, const PrivateCert &cert);
-        void async_create_next(AsyncIo &aio, std::function<void()> handler, AsyncIo::ErrorHandler error);
     };
 }
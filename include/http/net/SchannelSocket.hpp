@@ -6,6 +6,7 @@
 #include <cstdint>
 #include <vector>
 #include <memory>
+#include <string>
 namespace http
 {
     class PrivateCert;
@@ -16,7 +17,7 @@ namespace http
         SchannelSocket();
         SchannelSocket(SchannelSocket &&mv);
         /**Establish a client connection to a specific host and port.*/
-        SchannelSocket(const std::string &host, uint16_t port);
+        SchannelSocket(const std::string &host, uint16_t port, const SocketOptions &options = SocketOptions());
         /**Construct by taking ownership of an existing socket.*/
         SchannelSocket(SOCKET socket, const sockaddr *address);
         /**Construct by taking ownership of an existing socket.*/
@@ -31,7 +32,7 @@ namespace http
         /**Construct by taking ownership of an existing socket.*/
         void set_socket(SOCKET socket, const sockaddr *address);
         /**Establish a client connection to a specific host and port.*/
-        void connect(const std::string &host, uint16_t port);
+        void connect(const std::string &host, uint16_t port, const SocketOptions &options = SocketOptions());
 
         virtual SOCKET get()override { return tcp.get(); }
         virtual std::string address_str()const override;
@@ -130,6 +131,10 @@ namespace http
         SchannelServerSocket(TcpSocket &&socket, const PrivateCert &cert);
         SchannelServerSocket(SchannelServerSocket &&mv) = default;
         SchannelServerSocket& operator = (SchannelServerSocket &&mv) = default;
+        /**ALPN is not yet implemented for S-Channel, so this is ignored and alpn_protocol()
+         * is always empty.
+         */
+        void set_alpn_protocols(const std::vector<std::string> &) {}
         void async_create(AsyncIo &aio, TcpSocket &&socket, const PrivateCert &cert,
             std::function<void()> complete, AsyncIo::ErrorHandler error);
     protected:
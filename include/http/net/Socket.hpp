@@ -4,6 +4,7 @@
 #include <string>
 namespace http
 {
+    class File;
     /**Base socket type.
      * Different underlying protocols may potentionally be used, e.g. TCP/IP or TLS, but it will
      * always be a stream socket.
@@ -25,6 +26,10 @@ namespace http
          * Includes the port number and may use a hostname or ip address.
          */
         virtual std::string address_str()const = 0;
+        /**The application protocol selected by ALPN during a TLS handshake, or an empty string
+         * if none was negotiated.
+         */
+        virtual std::string alpn_protocol()const { return std::string(); }
         /**Close the socket, without waiting for a clean disconnect.*/
         virtual void close() = 0;
         /**Disconnect this socket if connected. Sending and receiving will fail after.*/
@@ -52,10 +57,20 @@ namespace http
             std::function<void()> handler, AsyncIo::ErrorHandler error) = 0;
         virtual void async_recv(AsyncIo &aio, void *buffer, size_t len,
             AsyncIo::RecvHandler handler, AsyncIo::ErrorHandler error) = 0;
+        /**Wait until async_recv would have data or see the connection closed, without reading
+         * anything, so no buffer is needed while waiting.
+         * The default waits for the OS socket to be readable, unless recv_pending.
+         */
+        virtual void async_wait_recv(AsyncIo &aio, std::function<void()> handler, AsyncIo::ErrorHandler error);
         virtual void async_send(AsyncIo &aio, const void *buffer, size_t len,
             AsyncIo::SendHandler handler, AsyncIo::ErrorHandler error) = 0;
         virtual void async_send_all(AsyncIo &aio, const void *buffer, size_t len,
             AsyncIo::SendHandler handler, AsyncIo::ErrorHandler error) = 0;
+        /**Sends len bytes of file starting at offset. The file must remain open until complete.
+         * The default implementation reads blocks of the file into a buffer for async_send_all.
+         */
+        virtual void async_send_file(AsyncIo &aio, const File &file, uint64_t offset, size_t len,
+            AsyncIo::SendHandler handler, AsyncIo::ErrorHandler error);
     private:
         Socket(const Socket &socket);
         Socket& operator = (const Socket &socket);
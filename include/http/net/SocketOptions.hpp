@@ -0,0 +1,66 @@
+#pragma once
+#include "Os.hpp"
+#include <chrono>
+namespace http
+{
+    /**TCP options for a connected socket. Options left at their defaults are not set, keeping
+     * the OS default. Setting an option the platform does not support is an error.
+     */
+    struct SocketOptions
+    {
+        SocketOptions()
+            : no_delay(false), recv_buffer_size(0), send_buffer_size(0)
+            , user_timeout(0), fast_open(false)
+        {}
+        /**Set TCP_NODELAY, sending small writes immediately rather than waiting to combine them.*/
+        bool no_delay;
+        /**SO_RCVBUF in bytes, or 0 for the OS default.
+         * Set before connecting or listening, so the TCP window scale allows for it.
+         */
+        int recv_buffer_size;
+        /**SO_SNDBUF in bytes, or 0 for the OS default.*/
+        int send_buffer_size;
+        /**TCP_USER_TIMEOUT, how long sent data may remain unacknowledged before the connection
+         * is dropped, or 0 for the OS default. Linux only.
+         */
+        std::chrono::milliseconds user_timeout;
+        /**For client connections, send the first data with the SYN using a TCP Fast Open cookie
+         * from a previous connection (TCP_FASTOPEN_CONNECT). Linux only.
+         */
+        bool fast_open;
+    };
+    /**Options for a TCP listen socket, set before it starts listening.*/
+    struct ListenSocketOptions
+    {
+        ListenSocketOptions()
+            : backlog(SOMAXCONN), v6_only(false), reuse_port(false), defer_accept(0)
+            , fast_open_queue(0)
+        {}
+        /**Established connections the OS will queue before they are accepted.*/
+        int backlog;
+        /**For IPv6 bind addresses, only accept IPv6 connections, rather than being dual-stack.*/
+        bool v6_only;
+        /**Set SO_REUSEPORT, so several sockets, e.g. in different processes, can listen on the
+         * same address with the OS distributing connections between them. Not on Windows.
+         */
+        bool reuse_port;
+        /**TCP_DEFER_ACCEPT, only complete accepts once the client sends data, for up to this
+         * long, or 0 to not wait. Linux only.
+         */
+        std::chrono::seconds defer_accept;
+        /**TCP_FASTOPEN, the number of pending Fast Open connections allowed, or 0 to disable.
+         * Clients with a cookie can then send their request with the SYN.
+         */
+        int fast_open_queue;
+        /**Options set on the listen socket, and so inherited by accepted sockets on most
+         * platforms. Only buffer sizes must be set here for them to affect the TCP window scale.
+         */
+        SocketOptions socket;
+    };
+
+    /**Set the options that are not left at their defaults, except fast_open which is only used
+     * by TcpSocket::connect.
+     * @throws SocketError if an option could not be set.
+     */
+    void set_socket_options(SOCKET sock, const SocketOptions &options);
+}
@@ -1,28 +1,55 @@
 #pragma once
 #include "Os.hpp"
+#include "SocketOptions.hpp"
 #include <cstdint>
 #include <string>
 namespace http
 {
     class TcpSocket;
-    /**TCP server side listen socket.*/
+    /**TCP server side listen socket.
+     * Can also listen on a Unix domain socket, see unix_domain, accepting connections as
+     * TcpSocket objects which are used in the same way.
+     */
     class TcpListenSocket
     {
     public:
-        /**Listen on a port for a specific local interface address.*/
-        TcpListenSocket(const std::string &bind, uint16_t port);
+        /**Default listen backlog, the number of established connections the OS will queue
+         * before they are accepted.
+         */
+        static const int DEFAULT_BACKLOG = SOMAXCONN;
+        /**Listen on a port for a specific local interface address.
+         * @param bind An IPv4 or IPv6 address. IPv6 addresses may be in brackets.
+         * @param v6_only For IPv6 addresses, only accept IPv6 connections. Otherwise the socket is
+         * dual-stack, so binding "::" also accepts IPv4 connections, as IPv4-mapped addresses.
+         */
+        TcpListenSocket(const std::string &bind, uint16_t port, int backlog = DEFAULT_BACKLOG,
+            bool v6_only = false);
+        /**Listen on a port for a specific local interface address, with socket options.
+         * @param bind An IPv4 or IPv6 address. IPv6 addresses may be in brackets.
+         */
+        TcpListenSocket(const std::string &bind, uint16_t port, const ListenSocketOptions &options);
         /**Listen on a port for all interfaces.*/
         explicit TcpListenSocket(uint16_t port) : TcpListenSocket("0.0.0.0", port) {}
         TcpListenSocket();
-        TcpListenSocket(TcpListenSocket &&mv) : socket(mv.socket)
+        ~TcpListenSocket();
+        TcpListenSocket(TcpListenSocket &&mv) : socket(mv.socket), unix_path(std::move(mv.unix_path))
         {
             mv.socket = INVALID_SOCKET;
         }
         TcpListenSocket& operator = (TcpListenSocket &&mv)
         {
             std::swap(socket, mv.socket);
+            std::swap(unix_path, mv.unix_path);
             return *this;
         }
+        TcpListenSocket(const TcpListenSocket&) = delete;
+        TcpListenSocket& operator = (const TcpListenSocket&) = delete;
+
+        /**Listen on a Unix domain stream socket at a file system path.
+         * An existing socket file at path is replaced, and the file is removed again when the
+         * listen socket is destroyed. Not supported on Windows.
+         */
+        static TcpListenSocket unix_domain(const std::string &path, int backlog = DEFAULT_BACKLOG);
 
         SOCKET get() { return socket; }
         /**Sets this sockets non-blocking flag.*/
@@ -33,7 +60,12 @@ namespace http
          * If the socket is non-blocking, an empty TcpSocket may be returned.
          */
         TcpSocket accept();
+        /**The path of a Unix domain listen socket, else empty.*/
+        const std::string &path()const { return unix_path; }
     private:
         SOCKET socket;
+        std::string unix_path;
+
+        static ListenSocketOptions listen_options(int backlog, bool v6_only);
     };
 }
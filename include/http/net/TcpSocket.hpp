@@ -1,16 +1,26 @@
 #pragma once
 #include "Socket.hpp"
 #include "Os.hpp"
+#include "SocketOptions.hpp"
+#include <chrono>
 #include <cstdint>
+#include <vector>
 namespace http
 {
-    /**Basic unencrypted TCP stream socket using SOCKET and related system API's.*/
+    /**Basic unencrypted TCP stream socket using SOCKET and related system API's.
+     * Also used for Unix domain stream sockets, which support the same operations.
+     */
     class TcpSocket : public Socket
     {
     public:
+        /**Delay before starting a connection attempt to the next address, while previous attempts
+         * are still in progress.
+         */
+        static const std::chrono::milliseconds CONNECT_ATTEMPT_DELAY;
+
         TcpSocket();
         /**Establish a new client connection. See connect.*/
-        TcpSocket(const std::string &host, uint16_t port);
+        TcpSocket(const std::string &host, uint16_t port, const SocketOptions &options = SocketOptions());
         /**Construct using an existing socket. See set_socket.*/
         TcpSocket(SOCKET socket, const sockaddr *address);
         virtual ~TcpSocket();
@@ -28,19 +38,40 @@ namespace http
          */
         void set_socket(SOCKET socket, const sockaddr *address);
         /**Create a new client side connection to a remote host or port.
-         * Host can either be a hostname or an IP address.
+         * Host can either be a hostname or an IPv4 or IPv6 address. IPv6 addresses may be in
+         * brackets.
+         *
+         * All IPv4 and IPv6 addresses of the host are tried using Happy Eyeballs (RFC 8305).
+         * Addresses alternate between families, and a new attempt is started every
+         * CONNECT_ATTEMPT_DELAY, or as soon as one fails, without abandoning previous attempts.
+         * The first to connect is used.
+         *
+         * options are set on each socket before connecting.
          */
-        void connect(const std::string &host, uint16_t port);
+        void connect(const std::string &host, uint16_t port, const SocketOptions &options = SocketOptions());
+        /**Create a new client side connection to a Unix domain stream socket.
+         * host is set to the path, and port to 0. Not supported on Windows.
+         */
+        void connect_unix(const std::string &path);
 
         virtual SOCKET get()override { return socket; }
+        /**Set socket options on the connected socket. See set_socket_options.*/
+        void set_options(const SocketOptions &options);
         /**Sets this sockets non-blocking flag.*/
         void set_non_blocking(bool non_blocking = true);
-        /**Gets the remote address as a string in the form `host() + ':' + port()`.*/
+        /**Gets the remote address as a string in the form `host() + ':' + port()`, or
+         * `"unix:" + host()` for a Unix domain socket.
+         */
         virtual std::string address_str()const override;
-        /**Get the remote host name or IP address.*/
+        /**Get the remote host name or IP address.
+         * For Unix domain sockets this is the path, which is empty for accepted connections, as
+         * clients do not normally bind a path.
+         */
         const std::string &host()const { return _host; }
         /**Get the remote port number.*/
         uint16_t port()const { return _port;; }
+        /**True if this is a Unix domain socket.*/
+        bool is_unix_domain()const { return unix_domain; }
         virtual void close()override;
         virtual void disconnect()override;
         virtual size_t recv(void *buffer, size_t len)override;
@@ -54,9 +85,16 @@ namespace http
             AsyncIo::SendHandler handler, AsyncIo::ErrorHandler error)override;
         virtual void async_send_all(AsyncIo &aio, const void *buffer, size_t len,
             AsyncIo::SendHandler handler, AsyncIo::ErrorHandler error)override;
+        /**Sends directly from the file using AsyncIo::send_file.*/
+        virtual void async_send_file(AsyncIo &aio, const File &file, uint64_t offset, size_t len,
+            AsyncIo::SendHandler handler, AsyncIo::ErrorHandler error)override;
     private:
         SOCKET socket;
         std::string _host;
         uint16_t _port;
+        bool unix_domain;
+
+        /**Order resolved addresses for connect, alternating address families.*/
+        static std::vector<const addrinfo*> happy_eyeballs_order(const addrinfo *addresses);
     };
 }
@@ -0,0 +1,125 @@
+#pragma once
+#include "../util/ThreadShards.hpp"
+#include "../Version.hpp"
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <iosfwd>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+namespace http
+{
+    /**A completed request recorded by AccessLog.
+     * This is a fixed size so that it can be queued without allocating. Longer strings are
+     * truncated.
+     */
+    struct AccessLogRecord
+    {
+        /**When the request started.*/
+        std::chrono::system_clock::time_point time;
+        /**Microseconds from receiving the request to completing the response.*/
+        uint64_t duration_us;
+        uint64_t request_bytes;
+        uint64_t response_bytes;
+        int status;
+        Version version;
+        char method[16];
+        char remote[64];
+        char path[256];
+
+        void set_method(const std::string &str) { copy(method, str); }
+        void set_remote(const std::string &str) { copy(remote, str); }
+        void set_path(const std::string &str) { copy(path, str); }
+    private:
+        template<size_t N> static void copy(char (&dest)[N], const std::string &src)
+        {
+            auto len = src.size() < N ? src.size() : N - 1;
+            src.copy(dest, len);
+            dest[len] = '\0';
+        }
+    };
+
+    /**Writes access log records on a background thread.
+     *
+     * Each thread queues records in its own fixed size ring buffer, so log is wait-free after a
+     * threads first call and never blocks on IO. The background thread periodically formats
+     * the queued records and writes them in one batch. If a ring is full, the record is dropped
+     * and counted rather than waiting.
+     *
+     * Records are written in the Common Log Format, followed by the request bytes and duration in
+     * microseconds:
+     * @code
+     * 127.0.0.1:51000 - - [Sun, 06 Nov 1994 08:49:37 GMT] "GET /index.html HTTP/1.1" 200 1024 96 250
+     * @endcode
+     */
+    class AccessLog
+    {
+    public:
+        /**Called on the background thread with a batch of formatted records.*/
+        typedef std::function<void(const std::string &data)> Writer;
+        static const size_t DEFAULT_RING_SIZE = 1024;
+
+        /**@param writer Receives formatted records.
+         * @param ring_size Records each thread may queue, rounded up to a power of two.
+         * @param interval How often the background thread writes queued records.
+         */
+        explicit AccessLog(Writer writer, size_t ring_size = DEFAULT_RING_SIZE,
+            std::chrono::milliseconds interval = std::chrono::milliseconds(100));
+        /**Write records to a stream, which must remain valid until the AccessLog is destroyed.*/
+        explicit AccessLog(std::ostream &out, size_t ring_size = DEFAULT_RING_SIZE,
+            std::chrono::milliseconds interval = std::chrono::milliseconds(100));
+        /**Stops the background thread after writing any queued records.*/
+        ~AccessLog();
+        AccessLog(const AccessLog&) = delete;
+        AccessLog& operator = (const AccessLog&) = delete;
+
+        /**Queue a record to be written, or drop it if this threads ring is full.*/
+        void log(const AccessLogRecord &record);
+        /**Wait until all records queued before the call have been written.*/
+        void flush();
+        /**Number of records dropped because a ring was full, or the writer threw.*/
+        uint64_t dropped()const;
+        /**Number of records written.*/
+        uint64_t written()const { return written_count.load(std::memory_order_relaxed); }
+
+        /**Append a formatted record, with a trailing new line.*/
+        static void format(const AccessLogRecord &record, std::string *out);
+    private:
+        /**Single producer, single consumer ring of records.*/
+        struct Ring
+        {
+            explicit Ring(size_t size);
+            std::unique_ptr<AccessLogRecord[]> records;
+            size_t mask;
+            /**Next record to write, only changed by the owning thread.*/
+            std::atomic<uint64_t> head;
+            /**Next record to read, only changed by the background thread.*/
+            std::atomic<uint64_t> tail;
+            /**Only changed by the owning thread.*/
+            std::atomic<uint64_t> dropped;
+        };
+
+        Writer writer;
+        std::chrono::milliseconds interval;
+        ThreadShards<Ring> rings;
+        std::atomic<uint64_t> written_count;
+        std::atomic<uint64_t> writer_dropped;
+
+        std::mutex mutex;
+        std::condition_variable cv;
+        /**Signals flush waiters once flushed reaches their flush_requests value.*/
+        std::condition_variable flushed_cv;
+        bool exiting;
+        uint64_t flush_requests;
+        uint64_t flushed;
+        std::thread thread;
+
+        void run();
+        /**Format and write all queued records.*/
+        void write_queued(std::string *batch);
+    };
+}
@@ -0,0 +1,102 @@
+#pragma once
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <string>
+namespace http
+{
+    /**Limits for ClientLimiter, applied to each remote address.*/
+    struct ClientLimitOptions
+    {
+        ClientLimitOptions()
+            : requests_per_second(0), burst(0), max_connections(0), max_clients(65536)
+        {}
+        /**Sustained request rate allowed, or 0 for no rate limit.*/
+        double requests_per_second;
+        /**Requests allowed at once after being idle. If less than 1, requests_per_second is
+         * used, with a minimum of 1.
+         */
+        double burst;
+        /**Connections that may be open at once, or 0 for no limit.*/
+        size_t max_connections;
+        /**Number of clients tracked, rounded up to a power of two. Memory use is fixed by this.*/
+        size_t max_clients;
+    };
+    /**Statistics for a ClientLimiter.*/
+    struct ClientLimiterStats
+    {
+        /**Connections refused due to max_connections.*/
+        uint64_t rejected_connections;
+        /**Requests refused due to requests_per_second.*/
+        uint64_t rejected_requests;
+    };
+
+    /**Per-client request rate and connection limits, keyed by remote address.
+     *
+     * Clients are kept in a fixed size table, so memory use does not grow with the number of
+     * clients. Each address maps to a set of SET_SIZE slots. A client takes over an idle slot,
+     * one with no open connections and a full token bucket. If all slots in the set are active,
+     * the client shares the first one, so is limited together with the other clients using it.
+     * This can only make the limits stricter.
+     *
+     * The rate limit is a token bucket, stored as a single "theoretical arrival time" (the
+     * generic cell rate algorithm), so all operations are lock-free.
+     *
+     * Thread safe.
+     */
+    class ClientLimiter
+    {
+    public:
+        /**Slots checked for each address.*/
+        static const size_t SET_SIZE = 4;
+
+        explicit ClientLimiter(const ClientLimitOptions &options);
+        ClientLimiter(const ClientLimiter&) = delete;
+        ClientLimiter& operator = (const ClientLimiter&) = delete;
+
+        const ClientLimitOptions &options()const { return opts; }
+        /**Count a new connection from a client.
+         * @param host The remote address, e.g. from TcpSocket::host.
+         * @param slot Set to the clients slot, for allow_request and close_connection.
+         * @return False if the client already has max_connections open. The connection is not
+         * counted.
+         */
+        bool open_connection(const std::string &host, size_t *slot);
+        /**Called when a connection counted by open_connection closes.*/
+        void close_connection(size_t slot);
+        /**Take a token for a request from the client in slot.
+         * @return False if the client exceeded the rate limit.
+         */
+        bool allow_request(size_t slot,
+            std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now());
+        /**Seconds a rate limited client should wait, for Retry-After.*/
+        unsigned retry_after()const;
+        ClientLimiterStats stats()const;
+    private:
+        struct Slot
+        {
+            /**Hash of the address, or 0 if unused.*/
+            std::atomic<uint64_t> key;
+            /**Theoretical arrival time in steady_clock nanoseconds. The bucket is full if this
+             * is not after now.
+             */
+            std::atomic<int64_t> tat;
+            std::atomic<uint32_t> connections;
+        };
+
+        ClientLimitOptions opts;
+        std::unique_ptr<Slot[]> slots;
+        size_t mask;
+        /**Nanoseconds per request, or 0 if not rate limited.*/
+        int64_t emission_interval;
+        /**How far tat may be ahead of now, allowing burst requests at once.*/
+        int64_t burst_tolerance;
+        std::atomic<uint64_t> rejected_connections;
+        std::atomic<uint64_t> rejected_requests;
+
+        /**Find or claim the slot for an address.*/
+        size_t find_slot(const std::string &host, int64_t now);
+        static int64_t to_ns(std::chrono::steady_clock::time_point time);
+    };
+}
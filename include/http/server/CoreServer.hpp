@@ -1,13 +1,23 @@
 #pragma once
+#include "../core/Parser.hpp"
 #include "../net/AsyncIo.hpp"
 #include "../net/TcpListenSocket.hpp"
 #include "../net/Cert.hpp"
+#include "../util/BufferPool.hpp"
+#include "../util/Metrics.hpp"
+#include "Http2Session.hpp"
+#include "Responder.hpp"
 #include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <functional>
 #include <future>
 #include <list>
 #include <memory>
 #include <mutex>
 #include <thread>
+#include <unordered_set>
 #include <vector>
 namespace http
 {
@@ -16,7 +26,126 @@ namespace http
     class Request;
     class Response;
     class ParserError;
-    //TODO: add clean-shutdown functionality
+    class ResponseCache;
+    class ResponseCompressor;
+    class AccessLog;
+    class ClientLimiter;
+    struct CachedResponse;
+
+    /**Configuration for a single CoreServer listener.*/
+    struct ListenerOptions
+    {
+        ListenerOptions()
+            : backlog(TcpListenSocket::DEFAULT_BACKLOG), max_connections(0), resume_connections(0)
+            , http2(false), ipv6_only(false), reuse_port(false), defer_accept(0), fast_open_queue(0)
+        {}
+        /**Listen socket backlog. While accepting is paused, new connections wait in this OS queue.*/
+        int backlog;
+        /**Maximum number of connections from this listener that may be open at once, or 0 for no
+         * per-listener limit.
+         * Once reached, no more connections are accepted until the count falls to
+         * resume_connections.
+         */
+        size_t max_connections;
+        /**Low-water mark at which accepting resumes after reaching max_connections.
+         * If 0, 90% of max_connections is used.
+         */
+        size_t resume_connections;
+        /**Accept HTTP/2 connections as well as HTTP/1.1.
+         * TLS listeners offer "h2" with ALPN, while plain TCP listeners accept clients that start
+         * with the HTTP/2 connection preface ("prior knowledge"). Requests from both protocols
+         * are passed to the same handle_request.
+         */
+        bool http2;
+        /**For IPv6 bind addresses, only accept IPv6 clients.
+         * Otherwise the listener is dual-stack, so "::" accepts both IPv4 and IPv6 clients, with
+         * IPv4 clients reported by their IPv4 address.
+         */
+        bool ipv6_only;
+        /**Set SO_REUSEPORT, allowing several processes to listen on the same port with the OS
+         * balancing connections between them. Not on Windows.
+         */
+        bool reuse_port;
+        /**Use TCP_DEFER_ACCEPT, so connections are only accepted once the client sends its
+         * request, or this timeout passes. 0 accepts immediately. Linux only.
+         */
+        std::chrono::seconds defer_accept;
+        /**Allow TCP Fast Open with this many pending connections, so returning clients can send
+         * their first request with the SYN. 0 disables it.
+         */
+        int fast_open_queue;
+        /**Options set on the listen socket, and on each accepted TCP socket, such as
+         * TCP_NODELAY and buffer sizes. Connections whose options can not be set are closed.
+         * Not used by Unix domain socket listeners.
+         */
+        SocketOptions socket_options;
+        /**Settings for HTTP/2 connections, if http2 is enabled.*/
+        Http2Settings http2_settings;
+        /**Header and body limits for HTTP/1 requests. Requests exceeding them get a 431 or 413
+         * response, and the connection is closed.
+         * If http2_settings.max_body_size is 0, max_body_size is also used for HTTP/2.
+         *
+         * The receive buffer grows as needed for a single request line or header of up to
+         * max_headers_size bytes.
+         */
+        ParserLimits parser_limits;
+    };
+    /**Admission control settings for CoreServer::set_load_shedding.
+     *
+     * At most max_in_flight requests are passed to handle_request at once, with up to max_queued
+     * more waiting. Requests beyond that are rejected immediately with a 503 response.
+     *
+     * Queued requests are also rejected if they waited too long, using the CoDel approach. If
+     * every request that left the queue during the last interval waited longer than target, the
+     * queue is considered overloaded and requests that waited longer than target are rejected.
+     * Otherwise requests are only rejected after waiting for interval.
+     */
+    struct LoadShedOptions
+    {
+        LoadShedOptions()
+            : max_in_flight(0), max_queued(0)
+            , target(std::chrono::milliseconds(5)), interval(std::chrono::milliseconds(100))
+            , retry_after(std::chrono::seconds(1))
+        {}
+        /**Maximum requests in handle_request at once, or 0 to disable load shedding.*/
+        size_t max_in_flight;
+        /**Maximum requests waiting for a handler.*/
+        size_t max_queued;
+        /**Acceptable standing queue delay.*/
+        std::chrono::milliseconds target;
+        /**Time over which the queue delay must stay above target to be overloaded, and the longest
+         * a request may wait otherwise.
+         */
+        std::chrono::milliseconds interval;
+        /**Retry-After value of rejected requests.*/
+        std::chrono::seconds retry_after;
+    };
+    /**Statistics for a CoreServer.*/
+    struct CoreServerStats
+    {
+        /**Number of currently open connections.*/
+        size_t connections;
+        /**Number of times a listener stopped accepting due to a connection limit.*/
+        uint64_t accept_pauses;
+        /**Total time listeners have spent not accepting due to a connection limit, including
+         * any current pauses. Summed over all listeners.
+         */
+        std::chrono::steady_clock::duration accept_paused_time;
+        /**Responses compressed by the ResponseCompressor, if set.*/
+        uint64_t compressed_responses;
+        /**Thread CPU time spent compressing responses.*/
+        std::chrono::nanoseconds compression_time;
+        /**Requests currently being handled, if load shedding is enabled.*/
+        size_t handlers_in_flight;
+        /**Requests waiting for a handler, if load shedding is enabled.*/
+        size_t handlers_queued;
+        /**Requests rejected by load shedding.*/
+        uint64_t shed_requests;
+        /**Bytes of HTTP/1 request bodies counted against the body memory budget.*/
+        size_t body_memory;
+        /**Receive buffers held by connections. Idle connections do not hold one.*/
+        size_t buffers_in_use;
+    };
     /**A minimalistic server implementation.
      * Uses multiple threads for connections, but contains no logic for
      * processing the recieved requests.
@@ -36,19 +165,151 @@ namespace http
         explicit CoreServer(uint16_t port) : CoreServer("0.0.0.0", port) {}
         virtual ~CoreServer();
 
-        /**Add a listener before calling run.*/
-        void add_tcp_listener(const std::string &bind, uint16_t port);
+        /**Add a listener before calling run.
+         * bind may be an IPv4 or IPv6 address, see ListenerOptions::ipv6_only.
+         */
+        void add_tcp_listener(const std::string &bind, uint16_t port,
+            const ListenerOptions &options = ListenerOptions());
+        /**Add a Unix domain socket listener before calling run. Not supported on Windows.
+         *
+         * Connections are handled in the same way as TCP ones, but avoid the TCP/IP stack and
+         * ephemeral ports, for clients on the same host such as a reverse proxy.
+         * Clients have no address, so a ClientLimiter counts them all as a single client.
+         *
+         * An existing socket file at path is replaced, and the file is removed when the server
+         * is destroyed.
+         */
+        void add_unix_listener(const std::string &path,
+            const ListenerOptions &options = ListenerOptions());
         /**Add a TLS listener before calling run.*/
-        void add_tls_listener(const std::string &bind, uint16_t port, const PrivateCert &cert);
+        void add_tls_listener(const std::string &bind, uint16_t port, const PrivateCert &cert,
+            const ListenerOptions &options = ListenerOptions());
+        /**Replace the certificate of a TLS listener, without restarting. May be called from any
+         * thread, including while running.
+         *
+         * New handshakes use the new certificate, while existing connections keep the one they
+         * were established with. See CertWatcher to reload certificate files as they change.
+         *
+         * @param bind The bind address, exactly as given to add_tls_listener.
+         * @throws std::invalid_argument If there is no such TLS listener, or cert is empty.
+         */
+        void set_tls_cert(const std::string &bind, uint16_t port, const PrivateCert &cert);
+        /**Limit the number of connections open at once across all listeners. 0 is unlimited.
+         * Once reached all listeners stop accepting, leaving new connections in the listen
+         * backlog, until the count falls to resume_connections.
+         *
+         * Since each listener may already be waiting for a connection, the limit may be exceeded
+         * by up to one connection per listener.
+         *
+         * @param max Maximum number of connections.
+         * @param resume Low-water mark to resume accepting. If 0, 90% of max is used.
+         */
+        void set_max_connections(size_t max, size_t resume = 0);
+        /**Use a cache for responses. Must be set before run, and remain valid until exit.
+         * If a request has a cached response, it is sent without calling handle_request, and
+         * cacheable responses from handle_request are stored.
+         */
+        void set_response_cache(ResponseCache *cache)
+        {
+            response_cache = cache;
+        }
+        /**Compress responses from handle_request. Must be set before run, and remain valid until
+         * exit. Compression is done before storing in any ResponseCache, so cached responses are
+         * not compressed again.
+         */
+        void set_response_compressor(ResponseCompressor *compressor)
+        {
+            response_compressor = compressor;
+        }
+        /**Record server metrics in a registry, and serve them for GET requests to path without
+         * calling handle_request. Must be set before run, and remain valid until exit.
+         *
+         * Recorded metrics are requests by status class, request and response bytes, open
+         * connections, handle_request latency, request parse errors and TLS handshake time.
+         *
+         * @param path URL path for the metrics, or empty to not serve them.
+         */
+        void set_metrics(Metrics *metrics, const std::string &path = "/metrics");
+        /**The registry given to set_metrics, or null.*/
+        Metrics *metrics_registry()const { return metrics; }
+        /**Serve these values at the metrics path, rather than just those of the set_metrics
+         * registry, such as to add the metrics of other processes. Must be set before run.
+         */
+        void set_metrics_snapshot(std::function<MetricsSnapshot()> snapshot)
+        {
+            metrics_snapshot = snapshot;
+        }
+        /**Record each completed request in an access log. Must be set before run, and remain
+         * valid until exit.
+         *
+         * For HTTP/2, the duration and sizes cover the request and response bodies up until the
+         * response is queued on the connection, rather than until it is completely sent.
+         */
+        void set_access_log(AccessLog *log)
+        {
+            access_log = log;
+        }
+        /**Limit the number of requests being handled at once. Must be set before run.
+         * Rejected requests get a "503 Service Unavailable" response without calling
+         * handle_request.
+         */
+        void set_load_shedding(const LoadShedOptions &options);
+        /**Limit connections and requests from each client address. Must be set before run, and
+         * remain valid until exit.
+         *
+         * Connections over the limit are closed as soon as they are accepted. Requests over the
+         * rate limit get a "429 Too Many Requests" response once their first data is received,
+         * before it is parsed, and the connection is closed.
+         */
+        void set_client_limiter(ClientLimiter *limiter);
+        /**Limit the memory used by HTTP/1 request bodies across all connections. 0 is unlimited.
+         * Must be set before run.
+         *
+         * Request bodies are counted from when their size is known, until the response is sent.
+         * Requests that would exceed the budget get a "503 Service Unavailable" response, and the
+         * connection is closed. To limit each request, use ListenerOptions::parser_limits.
+         */
+        void set_body_memory_budget(size_t bytes)
+        {
+            body_memory_budget = bytes;
+        }
+        /**Get the current server statistics. Thread safe.*/
+        CoreServerStats stats()const;
         void run();
-        /**Signals the thread in run() and all workers to exit, then waits for them.*/
+        /**Signals the thread in run() and all workers to exit, then waits for them.
+         * In-progress requests are aborted. See drain for a clean shutdown.
+         */
         void exit();
+        /**Cleanly shutdown the server, then exit().
+         *
+         * Stops accepting new connections, and closes idle connections, including new ones that
+         * have not sent a request yet. Requests already in progress are completed with a
+         * "Connection: close" response. Any connections still open after timeout are aborted by
+         * exit().
+         */
+        void drain(std::chrono::steady_clock::duration timeout);
 
     protected:
         /**Process the request. This may be called by multiple internal threads.
-         * Any uncaught exception will kill the thread.
+         * Exceptions are sent as plain text error responses.
+         *
+         * Must be overridden unless handle_request_async is. The default throws.
+         */
+        virtual Response handle_request(Request &request);
+        /**Process the request, sending the response later with responder, from any thread.
+         * This may be called by multiple internal threads.
+         *
+         * Handlers that wait on other services can return once the work is started, rather than
+         * holding a thread until it completes, and send the response when it does. The request
+         * remains valid until the response is sent. Exceptions thrown before a response is sent
+         * are sent as plain text error responses.
+         *
+         * Load shedding only counts the time until this returns. Responses sent after exit are
+         * discarded.
+         *
+         * The default calls handle_request and sends its response.
          */
-        virtual Response handle_request(Request &request)=0;
+        virtual void handle_request_async(Request &request, Responder responder);
         /**Create an error response page.
          * This may be called by CoreServer instead of handle_request if there was an issue reading
          * the HTTP request.
@@ -56,24 +317,186 @@ namespace http
          * Any uncaught exception will kill the thread.
          */
         virtual Response parser_error_page(const ParserError &err)=0;
+        /**Decide whether to accept a request body, called once the headers of a HTTP/1.1 request
+         * with "Expect: 100-continue" are received and before the client sends the body.
+         * This may be called by multiple internal threads. Like handle_request, it is subject to
+         * load shedding, so when overloaded the client gets "503 Service Unavailable" instead.
+         *
+         * The default accepts all requests.
+         *
+         * @param request The request, with an empty body.
+         * @param response Set to the final response if the request is rejected. Since the body
+         * is not read, the connection is closed after sending it.
+         * @return True to send "100 Continue" and read the body, before calling handle_request.
+         */
+        virtual bool admit_request(const Request &request, Response &response);
     private:
         struct Listener
         {
             TcpListenSocket socket;
+            /**The bind address or Unix socket path and port it was added with.*/
+            std::string bind;
+            uint16_t port;
             bool tls;
+            /**Requires tls_cert_mutex, since set_tls_cert may replace it while running.*/
             PrivateCert tls_cert;
+            ListenerOptions options;
+            /**Open connections accepted by this listener.*/
+            size_t connections;
+            /**Accepting is paused due to a connection limit.*/
+            bool paused;
+            /**When paused was set.*/
+            std::chrono::steady_clock::time_point paused_at;
         };
         class Connection;
+        /**Metrics recorded when set_metrics is used, else these do nothing.*/
+        struct ServerMetrics
+        {
+            /**Responses by status class, 1xx to 5xx.*/
+            Counter responses[5];
+            Counter request_bytes;
+            Counter response_bytes;
+            Gauge connections;
+            /**Microseconds spent in handle_request.*/
+            Histogram request_duration;
+            Counter parse_errors;
+            /**HTTP/2, WebSocket and event stream connections closed due to an error, which are
+             * not logged, to keep the IO thread from blocking on output.
+             */
+            Counter protocol_errors;
+            /**Microseconds from accepting a TLS connection to completing the handshake.*/
+            Histogram tls_handshake_duration;
+            Counter shed_requests;
+        };
+        /**Tracks the completion of asynchronous responses, so exit can stop them from using the
+         * server. Shared with each pending response.
+         */
+        struct PendingResponses
+        {
+            std::mutex mutex;
+            std::condition_variable completed_cv;
+            /**Responses being completed.*/
+            size_t completing = 0;
+            /**exit() was called, so later responses are discarded.*/
+            bool closed = false;
+        };
+        /**A request waiting for a handler due to load shedding.*/
+        struct QueuedRequest
+        {
+            std::chrono::steady_clock::time_point queued;
+            /**Handles the request.*/
+            std::function<void()> handle;
+            /**Sends the load shedding response.*/
+            std::function<void()> shed;
+        };
 
         AsyncIo aio;
+        /**Receive buffers, leased by connections only while reading.*/
+        BufferPool buffer_pool;
         std::vector<Listener> listeners;
+        /**Protects Listener::tls_cert.*/
+        std::mutex tls_cert_mutex;
+        ResponseCache *response_cache = nullptr;
+        ResponseCompressor *response_compressor = nullptr;
+        Metrics *metrics = nullptr;
+        AccessLog *access_log = nullptr;
+        ClientLimiter *client_limiter = nullptr;
+        /**Pre-serialized response for requests rejected by client_limiter.*/
+        std::shared_ptr<const CachedResponse> rate_limited_response;
+        size_t body_memory_budget = 0;
+        /**Bytes reserved from body_memory_budget.*/
+        std::atomic<size_t> body_memory{0};
+        std::string metrics_path;
+        std::function<MetricsSnapshot()> metrics_snapshot;
+        ServerMetrics server_metrics;
+        /**Protects the connection counts and list, exiting and listener pause state.*/
+        mutable std::mutex connections_mutex;
+        /**exit() was called, so paused listeners should not be resumed.*/
+        bool exiting = false;
+        /**drain() was called, so no more connections are accepted, and responses close their
+         * connection.
+         */
+        std::atomic<bool> draining{false};
+        /**Open connections across all listeners.*/
+        size_t connections = 0;
+        /**The open connections.*/
+        std::unordered_set<Connection*> open_connections;
+        /**Signalled when a connection is closed.*/
+        std::condition_variable connection_closed_cv;
+        size_t max_connections = 0;
+        size_t resume_connections = 0;
+        uint64_t accept_pauses = 0;
+        /**Paused time of previously completed pauses.*/
+        std::chrono::steady_clock::duration accept_paused_time = std::chrono::steady_clock::duration::zero();
         /**Held by run(), preventing exit() from continueing until run() is finished.*/
         std::mutex running_mutex;
         std::mutex handle_mutex;
         std::vector<std::future<void>> in_progress_handlers;
+        std::shared_ptr<PendingResponses> pending_responses = std::make_shared<PendingResponses>();
 
+        LoadShedOptions load_shed;
+        /**Pre-serialized load shedding response for HTTP/1.*/
+        std::shared_ptr<const CachedResponse> shed_response;
+        /**Protects the load shedding state. Locked before handle_mutex.*/
+        mutable std::mutex shed_mutex;
+        size_t handlers_in_flight = 0;
+        std::deque<QueuedRequest> queued_requests;
+        uint64_t shed_requests = 0;
+        /**exit() was called, so no more queued requests are started.*/
+        bool shed_exiting = false;
+        /**The queue delay was above target for the whole of the last interval.*/
+        bool overloaded = false;
+        /**End of the current CoDel interval.*/
+        std::chrono::steady_clock::time_point shed_interval_end;
+        /**Lowest queue delay in the current interval.*/
+        std::chrono::steady_clock::duration shed_interval_min = std::chrono::steady_clock::duration::zero();
+
+        static ListenSocketOptions listen_socket_options(const ListenerOptions &options);
+        void add_listener(TcpListenSocket &&socket, const std::string &bind, uint16_t port,
+            bool tls, const PrivateCert &cert, const ListenerOptions &options);
+        /**Copy the current certificate of a TLS listener for a new connection.*/
+        PrivateCert tls_cert(const Listener &listener);
         void accept_next(Listener &listener);
         void accept(Listener &listener, TcpSocket &&sock);
         void accept_error();
+        /**Run a request handler on another thread, tracked by in_progress_handlers.*/
+        void start_handler(std::function<void()> func);
+        /**Run a request handler with start_handler if load shedding allows, else queue it or call
+         * shed.
+         * @param handle Handles the request.
+         * @param shed Sends a load shedding response instead. Called on the calling thread, or on
+         * the thread of a completing handler.
+         */
+        void dispatch(std::function<void()> handle, std::function<void()> shed);
+        /**Start handle, then start the next queued request once it completes. Requires shed_mutex.*/
+        void start_admitted(std::function<void()> handle);
+        /**Called as each admitted request completes, to start or reject queued requests.*/
+        void handler_done();
+        /**Call handle_request_async, or serve the metrics, then apply response_compressor and
+         * response_cache to the response and pass it to complete.
+         * Exceptions are converted to plain text error responses, with ok false.
+         *
+         * complete is called on the thread that sends the response, which may be before this
+         * returns. It is not called if the response is sent after exit.
+         */
+        void process_request(const std::shared_ptr<Request> &request,
+            std::function<void(Response &response, bool ok)> complete);
+        /**Reserve request body memory.
+         * @return False if this would exceed body_memory_budget, in which case nothing is reserved.
+         */
+        bool reserve_body_memory(size_t bytes);
+        void release_body_memory(size_t bytes);
+        /**Count a response in server_metrics.responses.*/
+        void count_response(int status_code);
+        /**True if listener has reached a connection limit. Requires connections_mutex.*/
+        bool at_connection_limit(const Listener &listener)const;
+        /**Called as each connection is destroyed, resuming any paused listeners if the low-water
+         * marks were reached.
+         */
+        void connection_closed(Connection *connection, Listener &listener);
+        /**Called on the AsyncIo thread by drain to stop accepting, close idle connections, and send
+         * GOAWAY to HTTP/2 connections.
+         */
+        void drain_start();
     };
 }
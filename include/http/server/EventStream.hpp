@@ -0,0 +1,155 @@
+#pragma once
+#include "../Request.hpp"
+#include "StreamOutput.hpp"
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+namespace http
+{
+    class Response;
+
+    /**Settings for an EventStream.*/
+    struct EventStreamOptions
+    {
+        EventStreamOptions()
+            : max_buffered(1024 * 1024), disconnect_slow(false), retry(0)
+        {}
+        /**Most event data that may be queued for the client. Further events are dropped until the
+         * client catches up, or the stream is closed if disconnect_slow.
+         */
+        size_t max_buffered;
+        /**Close the stream rather than dropping events when max_buffered is exceeded, so the
+         * client reconnects and can resume with Last-Event-ID.
+         */
+        bool disconnect_slow;
+        /**If non-zero, sent as the "retry" field when the stream starts, to set how long the
+         * client waits before reconnecting.
+         */
+        std::chrono::milliseconds retry;
+    };
+
+    /**An event serialized once in the text/event-stream format, to send to any number of
+     * EventStreams without copying.
+     */
+    class ServerEvent
+    {
+    public:
+        /**Serialize an event.
+         * @param data Event data. Each line is sent as a separate data field, and the client
+         * joins them with newlines.
+         * @param event Event type, or empty for the default "message" type.
+         * @param id Event ID, which the client sends as Last-Event-ID when reconnecting.
+         * @throws std::invalid_argument If event or id contain a line break.
+         */
+        explicit ServerEvent(const std::string &data, const std::string &event = std::string(),
+            const std::string &id = std::string());
+        /**A comment, ignored by clients. Can be sent periodically to keep idle connections
+         * from being closed by proxies.
+         */
+        static ServerEvent comment(const std::string &text = std::string());
+
+        /**The serialized event.*/
+        const std::shared_ptr<const std::string> &serialized()const { return buffer; }
+    private:
+        ServerEvent() {}
+        std::shared_ptr<const std::string> buffer;
+    };
+
+    /**A server side text/event-stream response (Server-Sent Events), held open to send events.
+     *
+     * The send methods are thread safe, and queue events to be sent by the connection's IO
+     * thread. Each returns false if the event was not queued, because the stream closed, or
+     * the client is too slow and the event was dropped.
+     *
+     * The server connection sends queued events with take_output. A single queued event is
+     * sent directly from its shared buffer, while small events are combined up to
+     * StreamOutput::BATCH_SIZE.
+     */
+    class EventStream
+    {
+    public:
+        /**Created by event_stream.*/
+        EventStream(Request &&request, const EventStreamOptions &options);
+        EventStream(const EventStream&) = delete;
+        EventStream& operator = (const EventStream&) = delete;
+
+        /**The request that opened the stream.*/
+        const Request &request()const { return stream_request; }
+        /**The Last-Event-ID header of a reconnecting client, or empty.*/
+        const std::string &last_event_id()const;
+
+        /**Send an event.*/
+        bool send(const ServerEvent &event);
+        /**Serialize and send an event.*/
+        bool send(const std::string &data, const std::string &event = std::string(),
+            const std::string &id = std::string());
+        /**Close the stream once the queued events are sent.*/
+        void close();
+        /**Bytes queued to send that have not yet been taken by the connection.*/
+        size_t buffered_amount()const;
+        /**True until closed or the connection is lost.*/
+        bool is_open()const;
+        /**Number of events dropped due to max_buffered.*/
+        uint64_t dropped()const;
+
+        /**Connect to a server connection on its IO thread. notify is called from any thread,
+         * without locks held, whenever output is queued while there was none.
+         */
+        void attach(std::function<void()> notify);
+        /**Disconnect from the server connection, once it is closed. Further sends return false.*/
+        void detach();
+        /**Take the next data to send, or null if there is nothing to send.*/
+        std::shared_ptr<const std::string> take_output();
+        /**True once closed, so after sending the remaining output the connection should be
+         * closed.
+         */
+        bool wants_close()const;
+    private:
+        Request stream_request;
+        StreamOutput output;
+    };
+
+    /**A set of EventStreams that each published event is sent to. Thread safe.
+     *
+     * Each event is serialized once, and the same buffer is queued for every subscriber.
+     * Closed streams are removed when publishing.
+     */
+    class EventTopic
+    {
+    public:
+        EventTopic() {}
+        EventTopic(const EventTopic&) = delete;
+        EventTopic& operator = (const EventTopic&) = delete;
+
+        void subscribe(std::shared_ptr<EventStream> stream);
+        void unsubscribe(const std::shared_ptr<EventStream> &stream);
+        /**Number of subscribed streams, including any closed since the last publish.*/
+        size_t subscribers()const;
+        /**Send an event to every subscriber.
+         * @return The number of subscribers it was queued for.
+         */
+        size_t publish(const ServerEvent &event);
+        /**Serialize and send an event to every subscriber.*/
+        size_t publish(const std::string &data, const std::string &event = std::string(),
+            const std::string &id = std::string());
+    private:
+        mutable std::mutex mutex;
+        std::vector<std::shared_ptr<EventStream>> streams;
+    };
+
+    /**Start an event stream, for use within a request handler.
+     *
+     * Returns a "200 OK" text/event-stream response. Once the server has sent the response
+     * header, the connection stays open to send the events queued on the response's
+     * event_stream, until it is closed. Add the stream to an EventTopic, or keep it to send
+     * events directly.
+     *
+     * The response has no length, so the connection is closed when the stream ends. Only
+     * supported for HTTP/1 connections.
+     */
+    Response event_stream(const Request &request, const EventStreamOptions &options = EventStreamOptions());
+}
@@ -0,0 +1,180 @@
+#pragma once
+#include "../core/Hpack.hpp"
+#include "../core/Http2.hpp"
+#include "../Request.hpp"
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <memory>
+#include <string>
+namespace http
+{
+    class File;
+    class Response;
+
+    /**Local settings for a server side HTTP/2 connection.*/
+    struct Http2Settings
+    {
+        Http2Settings()
+            : max_concurrent_streams(100)
+            , initial_window_size(1024 * 1024)
+            , max_frame_size(http2::DEFAULT_MAX_FRAME_SIZE)
+            , header_table_size(http2::DEFAULT_HEADER_TABLE_SIZE)
+            , max_header_list_size(65536)
+            , max_body_size(0)
+        {}
+        /**Maximum number of requests a client may have in progress at once. Further streams are
+         * refused with REFUSED_STREAM.
+         */
+        uint32_t max_concurrent_streams;
+        /**Receive window for each request body, and for the connection as a whole.
+         * Must be at least the protocol default of 65535.
+         */
+        uint32_t initial_window_size;
+        /**Largest frame payload the client may send.*/
+        uint32_t max_frame_size;
+        /**HPACK dynamic table size the client may use for request headers.*/
+        uint32_t header_table_size;
+        /**Largest decoded request header list, as measured by SETTINGS_MAX_HEADER_LIST_SIZE.
+         * Larger requests get a 431 response.
+         */
+        uint32_t max_header_list_size;
+        /**Largest request body, or 0 for no limit. Larger requests get a 413 response.*/
+        size_t max_body_size;
+    };
+
+    /**Server side HTTP/2 connection state (RFC7540).
+     *
+     * This does no IO itself. The owner passes received data to receive(), and sends the frames
+     * from take_output(). Complete requests are passed to the RequestHandler with their stream id,
+     * and each must eventually be answered by send_response(), in any order.
+     *
+     * Protocol errors are handled internally by resetting the stream, or for connection errors
+     * by sending GOAWAY, after which wants_close() is true.
+     *
+     * Not thread safe.
+     */
+    class Http2Session
+    {
+    public:
+        typedef std::function<void(uint32_t stream_id, Request &request)> RequestHandler;
+        /**Target size of the output returned by each take_output.*/
+        static const size_t OUTPUT_BATCH_SIZE = 65536;
+
+        /**Create a session, queueing the server connection preface.*/
+        explicit Http2Session(RequestHandler on_request, const Http2Settings &settings = Http2Settings());
+
+        /**Process data received from the client, which must begin with the client connection
+         * preface.
+         */
+        void receive(const void *data, size_t len);
+        /**Send the response for a stream passed to the RequestHandler.
+         * If the stream was since reset by the client, the response is discarded.
+         */
+        void send_response(uint32_t stream_id, Response &&response);
+        /**Appends frames ready to send to out, limited by flow control.
+         * @return True if any data was added.
+         */
+        bool take_output(std::string *out);
+        /**Gracefully shutdown by sending GOAWAY. Requests already received are completed, but
+         * no new ones are accepted.
+         */
+        void shutdown();
+        /**True once the connection should be closed after sending any remaining output.
+         * This is after a connection error, or after a GOAWAY once no streams remain.
+         */
+        bool wants_close()const;
+        /**Number of requests received but not yet completely responded to.*/
+        size_t active_streams()const { return streams.size(); }
+    private:
+        struct Stream
+        {
+            Request request;
+            /**Value of a content-length request header, or -1.*/
+            int64_t content_length;
+            /**The client has sent END_STREAM.*/
+            bool remote_closed;
+            /**send_response has been called.*/
+            bool responded;
+            /**The request was HEAD, so no response body is sent.*/
+            bool head;
+            /**Response flow control window.*/
+            int64_t send_window;
+            /**Remaining request body window advertised to the client.*/
+            int64_t recv_window;
+            /**Response body still to send, either from body or body_file.*/
+            std::string body;
+            std::shared_ptr<const File> body_file;
+            uint64_t body_offset;
+            uint64_t body_size;
+        };
+        typedef std::map<uint32_t, Stream> StreamMap;
+
+        RequestHandler on_request;
+        Http2Settings settings;
+        http2::HpackDecoder decoder;
+        http2::HpackEncoder encoder;
+        StreamMap streams;
+        /**Unprocessed received data.*/
+        std::string input;
+        /**Control and HEADERS frames ready to send, preceding any DATA.*/
+        std::string output;
+        bool preface_received;
+        bool settings_received;
+        /**Highest client stream id seen.*/
+        uint32_t last_stream_id;
+        /**Stream of an incomplete header block awaiting CONTINUATION, else 0.*/
+        uint32_t continuation_stream;
+        /**The incomplete header block had END_STREAM set.*/
+        bool continuation_end_stream;
+        std::string header_block;
+        /**Stream id after which DATA frames are next scheduled, for round-robin.*/
+        uint32_t next_data_stream;
+        int64_t conn_send_window;
+        int64_t conn_recv_window;
+        /**Clients SETTINGS_INITIAL_WINDOW_SIZE.*/
+        int64_t peer_initial_window;
+        /**Clients SETTINGS_MAX_FRAME_SIZE.*/
+        uint32_t peer_max_frame_size;
+        bool goaway_sent;
+        bool goaway_received;
+        /**A connection error occurred, nothing more is processed.*/
+        bool failed;
+
+        void process_frame(const http2::FrameHeader &header, const uint8_t *payload);
+        void on_data(const http2::FrameHeader &header, const uint8_t *payload);
+        void on_headers(const http2::FrameHeader &header, const uint8_t *payload);
+        void on_continuation(const http2::FrameHeader &header, const uint8_t *payload);
+        void on_header_block(uint32_t stream_id, bool end_stream);
+        void on_rst_stream(const http2::FrameHeader &header, const uint8_t *payload);
+        void on_settings(const http2::FrameHeader &header, const uint8_t *payload);
+        void on_ping(const http2::FrameHeader &header, const uint8_t *payload);
+        void on_goaway(const http2::FrameHeader &header, const uint8_t *payload);
+        void on_window_update(const http2::FrameHeader &header, const uint8_t *payload);
+        /**Build the request from decoded headers.
+         * @throws Http2Error A stream PROTOCOL_ERROR if the headers are malformed.
+         * @throws ErrorResponse If the method is not supported or the path is invalid.
+         */
+        void make_request(uint32_t stream_id, const http2::HeaderList &fields, Stream &stream);
+        /**The request is complete, pass it to on_request.*/
+        void dispatch(uint32_t stream_id, Stream &stream);
+        /**Respond to a stream with a plain text error rather than calling on_request.*/
+        void send_error(uint32_t stream_id, int status_code);
+        /**Remove a stream once the response is sent, resetting it if the request is incomplete.
+         * @return The following stream.
+         */
+        StreamMap::iterator close_stream(StreamMap::iterator stream);
+        /**Append the next DATA frame for stream to out, as allowed by flow control.
+         * @return True if the response is complete.
+         */
+        bool write_data(uint32_t stream_id, Stream &stream, std::string *out);
+        /**Replenish receive windows once half used.*/
+        void update_recv_window(uint32_t stream_id, int64_t *window);
+        void write_frame(http2::FrameType type, uint8_t flags, uint32_t stream_id,
+            const void *payload, size_t len);
+        void write_rst_stream(uint32_t stream_id, http2::ErrorCode code);
+        void write_goaway(http2::ErrorCode code, const std::string &debug);
+        /**Handle a stream or connection error.*/
+        void on_error(const http2::Http2Error &err);
+    };
+}
@@ -0,0 +1,43 @@
+#pragma once
+#include <exception>
+#include <functional>
+#include <memory>
+namespace http
+{
+    class Response;
+
+    /**Completes an asynchronous request, by sending its response from any thread.
+     *
+     * Copies share the same request, and only the first response sent by any of them is used.
+     * If every copy is destroyed without sending a response, a "500 Internal Server Error"
+     * response is sent, so a request can not be left waiting forever.
+     */
+    class Responder
+    {
+    public:
+        /**A responder for no request, which must not be used.*/
+        Responder() : state() {}
+        /**@param complete Called once with the response, on the thread that sent it.
+         * failed is true for error responses made by send_error, or if no response was sent.
+         */
+        explicit Responder(std::function<void(Response &&response, bool failed)> complete);
+
+        /**Send the response. Thread safe.
+         * @return False if a response was already sent, in which case this one is discarded.
+         */
+        bool send(Response &&response);
+        /**Send a plain text error response for an exception. Thread safe.
+         * ErrorResponse exceptions use their status code, and any other exception is a
+         * "500 Internal Server Error".
+         * @return False if a response was already sent.
+         */
+        bool send_error(std::exception_ptr error);
+        /**True once a response was sent.*/
+        bool completed()const;
+        /**True unless default constructed.*/
+        explicit operator bool()const { return (bool)state; }
+    private:
+        struct State;
+        std::shared_ptr<State> state;
+    };
+}
@@ -0,0 +1,111 @@
+#pragma once
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+namespace http
+{
+    class Request;
+    class Response;
+
+    /**A response stored by ResponseCache, serialized ready to send.*/
+    struct CachedResponse
+    {
+        /**The status line and headers, including Content-Length, but not the Date or Connection
+         * headers or the final blank line.
+         */
+        std::string head;
+        /**The response body.*/
+        std::string body;
+
+        /**Parse head back into a Response with a copy of the body, for sending over HTTP/2.*/
+        Response to_response()const;
+    };
+    /**Statistics for a ResponseCache.*/
+    struct ResponseCacheStats
+    {
+        uint64_t hits;
+        uint64_t misses;
+        /**Responses added to the cache.*/
+        uint64_t stores;
+        /**Entries removed to stay within the byte budget.*/
+        uint64_t evictions;
+        /**Current number of cached responses.*/
+        size_t entries;
+        /**Current approximate memory used by cached responses.*/
+        size_t bytes;
+    };
+
+    /**Thread safe in-memory cache of complete responses, for use by CoreServer before calling
+     * handle_request.
+     *
+     * Only GET and HEAD responses with an explicit Cache-Control max-age or s-maxage, and without
+     * no-store, no-cache, private or Set-Cookie are stored. Entries are keyed by the method,
+     * Request::raw_url and the request values of any headers named by the responses Vary
+     * header, and expire after the max-age.
+     *
+     * Memory is limited to max_bytes, split evenly between a number of independently locked
+     * shards, each evicting the least recently used entries.
+     */
+    class ResponseCache
+    {
+    public:
+        static const size_t DEFAULT_SHARDS = 16;
+
+        /**@param max_bytes Maximum size of all cached responses.
+         * @param shards Number of independently locked partitions of the cache.
+         */
+        explicit ResponseCache(size_t max_bytes, size_t shards = DEFAULT_SHARDS);
+
+        /**Find a fresh cached response for a request, or null.*/
+        std::shared_ptr<const CachedResponse> get(const Request &request);
+        /**Store the response for request if it is cacheable.
+         * @return True if the response was stored.
+         */
+        bool put(const Request &request, const Response &response);
+        /**Remove all entries.*/
+        void clear();
+        /**Get the current statistics.*/
+        ResponseCacheStats stats()const;
+    private:
+        typedef std::chrono::steady_clock clock;
+        struct Entry
+        {
+            /**Method and raw_url.*/
+            std::string key;
+            /**Header names from Vary, and the request values they were stored for.*/
+            std::vector<std::pair<std::string, std::string>> vary;
+            clock::time_point expires;
+            std::shared_ptr<const CachedResponse> response;
+            size_t size;
+        };
+        typedef std::list<Entry> EntryList;
+        struct Shard
+        {
+            std::mutex mutex;
+            /**Most recently used at the front.*/
+            EntryList lru;
+            /**Entries by key. There may be multiple entries for a key with different vary values.*/
+            std::unordered_multimap<std::string, EntryList::iterator> index;
+            size_t bytes = 0;
+        };
+
+        size_t max_shard_bytes;
+        std::unique_ptr<Shard[]> shards;
+        size_t shard_count;
+        std::atomic<uint64_t> hits, misses, stores, evictions;
+
+        static std::string make_key(const Request &request);
+        Shard &get_shard(const std::string &key);
+        /**True if the request has the same values for the entries vary headers.*/
+        static bool vary_matches(const Entry &entry, const Request &request);
+        /**Remove an entry. Requires shard.mutex.*/
+        static void erase(Shard &shard, EntryList::iterator entry);
+    };
+}
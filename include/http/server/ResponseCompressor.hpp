@@ -0,0 +1,104 @@
+#pragma once
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <list>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+namespace http
+{
+    class Request;
+    class Response;
+
+    /**Configuration for ResponseCompressor.*/
+    struct CompressionOptions
+    {
+        CompressionOptions();
+        /**Content codings to use in order of server preference, which breaks ties between
+         * codings of equal quality in Accept-Encoding. Codings not supported by Compressor
+         * are ignored. Defaults to "br", "gzip", "deflate".
+         */
+        std::vector<std::string> codings;
+        /**Compressor level for all codings.*/
+        int level;
+        /**Bodies smaller than this are not compressed. Defaults to 1KB.*/
+        size_t min_size;
+        /**Bodies larger than this are not compressed. The whole compressed body is held in
+         * memory for each response being sent, so this bounds that memory, while larger files
+         * are still sent uncompressed from Response::body_file. Defaults to 1MB.
+         */
+        size_t max_size;
+        /**Content types to compress, compared case insensitively. A type ending in '/' matches
+         * all subtypes. Defaults to "text/" and common JSON, JavaScript, XML and SVG types.
+         */
+        std::vector<std::string> content_types;
+        /**Memory limit for compressed variants of responses with a strong ETag, which are
+         * reused while the ETag is unchanged. 0 disables the cache. Defaults to 16MB.
+         */
+        size_t cache_bytes;
+    };
+    /**Statistics for a ResponseCompressor.*/
+    struct CompressionStats
+    {
+        /**Responses sent with a Content-Encoding.*/
+        uint64_t responses;
+        /**Of responses, the number that used a cached compressed body.*/
+        uint64_t cache_hits;
+        /**Uncompressed size of the compressed bodies, excluding cache hits.*/
+        uint64_t bytes_in;
+        /**Compressed size of the compressed bodies, excluding cache hits.*/
+        uint64_t bytes_out;
+        /**Thread CPU time spent compressing.*/
+        std::chrono::nanoseconds cpu_time;
+    };
+
+    /**Compresses response bodies with a content coding negotiated from the requests
+     * Accept-Encoding header. Thread safe.
+     *
+     * Compressible responses also get "Vary: Accept-Encoding", and any strong ETag becomes weak,
+     * since the compressed representation is not byte-for-byte the same.
+     *
+     * Responses with Response::body_file are read a block at a time, but the compressed output
+     * is fully buffered and replaces body_file with Response::body. See
+     * CompressionOptions::max_size.
+     */
+    class ResponseCompressor
+    {
+    public:
+        explicit ResponseCompressor(const CompressionOptions &options = CompressionOptions());
+
+        /**Compress the body of response if it is compressible and the request accepts one of the
+         * content codings.
+         * @return True if the response was compressed.
+         */
+        bool compress(const Request &request, Response &response);
+        /**Get the current statistics.*/
+        CompressionStats stats()const;
+    private:
+        /**Compressed bodies by coding, URL and ETag.*/
+        struct Cache
+        {
+            typedef std::pair<std::string, std::string> Entry;
+            std::mutex mutex;
+            /**Most recently used key and body at the front.*/
+            std::list<Entry> lru;
+            std::unordered_map<std::string, std::list<Entry>::iterator> index;
+            size_t bytes = 0;
+        };
+
+        CompressionOptions options;
+        Cache cache;
+        std::atomic<uint64_t> responses, cache_hits, bytes_in, bytes_out;
+        std::atomic<int64_t> cpu_time_ns;
+
+        /**True if the responses status code and content type allow compression.*/
+        bool compressible(const Response &response)const;
+        /**Select the content coding to use, or an empty string for none.*/
+        std::string select_coding(const Request &request)const;
+        std::string compress_body(const std::string &coding, const Response &response);
+        bool cache_get(const std::string &key, std::string *body);
+        void cache_put(const std::string &key, const std::string &body);
+    };
+}
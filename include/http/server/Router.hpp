@@ -1,5 +1,7 @@
 #pragma once
 #include "../Request.hpp"
+#include "Responder.hpp"
+#include "../util/Coroutine.hpp"
 #include <functional>
 #include <memory>
 #include <vector>
@@ -8,21 +10,40 @@ namespace http
 {
     class Response;
     class UrlError;
+    struct WebSocketHandler;
+    struct WebSocketOptions;
     typedef std::unordered_map<std::string, std::string> PathParams;
     typedef std::function<Response(Request&, PathParams&)> RequestHandler;
+    /**A request handler that sends its response later, from any thread, with the Responder.
+     * The request remains valid until the response is sent, but the path parameters are only
+     * valid during the call.
+     */
+    typedef std::function<void(Request&, PathParams&, Responder)> AsyncRequestHandler;
+#ifdef HTTP_USE_COROUTINES
+    /**A request handler coroutine. The request remains valid until it completes, and the path
+     * parameters are copied into its frame.
+     */
+    typedef std::function<Task<Response>(Request&, PathParams)> CoroutineRequestHandler;
+#endif
     /**A route found by Router for a path and method.
      * If true, contains the handler and path parameters.
      */
     struct MatchedRoute
     {
-        /**Request handler if a route was matched, else null.*/
+        /**Request handler if a synchronous route was matched, else null.*/
         RequestHandler handler;
+        /**Request handler if an asynchronous route was matched, else null.*/
+        AsyncRequestHandler async_handler;
         /**Named path parameters from the matched URL path.*/
         PathParams path_params;
 
-        MatchedRoute() : handler(nullptr), path_params() {}
+        MatchedRoute() : handler(nullptr), async_handler(nullptr), path_params() {}
         /**True if a route was found.*/
-        explicit operator bool()const { return handler != nullptr; }
+        explicit operator bool()const { return handler != nullptr || async_handler != nullptr; }
+        /**Call either kind of handler, sending the response with responder. Exceptions thrown
+         * by the handler are sent with Responder::send_error, unless it already responded.
+         */
+        void respond(Request &request, Responder responder);
     };
 
     /**Thrown when trying to add a route that is invalid.*/
@@ -71,6 +92,27 @@ namespace http
          *    - If adding a prefix path, and the path already exists as a non-prefix path.
          */
         void add(const std::string &method, const std::string &path, RequestHandler handler);
+        /**Adds an asynchronous handler for a method and path.
+         * Paths are as for add, and the same path may have both kinds of handler for different
+         * methods.
+         * @throws InvalidRouteError As for add.
+         */
+        void add_async(const std::string &method, const std::string &path, AsyncRequestHandler handler);
+#ifdef HTTP_USE_COROUTINES
+        /**Adds a coroutine handler for a method and path, started with spawn on the thread
+         * handling the request. The response is sent once the coroutine returns.
+         * @throws InvalidRouteError As for add.
+         */
+        void add_coroutine(const std::string &method, const std::string &path, CoroutineRequestHandler handler);
+#endif
+        /**Adds a GET route accepting WebSocket upgrades with websocket_upgrade.
+         * Requests that are not an upgrade get a "426 Upgrade Required" response.
+         * @throws InvalidRouteError As for add.
+         */
+        void add_websocket(const std::string &path, const WebSocketHandler &handler);
+        /**Adds a GET route accepting WebSocket upgrades with websocket_upgrade.*/
+        void add_websocket(const std::string &path, const WebSocketHandler &handler,
+            const WebSocketOptions &options);
     private:
         typedef std::vector<std::string> PathParts;
         typedef PathParts::const_iterator PathIterator;
@@ -96,7 +138,8 @@ namespace http
              * A prefix node can not have child nodes.
              */
             bool prefix;
-            std::unordered_map<std::string, RequestHandler> methods;
+            /**Handlers by method. Only one of each pair is set.*/
+            std::unordered_map<std::string, std::pair<RequestHandler, AsyncRequestHandler>> methods;
             /**Named child paths.*/
             std::unordered_map<std::string, std::unique_ptr<Node>> children;
             /**Parameter child node. Note that all such routes must use a common parameter name.*/
@@ -112,5 +155,8 @@ namespace http
          * e.g. "/profiles/55" will return `{"profiles", "55"}`.
          */
         PathParts get_parts(const std::string &path)const;
+        /**Adds a route with one of handler or async_handler.*/
+        void add_route(const std::string &method, const std::string &path,
+            RequestHandler handler, AsyncRequestHandler async_handler);
     };
 }
@@ -0,0 +1,96 @@
+#pragma once
+#include "Router.hpp"
+#include <chrono>
+#include <ctime>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+namespace http
+{
+    class File;
+    class Response;
+    /**Request handler serving files from a directory for a Router prefix route.
+     *
+     * The response body is sent directly from the file (Response::body_file). Responses include
+     * ETag and Last-Modified headers, and If-None-Match or If-Modified-Since requests for an
+     * unmodified file get a 304 Not Modified.
+     *
+     * Open files are cached, and only checked for changes every revalidate_interval. Copies of a
+     * StaticFiles share the same cache.
+     *
+     * Example:
+     * @code
+     * StaticFiles assets("/assets", "public/assets");
+     * router.add("GET", "/assets/&lowast;", assets);
+     * router.add("HEAD", "/assets/&lowast;", assets);
+     * @endcode
+     */
+    class StaticFiles
+    {
+    public:
+        static const size_t DEFAULT_MAX_CACHED_FILES = 1024;
+
+        /**Serve files from directory for URL paths under url_prefix.
+         * @param url_prefix The route path without the trailing "/&lowast;", e.g. "/assets".
+         * @param directory The directory containing the files.
+         */
+        StaticFiles(const std::string &url_prefix, const std::string &directory);
+
+        /**Handle a GET or HEAD request.
+         * @throws NotFound If the path does not refer to a regular file under the directory.
+         */
+        Response operator()(Request &request, PathParams &params)const;
+
+        /**Set the Content-Type for files with a file extension (without the '.').
+         * Common web file types are set by default, else "application/octet-stream" is used.
+         */
+        void set_content_type(const std::string &extension, const std::string &content_type);
+        /**How long a cached file is used before checking the file system for a newer version.
+         * Zero checks on every request.
+         */
+        void set_revalidate_interval(std::chrono::steady_clock::duration interval)
+        {
+            revalidate_interval = interval;
+        }
+        /**Limit the number of open files that are cached.*/
+        void set_max_cached_files(size_t max);
+
+        /**Create a strong ETag header value from a files size and modification time.*/
+        static std::string make_etag(uint64_t size, time_t mtime);
+    private:
+        /**An open file with pre-formatted validator headers.*/
+        struct CachedFile
+        {
+            std::shared_ptr<const File> file;
+            std::string etag;
+            std::string last_modified;
+            std::chrono::steady_clock::time_point checked;
+        };
+        /**Open files by file system path. Shared by copies of StaticFiles.*/
+        struct Cache
+        {
+            std::mutex mutex;
+            std::unordered_map<std::string, std::shared_ptr<CachedFile>> files;
+            size_t max_files = DEFAULT_MAX_CACHED_FILES;
+        };
+
+        std::string url_prefix;
+        std::string directory;
+        std::unordered_map<std::string, std::string> content_types;
+        std::chrono::steady_clock::duration revalidate_interval;
+        std::shared_ptr<Cache> cache;
+
+        /**Maps a decoded request URL path to a file system path.
+         * @throws NotFound If the path is not under url_prefix, or contains "." or ".." segments.
+         */
+        std::string file_path(const std::string &url_path)const;
+        /**Get the file from cache, opening or revalidating it if needed.
+         * @throws NotFound
+         */
+        std::shared_ptr<CachedFile> get_file(const std::string &path)const;
+        const std::string &content_type(const std::string &path)const;
+        /**True if the request has a If-None-Match or If-Modified-Since matching file.*/
+        static bool not_modified(const Request &request, const CachedFile &file);
+    };
+}
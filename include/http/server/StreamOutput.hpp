@@ -0,0 +1,89 @@
+#pragma once
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <limits>
+#include <memory>
+#include <mutex>
+#include <string>
+namespace http
+{
+    /**Data queued by any thread for a long lived stream, such as a WebSocket or EventStream,
+     * to be sent by the server connection's IO thread. Thread safe.
+     *
+     * Buffers are queued by shared pointer, so the same data can be queued for many streams
+     * without copying. take returns a single or large buffer as is, while several small
+     * buffers are copied into one.
+     */
+    class StreamOutput
+    {
+    public:
+        /**Small buffers are combined into one up to this size by take.*/
+        static const size_t BATCH_SIZE = 65536;
+
+        enum QueueResult
+        {
+            /**The data will be sent.*/
+            QUEUED,
+            /**Dropped because max_bytes would be exceeded.*/
+            FULL,
+            /**Dropped because the output is closed or detached.*/
+            CLOSED
+        };
+
+        /**@param max_bytes Most data that may be queued. Further data is dropped until the
+         * connection takes some.
+         * @param close_when_full Close when max_bytes would be exceeded, rather than just
+         * dropping the data.
+         */
+        explicit StreamOutput(size_t max_bytes = std::numeric_limits<size_t>::max(),
+            bool close_when_full = false);
+        StreamOutput(const StreamOutput&) = delete;
+        StreamOutput& operator = (const StreamOutput&) = delete;
+
+        /**Queue data to send.
+         * @param close Close the output after this data, such as a WebSocket close frame.
+         */
+        QueueResult queue(std::shared_ptr<const std::string> data, bool close = false);
+        /**Stop accepting data. Data already queued is still taken.
+         * @return False if already closed or detached.
+         */
+        bool close();
+        /**Bytes queued that have not yet been taken.*/
+        size_t buffered_amount()const;
+        /**True once closed, even if data remains to be taken.*/
+        bool closed()const;
+        /**True until closed or detached.*/
+        bool is_open()const;
+        /**Number of times queue returned FULL.*/
+        uint64_t dropped()const;
+
+        /**Connect to a server connection on its IO thread. notify is called from any thread,
+         * without locks held, whenever data is queued while there was none, or on close.
+         */
+        void attach(std::function<void()> notify);
+        /**Disconnect from the server connection, once it is closed. Queued data is discarded
+         * and further data is rejected.
+         */
+        void detach();
+        /**Take the next data to send, or null if there is nothing to send.*/
+        std::shared_ptr<const std::string> take();
+    private:
+        size_t max_bytes;
+        bool close_when_full;
+
+        mutable std::mutex mutex;
+        /**Requires mutex.*/
+        std::deque<std::shared_ptr<const std::string>> output;
+        /**Total size of output. Requires mutex.*/
+        size_t output_bytes;
+        /**Requires mutex.*/
+        std::function<void()> notify;
+        /**Requires mutex.*/
+        bool is_closed;
+        /**Requires mutex.*/
+        bool detached;
+        /**Requires mutex.*/
+        uint64_t dropped_count;
+    };
+}
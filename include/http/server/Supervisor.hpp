@@ -0,0 +1,143 @@
+#pragma once
+#include "CoreServer.hpp"
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <vector>
+namespace http
+{
+    /**Settings for a Supervisor.*/
+    struct SupervisorOptions
+    {
+        SupervisorOptions()
+            : workers(0), restart_delay(std::chrono::seconds(1))
+            , drain_timeout(std::chrono::seconds(10)), stats_interval(std::chrono::milliseconds(100))
+            , metrics_bytes(64 * 1024)
+        {}
+        /**Number of worker processes. If 0, std::thread::hardware_concurrency is used.*/
+        unsigned workers;
+        /**Minimum time between starting a worker and restarting it, so a worker that fails at
+         * startup does not restart in a tight loop.
+         */
+        std::chrono::milliseconds restart_delay;
+        /**Time workers are given to finish their requests once the supervisor exits, before
+         * they are killed.
+         */
+        std::chrono::milliseconds drain_timeout;
+        /**How often workers publish their CoreServer::stats and metrics.*/
+        std::chrono::milliseconds stats_interval;
+        /**Shared memory for each worker's metrics. A worker whose metrics do not fit does not
+         * publish them. 0 to not share metrics.
+         */
+        size_t metrics_bytes;
+    };
+    /**State of a single worker process.*/
+    struct WorkerStats
+    {
+        /**Process ID of the current process for this worker, or 0 if not running.*/
+        int pid;
+        /**Times the worker has been restarted after exiting.*/
+        uint64_t restarts;
+        /**The workers most recently published CoreServer::stats.*/
+        CoreServerStats server;
+    };
+
+    /**Runs a CoreServer in several worker processes ("pre-fork"), restarting any that exit.
+     *
+     * Each worker creates its own server after the fork, with its own listen sockets and event
+     * loop. The listeners should set ListenerOptions::reuse_port, so every worker can listen on
+     * the same ports with the OS balancing new connections between them. This isolates workers
+     * from each other's crashes and avoids a single accepting thread.
+     *
+     * Workers publish their stats to memory shared with the supervisor, which can be read with
+     * stats and server_stats.
+     *
+     * If the factory gives a server a Metrics registry with CoreServer::set_metrics, the worker
+     * also publishes a MetricsSnapshot of it every stats_interval. Series are matched by name
+     * and labels, so the workers may register them in any order. The metrics path of any
+     * worker serves its own current values plus the last published values of the others, so
+     * a scrape that reuse_port sends to any worker sees the whole server, and the supervisor
+     * can read the same total with metrics. Every worker must give each metric the same type.
+     * A restarted worker's counters start again from zero, which monitoring systems such as
+     * Prometheus treat as a counter reset.
+     *
+     * Workers are forked from the thread calling run, so it is best to call run before starting
+     * other threads. Worker processes never return from run, they call _exit once their server
+     * stops. Requires fork, so is not supported on Windows.
+     */
+    class Supervisor
+    {
+    public:
+        /**Creates the server for a worker, called in the worker process.
+         * @param worker Index of the worker, from 0 to workers - 1. A restarted worker keeps its
+         * index.
+         */
+        typedef std::function<std::unique_ptr<CoreServer>(unsigned worker)> ServerFactory;
+
+        Supervisor(const SupervisorOptions &options, ServerFactory factory);
+        ~Supervisor();
+        Supervisor(const Supervisor&) = delete;
+        Supervisor& operator = (const Supervisor&) = delete;
+
+        /**Number of worker processes.*/
+        unsigned workers()const { return worker_count; }
+        /**Start the workers, then restart them as they exit, until exit is called.*/
+        void run();
+        /**Stop run. Workers are drained for up to drain_timeout, then killed.
+         * Thread safe, but not async signal safe.
+         */
+        void exit();
+        /**Get the state of each worker. Thread safe.*/
+        std::vector<WorkerStats> stats()const;
+        /**Get the CoreServer::stats of all running workers added together. Thread safe.*/
+        CoreServerStats server_stats()const;
+        /**Get the last published metrics of all running workers added together. Thread safe.
+         * @throws std::invalid_argument If workers gave a metric different types.
+         */
+        MetricsSnapshot metrics()const;
+    private:
+        /**Per worker state in shared memory, written by the worker process.*/
+        struct SharedStats;
+        struct Worker
+        {
+            int pid;
+            /**Write end of the control pipe. The worker drains its server once this is closed.*/
+            int control;
+            uint64_t restarts;
+            std::chrono::steady_clock::time_point started;
+        };
+
+        SupervisorOptions opts;
+        ServerFactory factory;
+        unsigned worker_count;
+        /**worker_count SharedStats in a shared anonymous mapping.*/
+        SharedStats *shared;
+        /**metrics_words per worker in a shared anonymous mapping, or null. Each starts with a
+         * sequence number, odd while the worker is writing, then the size in bytes and the
+         * serialized MetricsSnapshot.
+         */
+        std::atomic<uint64_t> *shared_metrics;
+        size_t metrics_words;
+        std::vector<Worker> worker_state;
+        mutable std::mutex mutex;
+        std::condition_variable exit_cv;
+        bool exiting;
+
+        /**Fork the worker at index. Requires mutex.*/
+        void start_worker(unsigned index);
+        /**The worker process main, never returns.*/
+        void run_worker(unsigned index, int control);
+        /**Wait up to drain_timeout for workers to exit, then kill the rest.*/
+        void stop_workers();
+        /**Write the metrics of the worker at index. Only called by that worker.*/
+        void publish_metrics(unsigned index, const std::string &data);
+        /**Read the metrics of the worker at index, or an empty snapshot if it has none.*/
+        MetricsSnapshot load_metrics(unsigned index)const;
+        /**Remove the metrics of the worker at index, once it no longer publishes them.*/
+        void clear_metrics(unsigned index);
+    };
+}
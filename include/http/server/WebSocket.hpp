@@ -0,0 +1,238 @@
+#pragma once
+#include "../core/WebSocket.hpp"
+#include "../Request.hpp"
+#include "Router.hpp"
+#include "StreamOutput.hpp"
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+namespace http
+{
+    class Response;
+    class WebSocket;
+
+    /**Settings for WebSocket connections accepted by websocket_upgrade.*/
+    struct WebSocketOptions
+    {
+        WebSocketOptions()
+            : max_message_size(16 * 1024 * 1024), permessage_deflate(true), deflate_level(-1)
+            , deflate_min_size(256), protocols()
+        {}
+        /**Largest message that may be received, after decompression. Larger messages close the
+         * connection with CLOSE_MESSAGE_TOO_BIG.
+         */
+        size_t max_message_size;
+        /**Accept the permessage-deflate extension (RFC7692) if the client offers it.*/
+        bool permessage_deflate;
+        /**zlib compression level for sent messages, 1 to 9, or -1 for the zlib default.*/
+        int deflate_level;
+        /**Sent messages smaller than this are not compressed.*/
+        size_t deflate_min_size;
+        /**Supported subprotocols, in order of preference. The first one the client offers in
+         * Sec-WebSocket-Protocol is selected. If empty, no subprotocol is selected.
+         */
+        std::vector<std::string> protocols;
+    };
+
+    /**Callbacks for a WebSocket connection. Any may be left empty.
+     *
+     * These are called on the server's IO thread, so must not block. Slower work should be done
+     * on other threads, sending results with the thread safe WebSocket methods.
+     */
+    struct WebSocketHandler
+    {
+        /**The connection was upgraded and messages may now be received.*/
+        std::function<void(const std::shared_ptr<WebSocket> &ws)> on_open;
+        /**A complete message was received. data is only valid for the call, and text messages
+         * are valid UTF-8. Messages that arrived in a single frame point directly into the
+         * connection's receive buffer.
+         */
+        std::function<void(const std::shared_ptr<WebSocket> &ws, websocket::Opcode opcode,
+            const char *data, size_t len)> on_message;
+        /**The connection closed. Called once for each opened connection. code is
+         * CLOSE_ABNORMAL if the connection was lost without a close handshake.
+         */
+        std::function<void(const std::shared_ptr<WebSocket> &ws, uint16_t code,
+            const std::string &reason)> on_close;
+    };
+
+    /**A message framed once, to send to any number of WebSockets without framing or compressing
+     * it again for each of them. The frames are shared by every connection it is sent to.
+     */
+    class WebSocketMessage
+    {
+    public:
+        /**Frame a text or binary message. If options.permessage_deflate and the message is at
+         * least options.deflate_min_size, a compressed frame is also made, and used for
+         * connections that negotiated permessage-deflate.
+         */
+        WebSocketMessage(websocket::Opcode opcode, const void *data, size_t len,
+            const WebSocketOptions &options = WebSocketOptions());
+        WebSocketMessage(websocket::Opcode opcode, const std::string &data,
+            const WebSocketOptions &options = WebSocketOptions())
+            : WebSocketMessage(opcode, data.data(), data.size(), options)
+        {}
+
+        /**The frame to send on a connection, compressed if available and deflate is true.*/
+        const std::shared_ptr<const std::string> &frame(bool deflate)const
+        {
+            return deflate && deflated ? deflated : plain;
+        }
+    private:
+        std::shared_ptr<const std::string> plain;
+        std::shared_ptr<const std::string> deflated;
+    };
+
+    /**A server side WebSocket connection (RFC6455).
+     *
+     * This is both the handle used by applications to send messages, and the protocol engine
+     * driven by the server connection. The send methods are thread safe, and queue frames to be
+     * sent by the connection's IO thread. Each returns false if the connection has closed, or a
+     * close frame was already sent.
+     *
+     * Like Http2Session, the engine does no IO itself. The connection passes received data to
+     * receive, which unmasks it in place, handles fragmentation, control frames and
+     * decompression, and calls the WebSocketHandler. Frames to send are taken with take_output.
+     *
+     * With permessage-deflate, sent messages are always compressed independently
+     * ("server_no_context_takeover"), so a compressed WebSocketMessage can be shared between
+     * connections.
+     */
+    class WebSocket : public std::enable_shared_from_this<WebSocket>
+    {
+    public:
+        /**Created by websocket_upgrade.
+         * @param deflate permessage-deflate was negotiated.
+         * @param protocol The selected subprotocol, or empty.
+         */
+        WebSocket(Request &&request, PathParams &&params, const WebSocketHandler &handler,
+            const WebSocketOptions &options, bool deflate, const std::string &protocol);
+        ~WebSocket();
+        WebSocket(const WebSocket&) = delete;
+        WebSocket& operator = (const WebSocket&) = delete;
+
+        /**Send the same message to each socket, without copying it.
+         * @return The number of sockets it was queued for.
+         */
+        static size_t broadcast(const std::vector<std::shared_ptr<WebSocket>> &sockets,
+            const WebSocketMessage &message);
+
+        /**The upgrade request, with an empty body.*/
+        const Request &request()const { return upgrade_request; }
+        /**Path parameters of the route that accepted the upgrade.*/
+        const PathParams &path_params()const { return params; }
+        /**The selected subprotocol, or empty.*/
+        const std::string &protocol()const { return selected_protocol; }
+        /**True if permessage-deflate was negotiated.*/
+        bool deflate()const { return deflate_enabled; }
+
+        /**Send a text message, which must be valid UTF-8.*/
+        bool send_text(const std::string &text);
+        /**Send a binary message.*/
+        bool send_binary(const void *data, size_t len);
+        /**Send a message that was framed in advance.*/
+        bool send(const WebSocketMessage &message);
+        /**Send a ping. The payload is at most MAX_CONTROL_PAYLOAD bytes.*/
+        bool ping(const std::string &payload = std::string());
+        /**Start the close handshake. No further messages may be sent, but messages may still be
+         * received until the client responds.
+         */
+        bool close(uint16_t code = websocket::CLOSE_NORMAL, const std::string &reason = std::string());
+        /**Bytes queued to send that have not yet been taken by the connection.
+         * Can be used to stop sending to slow clients.
+         */
+        size_t buffered_amount()const;
+        /**True until a close frame is sent or the connection is lost.*/
+        bool is_open()const;
+
+        /**Connect to a server connection on its IO thread. notify is called from any thread,
+         * without locks held, whenever output is queued while there was none.
+         */
+        void attach(std::function<void()> notify);
+        /**Called by the connection once the upgrade response was sent, to call on_open.*/
+        void open();
+        /**Disconnect from the server connection, once it is closed. Further sends return false,
+         * and on_close is called if it was not already.
+         */
+        void detach();
+        /**Process received data, unmasking it in place.
+         * Frames up to capacity bytes are only processed once complete, so they can be passed to
+         * on_message without a copy. Larger frames are accumulated as they arrive.
+         * @param capacity Size of the buffer data is in, so the largest frame that would fit.
+         * @return Bytes used. Any remainder is the start of a frame, and must be passed again
+         * with more data.
+         */
+        size_t receive(uint8_t *data, size_t len, size_t capacity);
+        /**Take the next data to send. A single or large frame is returned as is, while several
+         * small frames are copied into one buffer.
+         * @return The data, or null if there is nothing to send.
+         */
+        std::shared_ptr<const std::string> take_output();
+        /**True once the close handshake completed or the connection failed, so after sending the
+         * remaining output, the connection should be closed.
+         */
+        bool wants_close()const;
+    private:
+        class Inflater;
+
+        Request upgrade_request;
+        PathParams params;
+        WebSocketHandler handler;
+        WebSocketOptions options;
+        bool deflate_enabled;
+        std::string selected_protocol;
+
+        /**Frames to send. Closed once a close frame is queued.*/
+        StreamOutput output;
+
+        // Receive state, only used on the IO thread
+        bool opened;
+        bool close_received;
+        bool close_reported;
+        bool failed;
+        /**A frame too large for the receive buffer is being accumulated into message.*/
+        bool in_frame;
+        websocket::FrameHeader frame;
+        uint64_t frame_pos;
+        /**A fragmented or compressed message is being received into message.*/
+        bool in_message;
+        websocket::Opcode message_opcode;
+        bool message_compressed;
+        std::string message;
+        /**Decompression state, kept between messages for client context takeover.*/
+        std::unique_ptr<Inflater> inflater;
+
+        /**Queue a frame, unless closed.
+         * @param closing This is a close frame, after which nothing else may be sent.
+         */
+        bool queue(std::shared_ptr<const std::string> frame, bool closing = false);
+        /**Validate a frame header, and update the message state.
+         * @throws websocket::WebSocketError
+         */
+        void check_header(const websocket::FrameHeader &header);
+        /**Handle the unmasked payload of a frame.*/
+        void frame_received(const websocket::FrameHeader &header, const uint8_t *payload, size_t len);
+        void message_received();
+        void close_received_frame(const uint8_t *payload, size_t len);
+        void deliver(websocket::Opcode opcode, const char *data, size_t len);
+        /**Send a close frame for a protocol error, and stop processing received data.*/
+        void fail(uint16_t code, const std::string &reason);
+        /**Call on_close, if not already called.*/
+        void report_close(uint16_t code, const std::string &reason);
+    };
+
+    /**Accept a WebSocket upgrade request, for use within a request handler.
+     *
+     * Validates the handshake, negotiates permessage-deflate and the subprotocol, and returns
+     * the "101 Switching Protocols" response. Once the server has sent it, the connection
+     * switches to the returned response's WebSocket. Only supported for HTTP/1.1 connections.
+     *
+     * If the request is not a WebSocket upgrade, or uses an unsupported version, a
+     * "426 Upgrade Required" response is returned instead.
+     * @throws BadRequest If the upgrade request is invalid.
+     */
+    Response websocket_upgrade(Request &request, PathParams &params, const WebSocketHandler &handler,
+        const WebSocketOptions &options = WebSocketOptions());
+}
@@ -0,0 +1,98 @@
+#pragma once
+#include <cstddef>
+#include <memory>
+#include <mutex>
+#include <vector>
+namespace http
+{
+    class BufferPool;
+    /**A buffer leased from a BufferPool, returned to the pool when destroyed or reset.*/
+    class PooledBuffer
+    {
+    public:
+        PooledBuffer() : pool(nullptr), _data(nullptr), _size(0) {}
+        PooledBuffer(PooledBuffer &&mv)
+            : pool(mv.pool), _data(mv._data), _size(mv._size)
+        {
+            mv.pool = nullptr;
+            mv._data = nullptr;
+            mv._size = 0;
+        }
+        ~PooledBuffer()
+        {
+            reset();
+        }
+        PooledBuffer& operator = (PooledBuffer &&mv)
+        {
+            if (this != &mv)
+            {
+                reset();
+                std::swap(pool, mv.pool);
+                std::swap(_data, mv._data);
+                std::swap(_size, mv._size);
+            }
+            return *this;
+        }
+        PooledBuffer(const PooledBuffer&) = delete;
+        PooledBuffer& operator = (const PooledBuffer&) = delete;
+
+        explicit operator bool()const { return _data != nullptr; }
+        char *data() { return _data; }
+        const char *data()const { return _data; }
+        size_t size()const { return _size; }
+        /**Return the buffer to the pool.*/
+        void reset();
+    private:
+        friend class BufferPool;
+        PooledBuffer(BufferPool *pool, char *data, size_t size)
+            : pool(pool), _data(data), _size(size)
+        {}
+
+        BufferPool *pool;
+        char *_data;
+        size_t _size;
+    };
+
+    /**Pool of byte buffers in power of two size classes, so connections only need to hold a
+     * buffer while actually reading, and can grow it on demand.
+     *
+     * Up to max_free buffers of each class up to max_pooled_size are kept for reuse. Larger
+     * buffers are allocated and freed directly.
+     *
+     * Thread safe. The pool must outlive all its buffers.
+     */
+    class BufferPool
+    {
+    public:
+        /**Smallest size class.*/
+        static const size_t MIN_SIZE = 4096;
+
+        explicit BufferPool(size_t max_pooled_size = 65536, size_t max_free = 256);
+        ~BufferPool();
+        BufferPool(const BufferPool&) = delete;
+        BufferPool& operator = (const BufferPool&) = delete;
+
+        /**Lease a buffer of at least size bytes.*/
+        PooledBuffer get(size_t size);
+        /**Lease a larger buffer containing the first len bytes of buffer, and release buffer.*/
+        PooledBuffer grow(PooledBuffer &&buffer, size_t size, size_t len);
+        /**Number of buffers currently leased.*/
+        size_t in_use()const;
+        /**Bytes held by free buffers waiting for reuse.*/
+        size_t free_bytes()const;
+        /**Size of the buffer that get would return.*/
+        static size_t size_class(size_t size);
+    private:
+        friend class PooledBuffer;
+
+        size_t max_pooled_size;
+        size_t max_free;
+        mutable std::mutex mutex;
+        /**Free buffers for each size class, from MIN_SIZE.*/
+        std::vector<std::vector<char*>> free_buffers;
+        size_t leased;
+
+        void put(char *data, size_t size);
+        static size_t class_index(size_t size);
+    };
+}
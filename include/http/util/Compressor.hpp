@@ -0,0 +1,58 @@
+#pragma once
+#include <cstddef>
+#include <memory>
+#include <stdexcept>
+#include <string>
+namespace http
+{
+    /**Errors from a compression library.*/
+    class CompressionError : public std::runtime_error
+    {
+    public:
+        explicit CompressionError(const std::string &msg)
+            : std::runtime_error(msg)
+        {}
+    };
+
+    /**Incremental compression of a byte stream for a HTTP content coding.
+     *
+     * "gzip" and "deflate" (zlib format, RFC7230 4.2.2) use zlib. "br" uses the brotli encoder
+     * if built with HTTP_USE_BROTLI.
+     *
+     * Input may be provided in any number of pieces, so large bodies can be compressed without
+     * holding the entire input in memory.
+     */
+    class Compressor
+    {
+    public:
+        /**Use the default compression level for the coding.*/
+        static const int DEFAULT_LEVEL = -1;
+
+        /**True if the content coding is supported.*/
+        static bool supported(const std::string &coding);
+        /**Compress an entire buffer.*/
+        static std::string compress(const std::string &coding, const void *data, size_t len,
+            int level = DEFAULT_LEVEL);
+
+        /**Start a new compressed stream.
+         * @param coding The content coding, e.g. "gzip".
+         * @param level Coding specific compression level. 1 to 9 for gzip and deflate, and 0 to
+         * 11 for br.
+         * @throws std::invalid_argument If the coding is not supported.
+         */
+        explicit Compressor(const std::string &coding, int level = DEFAULT_LEVEL);
+        ~Compressor();
+        Compressor(const Compressor&) = delete;
+        Compressor& operator = (const Compressor&) = delete;
+        Compressor(Compressor &&mv);
+        Compressor& operator = (Compressor &&mv);
+
+        /**Compress more input, appending any available output to out.*/
+        void write(const void *data, size_t len, std::string *out);
+        /**Complete the stream, appending the remaining output to out.*/
+        void finish(std::string *out);
+    private:
+        class Impl;
+        std::unique_ptr<Impl> impl;
+    };
+}
@@ -0,0 +1,194 @@
+#pragma once
+#ifdef HTTP_USE_COROUTINES
+#include <coroutine>
+#include <cstddef>
+#include <cstdint>
+#include <exception>
+#include <optional>
+#include <utility>
+namespace http
+{
+    /**Allocates coroutine frames from free lists shared by all threads, in GRANULARITY size
+     * classes up to MAX_POOLED_SIZE. Coroutine route handlers start on a handler thread and
+     * often finish on an IO thread, so frames freed by one thread are reused by any other.
+     * Taking and returning a frame is lock-free, and once a few coroutines have run, starting
+     * more does not use the global allocator.
+     */
+    class FrameAllocator
+    {
+    public:
+        static const size_t GRANULARITY = 64;
+        static const size_t MAX_POOLED_SIZE = 4096;
+        /**Most free frames kept for each size class.*/
+        static const size_t MAX_FREE = 64;
+
+        static void *allocate(size_t size);
+        static void deallocate(void *frame, size_t size)noexcept;
+        /**Number of free frames in the pool.*/
+        static size_t free_frames();
+        /**Number of poolable frames allocated from the global allocator, because the pool had
+         * none of their size class.
+         */
+        static uint64_t allocated_frames();
+    };
+
+    template<class T> class Task;
+    namespace detail
+    {
+        struct TaskPromiseBase
+        {
+            /**The coroutine awaiting this task, resumed once it completes.*/
+            std::coroutine_handle<> continuation;
+            std::exception_ptr error;
+
+            static void *operator new(size_t size)
+            {
+                return FrameAllocator::allocate(size);
+            }
+            static void operator delete(void *frame, size_t size)noexcept
+            {
+                FrameAllocator::deallocate(frame, size);
+            }
+
+            struct FinalAwaiter
+            {
+                bool await_ready()const noexcept { return false; }
+                template<class Promise>
+                std::coroutine_handle<> await_suspend(std::coroutine_handle<Promise> handle)noexcept
+                {
+                    // Resume the awaiter directly, without growing the stack
+                    auto next = handle.promise().continuation;
+                    return next ? next : std::noop_coroutine();
+                }
+                void await_resume()const noexcept {}
+            };
+            std::suspend_always initial_suspend()const noexcept { return {}; }
+            FinalAwaiter final_suspend()const noexcept { return {}; }
+            void unhandled_exception()noexcept { error = std::current_exception(); }
+        };
+        template<class T> struct TaskPromise : TaskPromiseBase
+        {
+            std::optional<T> value;
+
+            Task<T> get_return_object();
+            template<class U> void return_value(U &&result)
+            {
+                value.emplace(std::forward<U>(result));
+            }
+            T result()
+            {
+                if (error) std::rethrow_exception(error);
+                return std::move(*value);
+            }
+        };
+        template<> struct TaskPromise<void> : TaskPromiseBase
+        {
+            Task<void> get_return_object();
+            void return_void()const noexcept {}
+            void result()
+            {
+                if (error) std::rethrow_exception(error);
+            }
+        };
+    }
+
+    /**A coroutine returning T, which starts when awaited.
+     *
+     * Frames are allocated by FrameAllocator. Exceptions are rethrown to the awaiting coroutine.
+     */
+    template<class T> class Task
+    {
+    public:
+        typedef detail::TaskPromise<T> promise_type;
+
+        Task() : handle() {}
+        Task(Task &&mv)noexcept : handle(std::exchange(mv.handle, nullptr)) {}
+        Task& operator = (Task &&mv)noexcept
+        {
+            if (this != &mv)
+            {
+                if (handle) handle.destroy();
+                handle = std::exchange(mv.handle, nullptr);
+            }
+            return *this;
+        }
+        Task(const Task&) = delete;
+        Task& operator = (const Task&) = delete;
+        ~Task()
+        {
+            if (handle) handle.destroy();
+        }
+
+        explicit operator bool()const { return (bool)handle; }
+
+        class Awaiter
+        {
+        public:
+            explicit Awaiter(std::coroutine_handle<promise_type> handle) : handle(handle) {}
+            bool await_ready()const noexcept { return handle.done(); }
+            std::coroutine_handle<> await_suspend(std::coroutine_handle<> awaiting)noexcept
+            {
+                handle.promise().continuation = awaiting;
+                return handle;
+            }
+            T await_resume() { return handle.promise().result(); }
+        private:
+            std::coroutine_handle<promise_type> handle;
+        };
+        /**Run the task, and wait for its result. The task must still be owned while awaiting.*/
+        Awaiter operator co_await()const& noexcept { return Awaiter(handle); }
+        Awaiter operator co_await()const&& noexcept { return Awaiter(handle); }
+    private:
+        friend struct detail::TaskPromise<T>;
+        explicit Task(std::coroutine_handle<promise_type> handle) : handle(handle) {}
+
+        std::coroutine_handle<promise_type> handle;
+    };
+
+    namespace detail
+    {
+        template<class T> Task<T> TaskPromise<T>::get_return_object()
+        {
+            return Task<T>(std::coroutine_handle<TaskPromise<T>>::from_promise(*this));
+        }
+        inline Task<void> TaskPromise<void>::get_return_object()
+        {
+            return Task<void>(std::coroutine_handle<TaskPromise<void>>::from_promise(*this));
+        }
+
+        /**A coroutine that starts immediately, and destroys itself when complete.*/
+        struct DetachedTask
+        {
+            struct promise_type
+            {
+                static void *operator new(size_t size)
+                {
+                    return FrameAllocator::allocate(size);
+                }
+                static void operator delete(void *frame, size_t size)noexcept
+                {
+                    FrameAllocator::deallocate(frame, size);
+                }
+                DetachedTask get_return_object()const noexcept { return {}; }
+                std::suspend_never initial_suspend()const noexcept { return {}; }
+                std::suspend_never final_suspend()const noexcept { return {}; }
+                void return_void()const noexcept {}
+                void unhandled_exception()const noexcept { std::terminate(); }
+            };
+        };
+        inline DetachedTask run_detached(Task<void> task)
+        {
+            co_await task;
+        }
+    }
+
+    /**Start a task without waiting for it. It runs on the calling thread until it first
+     * suspends, and is destroyed once complete.
+     * As with std::thread, if the task throws, std::terminate is called.
+     */
+    inline void spawn(Task<void> task)
+    {
+        detail::run_detached(std::move(task));
+    }
+}
+#endif
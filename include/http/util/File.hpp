@@ -0,0 +1,96 @@
+#pragma once
+#include "../net/Os.hpp"
+#include <cstdint>
+#include <ctime>
+#include <stdexcept>
+#include <string>
+namespace http
+{
+#ifdef _WIN32
+    typedef HANDLE FileHandle;
+    static const FileHandle INVALID_FILE = INVALID_HANDLE_VALUE;
+#else
+    typedef int FileHandle;
+    static const FileHandle INVALID_FILE = -1;
+#endif
+
+    /**Errors opening or reading a file.*/
+    class FileError : public std::runtime_error
+    {
+    public:
+        explicit FileError(const std::string &msg)
+            : std::runtime_error(msg)
+        {}
+        FileError(const std::string &path, const std::string &msg)
+            : std::runtime_error(msg + ": " + path)
+        {}
+    };
+
+    /**Size and modification time of a file.*/
+    struct FileInfo
+    {
+        uint64_t size;
+        /**Last modified time in UTC.*/
+        time_t mtime;
+
+        bool operator == (const FileInfo &other)const
+        {
+            return size == other.size && mtime == other.mtime;
+        }
+        bool operator != (const FileInfo &other)const { return !(*this == other); }
+    };
+
+    /**A regular file opened for reading.
+     * Reads take an explicit offset, so a single File may be read by multiple threads at once.
+     */
+    class File
+    {
+    public:
+        /**Gets the info for a regular file without opening it.
+         * @return false if the path does not exist or is not a regular file.
+         */
+        static bool stat(const std::string &path, FileInfo *info);
+        /**Reads up to len bytes starting at offset from an open file handle.
+         * Works like POSIX `pread`.
+         * @return The number of bytes read, or 0 at the end of the file.
+         */
+        static size_t read(FileHandle handle, void *buffer, size_t len, uint64_t offset);
+
+        File();
+        /**Open an existing regular file for reading.
+         * @throws FileError if the file can not be opened, or is not a regular file.
+         */
+        explicit File(const std::string &path);
+        ~File();
+
+        File(const File&) = delete;
+        File& operator = (const File&) = delete;
+
+        File(File &&mv);
+        File& operator = (File &&mv);
+
+        explicit operator bool()const { return is_open(); }
+        bool is_open()const;
+        void close();
+
+        /**Get the underlying OS file handle.*/
+        FileHandle get()const { return handle; }
+        /**The path the file was opened with.*/
+        const std::string &path()const { return _path; }
+        /**The size and modification time when the file was opened.*/
+        const FileInfo &info()const { return _info; }
+        uint64_t size()const { return _info.size; }
+
+        /**Reads up to len bytes starting at offset. Works like POSIX `pread`.
+         * @return The number of bytes read, or 0 at the end of the file.
+         */
+        size_t read(void *buffer, size_t len, uint64_t offset)const
+        {
+            return read(handle, buffer, len, offset);
+        }
+    private:
+        FileHandle handle;
+        std::string _path;
+        FileInfo _info;
+    };
+}
@@ -0,0 +1,60 @@
+#pragma once
+#include "Metrics.hpp"
+#include <cstdint>
+#include <vector>
+namespace http
+{
+    /**Records latencies for reporting percentiles, in the manner of HdrHistogram.
+     *
+     * Values are counted in the log-linear HistogramBuckets, so each recorded value is kept to a
+     * fixed relative precision (1/1024, about 3 significant digits, by default) over the whole
+     * range, with constant time recording and no allocation after construction. The exact
+     * minimum, maximum and mean are also kept.
+     *
+     * Not thread safe. Each thread should record into its own histogram, and merge them.
+     */
+    class LatencyHistogram
+    {
+    public:
+        /**Default range, in nanoseconds up to about 18 minutes.*/
+        static const int DEFAULT_MAX_POWER = 40;
+        static const int DEFAULT_SUB_BUCKET_BITS = 10;
+
+        /**@param max_power Largest value that can be recorded is 2^max_power - 1. Larger values
+         * are recorded as that value, and counted by saturated.
+         * @param sub_bucket_bits Log2 of the number of buckets for each power of two, setting the
+         * precision.
+         */
+        explicit LatencyHistogram(int max_power = DEFAULT_MAX_POWER,
+            int sub_bucket_bits = DEFAULT_SUB_BUCKET_BITS);
+
+        void record(uint64_t value);
+        /**Add the values recorded by another histogram with the same layout.
+         * @throws std::invalid_argument If the layouts differ.
+         */
+        void merge(const LatencyHistogram &other);
+        void reset();
+
+        uint64_t count()const { return total; }
+        /**Smallest value recorded, or 0 if empty.*/
+        uint64_t min()const { return total ? min_value : 0; }
+        /**Largest value recorded, or 0 if empty.*/
+        uint64_t max()const { return max_value; }
+        double mean()const { return total ? (double)sum / (double)total : 0; }
+        /**Number of values larger than could be recorded.*/
+        uint64_t saturated()const { return saturated_count; }
+        /**Value that percentile percent of the recorded values are less than or equal to, to
+         * the precision of the buckets. e.g. 99.9 for the 99.9th percentile.
+         * @return The largest value in the bucket, limited to max(), or 0 if empty.
+         */
+        uint64_t percentile(double percent)const;
+    private:
+        HistogramBuckets buckets;
+        std::vector<uint64_t> counts;
+        uint64_t total;
+        uint64_t sum;
+        uint64_t min_value;
+        uint64_t max_value;
+        uint64_t saturated_count;
+    };
+}
@@ -0,0 +1,277 @@
+#pragma once
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <utility>
+#include <vector>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+namespace http
+{
+    class Metrics;
+    /**Label names and values for a metric series, e.g. {{"code", "2xx"}}.*/
+    typedef std::vector<std::pair<std::string, std::string>> MetricLabels;
+
+    /**Bucket layout for a log-linear histogram of integer values.
+     *
+     * Each power of two range is split into 2^sub_bucket_bits linear buckets, so the relative
+     * error of any bucket is at most 2^-sub_bucket_bits. Values below 2^sub_bucket_bits each have
+     * their own bucket, and values of 2^max_power or more are only counted by the +Inf bucket.
+     */
+    struct HistogramBuckets
+    {
+        /**@param max_power Values up to 2^max_power - 1 have a finite bucket.
+         * @param sub_bucket_bits Log2 of the number of buckets for each power of two.
+         * @param scale Multiplier to convert values to the exported unit, e.g. 1e-6 to export
+         * microseconds as seconds.
+         */
+        explicit HistogramBuckets(int max_power = 32, int sub_bucket_bits = 2, double scale = 1)
+            : max_power(max_power), sub_bucket_bits(sub_bucket_bits), scale(scale)
+        {}
+        int max_power;
+        int sub_bucket_bits;
+        double scale;
+
+        /**Number of finite buckets.*/
+        size_t count()const
+        {
+            return (size_t)(max_power - sub_bucket_bits + 1) << sub_bucket_bits;
+        }
+        /**Bucket for a value, or count() if it has no finite bucket.*/
+        size_t index(uint64_t value)const
+        {
+            auto sub_count = (uint64_t)1 << sub_bucket_bits;
+            if (value < sub_count) return (size_t)value;
+            if (max_power < 64 && value >> max_power) return count();
+            auto power = floor_log2(value);
+            auto shift = power - sub_bucket_bits;
+            return (size_t)(((uint64_t)(shift + 1) << sub_bucket_bits) + (value >> shift) - sub_count);
+        }
+        /**Largest value in a bucket.*/
+        uint64_t upper_bound(size_t index)const;
+
+        static int floor_log2(uint64_t value)
+        {
+#if defined(_MSC_VER) && defined(_WIN64)
+            unsigned long bit;
+            _BitScanReverse64(&bit, value);
+            return (int)bit;
+#elif defined(_MSC_VER)
+            unsigned long bit;
+            if (_BitScanReverse(&bit, (unsigned long)(value >> 32))) return (int)bit + 32;
+            _BitScanReverse(&bit, (unsigned long)value);
+            return (int)bit;
+#else
+            return 63 - __builtin_clzll(value);
+#endif
+        }
+    };
+
+    /**A monotonically increasing counter. A default constructed Counter does nothing.*/
+    class Counter
+    {
+    public:
+        Counter() : metrics(nullptr), slot(0) {}
+        void inc(uint64_t n = 1)const;
+    private:
+        friend class Metrics;
+        Metrics *metrics;
+        size_t slot;
+    };
+    /**A value that may go up and down, such as a number of open connections.
+     * Only changes are recorded, so that updates from many threads can be summed.
+     * A default constructed Gauge does nothing.
+     */
+    class Gauge
+    {
+    public:
+        Gauge() : metrics(nullptr), slot(0) {}
+        void add(int64_t n)const;
+        void inc()const { add(1); }
+        void dec()const { add(-1); }
+    private:
+        friend class Metrics;
+        Metrics *metrics;
+        size_t slot;
+    };
+    /**A log-linear histogram. A default constructed Histogram does nothing.*/
+    class Histogram
+    {
+    public:
+        Histogram() : metrics(nullptr), slot(0) {}
+        /**Record a value, in the unit before HistogramBuckets::scale is applied.*/
+        void observe(uint64_t value)const;
+    private:
+        friend class Metrics;
+        Metrics *metrics;
+        /**First bucket, followed by the other finite buckets, the +Inf bucket and the sum.*/
+        size_t slot;
+        HistogramBuckets buckets;
+    };
+
+    /**The values of every series in a Metrics registry, keyed by metric name and labels
+     * rather than by where the registry stores them. So snapshots of registries in different
+     * processes, which may have created their series in a different order, can be added
+     * together and rendered as one.
+     */
+    class MetricsSnapshot
+    {
+    public:
+        enum Type { COUNTER, GAUGE, HISTOGRAM };
+
+        /**Add the values of other. Series are matched by name and labels, and series only in
+         * other are added.
+         * @throws std::invalid_argument If a metric has a different type or buckets in each.
+         */
+        void add(const MetricsSnapshot &other);
+        /**Render in the Prometheus text format.*/
+        std::string render()const;
+        /**Encode, to pass to another process on the same machine.*/
+        std::string serialize()const;
+        /**Decode the output of serialize.
+         * @throws std::invalid_argument If data is not a valid snapshot.
+         */
+        static MetricsSnapshot parse(const std::string &data);
+    private:
+        friend class Metrics;
+        struct Series
+        {
+            MetricLabels labels;
+            /**One value, or for a histogram each finite bucket, +Inf and the sum.*/
+            std::vector<uint64_t> values;
+        };
+        struct Family
+        {
+            std::string name;
+            std::string help;
+            Type type;
+            HistogramBuckets buckets;
+            std::vector<Series> series;
+        };
+        std::vector<Family> families;
+    };
+
+    /**A registry of metrics, rendered in the Prometheus text exposition format.
+     *
+     * Values are spread over SHARD_COUNT shards, which are summed when rendered. Each thread is
+     * assigned a shard round robin on its first update, without a lock, so threads started for
+     * each request are as cheap as long lived ones. Updates are a single relaxed atomic add to
+     * the thread's shard. Shards are allocated on first use, so few threads use few shards.
+     *
+     * Registering metrics and rendering are thread safe. The Metrics must outlive any updates
+     * through the returned Counter, Gauge and Histogram objects.
+     */
+    class Metrics
+    {
+    public:
+        /**Default maximum number of values, where each histogram uses a value per bucket.*/
+        static const size_t DEFAULT_MAX_VALUES = 4096;
+        /**Number of shards that threads are spread over.*/
+        static const size_t SHARD_COUNT = 16;
+        /**Content-Type of the output of render.*/
+        static const char CONTENT_TYPE[];
+
+        /**@param max_values Maximum number of values, which sets the size of each shard.*/
+        explicit Metrics(size_t max_values = DEFAULT_MAX_VALUES);
+        ~Metrics();
+        Metrics(const Metrics&) = delete;
+        Metrics& operator = (const Metrics&) = delete;
+
+        /**Get or create a counter series.
+         * Series with the same name are rendered as one metric, and must have the same type
+         * and label names.
+         * @throws std::invalid_argument If the name or labels are not valid, or the name is used
+         * by a different type.
+         * @throws std::length_error If max_values would be exceeded.
+         */
+        Counter counter(const std::string &name, const std::string &help,
+            const MetricLabels &labels = MetricLabels());
+        /**Get or create a gauge series. See counter.*/
+        Gauge gauge(const std::string &name, const std::string &help,
+            const MetricLabels &labels = MetricLabels());
+        /**Get or create a histogram series. See counter.
+         * Series with the same name must also have the same buckets.
+         */
+        Histogram histogram(const std::string &name, const std::string &help,
+            const HistogramBuckets &buckets, const MetricLabels &labels = MetricLabels());
+
+        /**Render all metrics in the Prometheus text format.*/
+        std::string render()const;
+        /**Get the current values of all metrics.*/
+        MetricsSnapshot snapshot()const;
+    private:
+        friend class Counter;
+        friend class Gauge;
+        friend class Histogram;
+        typedef MetricsSnapshot::Type Type;
+        struct Series
+        {
+            MetricLabels labels;
+            size_t slot;
+        };
+        struct Family
+        {
+            std::string name;
+            std::string help;
+            Type type;
+            HistogramBuckets buckets;
+            std::vector<Series> series;
+        };
+        /**Values written by the threads assigned to the shard.*/
+        struct Shard
+        {
+            explicit Shard(size_t size);
+            std::unique_ptr<std::atomic<uint64_t>[]> values;
+        };
+
+        const size_t max_values;
+        /**Null until a thread assigned to the shard first updates a value.*/
+        std::atomic<Shard*> shards[SHARD_COUNT];
+        /**Protects everything below.*/
+        mutable std::mutex mutex;
+        size_t used_values;
+        std::vector<Family> families;
+
+        /**Find or create a series, returning its first slot.*/
+        size_t add_series(const std::string &name, const std::string &help, Type type,
+            const HistogramBuckets &buckets, const MetricLabels &labels);
+        void add(size_t slot, uint64_t n)
+        {
+            auto &shard = shards[thread_shard()];
+            auto p = shard.load(std::memory_order_acquire);
+            if (!p) p = create_shard(shard);
+            p->values[slot].fetch_add(n, std::memory_order_relaxed);
+        }
+        /**Index of the calling thread's shard.*/
+        static size_t thread_shard()
+        {
+            static std::atomic<size_t> next(0);
+            static thread_local size_t index = next.fetch_add(1, std::memory_order_relaxed) % SHARD_COUNT;
+            return index;
+        }
+        /**Allocate a shard, unless another thread already did.*/
+        Shard *create_shard(std::atomic<Shard*> &shard);
+        /**The allocated shards.*/
+        std::vector<Shard*> all_shards()const;
+        /**Sum of a value over all shards.*/
+        static uint64_t sum(const std::vector<Shard*> &all, size_t slot);
+    };
+
+    inline void Counter::inc(uint64_t n)const
+    {
+        if (metrics) metrics->add(slot, n);
+    }
+    inline void Gauge::add(int64_t n)const
+    {
+        if (metrics) metrics->add(slot, (uint64_t)n);
+    }
+    inline void Histogram::observe(uint64_t value)const
+    {
+        if (!metrics) return;
+        metrics->add(slot + buckets.index(value), 1);
+        metrics->add(slot + buckets.count() + 1, value);
+    }
+}
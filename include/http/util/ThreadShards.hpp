@@ -0,0 +1,132 @@
+#pragma once
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <utility>
+#include <vector>
+namespace http
+{
+    /**A set of T objects, each used by one thread at a time.
+     *
+     * Each thread gets its own object on the first call to local(). When the thread exits the
+     * object is released, with release ordering, for reuse by the next new thread. So the number
+     * of objects is limited by the number of threads running at once, even when threads are
+     * short lived.
+     *
+     * Objects are destroyed with the ThreadShards. Threads that used it drop their references
+     * when they next look up an object not yet used by that thread.
+     *
+     * The first call on each thread takes a lock and searches the objects, so this suits
+     * threads that make many calls, such as IO threads. For values updated by short lived
+     * threads, like Metrics, a fixed set of shared shards avoids the lock.
+     */
+    template<typename T> class ThreadShards
+    {
+    public:
+        typedef std::function<std::unique_ptr<T>()> Factory;
+
+        /**@param create Creates each new object.*/
+        explicit ThreadShards(Factory create)
+            : id(next_id()), create(create)
+        {}
+        ThreadShards(const ThreadShards&) = delete;
+        ThreadShards& operator = (const ThreadShards&) = delete;
+
+        /**Get the calling threads object.
+         * Only the first call on a thread takes a lock, later calls are wait-free.
+         */
+        T &local()
+        {
+            static thread_local Owned owned;
+            if (owned.last_id == id) return *owned.last->value;
+            for (auto i = owned.shards.begin(); i != owned.shards.end();)
+            {
+                if (i->first == id)
+                {
+                    // Still held by this ThreadShards, since it is being used
+                    owned.last_id = id;
+                    owned.last = i->second.lock().get();
+                    return *owned.last->value;
+                }
+                // Drop shards of destroyed ThreadShards
+                if (i->second.expired()) i = owned.shards.erase(i);
+                else ++i;
+            }
+
+            std::shared_ptr<Shard> shard;
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                for (auto &i : shards)
+                {
+                    bool expected = false;
+                    if (i->in_use.compare_exchange_strong(expected, true, std::memory_order_acquire))
+                    {
+                        shard = i;
+                        break;
+                    }
+                }
+                if (!shard)
+                {
+                    // Not make_shared, so the object is freed even while a weak_ptr remains
+                    shard.reset(new Shard());
+                    shard->value = create();
+                    shard->in_use.store(true, std::memory_order_relaxed);
+                    shards.push_back(shard);
+                }
+            }
+            owned.shards.emplace_back(id, shard);
+            owned.last_id = id;
+            owned.last = shard.get();
+            return *shard->value;
+        }
+        /**Get all the objects, including those owned by other threads.
+         * The pointers remain valid for the life of the ThreadShards.
+         */
+        std::vector<T*> all()const
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            std::vector<T*> ret;
+            ret.reserve(shards.size());
+            for (auto &shard : shards) ret.push_back(shard->value.get());
+            return ret;
+        }
+    private:
+        struct Shard
+        {
+            std::unique_ptr<T> value;
+            std::atomic<bool> in_use;
+        };
+        /**The shards owned by a thread, released when the thread exits.*/
+        struct Owned
+        {
+            Owned() : last_id(0), last(nullptr) {}
+            ~Owned()
+            {
+                for (auto &i : shards)
+                {
+                    auto shard = i.second.lock();
+                    if (shard) shard->in_use.store(false, std::memory_order_release);
+                }
+            }
+            /**Most recently used shard, to avoid searching shards.*/
+            uint64_t last_id;
+            Shard *last;
+            /**ThreadShards::id and shard, which expires when the ThreadShards is destroyed.*/
+            std::vector<std::pair<uint64_t, std::weak_ptr<Shard>>> shards;
+        };
+
+        /**Unique for each ThreadShards, to find the threads shard.*/
+        const uint64_t id;
+        Factory create;
+        mutable std::mutex mutex;
+        std::vector<std::shared_ptr<Shard>> shards;
+
+        static uint64_t next_id()
+        {
+            static std::atomic<uint64_t> next(1);
+            return next++;
+        }
+    };
+}
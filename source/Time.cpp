@@ -1,20 +1,146 @@
 #include "Time.hpp"
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <cstring>
 #include <sstream>
 #include <stdexcept>
 
 namespace http
 {
+    namespace
+    {
+        const char DAY_NAMES[7][4] = { "Sun", "Mon", "Tue", "Wed", "Thu", "Fri", "Sat" };
+        const char MONTH_NAMES[12][4] = {
+            "Jan", "Feb", "Mar", "Apr", "May", "Jun", "Jul", "Aug", "Sep", "Oct", "Nov", "Dec" };
+
+        /**Number of formatted values kept by the current time cache.
+         * Slots are written in rotation, so a reader copying one is only overwritten if it stalls
+         * for several seconds.
+         */
+        const unsigned CURRENT_TIME_SLOTS = 8;
+        const unsigned CURRENT_TIME_WORDS = (TIME_STR_LEN + 7) / 8;
+        /**A formatted value in the current time cache.
+         * The string is stored as atomic words, and time works as a sequence lock. It is -1
+         * while the slot is rewritten, so a reader can tell if its copy may be torn.
+         */
+        struct CurrentTimeSlot
+        {
+            std::atomic<time_t> time;
+            std::atomic<uint64_t> words[CURRENT_TIME_WORDS];
+        };
+        std::atomic<time_t> current_time_value(-1);
+        std::atomic<unsigned> current_time_slot(0);
+        std::atomic_flag current_time_updating = ATOMIC_FLAG_INIT;
+        CurrentTimeSlot current_time_slots[CURRENT_TIME_SLOTS];
+
+        char *write_2digit(char *p, unsigned val)
+        {
+            *p++ = (char)('0' + val / 10);
+            *p++ = (char)('0' + val % 10);
+            return p;
+        }
+        char *write_3chars(char *p, const char *str)
+        {
+            *p++ = str[0];
+            *p++ = str[1];
+            *p++ = str[2];
+            return p;
+        }
+    }
+
     std::string format_time(time_t utc)
     {
-        char buffer[sizeof("DDD, DD MMM YYYY HH:MM:SS GMT")];
-        tm tm;
-#ifdef _MSC_VER
-        gmtime_s(&tm, &utc);
-#else
-        gmtime_r(&utc, &tm);
-#endif
-        size_t len = strftime(buffer, sizeof(buffer), "%a, %d %b %Y %H:%M:%S GMT", &tm);
-        return {buffer, len};
+        char buffer[TIME_STR_LEN];
+        return {buffer, format_time(utc, buffer)};
+    }
+
+    char *format_time(time_t utc, char *buffer)
+    {
+        //Sun, 06 Nov 1994 08:49:37 GMT
+        // Split into days since the epoch and seconds of the day, rounding towards -infinity
+        long long days = (long long)utc / 86400;
+        long long secs = (long long)utc % 86400;
+        if (secs < 0)
+        {
+            secs += 86400;
+            --days;
+        }
+        // Convert days to a Gregorian calendar date.
+        // See "chrono-Compatible Low-Level Date Algorithms", civil_from_days.
+        long long z = days + 719468;
+        long long era = (z >= 0 ? z : z - 146096) / 146097;
+        auto doe = (unsigned)(z - era * 146097);
+        auto yoe = (doe - doe / 1460 + doe / 36524 - doe / 146096) / 365;
+        auto doy = doe - (365 * yoe + yoe / 4 - yoe / 100);
+        auto mp = (5 * doy + 2) / 153;
+        auto mday = doy - (153 * mp + 2) / 5 + 1;
+        auto month = mp < 10 ? mp + 2 : mp - 10;
+        long long year = (long long)yoe + era * 400 + (month < 2 ? 1 : 0);
+        if (year < 0 || year > 9999)
+            throw std::invalid_argument("HTTP time year out of range: " + std::to_string(year));
+        auto wday = (unsigned)(((days + 4) % 7 + 7) % 7);
+
+        auto p = buffer;
+        p = write_3chars(p, DAY_NAMES[wday]);
+        *p++ = ',';
+        *p++ = ' ';
+        p = write_2digit(p, mday);
+        *p++ = ' ';
+        p = write_3chars(p, MONTH_NAMES[month]);
+        *p++ = ' ';
+        p = write_2digit(p, (unsigned)(year / 100));
+        p = write_2digit(p, (unsigned)(year % 100));
+        *p++ = ' ';
+        p = write_2digit(p, (unsigned)(secs / 3600));
+        *p++ = ':';
+        p = write_2digit(p, (unsigned)(secs / 60 % 60));
+        *p++ = ':';
+        p = write_2digit(p, (unsigned)(secs % 60));
+        p = write_3chars(p, " GM");
+        *p++ = 'T';
+        return p;
+    }
+
+    char *format_current_time(char *buffer)
+    {
+        auto now = time(nullptr);
+        if (now != current_time_value.load(std::memory_order_acquire))
+        {
+            // Only one thread regenerates the value, any others just format their own copy
+            if (current_time_updating.test_and_set(std::memory_order_acquire))
+                return format_time(now, buffer);
+            if (now != current_time_value.load(std::memory_order_relaxed))
+            {
+                auto next = (current_time_slot.load(std::memory_order_relaxed) + 1) % CURRENT_TIME_SLOTS;
+                auto &slot = current_time_slots[next];
+                char str[CURRENT_TIME_WORDS * 8] = {};
+                format_time(now, str);
+                slot.time.store(-1, std::memory_order_relaxed);
+                std::atomic_thread_fence(std::memory_order_release);
+                for (unsigned i = 0; i < CURRENT_TIME_WORDS; ++i)
+                {
+                    uint64_t word;
+                    memcpy(&word, str + i * 8, 8);
+                    slot.words[i].store(word, std::memory_order_relaxed);
+                }
+                slot.time.store(now, std::memory_order_release);
+                current_time_slot.store(next, std::memory_order_release);
+                current_time_value.store(now, std::memory_order_release);
+            }
+            current_time_updating.clear(std::memory_order_release);
+        }
+        auto &slot = current_time_slots[current_time_slot.load(std::memory_order_acquire)];
+        auto slot_time = slot.time.load(std::memory_order_acquire);
+        uint64_t words[CURRENT_TIME_WORDS];
+        for (unsigned i = 0; i < CURRENT_TIME_WORDS; ++i)
+            words[i] = slot.words[i].load(std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_acquire);
+        // The slot was rewritten during the copy, after this thread stalled for several seconds
+        if (slot_time == -1 || slot.time.load(std::memory_order_relaxed) != slot_time)
+            return format_time(now, buffer);
+        memcpy(buffer, words, TIME_STR_LEN);
+        return buffer + TIME_STR_LEN;
     }
 
     namespace
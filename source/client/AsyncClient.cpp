@@ -3,12 +3,27 @@
 #include "net/Net.hpp"
 #include "net/Socket.hpp"
 #include "util/Thread.hpp"
+#include <algorithm>
 #include <cassert>
 #include <iostream>
 namespace http
 {
+    namespace
+    {
+        /**Call and clear request->detail.on_done, once the client is finished with request.*/
+        void request_done(AsyncRequest *request)
+        {
+            if (!request->detail.on_done) return;
+            auto done = std::move(request->detail.on_done);
+            request->detail.on_done = nullptr;
+            done();
+        }
+    }
+
     AsyncRequest::~AsyncRequest()
     {
+        // Whatever was waiting for this request is being destroyed with it
+        detail.on_done = nullptr;
         if (auto client = detail.client.load())
         {
             //TODO: Ensure client can not get invalidated while still in this block
@@ -47,17 +62,15 @@ namespace http
 
     void AsyncClient::abort(AsyncRequest *request)
     {
-        Lock lock(mutex);
-        for (auto it = request_queue.begin(); it != request_queue.end(); ++it)
         {
-            if (*it == request)
-            {
-                request_queue.erase(it);
-                request->detail.promise.set_value(nullptr);
-                request->detail.client = nullptr;
-                return;
-            }
+            Lock lock(mutex);
+            auto it = std::find(request_queue.begin(), request_queue.end(), request);
+            if (it == request_queue.end()) return;
+            request_queue.erase(it);
+            request->detail.promise.set_value(nullptr);
+            request->detail.client = nullptr;
         }
+        request_done(request);
     }
 
     void AsyncClient::start()
@@ -82,6 +95,7 @@ namespace http
             thread.wait_for_exit();
         }
         threads.clear();
+        std::deque<AsyncRequest*> aborted;
         {
             Lock lock(mutex);
             for (auto &req : request_queue)
@@ -89,8 +103,9 @@ namespace http
                 req->detail.promise.set_value(nullptr);
                 req->detail.client = nullptr;
             }
-            request_queue.clear();
+            aborted.swap(request_queue);
         }
+        for (auto req : aborted) request_done(req);
     }
 
     void AsyncClient::rate_limit_wait()
@@ -221,8 +236,16 @@ namespace http
             }
             request->detail.promise.set_exception(std::current_exception());
         }
+        request_done(request);
     }
 
+#ifdef HTTP_USE_COROUTINES
+    void AsyncRequestAwaiter::await_suspend(std::coroutine_handle<> awaiting)
+    {
+        request.detail.on_done = [awaiting]() { awaiting.resume(); };
+        client.queue(&request);
+    }
+#endif
 
     void AsyncClient::Thread::wait_for_exit()
     {
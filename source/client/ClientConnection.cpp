@@ -27,7 +27,6 @@ namespace http
     {
         assert(socket);
         request.headers.set_default("Connection", "keep-alive");
-        add_default_headers(request);
         http::send_request(socket.get(), request);
 
         parser.reset(request.method);
@@ -0,0 +1,408 @@
+#include "client/LoadGenerator.hpp"
+#include "core/Parser.hpp"
+#include "core/Writer.hpp"
+#include "net/AsyncIo.hpp"
+#include "net/TcpSocket.hpp"
+#ifdef HTTP_USE_OPENSSL
+#include "net/OpenSslSocket.hpp"
+#endif
+#include <cassert>
+#include <cstring>
+#include <deque>
+#include <future>
+#include <memory>
+#include <sstream>
+#include <stdexcept>
+#include <thread>
+namespace http
+{
+    namespace
+    {
+        typedef std::chrono::steady_clock Clock;
+
+        /**Largest response header line, or part of a body, held while waiting for more data.*/
+        const size_t RECV_BUFFER_SIZE = 65536;
+
+        /**A request serialized once before the run.*/
+        struct Message
+        {
+            Method method;
+            std::string data;
+        };
+
+        std::vector<Message> serialize_requests(const LoadOptions &options)
+        {
+            std::vector<Request> requests = options.requests;
+            if (requests.empty())
+            {
+                Request request;
+                request.method = GET;
+                request.raw_url = "/";
+                requests.push_back(request);
+            }
+            std::vector<Message> messages;
+            for (auto &request : requests)
+            {
+                request.headers.set_default("Host", options.host + ":" + std::to_string(options.port));
+                // Connections are reused for the whole run
+                request.headers.set_default("Connection", "keep-alive");
+                if (!request.body.empty())
+                    request.headers.set("Content-Length", std::to_string(request.body.size()));
+                std::stringstream ss;
+                write_request_header(ss, request);
+                Message message = { request.method, ss.str() + request.body };
+                messages.push_back(std::move(message));
+            }
+            return messages;
+        }
+    }
+
+    /**State of a run, used on the AsyncIo thread once the run starts.*/
+    class LoadGenerator::Run
+    {
+    public:
+        struct InFlight
+        {
+            /**When the request was due to be sent.*/
+            Clock::time_point due;
+            Method method;
+        };
+        struct Connection
+        {
+            Connection() : socket(), parser(), parser_ready(false), recv_buffer(RECV_BUFFER_SIZE)
+                , recv_len(0), send_buffer(), sending(false), in_flight(), unsent(0)
+                , next_message(0), failed(false)
+            {}
+            std::unique_ptr<Socket> socket;
+            ResponseParser parser;
+            /**parser was reset for the response to in_flight.front().*/
+            bool parser_ready;
+            std::vector<char> recv_buffer;
+            /**Received data at the start of recv_buffer that was not yet parsed.*/
+            size_t recv_len;
+            std::string send_buffer;
+            bool sending;
+            /**Requests assigned to this connection, in the order they are sent.*/
+            std::deque<InFlight> in_flight;
+            /**Number of requests at the end of in_flight not yet written.*/
+            size_t unsent;
+            /**Index in messages of the next request to send.*/
+            size_t next_message;
+            bool failed;
+        };
+
+        Run(const LoadOptions &options)
+            : options(options), messages(serialize_requests(options)), aio(), connections()
+            , backlog(), start(), record_from(), ending(false), result()
+        {}
+
+        const LoadOptions &options;
+        std::vector<Message> messages;
+        AsyncIo aio;
+        std::vector<std::unique_ptr<Connection>> connections;
+        /**Open loop requests that were due while every connection had pipeline requests
+         * outstanding.
+         */
+        std::deque<Clock::time_point> backlog;
+        Clock::time_point start;
+        /**Requests due from this time are recorded.*/
+        Clock::time_point record_from;
+        /**The run is over, so any further completions or errors are ignored.*/
+        bool ending;
+        LoadResult result;
+
+        /**Connect the sockets, before the AsyncIo thread is started.*/
+        void connect()
+        {
+            for (unsigned i = 0; i < options.connections; ++i)
+            {
+                std::unique_ptr<Connection> conn(new Connection());
+                std::unique_ptr<TcpSocket> tcp(new TcpSocket(options.host, options.port, options.socket_options));
+                tcp->set_non_blocking();
+                conn->socket = std::move(tcp);
+                connections.push_back(std::move(conn));
+            }
+        }
+        /**Replace each socket with a TLS socket and do the handshakes, while the AsyncIo thread
+         * is running.
+         */
+        void tls_handshake()
+        {
+#ifdef HTTP_USE_OPENSSL
+            std::vector<std::promise<void>> done(connections.size());
+            for (size_t i = 0; i < connections.size(); ++i)
+            {
+                auto &conn = *connections[i];
+                auto tcp = static_cast<TcpSocket*>(conn.socket.get());
+                std::unique_ptr<OpenSslSocket> tls(new OpenSslSocket());
+                auto promise = &done[i];
+                tls->async_connect(aio, std::move(*tcp),
+                    [promise]() { promise->set_value(); },
+                    [promise]() { promise->set_exception(std::current_exception()); });
+                conn.socket = std::move(tls);
+            }
+            // Wait for every handshake, even after one fails, as each uses its promise
+            std::exception_ptr error;
+            for (auto &promise : done)
+            {
+                try { promise.get_future().get(); }
+                catch (const std::exception &) { if (!error) error = std::current_exception(); }
+            }
+            if (error) std::rethrow_exception(error);
+#else
+            throw std::runtime_error("LoadGenerator TLS requires OpenSSL");
+#endif
+        }
+
+        /**Start on the AsyncIo thread.*/
+        void begin()
+        {
+            for (auto &conn : connections)
+            {
+                recv_next(*conn);
+                if (options.rate <= 0)
+                {
+                    auto now = Clock::now();
+                    for (unsigned i = 0; i < options.pipeline; ++i) assign(*conn, now);
+                    send_next(*conn);
+                }
+            }
+        }
+        /**Send an open loop request that is due, on the least busy connection.*/
+        void dispatch(Clock::time_point due)
+        {
+            if (ending) return;
+            Connection *best = nullptr;
+            for (auto &conn : connections)
+            {
+                if (!conn->failed && (!best || conn->in_flight.size() < best->in_flight.size()))
+                    best = conn.get();
+            }
+            if (!best) ++result.errors;
+            else if (best->in_flight.size() >= options.pipeline) backlog.push_back(due);
+            else
+            {
+                assign(*best, due);
+                send_next(*best);
+            }
+        }
+        /**End the run on the AsyncIo thread.*/
+        void end()
+        {
+            ending = true;
+            result.incomplete = backlog.size();
+            for (auto &conn : connections)
+            {
+                if (!conn->failed) result.incomplete += conn->in_flight.size();
+                aio.cancel(conn->socket->get());
+            }
+        }
+    private:
+        void assign(Connection &conn, Clock::time_point due)
+        {
+            InFlight req = { due, messages[(conn.next_message + conn.unsent) % messages.size()].method };
+            conn.in_flight.push_back(req);
+            ++conn.unsent;
+        }
+        void send_next(Connection &conn)
+        {
+            if (conn.sending || conn.failed || !conn.unsent) return;
+            // Write every request waiting, in one send
+            conn.send_buffer.clear();
+            for (; conn.unsent; --conn.unsent)
+            {
+                conn.send_buffer += messages[conn.next_message].data;
+                conn.next_message = (conn.next_message + 1) % messages.size();
+            }
+            conn.sending = true;
+            auto c = &conn;
+            conn.socket->async_send_all(aio, conn.send_buffer.data(), conn.send_buffer.size(),
+                [this, c](size_t)
+                {
+                    if (ending) return;
+                    c->sending = false;
+                    send_next(*c);
+                },
+                [this, c]() { fail(*c); });
+        }
+        void recv_next(Connection &conn)
+        {
+            if (conn.recv_len == conn.recv_buffer.size())
+                return fail(conn); // A line longer than the buffer
+            auto c = &conn;
+            conn.socket->async_recv(aio, conn.recv_buffer.data() + conn.recv_len,
+                conn.recv_buffer.size() - conn.recv_len,
+                [this, c](size_t len)
+                {
+                    if (ending || c->failed) return;
+                    if (len == 0) return fail(*c);
+                    if (Clock::now() >= record_from) result.bytes_received += len;
+                    c->recv_len += len;
+                    try
+                    {
+                        parse(*c);
+                    }
+                    catch (const std::exception &)
+                    {
+                        return fail(*c);
+                    }
+                    if (!c->failed) recv_next(*c);
+                },
+                [this, c]() { fail(*c); });
+        }
+        void parse(Connection &conn)
+        {
+            char *begin = conn.recv_buffer.data();
+            const char *end = begin + conn.recv_len, *p = begin;
+            while (p != end)
+            {
+                if (conn.in_flight.empty()) throw std::runtime_error("Unexpected response data");
+                if (!conn.parser_ready)
+                {
+                    conn.parser.reset(conn.in_flight.front().method);
+                    conn.parser_ready = true;
+                }
+                auto next = conn.parser.read(p, end);
+                if (!conn.parser.is_completed())
+                {
+                    p = next;
+                    break;
+                }
+                p = next;
+                conn.parser_ready = false;
+                completed(conn);
+            }
+            // Keep any partial line for the next read
+            conn.recv_len = (size_t)(end - p);
+            if (conn.recv_len && p != begin) memmove(begin, p, conn.recv_len);
+        }
+        void completed(Connection &conn)
+        {
+            auto now = Clock::now();
+            auto due = conn.in_flight.front().due;
+            conn.in_flight.pop_front();
+            if (due >= record_from)
+            {
+                ++result.completed;
+                if (conn.parser.status().code >= 400) ++result.status_errors;
+                auto latency = std::chrono::duration_cast<std::chrono::nanoseconds>(now - due).count();
+                result.latency.record(latency > 0 ? (uint64_t)latency : 0);
+            }
+            // Start the next request, due now in a closed loop, or the oldest waiting otherwise
+            if (options.rate <= 0) assign(conn, now);
+            else if (!backlog.empty())
+            {
+                assign(conn, backlog.front());
+                backlog.pop_front();
+            }
+            send_next(conn);
+        }
+        void fail(Connection &conn)
+        {
+            if (ending || conn.failed) return;
+            conn.failed = true;
+            result.errors += conn.in_flight.size();
+            conn.in_flight.clear();
+            conn.unsent = 0;
+            // Requests waiting can still be sent on other connections
+            if (!backlog.empty())
+            {
+                auto waiting = std::move(backlog);
+                backlog.clear();
+                for (auto due : waiting) dispatch(due);
+            }
+        }
+    };
+
+    LoadGenerator::LoadGenerator(const LoadOptions &options)
+        : options(options), stop_mutex(), stop_cv(), stopping(false)
+    {
+        if (!options.connections) throw std::invalid_argument("LoadOptions.connections must not be 0");
+        if (!options.pipeline) throw std::invalid_argument("LoadOptions.pipeline must not be 0");
+    }
+
+    LoadResult LoadGenerator::run()
+    {
+        {
+            std::unique_lock<std::mutex> lock(stop_mutex);
+            stopping = false;
+        }
+        Run state(options);
+        state.connect();
+        std::thread aio_thread(&AsyncIo::run, &state.aio);
+        try
+        {
+            if (options.tls) state.tls_handshake();
+        }
+        catch (const std::exception &)
+        {
+            state.aio.exit();
+            aio_thread.join();
+            throw;
+        }
+
+        auto start = Clock::now();
+        auto end = start + options.warmup + options.duration;
+        state.start = start;
+        state.record_from = start + options.warmup;
+        state.aio.post([&state]() { state.begin(); });
+
+        if (options.rate > 0)
+        {
+            // Release each request when due. If this thread falls behind, the requests due are
+            // released together, still with the time they were due.
+            auto interval = std::chrono::duration<double>(1 / options.rate);
+            uint64_t released = 0;
+            while (true)
+            {
+                auto now = Clock::now();
+                if (now >= end) break;
+                auto due = (uint64_t)(std::chrono::duration<double>(now - start) / interval) + 1;
+                if (due > released)
+                {
+                    auto first = released;
+                    state.aio.post([&state, start, interval, first, due]()
+                    {
+                        for (auto i = first; i < due; ++i)
+                        {
+                            state.dispatch(start + std::chrono::duration_cast<Clock::duration>(interval * (double)i));
+                        }
+                    });
+                    released = due;
+                }
+                auto next = start + std::chrono::duration_cast<Clock::duration>(interval * (double)released);
+                if (!wait_until(std::min(next, end))) break;
+            }
+        }
+        else wait_until(end);
+
+        std::promise<void> ended;
+        Clock::time_point end_time;
+        state.aio.post([&state, &ended, &end_time]()
+        {
+            end_time = Clock::now();
+            state.end();
+            ended.set_value();
+        });
+        ended.get_future().get();
+        state.aio.exit();
+        aio_thread.join();
+
+        state.result.elapsed = std::chrono::duration<double>(end_time - state.record_from).count();
+        if (state.result.elapsed < 0) state.result.elapsed = 0;
+        return std::move(state.result);
+    }
+
+    void LoadGenerator::stop()
+    {
+        std::unique_lock<std::mutex> lock(stop_mutex);
+        stopping = true;
+        stop_cv.notify_all();
+    }
+
+    bool LoadGenerator::wait_until(std::chrono::steady_clock::time_point time)
+    {
+        std::unique_lock<std::mutex> lock(stop_mutex);
+        return !stop_cv.wait_until(lock, time, [this]() { return stopping; });
+    }
+}
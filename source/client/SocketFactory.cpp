@@ -1,12 +1,21 @@
 #include "client/SocketFactory.hpp"
 #include "net/TcpSocket.hpp"
 #include "net/TlsSocket.hpp"
+#include "net/Net.hpp"
 
 namespace http
 {
     std::unique_ptr<Socket> DefaultSocketFactory::connect(const std::string &host, uint16_t port, bool tls)
     {
-        if (tls) return std::unique_ptr<Socket>(new TlsSocket(host, port));
-        else return std::unique_ptr<Socket>(new TcpSocket(host, port));
+        if (tls) return std::unique_ptr<Socket>(new TlsSocket(host, port, options));
+        else return std::unique_ptr<Socket>(new TcpSocket(host, port, options));
+    }
+
+    std::unique_ptr<Socket> UnixSocketFactory::connect(const std::string &host, uint16_t port, bool tls)
+    {
+        if (tls) throw ConnectionError("TLS is not supported over Unix domain sockets", host, port);
+        std::unique_ptr<TcpSocket> sock(new TcpSocket());
+        sock->connect_unix(path);
+        return std::move(sock);
     }
 }
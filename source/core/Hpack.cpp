@@ -0,0 +1,504 @@
+#include "core/Hpack.hpp"
+#include <algorithm>
+#include <cassert>
+#include <memory>
+namespace http
+{
+    namespace http2
+    {
+        namespace
+        {
+            /**RFC7541 Appendix A.*/
+            const struct { const char *name; const char *value; } STATIC_TABLE[] =
+            {
+                { ":authority", "" },
+                { ":method", "GET" },
+                { ":method", "POST" },
+                { ":path", "/" },
+                { ":path", "/index.html" },
+                { ":scheme", "http" },
+                { ":scheme", "https" },
+                { ":status", "200" },
+                { ":status", "204" },
+                { ":status", "206" },
+                { ":status", "304" },
+                { ":status", "400" },
+                { ":status", "404" },
+                { ":status", "500" },
+                { "accept-charset", "" },
+                { "accept-encoding", "gzip, deflate" },
+                { "accept-language", "" },
+                { "accept-ranges", "" },
+                { "accept", "" },
+                { "access-control-allow-origin", "" },
+                { "age", "" },
+                { "allow", "" },
+                { "authorization", "" },
+                { "cache-control", "" },
+                { "content-disposition", "" },
+                { "content-encoding", "" },
+                { "content-language", "" },
+                { "content-length", "" },
+                { "content-location", "" },
+                { "content-range", "" },
+                { "content-type", "" },
+                { "cookie", "" },
+                { "date", "" },
+                { "etag", "" },
+                { "expect", "" },
+                { "expires", "" },
+                { "from", "" },
+                { "host", "" },
+                { "if-match", "" },
+                { "if-modified-since", "" },
+                { "if-none-match", "" },
+                { "if-range", "" },
+                { "if-unmodified-since", "" },
+                { "last-modified", "" },
+                { "link", "" },
+                { "location", "" },
+                { "max-forwards", "" },
+                { "proxy-authenticate", "" },
+                { "proxy-authorization", "" },
+                { "range", "" },
+                { "referer", "" },
+                { "refresh", "" },
+                { "retry-after", "" },
+                { "server", "" },
+                { "set-cookie", "" },
+                { "strict-transport-security", "" },
+                { "transfer-encoding", "" },
+                { "user-agent", "" },
+                { "vary", "" },
+                { "via", "" },
+                { "www-authenticate", "" },
+            };
+            static_assert(sizeof(STATIC_TABLE) / sizeof(STATIC_TABLE[0]) == HpackTable::STATIC_SIZE, "STATIC_TABLE size");
+            /**Huffman code and bit length for each symbol, RFC7541 Appendix B. 256 is EOS.*/
+            const struct { uint32_t code; uint8_t bits; } HUFFMAN_CODES[257] =
+            {
+                { 0x1ff8, 13 }, { 0x7fffd8, 23 }, { 0xfffffe2, 28 }, { 0xfffffe3, 28 },
+                { 0xfffffe4, 28 }, { 0xfffffe5, 28 }, { 0xfffffe6, 28 }, { 0xfffffe7, 28 },
+                { 0xfffffe8, 28 }, { 0xffffea, 24 }, { 0x3ffffffc, 30 }, { 0xfffffe9, 28 },
+                { 0xfffffea, 28 }, { 0x3ffffffd, 30 }, { 0xfffffeb, 28 }, { 0xfffffec, 28 },
+                { 0xfffffed, 28 }, { 0xfffffee, 28 }, { 0xfffffef, 28 }, { 0xffffff0, 28 },
+                { 0xffffff1, 28 }, { 0xffffff2, 28 }, { 0x3ffffffe, 30 }, { 0xffffff3, 28 },
+                { 0xffffff4, 28 }, { 0xffffff5, 28 }, { 0xffffff6, 28 }, { 0xffffff7, 28 },
+                { 0xffffff8, 28 }, { 0xffffff9, 28 }, { 0xffffffa, 28 }, { 0xffffffb, 28 },
+                { 0x14, 6 }, { 0x3f8, 10 }, { 0x3f9, 10 }, { 0xffa, 12 },
+                { 0x1ff9, 13 }, { 0x15, 6 }, { 0xf8, 8 }, { 0x7fa, 11 },
+                { 0x3fa, 10 }, { 0x3fb, 10 }, { 0xf9, 8 }, { 0x7fb, 11 },
+                { 0xfa, 8 }, { 0x16, 6 }, { 0x17, 6 }, { 0x18, 6 },
+                { 0x0, 5 }, { 0x1, 5 }, { 0x2, 5 }, { 0x19, 6 },
+                { 0x1a, 6 }, { 0x1b, 6 }, { 0x1c, 6 }, { 0x1d, 6 },
+                { 0x1e, 6 }, { 0x1f, 6 }, { 0x5c, 7 }, { 0xfb, 8 },
+                { 0x7ffc, 15 }, { 0x20, 6 }, { 0xffb, 12 }, { 0x3fc, 10 },
+                { 0x1ffa, 13 }, { 0x21, 6 }, { 0x5d, 7 }, { 0x5e, 7 },
+                { 0x5f, 7 }, { 0x60, 7 }, { 0x61, 7 }, { 0x62, 7 },
+                { 0x63, 7 }, { 0x64, 7 }, { 0x65, 7 }, { 0x66, 7 },
+                { 0x67, 7 }, { 0x68, 7 }, { 0x69, 7 }, { 0x6a, 7 },
+                { 0x6b, 7 }, { 0x6c, 7 }, { 0x6d, 7 }, { 0x6e, 7 },
+                { 0x6f, 7 }, { 0x70, 7 }, { 0x71, 7 }, { 0x72, 7 },
+                { 0xfc, 8 }, { 0x73, 7 }, { 0xfd, 8 }, { 0x1ffb, 13 },
+                { 0x7fff0, 19 }, { 0x1ffc, 13 }, { 0x3ffc, 14 }, { 0x22, 6 },
+                { 0x7ffd, 15 }, { 0x3, 5 }, { 0x23, 6 }, { 0x4, 5 },
+                { 0x24, 6 }, { 0x5, 5 }, { 0x25, 6 }, { 0x26, 6 },
+                { 0x27, 6 }, { 0x6, 5 }, { 0x74, 7 }, { 0x75, 7 },
+                { 0x28, 6 }, { 0x29, 6 }, { 0x2a, 6 }, { 0x7, 5 },
+                { 0x2b, 6 }, { 0x76, 7 }, { 0x2c, 6 }, { 0x8, 5 },
+                { 0x9, 5 }, { 0x2d, 6 }, { 0x77, 7 }, { 0x78, 7 },
+                { 0x79, 7 }, { 0x7a, 7 }, { 0x7b, 7 }, { 0x7ffe, 15 },
+                { 0x7fc, 11 }, { 0x3ffd, 14 }, { 0x1ffd, 13 }, { 0xffffffc, 28 },
+                { 0xfffe6, 20 }, { 0x3fffd2, 22 }, { 0xfffe7, 20 }, { 0xfffe8, 20 },
+                { 0x3fffd3, 22 }, { 0x3fffd4, 22 }, { 0x3fffd5, 22 }, { 0x7fffd9, 23 },
+                { 0x3fffd6, 22 }, { 0x7fffda, 23 }, { 0x7fffdb, 23 }, { 0x7fffdc, 23 },
+                { 0x7fffdd, 23 }, { 0x7fffde, 23 }, { 0xffffeb, 24 }, { 0x7fffdf, 23 },
+                { 0xffffec, 24 }, { 0xffffed, 24 }, { 0x3fffd7, 22 }, { 0x7fffe0, 23 },
+                { 0xffffee, 24 }, { 0x7fffe1, 23 }, { 0x7fffe2, 23 }, { 0x7fffe3, 23 },
+                { 0x7fffe4, 23 }, { 0x1fffdc, 21 }, { 0x3fffd8, 22 }, { 0x7fffe5, 23 },
+                { 0x3fffd9, 22 }, { 0x7fffe6, 23 }, { 0x7fffe7, 23 }, { 0xffffef, 24 },
+                { 0x3fffda, 22 }, { 0x1fffdd, 21 }, { 0xfffe9, 20 }, { 0x3fffdb, 22 },
+                { 0x3fffdc, 22 }, { 0x7fffe8, 23 }, { 0x7fffe9, 23 }, { 0x1fffde, 21 },
+                { 0x7fffea, 23 }, { 0x3fffdd, 22 }, { 0x3fffde, 22 }, { 0xfffff0, 24 },
+                { 0x1fffdf, 21 }, { 0x3fffdf, 22 }, { 0x7fffeb, 23 }, { 0x7fffec, 23 },
+                { 0x1fffe0, 21 }, { 0x1fffe1, 21 }, { 0x3fffe0, 22 }, { 0x1fffe2, 21 },
+                { 0x7fffed, 23 }, { 0x3fffe1, 22 }, { 0x7fffee, 23 }, { 0x7fffef, 23 },
+                { 0xfffea, 20 }, { 0x3fffe2, 22 }, { 0x3fffe3, 22 }, { 0x3fffe4, 22 },
+                { 0x7ffff0, 23 }, { 0x3fffe5, 22 }, { 0x3fffe6, 22 }, { 0x7ffff1, 23 },
+                { 0x3ffffe0, 26 }, { 0x3ffffe1, 26 }, { 0xfffeb, 20 }, { 0x7fff1, 19 },
+                { 0x3fffe7, 22 }, { 0x7ffff2, 23 }, { 0x3fffe8, 22 }, { 0x1ffffec, 25 },
+                { 0x3ffffe2, 26 }, { 0x3ffffe3, 26 }, { 0x3ffffe4, 26 }, { 0x7ffffde, 27 },
+                { 0x7ffffdf, 27 }, { 0x3ffffe5, 26 }, { 0xfffff1, 24 }, { 0x1ffffed, 25 },
+                { 0x7fff2, 19 }, { 0x1fffe3, 21 }, { 0x3ffffe6, 26 }, { 0x7ffffe0, 27 },
+                { 0x7ffffe1, 27 }, { 0x3ffffe7, 26 }, { 0x7ffffe2, 27 }, { 0xfffff2, 24 },
+                { 0x1fffe4, 21 }, { 0x1fffe5, 21 }, { 0x3ffffe8, 26 }, { 0x3ffffe9, 26 },
+                { 0xffffffd, 28 }, { 0x7ffffe3, 27 }, { 0x7ffffe4, 27 }, { 0x7ffffe5, 27 },
+                { 0xfffec, 20 }, { 0xfffff3, 24 }, { 0xfffed, 20 }, { 0x1fffe6, 21 },
+                { 0x3fffe9, 22 }, { 0x1fffe7, 21 }, { 0x1fffe8, 21 }, { 0x7ffff3, 23 },
+                { 0x3fffea, 22 }, { 0x3fffeb, 22 }, { 0x1ffffee, 25 }, { 0x1ffffef, 25 },
+                { 0xfffff4, 24 }, { 0xfffff5, 24 }, { 0x3ffffea, 26 }, { 0x7ffff4, 23 },
+                { 0x3ffffeb, 26 }, { 0x7ffffe6, 27 }, { 0x3ffffec, 26 }, { 0x3ffffed, 26 },
+                { 0x7ffffe7, 27 }, { 0x7ffffe8, 27 }, { 0x7ffffe9, 27 }, { 0x7ffffea, 27 },
+                { 0x7ffffeb, 27 }, { 0xffffffe, 28 }, { 0x7ffffec, 27 }, { 0x7ffffed, 27 },
+                { 0x7ffffee, 27 }, { 0x7ffffef, 27 }, { 0x7fffff0, 27 }, { 0x3ffffee, 26 },
+                { 0x3fffffff, 30 }
+            };
+            const int HUFFMAN_EOS = 256;
+
+            /**Binary tree for decoding Huffman codes a bit at a time.*/
+            class HuffmanTree
+            {
+            public:
+                struct Node
+                {
+                    /**Index of the child node for a 0 or 1 bit, or 0 for none.*/
+                    int16_t children[2];
+                    /**The symbol for a leaf, else -1.*/
+                    int16_t symbol;
+                };
+                /**The root is at index 0.*/
+                std::vector<Node> nodes;
+
+                HuffmanTree()
+                {
+                    nodes.push_back({ { 0, 0 }, -1 });
+                    for (int symbol = 0; symbol <= HUFFMAN_EOS; ++symbol)
+                    {
+                        auto &code = HUFFMAN_CODES[symbol];
+                        size_t node = 0;
+                        for (int bit = code.bits - 1; bit >= 0; --bit)
+                        {
+                            auto b = (code.code >> bit) & 1;
+                            if (!nodes[node].children[b])
+                            {
+                                nodes[node].children[b] = (int16_t)nodes.size();
+                                nodes.push_back({ { 0, 0 }, -1 });
+                            }
+                            node = (size_t)nodes[node].children[b];
+                        }
+                        nodes[node].symbol = (int16_t)symbol;
+                    }
+                }
+            };
+            const HuffmanTree &huffman_tree()
+            {
+                static const HuffmanTree tree;
+                return tree;
+            }
+
+            /**Field representations, with the first octet pattern and prefix length.*/
+            const uint8_t INDEXED = 0x80;
+            const int INDEXED_PREFIX = 7;
+            const uint8_t LITERAL_INDEXED = 0x40;
+            const int LITERAL_INDEXED_PREFIX = 6;
+            const uint8_t SIZE_UPDATE = 0x20;
+            const int SIZE_UPDATE_PREFIX = 5;
+            const uint8_t LITERAL_NEVER_INDEXED = 0x10;
+            const uint8_t LITERAL_NOT_INDEXED = 0x00;
+            const int LITERAL_PREFIX = 4;
+
+            /**Values that are unlikely to repeat, or are sensitive, so are not worth a dynamic
+             * table entry.
+             */
+            bool should_index(const HeaderField &field)
+            {
+                static const char *NOT_INDEXED[] =
+                {
+                    ":path", "authorization", "content-length", "cookie", "date", "etag",
+                    "last-modified", "location", "set-cookie"
+                };
+                if (field.value.size() > 256) return false;
+                for (auto name : NOT_INDEXED)
+                {
+                    if (field.name == name) return false;
+                }
+                return true;
+            }
+            /**Reads a HPACK string literal.*/
+            const uint8_t *read_string(const uint8_t *begin, const uint8_t *end, std::string *out)
+            {
+                if (begin == end) throw Http2Error(ERR_COMPRESSION_ERROR, "Truncated HPACK string");
+                bool huffman = (*begin & 0x80) != 0;
+                uint64_t len;
+                auto p = hpack_read_int(begin, end, 7, &len);
+                if (len > (uint64_t)(end - p)) throw Http2Error(ERR_COMPRESSION_ERROR, "Truncated HPACK string");
+                out->clear();
+                if (huffman) huffman_decode(p, p + len, out);
+                else out->assign((const char*)p, (size_t)len);
+                return p + len;
+            }
+        }
+
+        void huffman_encode(const std::string &str, std::string *out)
+        {
+            uint64_t bits = 0;
+            int bit_count = 0;
+            for (auto c : str)
+            {
+                auto &code = HUFFMAN_CODES[(uint8_t)c];
+                bits = (bits << code.bits) | code.code;
+                bit_count += code.bits;
+                while (bit_count >= 8)
+                {
+                    bit_count -= 8;
+                    out->push_back((char)(bits >> bit_count));
+                }
+            }
+            if (bit_count > 0)
+            {
+                // Pad with the most significant bits of EOS, which are all 1
+                out->push_back((char)((bits << (8 - bit_count)) | (0xFF >> bit_count)));
+            }
+        }
+        size_t huffman_encoded_len(const std::string &str)
+        {
+            size_t bits = 0;
+            for (auto c : str) bits += HUFFMAN_CODES[(uint8_t)c].bits;
+            return (bits + 7) / 8;
+        }
+        void huffman_decode(const uint8_t *begin, const uint8_t *end, std::string *out)
+        {
+            auto &nodes = huffman_tree().nodes;
+            size_t node = 0;
+            // Bits read since the last complete symbol, and if they were all 1
+            int pending_bits = 0;
+            bool pending_ones = true;
+            for (auto p = begin; p < end; ++p)
+            {
+                for (int bit = 7; bit >= 0; --bit)
+                {
+                    auto b = (*p >> bit) & 1;
+                    auto next = nodes[node].children[b];
+                    if (!next) throw Http2Error(ERR_COMPRESSION_ERROR, "Invalid Huffman code");
+                    node = (size_t)next;
+                    ++pending_bits;
+                    pending_ones = pending_ones && b;
+                    auto symbol = nodes[node].symbol;
+                    if (symbol >= 0)
+                    {
+                        if (symbol == HUFFMAN_EOS) throw Http2Error(ERR_COMPRESSION_ERROR, "Huffman EOS in string");
+                        out->push_back((char)symbol);
+                        node = 0;
+                        pending_bits = 0;
+                        pending_ones = true;
+                    }
+                }
+            }
+            // RFC7541 5.2, padding must be the EOS prefix and less than 8 bits
+            if (pending_bits > 7 || !pending_ones)
+                throw Http2Error(ERR_COMPRESSION_ERROR, "Invalid Huffman padding");
+        }
+
+        void hpack_write_int(std::string *out, uint8_t first, int prefix_bits, uint64_t value)
+        {
+            uint8_t max_prefix = (uint8_t)((1 << prefix_bits) - 1);
+            if (value < max_prefix)
+            {
+                out->push_back((char)(first | value));
+                return;
+            }
+            out->push_back((char)(first | max_prefix));
+            value -= max_prefix;
+            while (value >= 128)
+            {
+                out->push_back((char)((value & 0x7F) | 0x80));
+                value >>= 7;
+            }
+            out->push_back((char)value);
+        }
+        const uint8_t *hpack_read_int(const uint8_t *begin, const uint8_t *end, int prefix_bits, uint64_t *value)
+        {
+            if (begin == end) throw Http2Error(ERR_COMPRESSION_ERROR, "Truncated HPACK integer");
+            uint8_t max_prefix = (uint8_t)((1 << prefix_bits) - 1);
+            *value = *begin & max_prefix;
+            auto p = begin + 1;
+            if (*value < max_prefix) return p;
+            for (int shift = 0; ; shift += 7)
+            {
+                // No valid value needs more than 32 bits
+                if (p == end) throw Http2Error(ERR_COMPRESSION_ERROR, "Truncated HPACK integer");
+                if (shift > 28) throw Http2Error(ERR_COMPRESSION_ERROR, "HPACK integer overflow");
+                auto b = *p++;
+                *value += (uint64_t)(b & 0x7F) << shift;
+                if (!(b & 0x80)) return p;
+            }
+        }
+
+        HpackTable::HpackTable(uint32_t max_size)
+            : dynamic(), _size(0), _max_size(max_size)
+        {}
+        const HeaderField &HpackTable::get(size_t index)const
+        {
+            static const std::vector<HeaderField> static_table(
+                [] {
+                    std::vector<HeaderField> table;
+                    for (auto &entry : STATIC_TABLE) table.push_back({ entry.name, entry.value });
+                    return table;
+                }());
+            if (index == 0) throw Http2Error(ERR_COMPRESSION_ERROR, "HPACK index 0");
+            if (index <= STATIC_SIZE) return static_table[index - 1];
+            index -= STATIC_SIZE + 1;
+            if (index >= dynamic.size()) throw Http2Error(ERR_COMPRESSION_ERROR, "HPACK index out of range");
+            return dynamic[index];
+        }
+        size_t HpackTable::find(const std::string &name, const std::string &value, bool *value_match)const
+        {
+            size_t name_index = 0;
+            *value_match = false;
+            for (size_t i = 0; i < STATIC_SIZE; ++i)
+            {
+                if (name == STATIC_TABLE[i].name)
+                {
+                    if (value == STATIC_TABLE[i].value)
+                    {
+                        *value_match = true;
+                        return i + 1;
+                    }
+                    if (!name_index) name_index = i + 1;
+                }
+            }
+            for (size_t i = 0; i < dynamic.size(); ++i)
+            {
+                if (dynamic[i].name == name)
+                {
+                    if (dynamic[i].value == value)
+                    {
+                        *value_match = true;
+                        return i + STATIC_SIZE + 1;
+                    }
+                    if (!name_index) name_index = i + STATIC_SIZE + 1;
+                }
+            }
+            return name_index;
+        }
+        void HpackTable::add(const std::string &name, const std::string &value)
+        {
+            auto entry_size = name.size() + value.size() + ENTRY_OVERHEAD;
+            if (entry_size > _max_size)
+            {
+                // RFC7541 4.4, not an error, but empties the table
+                evict(0);
+                return;
+            }
+            evict(_max_size - entry_size);
+            dynamic.push_front({ name, value });
+            _size += entry_size;
+        }
+        void HpackTable::set_max_size(uint32_t max_size)
+        {
+            _max_size = max_size;
+            evict(max_size);
+        }
+        void HpackTable::evict(size_t max_size)
+        {
+            while (_size > max_size)
+            {
+                auto &last = dynamic.back();
+                _size -= last.name.size() + last.value.size() + ENTRY_OVERHEAD;
+                dynamic.pop_back();
+            }
+        }
+
+        HpackDecoder::HpackDecoder(uint32_t max_table_size, size_t max_header_list_size)
+            : table(max_table_size), max_table_size(max_table_size)
+            , max_header_list_size(max_header_list_size)
+        {}
+        bool HpackDecoder::decode(const uint8_t *begin, const uint8_t *end, HeaderList *headers)
+        {
+            size_t list_size = 0;
+            bool fields_started = false;
+            auto p = begin;
+            HeaderField field;
+            while (p < end)
+            {
+                auto first = *p;
+                if (first & INDEXED)
+                {
+                    uint64_t index;
+                    p = hpack_read_int(p, end, INDEXED_PREFIX, &index);
+                    field = table.get((size_t)index);
+                }
+                else if ((first & 0xE0) == SIZE_UPDATE)
+                {
+                    // RFC7541 4.2, only allowed at the start of a block
+                    if (fields_started) throw Http2Error(ERR_COMPRESSION_ERROR, "HPACK table size update after fields");
+                    uint64_t size;
+                    p = hpack_read_int(p, end, SIZE_UPDATE_PREFIX, &size);
+                    if (size > max_table_size) throw Http2Error(ERR_COMPRESSION_ERROR, "HPACK table size update too large");
+                    table.set_max_size((uint32_t)size);
+                    continue;
+                }
+                else
+                {
+                    bool indexed = (first & 0xC0) == LITERAL_INDEXED;
+                    uint64_t index;
+                    p = hpack_read_int(p, end, indexed ? LITERAL_INDEXED_PREFIX : LITERAL_PREFIX, &index);
+                    if (index) field.name = table.get((size_t)index).name;
+                    else p = read_string(p, end, &field.name);
+                    p = read_string(p, end, &field.value);
+                    if (indexed) table.add(field.name, field.value);
+                }
+                fields_started = true;
+                list_size += field.name.size() + field.value.size() + HpackTable::ENTRY_OVERHEAD;
+                if (list_size <= max_header_list_size) headers->push_back(std::move(field));
+            }
+            return list_size <= max_header_list_size;
+        }
+
+        HpackEncoder::HpackEncoder(uint32_t max_table_size)
+            : table(max_table_size), limit(max_table_size), size_update(false), min_size(max_table_size)
+        {}
+        void HpackEncoder::set_max_table_size(uint32_t max_table_size)
+        {
+            auto size = std::min(max_table_size, limit);
+            if (!size_update)
+            {
+                if (size == table.max_size()) return;
+                size_update = true;
+                min_size = size;
+            }
+            else min_size = std::min(min_size, size);
+            table.set_max_size(size);
+        }
+        void HpackEncoder::encode(const HeaderList &headers, std::string *out)
+        {
+            if (size_update)
+            {
+                // RFC7541 4.2, the smallest size must be signalled if it was reduced then increased
+                if (min_size < table.max_size()) hpack_write_int(out, SIZE_UPDATE, SIZE_UPDATE_PREFIX, min_size);
+                hpack_write_int(out, SIZE_UPDATE, SIZE_UPDATE_PREFIX, table.max_size());
+                size_update = false;
+            }
+            for (auto &field : headers)
+            {
+                bool value_match;
+                auto index = table.find(field.name, field.value, &value_match);
+                if (value_match)
+                {
+                    hpack_write_int(out, INDEXED, INDEXED_PREFIX, index);
+                    continue;
+                }
+                bool indexed = should_index(field);
+                if (indexed) hpack_write_int(out, LITERAL_INDEXED, LITERAL_INDEXED_PREFIX, index);
+                else hpack_write_int(out, LITERAL_NOT_INDEXED, LITERAL_PREFIX, index);
+                if (!index) encode_string(field.name, out);
+                encode_string(field.value, out);
+                if (indexed) table.add(field.name, field.value);
+            }
+        }
+        void HpackEncoder::encode_string(const std::string &str, std::string *out)
+        {
+            auto huffman_len = huffman_encoded_len(str);
+            if (huffman_len < str.size())
+            {
+                hpack_write_int(out, 0x80, 7, huffman_len);
+                huffman_encode(str, out);
+            }
+            else
+            {
+                hpack_write_int(out, 0, 7, str.size());
+                out->append(str);
+            }
+        }
+    }
+}
@@ -4,6 +4,12 @@
 
 namespace http
 {
+    ParserLimits::ParserLimits()
+        : max_header_count(BaseParser::MAX_HEADER_COUNT)
+        , max_headers_size(BaseParser::MAX_HEADERS_SIZE)
+        , max_body_size(0)
+    {}
+
     BaseParser::BaseParser()
     {
         reset();
@@ -14,9 +20,16 @@ namespace http
         _headers.clear();
         _body.clear();
         _content_length = 0;
+        headers_size = 0;
     }
     void BaseParser::read_header(const char *str, const char *end)
     {
+        // Includes the CRLF
+        headers_size += end - str + 2;
+        if (headers_size > _limits.max_headers_size)
+            throw ParserError("Headers too large", SC_REQUEST_HEADER_FIELDS_TOO_LARGE);
+        if (_headers.size() >= _limits.max_header_count)
+            throw ParserError("Too many headers", SC_REQUEST_HEADER_FIELDS_TOO_LARGE);
         auto name_end = parser::read_header_name(str, end);
         assert(name_end < end && *name_end == ':');
 
@@ -58,6 +71,7 @@ namespace http
                     throw ParserError("Invalid Content-Length header value");
                 }
 
+                check_body_size(0, (size_t)len);
                 remaining_content_length = _content_length = (size_t)len;
                 if (_content_length == 0) _state = COMPLETED;
                 else _state = BODY;
@@ -153,6 +167,7 @@ namespace http
                 if (begin + count != line_end) throw ParserError("Invalid chunk size");
 
                 begin = line_end + 2;
+                check_body_size(_content_length, len);
                 remaining_content_length = len;
                 _content_length += len;
 
@@ -119,6 +119,36 @@ namespace http
             }
         }
 
+        const char *read_qvalue(const char *begin, const char *end, float *out)
+        {
+            auto p = begin;
+            if (p == end) throw ParserError("Expected quality value");
+            if (*p == '0') //0 plus 3 optional decimals
+            {
+                *out = 0;
+                if (++p != end && *p == '.')
+                {
+                    static const float scale[] = { 0.1f, 0.01f, 0.001f };
+                    ++p;
+                    for (int i = 0; i < 3 && p != end && is_digit(*p); ++i, ++p)
+                    {
+                        *out += (*p - '0') * scale[i];
+                    }
+                }
+            }
+            else if (*p == '1') //1 plus 3 optional zeros
+            {
+                *out = 1;
+                if (++p != end && *p == '.')
+                {
+                    ++p;
+                    for (int i = 0; i < 3 && p != end && *p == '0'; ++i) ++p;
+                }
+            }
+            else throw ParserError("Invalid quality value");
+            return p;
+        }
+
         const char *read_qstring(const char *begin, const char *end, std::string *out)
         {
             if (begin == end || *begin != '"') throw ParserError("Expected \"");
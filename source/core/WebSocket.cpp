@@ -0,0 +1,261 @@
+#include "core/WebSocket.hpp"
+#include <cstring>
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define HTTP_WEBSOCKET_SSE2
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define HTTP_WEBSOCKET_NEON
+#endif
+namespace http
+{
+    namespace websocket
+    {
+        namespace
+        {
+            const char ACCEPT_GUID[] = "258EAFA5-E914-47DA-95CA-C5AB0DC85B11";
+            const char BASE64_CHARS[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+            uint32_t rotl(uint32_t x, int n)
+            {
+                return (x << n) | (x >> (32 - n));
+            }
+            /**SHA-1 (RFC3174), only used for the handshake key, not for security.*/
+            void sha1(const std::string &data, uint8_t digest[20])
+            {
+                uint32_t h[5] = { 0x67452301, 0xEFCDAB89, 0x98BADCFE, 0x10325476, 0xC3D2E1F0 };
+                // Pad with 0x80, zeros, and the 64bit bit length, to a multiple of 64 bytes
+                std::string msg = data;
+                msg.push_back((char)0x80);
+                while (msg.size() % 64 != 56) msg.push_back(0);
+                uint64_t bits = (uint64_t)data.size() * 8;
+                for (int i = 7; i >= 0; --i) msg.push_back((char)(bits >> (i * 8)));
+
+                for (size_t block = 0; block < msg.size(); block += 64)
+                {
+                    auto p = (const uint8_t*)msg.data() + block;
+                    uint32_t w[80];
+                    for (int i = 0; i < 16; ++i)
+                    {
+                        w[i] = ((uint32_t)p[i * 4] << 24) | ((uint32_t)p[i * 4 + 1] << 16) |
+                            ((uint32_t)p[i * 4 + 2] << 8) | p[i * 4 + 3];
+                    }
+                    for (int i = 16; i < 80; ++i) w[i] = rotl(w[i - 3] ^ w[i - 8] ^ w[i - 14] ^ w[i - 16], 1);
+
+                    uint32_t a = h[0], b = h[1], c = h[2], d = h[3], e = h[4];
+                    for (int i = 0; i < 80; ++i)
+                    {
+                        uint32_t f, k;
+                        if (i < 20) f = (b & c) | (~b & d), k = 0x5A827999;
+                        else if (i < 40) f = b ^ c ^ d, k = 0x6ED9EBA1;
+                        else if (i < 60) f = (b & c) | (b & d) | (c & d), k = 0x8F1BBCDC;
+                        else f = b ^ c ^ d, k = 0xCA62C1D6;
+                        uint32_t temp = rotl(a, 5) + f + e + k + w[i];
+                        e = d;
+                        d = c;
+                        c = rotl(b, 30);
+                        b = a;
+                        a = temp;
+                    }
+                    h[0] += a;
+                    h[1] += b;
+                    h[2] += c;
+                    h[3] += d;
+                    h[4] += e;
+                }
+                for (int i = 0; i < 5; ++i)
+                {
+                    digest[i * 4] = (uint8_t)(h[i] >> 24);
+                    digest[i * 4 + 1] = (uint8_t)(h[i] >> 16);
+                    digest[i * 4 + 2] = (uint8_t)(h[i] >> 8);
+                    digest[i * 4 + 3] = (uint8_t)h[i];
+                }
+            }
+            std::string base64_encode(const uint8_t *data, size_t len)
+            {
+                std::string out;
+                out.reserve((len + 2) / 3 * 4);
+                for (size_t i = 0; i < len; i += 3)
+                {
+                    uint32_t n = (uint32_t)data[i] << 16;
+                    if (i + 1 < len) n |= (uint32_t)data[i + 1] << 8;
+                    if (i + 2 < len) n |= data[i + 2];
+                    out.push_back(BASE64_CHARS[(n >> 18) & 63]);
+                    out.push_back(BASE64_CHARS[(n >> 12) & 63]);
+                    out.push_back(i + 1 < len ? BASE64_CHARS[(n >> 6) & 63] : '=');
+                    out.push_back(i + 2 < len ? BASE64_CHARS[n & 63] : '=');
+                }
+                return out;
+            }
+        }
+
+        size_t FrameHeader::read(const uint8_t *p, size_t len, FrameHeader *header)
+        {
+            if (len < 2) return 0;
+            header->fin = (p[0] & 0x80) != 0;
+            header->rsv1 = (p[0] & 0x40) != 0;
+            header->rsv23 = (p[0] >> 4) & 0x3;
+            header->opcode = (Opcode)(p[0] & 0xF);
+            header->masked = (p[1] & 0x80) != 0;
+            uint64_t length = p[1] & 0x7F;
+            size_t pos = 2;
+            if (length == 126)
+            {
+                if (len < 4) return 0;
+                length = ((uint64_t)p[2] << 8) | p[3];
+                pos = 4;
+                if (length < 126) throw WebSocketError(CLOSE_PROTOCOL_ERROR, "Frame length not minimally encoded");
+            }
+            else if (length == 127)
+            {
+                if (len < 10) return 0;
+                length = 0;
+                for (int i = 0; i < 8; ++i) length = (length << 8) | p[2 + i];
+                pos = 10;
+                if (length >> 63) throw WebSocketError(CLOSE_PROTOCOL_ERROR, "Frame length too large");
+                if (length <= 0xFFFF) throw WebSocketError(CLOSE_PROTOCOL_ERROR, "Frame length not minimally encoded");
+            }
+            if (header->masked)
+            {
+                if (len < pos + 4) return 0;
+                memcpy(header->mask, p + pos, 4);
+                pos += 4;
+            }
+            header->length = length;
+            return pos;
+        }
+        size_t FrameHeader::write(uint8_t *out)const
+        {
+            out[0] = (uint8_t)((fin ? 0x80 : 0) | (rsv1 ? 0x40 : 0) | ((rsv23 & 0x3) << 4) | (opcode & 0xF));
+            uint8_t mask_bit = masked ? 0x80 : 0;
+            size_t pos;
+            if (length < 126)
+            {
+                out[1] = (uint8_t)(mask_bit | length);
+                pos = 2;
+            }
+            else if (length <= 0xFFFF)
+            {
+                out[1] = mask_bit | 126;
+                out[2] = (uint8_t)(length >> 8);
+                out[3] = (uint8_t)length;
+                pos = 4;
+            }
+            else
+            {
+                out[1] = mask_bit | 127;
+                for (int i = 0; i < 8; ++i) out[2 + i] = (uint8_t)(length >> ((7 - i) * 8));
+                pos = 10;
+            }
+            if (masked)
+            {
+                memcpy(out + pos, mask, 4);
+                pos += 4;
+            }
+            return pos;
+        }
+        void FrameHeader::write(std::string *out)const
+        {
+            uint8_t buffer[MAX_HEADER_LEN];
+            out->append((const char*)buffer, write(buffer));
+        }
+
+        void apply_mask(uint8_t *data, size_t len, const uint8_t key[4], uint64_t offset)
+        {
+            // Rotate the key so it starts at data[0], then every block of a multiple of 4 bytes
+            // uses the same key
+            uint8_t k[4];
+            for (int i = 0; i < 4; ++i) k[i] = key[(offset + i) & 3];
+            uint32_t k32;
+            memcpy(&k32, k, 4);
+            size_t i = 0;
+#if defined(HTTP_WEBSOCKET_SSE2)
+            auto k128 = _mm_set1_epi32((int)k32);
+            for (; i + 64 <= len; i += 64)
+            {
+                auto p = (__m128i*)(data + i);
+                auto a = _mm_loadu_si128(p);
+                auto b = _mm_loadu_si128(p + 1);
+                auto c = _mm_loadu_si128(p + 2);
+                auto d = _mm_loadu_si128(p + 3);
+                _mm_storeu_si128(p, _mm_xor_si128(a, k128));
+                _mm_storeu_si128(p + 1, _mm_xor_si128(b, k128));
+                _mm_storeu_si128(p + 2, _mm_xor_si128(c, k128));
+                _mm_storeu_si128(p + 3, _mm_xor_si128(d, k128));
+            }
+            for (; i + 16 <= len; i += 16)
+            {
+                auto p = (__m128i*)(data + i);
+                _mm_storeu_si128(p, _mm_xor_si128(_mm_loadu_si128(p), k128));
+            }
+#elif defined(HTTP_WEBSOCKET_NEON)
+            auto k128 = vreinterpretq_u8_u32(vdupq_n_u32(k32));
+            for (; i + 16 <= len; i += 16) vst1q_u8(data + i, veorq_u8(vld1q_u8(data + i), k128));
+#endif
+            // Word at a time for the remainder, or without SIMD
+            uint64_t k64 = ((uint64_t)k32 << 32) | k32;
+            for (; i + 8 <= len; i += 8)
+            {
+                uint64_t word;
+                memcpy(&word, data + i, 8);
+                word ^= k64;
+                memcpy(data + i, &word, 8);
+            }
+            for (; i < len; ++i) data[i] ^= k[i & 3];
+        }
+        void write_frame(std::string *out, Opcode opcode, const void *data, size_t len, bool fin, bool rsv1)
+        {
+            FrameHeader header = { fin, rsv1, 0, opcode, false, {}, len };
+            out->reserve(out->size() + MAX_HEADER_LEN + len);
+            header.write(out);
+            out->append((const char*)data, len);
+        }
+        std::string accept_key(const std::string &key)
+        {
+            uint8_t digest[20];
+            sha1(key + ACCEPT_GUID, digest);
+            return base64_encode(digest, sizeof(digest));
+        }
+        bool valid_utf8(const char *data, size_t len)
+        {
+            auto p = (const uint8_t*)data;
+            auto end = p + len;
+            while (p < end)
+            {
+                // Skip ASCII a word at a time
+                while (end - p >= 8)
+                {
+                    uint64_t word;
+                    memcpy(&word, p, 8);
+                    if (word & 0x8080808080808080ULL) break;
+                    p += 8;
+                }
+                if (p == end) break;
+                auto c = *p;
+                if (c < 0x80)
+                {
+                    ++p;
+                    continue;
+                }
+                size_t n;
+                uint32_t cp;
+                if ((c & 0xE0) == 0xC0) n = 1, cp = c & 0x1F;
+                else if ((c & 0xF0) == 0xE0) n = 2, cp = c & 0x0F;
+                else if ((c & 0xF8) == 0xF0) n = 3, cp = c & 0x07;
+                else return false;
+                if ((size_t)(end - p) <= n) return false;
+                for (size_t i = 1; i <= n; ++i)
+                {
+                    if ((p[i] & 0xC0) != 0x80) return false;
+                    cp = (cp << 6) | (p[i] & 0x3F);
+                }
+                // Reject overlong encodings, surrogates, and code points past U+10FFFF
+                if (n == 1 && cp < 0x80) return false;
+                if (n == 2 && (cp < 0x800 || (cp >= 0xD800 && cp <= 0xDFFF))) return false;
+                if (n == 3 && (cp < 0x10000 || cp > 0x10FFFF)) return false;
+                p += n + 1;
+            }
+            return true;
+        }
+    }
+}
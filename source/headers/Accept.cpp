@@ -112,49 +112,7 @@ namespace http
                 if (end - p > 2 && p[0] == 'q' && p[1] == '=')
                 {
                     //end of media type params. quality, then accept params.
-                    p += 2;
-                    if (p == end) throw ParserError("Expected quality value");
-                    if (*p == '0') //0 plus 3 optional decimals
-                    {
-                        auto p2 = p;
-                        type.quality = 0;
-                        if (++p2 != end && *p2 == '.')
-                        {
-                            if (++p2 != end && parser::is_digit(*p2))
-                            {
-                                type.quality += (*p2 - '0') * 0.1f;
-                                if (++p2 != end && parser::is_digit(*p2))
-                                {
-                                    type.quality += (*p2 - '0') * 0.01f;
-                                    if (++p2 != end && parser::is_digit(*p2))
-                                    {
-                                        type.quality += (*p2 - '0') * 0.001f;
-                                        ++p2;
-                                    }
-                                }
-                            }
-                        }
-
-                        p = p2;
-                    }
-                    else if (*p == '1') //1 plus 3 optional zeros
-                    {
-                        type.quality = 1;
-                        if (++p != end && *p == '.')
-                        {
-                            if (++p != end && *p == '0')
-                            {
-                                if (++p != end && *p == '0')
-                                {
-                                    if (++p != end && *p == '0')
-                                    {
-                                        ++p;
-                                    }
-                                }
-                            }
-                        }
-                    }
-                    else throw ParserError("Invalid quality value");
+                    p = parser::read_qvalue(p + 2, end, &type.quality);
 
                     while (true)
                     {
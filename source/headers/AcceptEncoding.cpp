@@ -0,0 +1,72 @@
+#include "headers/AcceptEncoding.hpp"
+#include "core/ParserUtils.hpp"
+#include "String.hpp"
+namespace http
+{
+    AcceptEncoding::AcceptEncoding(const char *begin, const char *end)
+        : codings()
+    {
+        parse(begin, end);
+    }
+
+    float AcceptEncoding::quality(const std::string &coding)const
+    {
+        const Coding *wildcard = nullptr;
+        for (auto &x : codings)
+        {
+            if (ieq(x.coding, coding)) return x.quality;
+            if (x.coding == "*") wildcard = &x;
+        }
+        if (wildcard) return wildcard->quality;
+        // RFC7231 5.3.4, identity is always acceptable unless excluded, but least preferred
+        if (ieq(coding, "identity")) return 0.001f;
+        return 0;
+    }
+
+    std::string AcceptEncoding::preferred(const std::vector<std::string> &_codings)const
+    {
+        const std::string *best = nullptr;
+        float best_quality = 0;
+        for (auto &coding : _codings)
+        {
+            auto q = quality(coding);
+            if (q > best_quality)
+            {
+                best = &coding;
+                best_quality = q;
+            }
+        }
+        if (best) return *best;
+        else throw NotAcceptable(_codings);
+    }
+
+    void AcceptEncoding::parse(const char *begin, const char *end)
+    {
+        // RFC7231
+        // Accept-Encoding  = #( codings [ weight ] )
+        // codings          = content-coding / "identity" / "*"
+        // content-coding   = token
+        // weight = OWS ";" OWS "q=" qvalue
+        auto p = parser::skip_ows(begin, end);
+        while (p < end)
+        {
+            Coding coding;
+            coding.quality = 1; //default
+            auto p2 = parser::read_token(p, end);
+            if (p2 == p) throw ParserError("Invalid Accept-Encoding header");
+            coding.coding.assign(p, p2);
+            for (auto &c : coding.coding) if (c >= 'A' && c <= 'Z') c = (char)(c - 'A' + 'a');
+            p = parser::skip_ows(p2, end);
+
+            if (p != end && *p == ';')
+            {
+                p = parser::skip_ows(p + 1, end);
+                if (end - p < 2 || (p[0] != 'q' && p[0] != 'Q') || p[1] != '=')
+                    throw ParserError("Invalid Accept-Encoding header");
+                p = parser::read_qvalue(p + 2, end, &coding.quality);
+            }
+            codings.push_back(std::move(coding));
+            p = parser::read_list_sep(p, end);
+        }
+    }
+}
@@ -0,0 +1,55 @@
+#include "headers/CacheControl.hpp"
+#include "core/ParserUtils.hpp"
+#include "String.hpp"
+#include <limits>
+namespace http
+{
+    namespace
+    {
+        /**Parse delta-seconds. Values too large are capped, as recommended by RFC 7234 1.2.1.*/
+        int parse_delta_seconds(const std::string &str)
+        {
+            if (str.empty()) throw ParserError("Invalid Cache-Control delta-seconds");
+            long long value = 0;
+            for (auto c : str)
+            {
+                if (!parser::is_digit(c)) throw ParserError("Invalid Cache-Control delta-seconds");
+                value = value * 10 + (c - '0');
+                if (value > std::numeric_limits<int>::max()) return std::numeric_limits<int>::max();
+            }
+            return (int)value;
+        }
+    }
+
+    CacheControl::CacheControl(const char *begin, const char *end)
+        : CacheControl()
+    {
+        parse(begin, end);
+    }
+
+    void CacheControl::parse(const char *begin, const char *end)
+    {
+        // RFC7234
+        // Cache-Control   = 1#cache-directive
+        // cache-directive = token [ "=" ( token / quoted-string ) ]
+        auto p = begin;
+        while (p < end)
+        {
+            auto p2 = parser::read_token(p, end);
+            if (p2 == p) throw ParserError("Invalid Cache-Control header");
+            std::string name(p, p2), value;
+            p = p2;
+            if (p != end && *p == '=') p = parser::read_token_or_qstring(p + 1, end, &value);
+
+            if (ieq(name, "no-store")) no_store = true;
+            else if (ieq(name, "no-cache")) no_cache = true;
+            else if (ieq(name, "private")) is_private = true;
+            else if (ieq(name, "public")) is_public = true;
+            else if (ieq(name, "max-age")) max_age = parse_delta_seconds(value);
+            else if (ieq(name, "s-maxage")) s_maxage = parse_delta_seconds(value);
+            // Other directives are not relevant
+
+            p = parser::read_list_sep(p, end);
+        }
+    }
+}
@@ -7,6 +7,9 @@
 #include <limits>
 #include <cassert>
 #include <mswsock.h> // AcceptEx
+#ifdef __linux__
+#include <sys/sendfile.h>
+#endif
 namespace http
 {
     #ifdef HTTP_USE_SELECT
@@ -83,8 +86,9 @@ namespace http
     }
     void AsyncIo::SignalSocket::clear()
     {
-        char buffer[1];
-        ::recv(recv, buffer, 1, 0);
+        // Multiple signals may have been sent since the last select
+        char buffer[64];
+        ::recv(recv, buffer, sizeof(buffer), 0);
     }
     SOCKET AsyncIo::SignalSocket::get()
     {
@@ -92,7 +96,7 @@ namespace http
     }
 
     AsyncIo::AsyncIo()
-        : exiting(false)
+        : exiting(false), stopped(false)
     {
         signal.create();
     }
@@ -102,6 +106,11 @@ namespace http
     void AsyncIo::run()
     {
         std::unique_lock<std::mutex> exit_lock(exit_mutex);
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            stopped = false;
+        }
+        std::vector<std::function<void()>> posted;
         while (!exiting)
         {
             // pending
@@ -116,7 +125,10 @@ namespace http
                 new_operations.accept.clear();
                 new_operations.recv.clear();
                 new_operations.send.clear();
+                posted.swap(new_operations.post);
             }
+            for (auto &func : posted) func();
+            posted.clear();
             // fd_set
             FdSets fd_sets;
             fd_sets.read(signal.get());
@@ -168,7 +180,8 @@ namespace http
                     {
                         if (op.len > (size_t)std::numeric_limits<int>::max())
                             op.len = (size_t)std::numeric_limits<int>::max();
-                        auto ret = ::recv(op.sock, (char*)op.buffer, (int)op.len, 0);
+                        // A zero length recv only waits for the socket to be readable
+                        auto ret = op.len ? ::recv(op.sock, (char*)op.buffer, (int)op.len, 0) : 0;
                         if (ret < 0) throw SocketError(last_net_error());
                         op.handler((size_t)ret);
                         i->second.pop_front();
@@ -180,7 +193,13 @@ namespace http
                     }
                     catch (const std::exception &)
                     {
-                        op.error();
+                        // Remove the operation first, the error handler will likely close the socket
+                        auto error = std::move(op.error);
+                        i->second.pop_front();
+                        if (i->second.empty()) i = in_progress.recv.erase(i);
+                        else ++i;
+                        error();
+                        continue;
                     }
                 }
                 ++i;
@@ -198,9 +217,13 @@ namespace http
                             len = (size_t)std::numeric_limits<int>::max();
                         else len = (int)(op.len - op.sent);
 
-                        auto ret = ::send(op.sock, (const char*)op.buffer + op.sent, len, 0);
-                        if (ret <= 0) throw SocketError(last_net_error());
-                        op.sent += ret;
+                        if (op.file != INVALID_FILE) op.sent += send_file_some(op, len);
+                        else
+                        {
+                            auto ret = ::send(op.sock, (const char*)op.buffer + op.sent, len, 0);
+                            if (ret <= 0) throw SocketError(last_net_error());
+                            op.sent += ret;
+                        }
                         if (!op.all || op.sent >= op.len)
                         {
                             op.handler(op.sent);
@@ -214,7 +237,12 @@ namespace http
                     }
                     catch (const std::exception &e)
                     {
-                        call_error(e, send->error);
+                        auto error = std::move(op.error);
+                        i->second.pop_front();
+                        if (i->second.empty()) i = in_progress.send.erase(i);
+                        else ++i;
+                        call_error(e, error);
+                        continue;
                     }
                 }
                 ++i;
@@ -238,6 +266,8 @@ namespace http
             new_operations.accept.clear();
             new_operations.recv.clear();
             new_operations.send.clear();
+            new_operations.post.clear();
+            stopped = true;
         }
     }
     void AsyncIo::exit()
@@ -248,23 +278,153 @@ namespace http
     }
     void AsyncIo::accept(SOCKET sock, AcceptHandler handler, ErrorHandler error)
     {
-        std::unique_lock<std::mutex> lock(mutex);
-        new_operations.accept.emplace_back(Accept{ sock, handler, error });
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            if (!stopped)
+            {
+                new_operations.accept.emplace_back(Accept{ sock, handler, error });
+                signal.signal();
+                return;
+            }
+        }
+        do_abort(error);
     }
     void AsyncIo::recv(SOCKET sock, void *buffer, size_t len, RecvHandler handler, ErrorHandler error)
     {
-        std::unique_lock<std::mutex> lock(mutex);
-        new_operations.recv.emplace_back(Recv{sock, buffer, len, handler, error});
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            if (!stopped)
+            {
+                new_operations.recv.emplace_back(Recv{sock, buffer, len, handler, error});
+                signal.signal();
+                return;
+            }
+        }
+        do_abort(error);
     }
     void AsyncIo::send(SOCKET sock, const void *buffer, size_t len, SendHandler handler, ErrorHandler error)
     {
-        std::unique_lock<std::mutex> lock(mutex);
-        new_operations.send.emplace_back(Send{false, sock, buffer, len, 0, handler, error});
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            if (!stopped)
+            {
+                new_operations.send.emplace_back(Send{false, sock, buffer, len, 0, handler, error, INVALID_FILE, 0});
+                signal.signal();
+                return;
+            }
+        }
+        do_abort(error);
     }
     void AsyncIo::send_all(SOCKET sock, const void *buffer, size_t len, SendHandler handler, ErrorHandler error)
+    {
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            if (!stopped)
+            {
+                new_operations.send.emplace_back(Send{ true, sock, buffer, len, 0, handler, error, INVALID_FILE, 0 });
+                signal.signal();
+                return;
+            }
+        }
+        do_abort(error);
+    }
+    void AsyncIo::send_file(SOCKET sock, FileHandle file, uint64_t offset, size_t len,
+        SendHandler handler, ErrorHandler error)
+    {
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            if (!stopped)
+            {
+                new_operations.send.emplace_back(Send{ true, sock, nullptr, len, 0, handler, error, file, offset });
+                signal.signal();
+                return;
+            }
+        }
+        do_abort(error);
+    }
+    size_t AsyncIo::send_file_some(Send &op, int len)
+    {
+        auto offset = op.file_offset + op.sent;
+#ifdef __linux__
+        auto off = (off_t)offset;
+        auto ret = ::sendfile(op.sock, op.file, &off, (size_t)len);
+        if (ret < 0) throw SocketError(last_net_error());
+#else
+        char buffer[16384];
+        auto read = File::read(op.file, buffer, std::min<size_t>(sizeof(buffer), len), offset);
+        auto ret = read ? ::send(op.sock, buffer, (int)read, 0) : 0;
+        if (ret < 0) throw SocketError(last_net_error());
+#endif
+        if (ret == 0) throw std::runtime_error("send_file reached the end of the file");
+        return (size_t)ret;
+    }
+    void AsyncIo::post(std::function<void()> func)
     {
         std::unique_lock<std::mutex> lock(mutex);
-        new_operations.send.emplace_back(Send{ true, sock, buffer, len, 0, handler, error });
+        if (exiting) return;
+        new_operations.post.push_back(func);
+        signal.signal();
+    }
+    void AsyncIo::cancel(SOCKET sock)
+    {
+        // Remove everything first, since the error handlers may start new operations
+        std::vector<ErrorHandler> errors;
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            auto &accepts = new_operations.accept;
+            for (auto i = accepts.begin(); i != accepts.end();)
+            {
+                if (i->sock == sock)
+                {
+                    errors.push_back(i->error);
+                    i = accepts.erase(i);
+                }
+                else ++i;
+            }
+            auto &recvs = new_operations.recv;
+            for (auto i = recvs.begin(); i != recvs.end();)
+            {
+                if (i->sock == sock)
+                {
+                    errors.push_back(i->error);
+                    i = recvs.erase(i);
+                }
+                else ++i;
+            }
+            auto &sends = new_operations.send;
+            for (auto i = sends.begin(); i != sends.end();)
+            {
+                if (i->sock == sock)
+                {
+                    errors.push_back(i->error);
+                    i = sends.erase(i);
+                }
+                else ++i;
+            }
+        }
+        for (auto i = in_progress.accept.begin(); i != in_progress.accept.end();)
+        {
+            if (i->sock == sock)
+            {
+                errors.push_back(i->error);
+                i = in_progress.accept.erase(i);
+            }
+            else ++i;
+        }
+        auto recv = in_progress.recv.find(sock);
+        if (recv != in_progress.recv.end())
+        {
+            for (auto &op : recv->second) errors.push_back(op.error);
+            in_progress.recv.erase(recv);
+        }
+        auto send = in_progress.send.find(sock);
+        if (send != in_progress.send.end())
+        {
+            for (auto &op : send->second) errors.push_back(op.error);
+            in_progress.send.erase(send);
+        }
+
+        for (auto &error : errors) do_abort(error);
     }
     #endif
 
@@ -286,6 +446,8 @@ namespace http
         case ACCEPT: return delete (Accept*)this;
         case RECV: return delete (Recv*)this;
         case SEND: return delete (Send*)this;
+        case SEND_FILE: return delete (SendFile*)this;
+        case POST: return delete (Post*)this;
         default:
             assert(type == SEND_ALL);
             return delete (SendAll*)this;
@@ -294,8 +456,13 @@ namespace http
     AsyncIo::Accept::Accept(SOCKET sock, AcceptHandler handler, ErrorHandler error)
         : Operation(sock, ACCEPT, nullptr, 0, error)
         , handler(handler)
-        , client_sock(create_socket(AF_INET, SOCK_STREAM, IPPROTO_TCP))
+        , client_sock(INVALID_SOCKET)
     {
+        // AcceptEx needs a socket of the same family as the listen socket, which may be IPv6
+        sockaddr_storage addr = {};
+        int addr_len = (int)sizeof(addr);
+        if (getsockname(sock, (sockaddr*)&addr, &addr_len)) throw SocketError("getsockname", WSAGetLastError());
+        client_sock = create_socket(addr.ss_family, SOCK_STREAM, IPPROTO_TCP);
         if (client_sock == INVALID_SOCKET) throw SocketError("socket");
     }
     AsyncIo::Accept::~Accept()
@@ -382,6 +549,31 @@ namespace http
         send_all_next(std::unique_ptr<SendAll, Operation::Deleter>(
             new SendAll(sock, buffer, len, handler, error)), 0);
     }
+    void AsyncIo::send_file(SOCKET sock, FileHandle file, uint64_t offset, size_t len,
+        SendHandler handler, ErrorHandler error)
+    {
+        send_file_next(std::unique_ptr<SendFile, Operation::Deleter>(
+            new SendFile(sock, file, offset, len, handler, error)), 0);
+    }
+    void AsyncIo::post(std::function<void()> func)
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        if (!running) return;
+        Operation::Ptr op(new Post(func));
+        auto p = op.get();
+        inprogess_operations.push_back(std::move(op));
+        p->it = --inprogess_operations.end();
+        if (!PostQueuedCompletionStatus(iocp.port, 0, NULL, &p->overlapped))
+        {
+            inprogess_operations.erase(p->it);
+            throw WinError("PostQueuedCompletionStatus");
+        }
+    }
+    void AsyncIo::cancel(SOCKET sock)
+    {
+        // Completes with ERROR_OPERATION_ABORTED
+        CancelIoEx((HANDLE)sock, NULL);
+    }
     void AsyncIo::iocp_loop()
     {
         while (running || !inprogess_operations.empty())
@@ -439,6 +631,14 @@ namespace http
                     auto send = (Send*)op.get();
                     send->handler(bytes);
                 }
+                else if (op->type == Operation::POST)
+                {
+                    ((Post*)op.get())->func();
+                }
+                else if (op->type == Operation::SEND_FILE)
+                {
+                    send_file_next(std::unique_ptr<SendFile, Operation::Deleter>((SendFile*)op.release()), bytes);
+                }
                 else
                 {
                     assert(op->type == Operation::SEND_ALL);
@@ -497,6 +697,42 @@ namespace http
             call_error(e, send->error);
         }
     }
+    void AsyncIo::send_file_next(std::unique_ptr<SendFile, Operation::Deleter> send, size_t sent)
+    {
+        try
+        {
+            send->sent += sent;
+            assert(send->sent <= send->len);
+            if (send->sent == send->len)
+            {
+                send->handler(send->sent);
+            }
+            else
+            {
+                // TransmitFile is limited to INT_MAX - 1 bytes per call
+                auto len = (DWORD)std::min<size_t>(std::numeric_limits<int>::max() - 1, send->len - send->sent);
+                auto offset = send->offset + send->sent;
+                std::unique_lock<std::mutex> lock(mutex);
+                if (!start_operation(send->sock, send->error)) return;
+                send->overlapped = { 0 };
+                send->overlapped.Offset = (DWORD)offset;
+                send->overlapped.OffsetHigh = (DWORD)(offset >> 32);
+                auto ret = TransmitFile(send->sock, send->file, len, 0, &send->overlapped, nullptr, 0);
+                auto err = WSAGetLastError();
+                if (ret || err == WSA_IO_PENDING)
+                {
+                    auto p = send.get();
+                    inprogess_operations.push_back(std::move(send));
+                    p->it = --inprogess_operations.end();
+                }
+                else throw SocketError(err);
+            }
+        }
+        catch (const std::exception &e)
+        {
+            call_error(e, send->error);
+        }
+    }
     #endif
 
     void AsyncIo::call_error(const std::exception &e, const ErrorHandler &handler)
@@ -164,19 +164,22 @@ namespace http
         return cert;
     }
 #else
-    struct File
+    namespace
     {
-        FILE *f;
-        File(const std::string &file_name)
-          : f(fopen(file_name.c_str(), "rb"))
-        {
-            if (!f) throw std::runtime_error("Failed to open certificate file " + file_name);
-        }
-        ~File()
+        struct CertFile
         {
-            if (f) fclose(f);
-        }
-    };
+            FILE *f;
+            CertFile(const std::string &file_name)
+              : f(fopen(file_name.c_str(), "rb"))
+            {
+                if (!f) throw std::runtime_error("Failed to open certificate file " + file_name);
+            }
+            ~CertFile()
+            {
+                if (f) fclose(f);
+            }
+        };
+    }
     struct OpenSslDeleter
     {
         void operator()(PKCS12 *pfx)const { PKCS12_free(pfx); }
@@ -199,7 +202,7 @@ namespace http
 
     PrivateCert load_pfx_cert(const std::string &file_name, const std::string &password)
     {
-        File f(file_name);
+        CertFile f(file_name);
 
         std::unique_ptr<PKCS12,OpenSslDeleter> pfx(d2i_PKCS12_fp(f.f, nullptr));
         if (!pfx) throw std::runtime_error("Failed to read pfx certificate " + file_name);
@@ -216,9 +219,36 @@ namespace http
         return out;
     }
 
-    PrivateCert load_pem_priv_cert(const std::string &, const std::string &)
+    PrivateCert load_pem_priv_cert(const std::string &crt_file, const std::string &key_file)
     {
-        std::terminate();
+        auto data = std::make_shared<OpenSslPrivateCertData>();
+        PrivateCert out(data); // For RAII
+
+        {
+            CertFile f(crt_file);
+            data->cert = PEM_read_X509(f.f, nullptr, nullptr, nullptr);
+            if (!data->cert) throw std::runtime_error("Failed to read pem certificate " + crt_file);
+            // Any further certificates are the chain, leaf first
+            while (auto ca = PEM_read_X509(f.f, nullptr, nullptr, nullptr))
+            {
+                if (!data->ca) data->ca = sk_X509_new_null();
+                if (!data->ca || !sk_X509_push(data->ca, ca))
+                {
+                    X509_free(ca);
+                    throw std::runtime_error("Failed to read pem certificate " + crt_file);
+                }
+            }
+            ERR_clear_error(); // End of file
+        }
+        {
+            CertFile f(key_file);
+            data->pkey = PEM_read_PrivateKey(f.f, nullptr, nullptr, nullptr);
+            if (!data->pkey) throw std::runtime_error("Failed to read pem private key " + key_file);
+        }
+        if (X509_check_private_key(data->cert, data->pkey) != 1)
+            throw std::runtime_error(key_file + " is not the private key for " + crt_file);
+
+        return out;
     }
 #endif
 }
@@ -0,0 +1,84 @@
+#include "net/CertWatcher.hpp"
+#include "util/Thread.hpp"
+namespace http
+{
+    CertSource pem_cert_source(const std::string &crt_file, const std::string &key_file)
+    {
+        CertSource source;
+        source.files = { crt_file, key_file };
+        source.load = [crt_file, key_file]() { return load_pem_priv_cert(crt_file, key_file); };
+        return source;
+    }
+    CertSource pfx_cert_source(const std::string &file, const std::string &password)
+    {
+        CertSource source;
+        source.files = { file };
+        source.load = [file, password]() { return load_pfx_cert(file, password); };
+        return source;
+    }
+
+    CertWatcher::CertWatcher(const CertSource &source, Handler handler, ErrorHandler error,
+        std::chrono::milliseconds interval)
+        : source(source), handler(handler), error(error), interval(interval)
+        , reload_count(0), exiting(false)
+    {
+        seen = stat_files();
+        thread = std::thread(&CertWatcher::run, this);
+    }
+    CertWatcher::~CertWatcher()
+    {
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            exiting = true;
+        }
+        cv.notify_one();
+        thread.join();
+    }
+
+    bool CertWatcher::check()
+    {
+        std::unique_lock<std::mutex> lock(check_mutex);
+        auto current = stat_files();
+        if (current == seen) return false;
+        // Not retried until another change, so a broken file is reported once
+        seen = current;
+        try
+        {
+            auto cert = source.load();
+            handler(cert);
+        }
+        catch (const std::exception &e)
+        {
+            if (error) error(e);
+            return false;
+        }
+        ++reload_count;
+        return true;
+    }
+
+    std::vector<FileInfo> CertWatcher::stat_files()const
+    {
+        std::vector<FileInfo> infos;
+        for (auto &file : source.files)
+        {
+            FileInfo info = { 0, 0 };
+            File::stat(file, &info);
+            infos.push_back(info);
+        }
+        return infos;
+    }
+
+    void CertWatcher::run()
+    {
+        set_thread_name("http::CertWatcher");
+        std::unique_lock<std::mutex> lock(mutex);
+        while (true)
+        {
+            cv.wait_for(lock, interval, [this]() { return exiting; });
+            if (exiting) break;
+            lock.unlock();
+            check();
+            lock.lock();
+        }
+    }
+}
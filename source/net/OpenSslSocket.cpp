@@ -14,6 +14,7 @@
 
 #include <iostream>
 #include <cassert>
+#include <stdexcept>
 
 namespace http
 {
@@ -22,18 +23,18 @@ namespace http
     OpenSslSocket::OpenSslSocket() : tcp(), ssl(nullptr)
     {
     }
-    OpenSslSocket::OpenSslSocket(const std::string &host, uint16_t port)
+    OpenSslSocket::OpenSslSocket(const std::string &host, uint16_t port, const SocketOptions &options)
         : tcp(), ssl(nullptr)
     {
-        connect(host, port);
+        connect(host, port, options);
     }
     OpenSslSocket::~OpenSslSocket()
     {
     }
 
-    void OpenSslSocket::connect(const std::string &host, uint16_t port)
+    void OpenSslSocket::connect(const std::string &host, uint16_t port, const SocketOptions &options)
     {
-        tcp.connect(host, port);
+        tcp.connect(host, port, options);
 
         ssl.reset(SSL_new(openssl_ctx.get()));
 
@@ -53,10 +54,41 @@ namespace http
             throw CertificateVerificationError(host, port);
     }
 
+    void OpenSslSocket::async_connect(AsyncIo &aio, TcpSocket &&socket,
+        std::function<void()> handler, AsyncIo::ErrorHandler error)
+    {
+        tcp = std::move(socket);
+        ssl.reset(SSL_new(openssl_ctx.get()));
+        create_bios();
+        SSL_set_connect_state(ssl.get());
+        async_handshake(aio,
+            [this, handler, error]()
+            {
+                try
+                {
+                    X509* cert = SSL_get_peer_certificate(ssl.get());
+                    if (cert) { X509_free(cert); }
+                    if (!cert) throw std::runtime_error(tcp.host() + " did not send a TLS certificate");
+                    if (SSL_get_verify_result(ssl.get()) != X509_V_OK)
+                        throw CertificateVerificationError(tcp.host(), tcp.port());
+                }
+                catch (const std::exception &) { return error(); }
+                handler();
+            }, error);
+    }
+
     std::string OpenSslSocket::address_str()const
     {
         return tcp.address_str();
     }
+    std::string OpenSslSocket::alpn_protocol()const
+    {
+        if (!ssl) return std::string();
+        const unsigned char *data = nullptr;
+        unsigned len = 0;
+        SSL_get0_alpn_selected(ssl.get(), &data, &len);
+        return std::string((const char*)data, len);
+    }
     bool OpenSslSocket::check_recv_disconnect()
     {
         return tcp.check_recv_disconnect();
@@ -110,9 +142,9 @@ namespace http
     {
         // Try to read data either buffered by SSL or by in_bio synchronously.
         // Read asynchronously from underlying socket and retry if get SSL_ERROR_WANT_READ.
+        // A send may be in progress at the same time, so out_bio is not necessarily empty
         try
         {
-            assert(BIO_ctrl_pending(out_bio) == 0);
             if (len > (size_t)std::numeric_limits<int>::max())
                 len = (size_t)std::numeric_limits<int>::max();
 
@@ -130,13 +162,13 @@ namespace http
                 }
                 else if (len2 < 0 && err == SSL_ERROR_WANT_READ)
                 {
-                    return tcp.async_recv(aio, bio_buffer, sizeof(bio_buffer),
+                    return tcp.async_recv(aio, recv_buffer, sizeof(recv_buffer),
                         [this, &aio, buffer, len, handler, error](size_t recv_len)
                         {
                             if (recv_len == 0) handler(0);
                             else
                             {
-                                BIO_write(in_bio, bio_buffer, (int)recv_len);
+                                BIO_write(in_bio, recv_buffer, (int)recv_len);
                                 async_recv(aio, buffer, len, handler, error);
                             }
                         }, error);
@@ -146,6 +178,12 @@ namespace http
         }
         catch (const std::exception &) { error(); }
     }
+    void OpenSslSocket::async_wait_recv(AsyncIo &aio, std::function<void()> handler, AsyncIo::ErrorHandler error)
+    {
+        // Encrypted data already received may contain a whole record
+        if (SSL_pending(ssl.get()) > 0 || BIO_ctrl_pending(in_bio) > 0) return handler();
+        tcp.async_wait_recv(aio, handler, error);
+    }
     void OpenSslSocket::async_send(AsyncIo &aio, const void *buffer, size_t len,
         AsyncIo::SendHandler handler, AsyncIo::ErrorHandler error)
     {
@@ -161,7 +199,6 @@ namespace http
         AsyncIo::SendHandler handler, AsyncIo::ErrorHandler error)
     {
         assert(SSL_is_init_finished(ssl.get()));
-        assert(BIO_ctrl_pending(out_bio) == 0);
         assert(len <= (size_t)std::numeric_limits<int>::max());
         try
         {
@@ -183,10 +220,12 @@ namespace http
     }
     void OpenSslSocket::async_send_bio(AsyncIo &aio, std::function<void()> handler, AsyncIo::ErrorHandler error)
     {
-        assert(BIO_ctrl_pending(out_bio) > 0);
-        auto len = BIO_read(out_bio, bio_buffer, (int)sizeof(bio_buffer));
+        auto pending = BIO_ctrl_pending(out_bio);
+        assert(pending > 0);
+        send_buffer.resize(pending);
+        auto len = BIO_read(out_bio, send_buffer.data(), (int)send_buffer.size());
         if (len <= 0) throw std::runtime_error("BIO_read failed");
-        tcp.async_send_all(aio, bio_buffer, (size_t)len,
+        tcp.async_send_all(aio, send_buffer.data(), (size_t)len,
             [this, &aio, handler, error](size_t)
             {
                 if (BIO_ctrl_pending(out_bio) > 0) async_send_bio(aio, handler, error);
@@ -195,20 +234,8 @@ namespace http
             error);
     }
 
-    OpenSslServerSocket::OpenSslServerSocket(TcpSocket &&socket, const PrivateCert &cert)
-        : OpenSslSocket()
-    {
-        setup(std::move(socket), cert);
-        SSL_set_fd(ssl.get(), (int)tcp.get());
-        if (SSL_accept(ssl.get()) <= 0)
-            throw std::runtime_error("SSL_accept failed");
-    }
-
-    void OpenSslServerSocket::async_create(AsyncIo &aio, TcpSocket &&socket, const PrivateCert &cert,
-        std::function<void()> handler, AsyncIo::ErrorHandler error)
+    void OpenSslSocket::create_bios()
     {
-        setup(std::move(socket), cert);
-
         in_bio = BIO_new(BIO_s_mem());
         out_bio = BIO_new(BIO_s_mem());
 
@@ -216,35 +243,9 @@ namespace http
         BIO_set_mem_eof_return(out_bio, EOF);
 
         SSL_set_bio(ssl.get(), in_bio, out_bio);
-
-        SSL_set_accept_state(ssl.get());
-
-        async_create_next(aio, handler, error);
-    }
-
-    void OpenSslServerSocket::setup(TcpSocket &&socket, const PrivateCert &cert)
-    {
-        openssl_ctx.reset(SSL_CTX_new(openssl_server_method));
-        if (!openssl_ctx) throw std::runtime_error("SSL_CTX_new failed");
-
-        SSL_CTX_set_ecdh_auto(openssl_ctx.get(), 1);
-
-        if (SSL_CTX_use_certificate(openssl_ctx.get(), cert.get()->cert) != 1)
-            throw std::runtime_error("SSL_CTX_use_certificate failed");
-        if (cert.get()->ca)
-            if (SSL_CTX_set0_chain(openssl_ctx.get(), cert.get()->ca) != 1)
-                throw std::runtime_error("SSL_CTX_set0_chain failed");
-
-        if (SSL_CTX_use_PrivateKey(openssl_ctx.get(), cert.get()->pkey) != 1)
-            throw std::runtime_error("SSL_CTX_use_PrivateKey failed");
-
-        tcp = std::move(socket);
-
-        ssl.reset(SSL_new(openssl_ctx.get()));
-        assert(tcp.get() < INT_MAX);
     }
 
-    void OpenSslServerSocket::async_create_next(AsyncIo &aio, std::function<void()> handler, AsyncIo::ErrorHandler error)
+    void OpenSslSocket::async_handshake(AsyncIo &aio, std::function<void()> handler, AsyncIo::ErrorHandler error)
     {
         try
         {
@@ -256,20 +257,21 @@ namespace http
                 auto err = SSL_get_error(ssl.get(), ret);
                 if (err == SSL_ERROR_WANT_WRITE || BIO_ctrl_pending(out_bio))
                 {
-                    return async_send_bio(aio, std::bind(&OpenSslServerSocket::async_create_next, this, std::ref(aio), handler, error), error);
+                    return async_send_bio(aio, std::bind(&OpenSslSocket::async_handshake, this, std::ref(aio), handler, error), error);
                 }
                 else if (err == SSL_ERROR_WANT_READ)
                 {
-                    tcp.async_recv(aio, bio_buffer, sizeof(bio_buffer),
+                    tcp.async_recv(aio, recv_buffer, sizeof(recv_buffer),
                         [this, &aio, handler, error](size_t len)
                         {
                             if (len == 0)
                             {
-                                try { throw ConnectionError("Client disconnected before TLS handshake complete", tcp.host(), tcp.port()); }
+                                try { throw ConnectionError("Disconnected before TLS handshake complete", tcp.host(), tcp.port()); }
                                 catch (const std::exception &) { error(); }
+                                return;
                             }
-                            BIO_write(in_bio, bio_buffer, (int)len);
-                            async_create_next(aio, handler, error);
+                            BIO_write(in_bio, recv_buffer, (int)len);
+                            async_handshake(aio, handler, error);
                         }, error);
                     return;
                 }
@@ -291,4 +293,72 @@ namespace http
             return error();
         }
     }
+
+    OpenSslServerSocket::OpenSslServerSocket(TcpSocket &&socket, const PrivateCert &cert)
+        : OpenSslSocket()
+    {
+        setup(std::move(socket), cert);
+        SSL_set_fd(ssl.get(), (int)tcp.get());
+        if (SSL_accept(ssl.get()) <= 0)
+            throw std::runtime_error("SSL_accept failed");
+    }
+
+    namespace
+    {
+        /**SSL_CTX_set_alpn_select_cb callback. arg is the servers protocol list.*/
+        int alpn_select(SSL *, const unsigned char **out, unsigned char *outlen,
+            const unsigned char *in, unsigned int inlen, void *arg)
+        {
+            auto protocols = (const std::string*)arg;
+            auto ret = SSL_select_next_proto((unsigned char**)out, outlen,
+                (const unsigned char*)protocols->data(), (unsigned)protocols->size(), in, inlen);
+            return ret == OPENSSL_NPN_NEGOTIATED ? SSL_TLSEXT_ERR_OK : SSL_TLSEXT_ERR_NOACK;
+        }
+    }
+
+    void OpenSslServerSocket::set_alpn_protocols(const std::vector<std::string> &protocols)
+    {
+        alpn_protocols.reset(new std::string());
+        for (auto &protocol : protocols)
+        {
+            if (protocol.empty() || protocol.size() > 255) throw std::invalid_argument("Invalid ALPN protocol");
+            alpn_protocols->push_back((char)protocol.size());
+            *alpn_protocols += protocol;
+        }
+    }
+
+    void OpenSslServerSocket::async_create(AsyncIo &aio, TcpSocket &&socket, const PrivateCert &cert,
+        std::function<void()> handler, AsyncIo::ErrorHandler error)
+    {
+        setup(std::move(socket), cert);
+        create_bios();
+        SSL_set_accept_state(ssl.get());
+        async_handshake(aio, handler, error);
+    }
+
+    void OpenSslServerSocket::setup(TcpSocket &&socket, const PrivateCert &cert)
+    {
+        openssl_ctx.reset(SSL_CTX_new(openssl_server_method));
+        if (!openssl_ctx) throw std::runtime_error("SSL_CTX_new failed");
+
+        SSL_CTX_set_ecdh_auto(openssl_ctx.get(), 1);
+
+        if (SSL_CTX_use_certificate(openssl_ctx.get(), cert.get()->cert) != 1)
+            throw std::runtime_error("SSL_CTX_use_certificate failed");
+        // The chain is shared by every connection using cert, so the context takes a copy
+        if (cert.get()->ca)
+            if (SSL_CTX_set1_chain(openssl_ctx.get(), cert.get()->ca) != 1)
+                throw std::runtime_error("SSL_CTX_set1_chain failed");
+
+        if (SSL_CTX_use_PrivateKey(openssl_ctx.get(), cert.get()->pkey) != 1)
+            throw std::runtime_error("SSL_CTX_use_PrivateKey failed");
+
+        if (alpn_protocols && !alpn_protocols->empty())
+            SSL_CTX_set_alpn_select_cb(openssl_ctx.get(), &alpn_select, alpn_protocols.get());
+
+        tcp = std::move(socket);
+
+        ssl.reset(SSL_new(openssl_ctx.get()));
+        assert(tcp.get() < INT_MAX);
+    }
 }
@@ -91,10 +91,10 @@ namespace http
     {
         *this = std::move(mv);
     }
-    SchannelSocket::SchannelSocket(const std::string & host, uint16_t port)
+    SchannelSocket::SchannelSocket(const std::string & host, uint16_t port, const SocketOptions &options)
         : SchannelSocket()
     {
-        connect(host, port);
+        connect(host, port, options);
     }
     SchannelSocket::SchannelSocket(SOCKET socket, const sockaddr * address)
         : SchannelSocket()
@@ -117,7 +117,7 @@ namespace http
     {
         tcp.set_socket(socket, address);
     }
-    void SchannelSocket::connect(const std::string & host, uint16_t port)
+    void SchannelSocket::connect(const std::string & host, uint16_t port, const SocketOptions &options)
     {
         assert(sspi);
 
@@ -125,7 +125,7 @@ namespace http
         credentials.reset();
         recv_encrypted_buffer.clear();
         recv_decrypted_buffer.clear();
-        tcp.connect(host, port);
+        tcp.connect(host, port, options);
 
         client_handshake();
         alloc_buffers();
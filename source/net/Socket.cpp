@@ -1,7 +1,64 @@
 #include "net/Socket.hpp"
 #include "net/Net.hpp"
+#include "util/File.hpp"
+#include <algorithm>
+#include <memory>
 namespace http
 {
+    namespace
+    {
+        const size_t SEND_FILE_BUFFER_SIZE = 65536;
+
+        /**State for the default Socket::async_send_file. Deletes itself on completion.*/
+        class SendFileBuffered
+        {
+        public:
+            SendFileBuffered(Socket &socket, AsyncIo &aio, const File &file, uint64_t offset, size_t len,
+                AsyncIo::SendHandler handler, AsyncIo::ErrorHandler error)
+                : socket(socket), aio(aio), file(file), offset(offset), len(len), sent(0)
+                , handler(handler), error(error)
+                , buffer(new char[std::min(len, SEND_FILE_BUFFER_SIZE)])
+            {}
+
+            void next()
+            {
+                if (sent == len)
+                {
+                    auto handler = this->handler;
+                    auto sent = this->sent;
+                    delete this;
+                    handler(sent);
+                    return;
+                }
+                size_t block;
+                try
+                {
+                    block = file.read(buffer.get(), std::min(len - sent, SEND_FILE_BUFFER_SIZE), offset + sent);
+                    if (block == 0) throw FileError(file.path(), "Unexpected end of file");
+                }
+                catch (const std::exception &)
+                {
+                    auto error = this->error;
+                    delete this;
+                    error();
+                    return;
+                }
+                socket.async_send_all(aio, buffer.get(), block,
+                    [this](size_t block) { sent += block; next(); },
+                    [this]() { auto error = this->error; delete this; error(); });
+            }
+        private:
+            Socket &socket;
+            AsyncIo &aio;
+            const File &file;
+            uint64_t offset;
+            size_t len;
+            size_t sent;
+            AsyncIo::SendHandler handler;
+            AsyncIo::ErrorHandler error;
+            std::unique_ptr<char[]> buffer;
+        };
+    }
     void Socket::send_all(const void *buffer, size_t len)
     {
         while (len > 0)
@@ -12,4 +69,14 @@ namespace http
             buffer = ((const char*)buffer) + sent;
         }
     }
+    void Socket::async_wait_recv(AsyncIo &aio, std::function<void()> handler, AsyncIo::ErrorHandler error)
+    {
+        if (recv_pending()) return handler();
+        aio.recv(get(), nullptr, 0, [handler](size_t) { handler(); }, error);
+    }
+    void Socket::async_send_file(AsyncIo &aio, const File &file, uint64_t offset, size_t len,
+        AsyncIo::SendHandler handler, AsyncIo::ErrorHandler error)
+    {
+        (new SendFileBuffered(*this, aio, file, offset, len, handler, error))->next();
+    }
 }
@@ -0,0 +1,76 @@
+#include "net/SocketOptions.hpp"
+#include "net/Net.hpp"
+#include "net/SocketUtils.hpp"
+#ifndef _WIN32
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#endif
+namespace http
+{
+    namespace
+    {
+        void set_option(SOCKET sock, int level, int name, int value, const char *name_str)
+        {
+            if (setsockopt(sock, level, name, (const char*)&value, (socklen_t)sizeof(value)))
+                throw SocketError(std::string("Failed to set ") + name_str, last_net_error());
+        }
+    }
+
+    void set_socket_options(SOCKET sock, const SocketOptions &options)
+    {
+        if (options.no_delay) set_option(sock, IPPROTO_TCP, TCP_NODELAY, 1, "TCP_NODELAY");
+        if (options.recv_buffer_size) set_option(sock, SOL_SOCKET, SO_RCVBUF, options.recv_buffer_size, "SO_RCVBUF");
+        if (options.send_buffer_size) set_option(sock, SOL_SOCKET, SO_SNDBUF, options.send_buffer_size, "SO_SNDBUF");
+        if (options.user_timeout.count())
+        {
+#ifdef TCP_USER_TIMEOUT
+            set_option(sock, IPPROTO_TCP, TCP_USER_TIMEOUT, (int)options.user_timeout.count(), "TCP_USER_TIMEOUT");
+#else
+            throw SocketError("TCP_USER_TIMEOUT is not supported");
+#endif
+        }
+    }
+    namespace detail
+    {
+        void set_listen_socket_options(SOCKET sock, const ListenSocketOptions &options)
+        {
+            set_socket_options(sock, options.socket);
+            if (options.reuse_port)
+            {
+#ifdef SO_REUSEPORT
+                set_option(sock, SOL_SOCKET, SO_REUSEPORT, 1, "SO_REUSEPORT");
+#else
+                throw SocketError("SO_REUSEPORT is not supported");
+#endif
+            }
+            if (options.defer_accept.count())
+            {
+#ifdef TCP_DEFER_ACCEPT
+                set_option(sock, IPPROTO_TCP, TCP_DEFER_ACCEPT, (int)options.defer_accept.count(), "TCP_DEFER_ACCEPT");
+#else
+                throw SocketError("TCP_DEFER_ACCEPT is not supported");
+#endif
+            }
+            if (options.fast_open_queue)
+            {
+#ifdef TCP_FASTOPEN
+                set_option(sock, IPPROTO_TCP, TCP_FASTOPEN, options.fast_open_queue, "TCP_FASTOPEN");
+#else
+                throw SocketError("TCP_FASTOPEN is not supported");
+#endif
+            }
+        }
+        void set_connect_socket_options(SOCKET sock, const SocketOptions &options)
+        {
+            set_socket_options(sock, options);
+            if (options.fast_open)
+            {
+#ifdef TCP_FASTOPEN_CONNECT
+                set_option(sock, IPPROTO_TCP, TCP_FASTOPEN_CONNECT, 1, "TCP_FASTOPEN_CONNECT");
+#else
+                throw SocketError("TCP_FASTOPEN_CONNECT is not supported");
+#endif
+            }
+        }
+    }
+}
@@ -1,6 +1,7 @@
 #pragma once
 #include "net/Os.hpp"
 #include "net/Net.hpp"
+#include "net/SocketOptions.hpp"
 #include <cassert>
 #include <fcntl.h>
 namespace http
@@ -9,14 +10,21 @@ namespace http
     {
         assert(sock != INVALID_SOCKET);
 #ifdef WIN32
-        unsigned long mode = non_blocking ? 0 : 1;
+        unsigned long mode = non_blocking ? 1 : 0;
         auto ret = ioctlsocket(sock, FIONBIO, &mode);
 #else
         int flags = fcntl(sock, F_GETFL, 0);
         if (flags < 0) throw std::runtime_error("fcntl get failed");
-        flags = non_blocking ? (flags&~O_NONBLOCK) : (flags | O_NONBLOCK);
+        flags = non_blocking ? (flags | O_NONBLOCK) : (flags&~O_NONBLOCK);
         auto ret = fcntl(sock, F_SETFL, flags);
 #endif
         if (ret) throw SocketError(last_net_error());
     }
+    namespace detail
+    {
+        /**Set options on a listen socket before bind.*/
+        void set_listen_socket_options(SOCKET sock, const ListenSocketOptions &options);
+        /**Set options on a client socket before connect, including fast_open.*/
+        void set_connect_socket_options(SOCKET sock, const SocketOptions &options);
+    }
 }
@@ -2,35 +2,126 @@
 #include "net/Net.hpp"
 #include "net/TcpSocket.hpp"
 #include "net/SocketUtils.hpp"
+#ifndef _WIN32
+#include <cstring>
+#include <sys/stat.h>
+#include <sys/un.h>
+#endif
 namespace http
 {
-    TcpListenSocket::TcpListenSocket(const std::string &bind, uint16_t port)
+    TcpListenSocket::TcpListenSocket(const std::string &bind, uint16_t port, int backlog, bool v6_only)
+        : TcpListenSocket(bind, port, listen_options(backlog, v6_only))
+    {
+    }
+    TcpListenSocket::TcpListenSocket(const std::string &bind, uint16_t port, const ListenSocketOptions &options)
         : socket(INVALID_SOCKET)
     {
-        socket = create_socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+        //bind address, IPv4 or IPv6 with optional brackets
+        auto host = bind;
+        if (host.size() > 2 && host.front() == '[' && host.back() == ']') host = host.substr(1, host.size() - 2);
+        sockaddr_storage bind_addr = {};
+        socklen_t bind_addr_len;
+        auto addr4 = (sockaddr_in*)&bind_addr;
+        auto addr6 = (sockaddr_in6*)&bind_addr;
+        if (inet_pton(AF_INET, host.c_str(), &addr4->sin_addr) == 1)
+        {
+            addr4->sin_family = AF_INET;
+            addr4->sin_port = htons(port);
+            bind_addr_len = (socklen_t)sizeof(sockaddr_in);
+        }
+        else if (inet_pton(AF_INET6, host.c_str(), &addr6->sin6_addr) == 1)
+        {
+            addr6->sin6_family = AF_INET6;
+            addr6->sin6_port = htons(port);
+            bind_addr_len = (socklen_t)sizeof(sockaddr_in6);
+        }
+        else throw std::runtime_error("Invalid bind address: " + bind);
+
+        socket = create_socket(bind_addr.ss_family, SOCK_STREAM, IPPROTO_TCP);
         if (socket == INVALID_SOCKET) throw std::runtime_error("Failed to create listen socket");
+        auto fail = [this](const std::string &msg)
+        {
+            closesocket(socket);
+            socket = INVALID_SOCKET;
+            throw std::runtime_error(msg);
+        };
         //allow fast restart
 #ifndef _WIN32
         int yes = 1;
         setsockopt(socket, SOL_SOCKET, SO_REUSEADDR, (const char*)&yes, sizeof(yes));
 #endif
-        //bind socket
-        //TODO: Support IPv6
-        sockaddr_in bind_addr = { 0 };
-        bind_addr.sin_family = AF_INET;
-        bind_addr.sin_port = htons(port);
-        if (inet_pton(AF_INET, bind.c_str(), &bind_addr.sin_addr) != 1)
-            throw std::runtime_error("Invalid bind address: " + bind);
-
-        if (::bind(socket, (const sockaddr*)&bind_addr, sizeof(bind_addr)))
-            throw std::runtime_error("Failed to bind listen socket to " + bind + ":" + std::to_string(port));
+        //dual-stack, unless only IPv6 was requested. The OS default varies.
+        if (bind_addr.ss_family == AF_INET6)
+        {
+            int v6_only_opt = options.v6_only ? 1 : 0;
+            if (setsockopt(socket, IPPROTO_IPV6, IPV6_V6ONLY, (const char*)&v6_only_opt, sizeof(v6_only_opt)))
+                fail("Failed to set IPV6_V6ONLY for " + bind);
+        }
+        auto address = bind_addr.ss_family == AF_INET6 ? "[" + host + "]:" : host + ":";
+        address += std::to_string(port);
+        try
+        {
+            detail::set_listen_socket_options(socket, options);
+        }
+        catch (const std::exception &e)
+        {
+            fail(std::string(e.what()) + " for " + address);
+        }
+        if (::bind(socket, (const sockaddr*)&bind_addr, bind_addr_len))
+            fail("Failed to bind listen socket to " + address);
         //listen
-        if (::listen(socket, 10))
-            throw std::runtime_error("Socket listen failed for " + bind + ":" + std::to_string(port));
+        if (::listen(socket, options.backlog))
+            fail("Socket listen failed for " + address);
+    }
+    ListenSocketOptions TcpListenSocket::listen_options(int backlog, bool v6_only)
+    {
+        ListenSocketOptions options;
+        options.backlog = backlog;
+        options.v6_only = v6_only;
+        return options;
     }
     TcpListenSocket::TcpListenSocket()
+        : socket(INVALID_SOCKET)
     {
-        closesocket(socket);
+    }
+    TcpListenSocket::~TcpListenSocket()
+    {
+        if (socket != INVALID_SOCKET)
+        {
+            closesocket(socket);
+#ifndef _WIN32
+            if (!unix_path.empty()) unlink(unix_path.c_str());
+#endif
+        }
+    }
+    TcpListenSocket TcpListenSocket::unix_domain(const std::string &path, int backlog)
+    {
+#ifdef _WIN32
+        (void)path;
+        (void)backlog;
+        throw std::runtime_error("Unix domain sockets are not supported");
+#else
+        sockaddr_un bind_addr = {};
+        bind_addr.sun_family = AF_UNIX;
+        if (path.empty() || path.size() >= sizeof(bind_addr.sun_path))
+            throw std::runtime_error("Invalid Unix socket path: " + path);
+        memcpy(bind_addr.sun_path, path.c_str(), path.size() + 1);
+
+        TcpListenSocket listen;
+        listen.socket = create_socket(AF_UNIX, SOCK_STREAM, 0);
+        if (listen.socket == INVALID_SOCKET) throw std::runtime_error("Failed to create listen socket");
+        // A socket file left by a previous process would make bind fail. Only replace sockets,
+        // never other files.
+        struct stat st;
+        if (lstat(path.c_str(), &st) == 0 && S_ISSOCK(st.st_mode)) unlink(path.c_str());
+
+        if (::bind(listen.socket, (const sockaddr*)&bind_addr, sizeof(bind_addr)))
+            throw SocketError("Failed to bind listen socket to " + path, last_net_error());
+        listen.unix_path = path;
+        if (::listen(listen.socket, backlog))
+            throw SocketError("Socket listen failed for " + path, last_net_error());
+        return listen;
+#endif
     }
     void TcpListenSocket::set_non_blocking(bool non_blocking)
     {
@@ -2,21 +2,31 @@
 #include "net/Os.hpp"
 #include "net/Net.hpp"
 #include "net/SocketUtils.hpp"
+#include "util/File.hpp"
+#include <algorithm>
+#include <chrono>
 #include <limits>
 #include <cassert>
+#include <vector>
+#ifndef _WIN32
+#include <cstring>
+#include <sys/un.h>
+#endif
 namespace http
 {
+    const std::chrono::milliseconds TcpSocket::CONNECT_ATTEMPT_DELAY(250);
+
     TcpSocket::TcpSocket()
-        : socket(INVALID_SOCKET), _host(), _port(0)
+        : socket(INVALID_SOCKET), _host(), _port(0), unix_domain(false)
     {
     }
-    TcpSocket::TcpSocket(const std::string & host, uint16_t port)
-        : socket(INVALID_SOCKET), _host(), _port(0)
+    TcpSocket::TcpSocket(const std::string & host, uint16_t port, const SocketOptions &options)
+        : socket(INVALID_SOCKET), _host(), _port(0), unix_domain(false)
     {
-        connect(host, port);
+        connect(host, port, options);
     }
     TcpSocket::TcpSocket(SOCKET socket, const sockaddr *address)
-        : socket(INVALID_SOCKET), _host(), _port(0)
+        : socket(INVALID_SOCKET), _host(), _port(0), unix_domain(false)
     {
         set_socket(socket, address);
     }
@@ -26,7 +36,7 @@ namespace http
     }
 
     TcpSocket::TcpSocket(TcpSocket &&mv)
-        : socket(), _host(std::move(mv._host)), _port(mv._port)
+        : socket(), _host(std::move(mv._host)), _port(mv._port), unix_domain(mv.unix_domain)
     {
         socket = mv.socket;
         mv.socket = INVALID_SOCKET;
@@ -37,12 +47,14 @@ namespace http
         mv.socket = INVALID_SOCKET;
         _host = std::move(mv._host);
         _port = mv._port;
+        unix_domain = mv.unix_domain;
         return *this;
     }
 
     void TcpSocket::set_socket(SOCKET _socket, const sockaddr *address)
     {
         if (socket != INVALID_SOCKET) throw std::runtime_error("Already connected");
+        unix_domain = false;
         if (address->sa_family == AF_INET)
         {
             auto addr4 = (sockaddr_in*)address;
@@ -55,14 +67,27 @@ namespace http
         {
             auto addr6 = (sockaddr_in6*)address;
             char ipstr[INET6_ADDRSTRLEN];
-            inet_ntop(AF_INET6, &addr6->sin6_addr, ipstr, sizeof ipstr);
+            // IPv4 clients of a dual-stack listener are reported in their IPv4 form
+            if (IN6_IS_ADDR_V4MAPPED(&addr6->sin6_addr))
+                inet_ntop(AF_INET, &addr6->sin6_addr.s6_addr[12], ipstr, sizeof ipstr);
+            else inet_ntop(AF_INET6, &addr6->sin6_addr, ipstr, sizeof ipstr);
             _port = ntohs(addr6->sin6_port);
             _host = ipstr;
         }
+#ifndef _WIN32
+        else if (address->sa_family == AF_UNIX)
+        {
+            // sun_path is empty for unnamed sockets, and may not be null terminated if full
+            auto addr_un = (const sockaddr_un*)address;
+            _host.assign(addr_un->sun_path, strnlen(addr_un->sun_path, sizeof(addr_un->sun_path)));
+            _port = 0;
+            unix_domain = true;
+        }
+#endif
         else throw std::runtime_error("Unknown socket family");
         socket = _socket;
     }
-    void TcpSocket::connect(const std::string & host, uint16_t port)
+    void TcpSocket::connect(const std::string & host, uint16_t port, const SocketOptions &options)
     {
         struct AddrInfoPtr
         {
@@ -70,43 +95,196 @@ namespace http
             AddrInfoPtr() : p(nullptr) {}
             ~AddrInfoPtr() { freeaddrinfo (p); }
         };
+        struct Attempt
+        {
+            SOCKET socket;
+            std::chrono::steady_clock::time_point started;
+        };
 
         if (socket != INVALID_SOCKET) throw std::runtime_error("Already connected");
 
+        // IPv6 literals may be given in URL form
+        auto name = host;
+        if (name.size() > 2 && name.front() == '[' && name.back() == ']') name = name.substr(1, name.size() - 2);
         auto port_str = std::to_string(port);
         AddrInfoPtr result;
 
         addrinfo hints = {};
-        hints.ai_family = AF_INET;
+        hints.ai_family = AF_UNSPEC;
         hints.ai_socktype = SOCK_STREAM;
         hints.ai_protocol = IPPROTO_TCP;
 
-        auto ret = getaddrinfo(host.c_str(), port_str.c_str(), &hints, &result.p);
+        auto ret = getaddrinfo(name.c_str(), port_str.c_str(), &hints, &result.p);
         if (ret) throw ConnectionError(host, port);
         assert(result.p);
 
+        auto addresses = happy_eyeballs_order(result.p);
+        std::vector<Attempt> attempts;
+        size_t next = 0;
+        auto next_start = std::chrono::steady_clock::now();
         int last_error = 0;
-        for (auto p = result.p; p; p = p->ai_next)
+        auto close_attempts = [&attempts]()
         {
-            socket = ::socket(p->ai_family, p->ai_socktype, p->ai_protocol);
-            if (socket == INVALID_SOCKET) continue;
+            for (auto &i : attempts) closesocket(i.socket);
+        };
+        SOCKET connected = INVALID_SOCKET;
+        while (connected == INVALID_SOCKET)
+        {
+            auto now = std::chrono::steady_clock::now();
+            if (next < addresses.size() && (attempts.empty() || now >= next_start))
+            {
+                // Start the next attempt, without waiting for previous ones
+                auto addr = addresses[next++];
+                next_start = now + CONNECT_ATTEMPT_DELAY;
+                auto sock = ::socket(addr->ai_family, addr->ai_socktype, addr->ai_protocol);
+                if (sock == INVALID_SOCKET)
+                {
+                    last_error = last_net_error();
+                    continue;
+                }
+                try
+                {
+                    detail::set_connect_socket_options(sock, options);
+                    http::set_non_blocking(sock, true);
+                }
+                catch (const std::exception &)
+                {
+                    closesocket(sock);
+                    close_attempts();
+                    throw;
+                }
+                if (::connect(sock, addr->ai_addr, (int)addr->ai_addrlen) != SOCKET_ERROR)
+                {
+                    connected = sock;
+                    break;
+                }
+                auto err = last_net_error();
+#ifdef _WIN32
+                bool in_progress = err == WSAEWOULDBLOCK;
+#else
+                bool in_progress = err == EINPROGRESS;
+#endif
+                if (in_progress) attempts.push_back({ sock, now });
+                else
+                {
+                    last_error = err;
+                    closesocket(sock);
+                    next_start = now;
+                }
+                continue;
+            }
+            if (attempts.empty()) break; // All failed
 
-            if (::connect(socket, p->ai_addr, (int)p->ai_addrlen) != SOCKET_ERROR)
+            // Wait for an attempt to complete, or the time to start another
+            fd_set write_set, except_set;
+            FD_ZERO(&write_set);
+            FD_ZERO(&except_set);
+            SOCKET max_socket = 0;
+            for (auto &i : attempts)
             {
-                this->_host = host;
-                this->_port = port;
-                return;
+                FD_SET(i.socket, &write_set);
+                FD_SET(i.socket, &except_set);
+                max_socket = std::max(max_socket, i.socket);
             }
-            else
+            timeval timeout = {};
+            timeval *timeout_p = nullptr;
+            if (next < addresses.size())
+            {
+                auto wait = std::chrono::duration_cast<std::chrono::microseconds>(next_start - now).count();
+                if (wait < 0) wait = 0;
+                timeout.tv_sec = (long)(wait / 1000000);
+                timeout.tv_usec = (long)(wait % 1000000);
+                timeout_p = &timeout;
+            }
+            if (select((int)max_socket + 1, nullptr, &write_set, &except_set, timeout_p) < 0)
             {
                 last_error = last_net_error();
-                closesocket(socket);
-                continue;
+                close_attempts();
+                throw ConnectionError(last_error, host, port);
             }
+            for (auto i = attempts.begin(); i != attempts.end();)
+            {
+                if (!FD_ISSET(i->socket, &write_set) && !FD_ISSET(i->socket, &except_set))
+                {
+                    ++i;
+                    continue;
+                }
+                int err = 0;
+                socklen_t err_len = (socklen_t)sizeof(err);
+                if (getsockopt(i->socket, SOL_SOCKET, SO_ERROR, (char*)&err, &err_len)) err = last_net_error();
+                if (!err)
+                {
+                    connected = i->socket;
+                    attempts.erase(i);
+                    break;
+                }
+                // Failed, so move straight on to the next address
+                last_error = err;
+                closesocket(i->socket);
+                i = attempts.erase(i);
+                next_start = std::chrono::steady_clock::now();
+            }
+        }
+        close_attempts();
+        if (connected == INVALID_SOCKET)
+        {
+            //TODO: Better error report if there were multiple possible address
+            throw ConnectionError(last_error, host, port);
+        }
+        http::set_non_blocking(connected, false);
+        socket = connected;
+        this->_host = host;
+        this->_port = port;
+        unix_domain = false;
+    }
+    void TcpSocket::connect_unix(const std::string &path)
+    {
+        if (socket != INVALID_SOCKET) throw std::runtime_error("Already connected");
+#ifdef _WIN32
+        throw ConnectionError("Unix domain sockets are not supported", path, 0);
+#else
+        sockaddr_un addr = {};
+        addr.sun_family = AF_UNIX;
+        if (path.empty() || path.size() >= sizeof(addr.sun_path))
+            throw ConnectionError("Invalid Unix socket path", path, 0);
+        memcpy(addr.sun_path, path.c_str(), path.size() + 1);
 
+        socket = create_socket(AF_UNIX, SOCK_STREAM, 0);
+        if (socket == INVALID_SOCKET) throw ConnectionError(path, 0);
+        if (::connect(socket, (const sockaddr*)&addr, sizeof(addr)) == SOCKET_ERROR)
+        {
+            auto err = last_net_error();
+            closesocket(socket);
+            socket = INVALID_SOCKET;
+            throw ConnectionError(err, path, 0);
+        }
+        _host = path;
+        _port = 0;
+        unix_domain = true;
+#endif
+    }
+    std::vector<const addrinfo*> TcpSocket::happy_eyeballs_order(const addrinfo *addresses)
+    {
+        // Keep the resolver's preference within each family, but alternate between them
+        // starting with the family of the first address (RFC 8305 section 4).
+        std::vector<const addrinfo*> first, other;
+        for (auto p = addresses; p; p = p->ai_next)
+        {
+            if (p->ai_family == addresses->ai_family) first.push_back(p);
+            else other.push_back(p);
         }
-        //TODO: Better error report if there were multiple possible address
-        throw ConnectionError(last_error, host, port);
+        std::vector<const addrinfo*> ordered;
+        ordered.reserve(first.size() + other.size());
+        for (size_t i = 0; i < first.size() || i < other.size(); ++i)
+        {
+            if (i < first.size()) ordered.push_back(first[i]);
+            if (i < other.size()) ordered.push_back(other[i]);
+        }
+        return ordered;
+    }
+    void TcpSocket::set_options(const SocketOptions &options)
+    {
+        set_socket_options(socket, options);
     }
     void TcpSocket::set_non_blocking(bool non_blocking)
     {
@@ -114,8 +292,11 @@ namespace http
     }
     std::string TcpSocket::address_str() const
     {
-        if (socket != INVALID_SOCKET) return _host + ":" + std::to_string(_port);
-        else return "Not connected";
+        if (socket == INVALID_SOCKET) return "Not connected";
+        else if (unix_domain) return "unix:" + _host;
+        else if (_host.find(':') != std::string::npos && _host.front() != '[')
+            return "[" + _host + "]:" + std::to_string(_port);
+        else return _host + ":" + std::to_string(_port);
     }
     void TcpSocket::close()
     {
@@ -221,4 +402,9 @@ namespace http
     {
         aio.send_all(socket, buffer, len, handler, error);
     }
+    void TcpSocket::async_send_file(AsyncIo &aio, const File &file, uint64_t offset, size_t len,
+        AsyncIo::SendHandler handler, AsyncIo::ErrorHandler error)
+    {
+        aio.send_file(socket, file.get(), offset, len, handler, error);
+    }
 }
@@ -0,0 +1,155 @@
+#include "server/AccessLog.hpp"
+#include "Time.hpp"
+#include <cassert>
+#include <ostream>
+namespace http
+{
+    namespace
+    {
+        /**Append a string, escaping quotes and control characters so log lines can be parsed.*/
+        void append_escaped(std::string *out, const char *str)
+        {
+            static const char HEX[] = "0123456789ABCDEF";
+            for (auto p = str; *p; ++p)
+            {
+                auto c = (unsigned char)*p;
+                if (c == '"' || c == '\\' || c < 0x20 || c == 0x7F)
+                {
+                    *out += "\\x";
+                    out->push_back(HEX[c >> 4]);
+                    out->push_back(HEX[c & 0xF]);
+                }
+                else out->push_back((char)c);
+            }
+        }
+    }
+
+    AccessLog::Ring::Ring(size_t size)
+        : records(new AccessLogRecord[size]), mask(size - 1), head(0), tail(0), dropped(0)
+    {
+        assert((size & mask) == 0);
+    }
+
+    AccessLog::AccessLog(Writer writer, size_t ring_size, std::chrono::milliseconds interval)
+        : writer(writer), interval(interval)
+        , rings([ring_size]()
+            {
+                size_t size = 1;
+                while (size < ring_size) size <<= 1;
+                return std::unique_ptr<Ring>(new Ring(size));
+            })
+        , written_count(0), writer_dropped(0)
+        , exiting(false), flush_requests(0), flushed(0)
+    {
+        thread = std::thread(&AccessLog::run, this);
+    }
+    AccessLog::AccessLog(std::ostream &out, size_t ring_size, std::chrono::milliseconds interval)
+        : AccessLog([&out](const std::string &data)
+            {
+                out.write(data.data(), data.size());
+                out.flush();
+            }, ring_size, interval)
+    {}
+    AccessLog::~AccessLog()
+    {
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            exiting = true;
+        }
+        cv.notify_one();
+        thread.join();
+    }
+
+    void AccessLog::log(const AccessLogRecord &record)
+    {
+        auto &ring = rings.local();
+        auto head = ring.head.load(std::memory_order_relaxed);
+        if (head - ring.tail.load(std::memory_order_acquire) > ring.mask)
+        {
+            ring.dropped.store(ring.dropped.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+            return;
+        }
+        ring.records[head & ring.mask] = record;
+        ring.head.store(head + 1, std::memory_order_release);
+    }
+    void AccessLog::flush()
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        auto request = ++flush_requests;
+        cv.notify_one();
+        flushed_cv.wait(lock, [this, request]() { return flushed >= request; });
+    }
+    uint64_t AccessLog::dropped()const
+    {
+        uint64_t total = writer_dropped.load(std::memory_order_relaxed);
+        for (auto ring : rings.all()) total += ring->dropped.load(std::memory_order_relaxed);
+        return total;
+    }
+
+    void AccessLog::format(const AccessLogRecord &record, std::string *out)
+    {
+        append_escaped(out, record.remote);
+        *out += " - - [";
+        char date[TIME_STR_LEN];
+        format_time(std::chrono::system_clock::to_time_t(record.time), date);
+        out->append(date, TIME_STR_LEN);
+        *out += "] \"";
+        append_escaped(out, record.method);
+        out->push_back(' ');
+        append_escaped(out, record.path);
+        *out += " HTTP/";
+        *out += std::to_string(record.version.major);
+        out->push_back('.');
+        *out += std::to_string(record.version.minor);
+        *out += "\" ";
+        *out += std::to_string(record.status);
+        out->push_back(' ');
+        *out += std::to_string(record.response_bytes);
+        out->push_back(' ');
+        *out += std::to_string(record.request_bytes);
+        out->push_back(' ');
+        *out += std::to_string(record.duration_us);
+        out->push_back('\n');
+    }
+
+    void AccessLog::run()
+    {
+        std::string batch;
+        std::unique_lock<std::mutex> lock(mutex);
+        while (true)
+        {
+            auto request = flush_requests;
+            bool exit = exiting;
+            lock.unlock();
+            write_queued(&batch);
+            lock.lock();
+
+            flushed = request;
+            flushed_cv.notify_all();
+            if (exit) break;
+            if (flush_requests == request && !exiting) cv.wait_for(lock, interval);
+        }
+    }
+    void AccessLog::write_queued(std::string *batch)
+    {
+        batch->clear();
+        uint64_t count = 0;
+        for (auto ring : rings.all())
+        {
+            auto tail = ring->tail.load(std::memory_order_relaxed);
+            auto head = ring->head.load(std::memory_order_acquire);
+            for (; tail != head; ++tail, ++count) format(ring->records[tail & ring->mask], batch);
+            ring->tail.store(tail, std::memory_order_release);
+        }
+        if (!count) return;
+        try
+        {
+            writer(*batch);
+            written_count.fetch_add(count, std::memory_order_relaxed);
+        }
+        catch (const std::exception &)
+        {
+            writer_dropped.fetch_add(count, std::memory_order_relaxed);
+        }
+    }
+}
@@ -0,0 +1,114 @@
+#include "server/ClientLimiter.hpp"
+#include <algorithm>
+#include <cmath>
+#include <functional>
+namespace http
+{
+    ClientLimiter::ClientLimiter(const ClientLimitOptions &options)
+        : opts(options), rejected_connections(0), rejected_requests(0)
+    {
+        size_t size = SET_SIZE;
+        while (size < opts.max_clients) size <<= 1;
+        slots.reset(new Slot[size]);
+        mask = size - 1;
+        for (size_t i = 0; i < size; ++i)
+        {
+            slots[i].key.store(0, std::memory_order_relaxed);
+            slots[i].tat.store(0, std::memory_order_relaxed);
+            slots[i].connections.store(0, std::memory_order_relaxed);
+        }
+
+        if (opts.requests_per_second > 0)
+        {
+            auto burst = opts.burst >= 1 ? opts.burst : std::max(1.0, opts.requests_per_second);
+            emission_interval = (int64_t)(1e9 / opts.requests_per_second);
+            burst_tolerance = (int64_t)((burst - 1) * (double)emission_interval);
+        }
+        else emission_interval = burst_tolerance = 0;
+    }
+
+    bool ClientLimiter::open_connection(const std::string &host, size_t *slot)
+    {
+        *slot = find_slot(host, to_ns(std::chrono::steady_clock::now()));
+        auto &connections = slots[*slot].connections;
+        if (!opts.max_connections)
+        {
+            connections.fetch_add(1, std::memory_order_relaxed);
+            return true;
+        }
+        auto count = connections.load(std::memory_order_relaxed);
+        do
+        {
+            if (count >= opts.max_connections)
+            {
+                rejected_connections.fetch_add(1, std::memory_order_relaxed);
+                return false;
+            }
+        }
+        while (!connections.compare_exchange_weak(count, count + 1, std::memory_order_relaxed));
+        return true;
+    }
+    void ClientLimiter::close_connection(size_t slot)
+    {
+        slots[slot].connections.fetch_sub(1, std::memory_order_relaxed);
+    }
+    bool ClientLimiter::allow_request(size_t slot, std::chrono::steady_clock::time_point now)
+    {
+        if (!emission_interval) return true;
+        auto now_ns = to_ns(now);
+        auto &tat = slots[slot].tat;
+        auto current = tat.load(std::memory_order_relaxed);
+        int64_t next;
+        do
+        {
+            next = std::max(current, now_ns);
+            if (next - now_ns > burst_tolerance)
+            {
+                rejected_requests.fetch_add(1, std::memory_order_relaxed);
+                return false;
+            }
+            next += emission_interval;
+        }
+        while (!tat.compare_exchange_weak(current, next, std::memory_order_relaxed));
+        return true;
+    }
+    unsigned ClientLimiter::retry_after()const
+    {
+        auto seconds = (unsigned)std::ceil((double)emission_interval / 1e9);
+        return seconds ? seconds : 1;
+    }
+    ClientLimiterStats ClientLimiter::stats()const
+    {
+        ClientLimiterStats stats;
+        stats.rejected_connections = rejected_connections.load(std::memory_order_relaxed);
+        stats.rejected_requests = rejected_requests.load(std::memory_order_relaxed);
+        return stats;
+    }
+
+    size_t ClientLimiter::find_slot(const std::string &host, int64_t now)
+    {
+        uint64_t key = std::hash<std::string>()(host);
+        if (!key) key = 1;
+        auto first = (size_t)key & mask & ~(SET_SIZE - 1);
+        for (size_t i = first; i < first + SET_SIZE; ++i)
+        {
+            if (slots[i].key.load(std::memory_order_relaxed) == key) return i;
+        }
+        for (size_t i = first; i < first + SET_SIZE; ++i)
+        {
+            auto &slot = slots[i];
+            auto old = slot.key.load(std::memory_order_relaxed);
+            // Take over an unused slot, or one whose client has no connections and a full bucket,
+            // so would be in the same state if it were new
+            bool idle = old == 0 || (slot.connections.load(std::memory_order_relaxed) == 0 &&
+                slot.tat.load(std::memory_order_relaxed) <= now);
+            if (idle && slot.key.compare_exchange_strong(old, key, std::memory_order_relaxed)) return i;
+            if (old == key) return i; // Claimed by another thread for the same client
+        }
+        return first;
+    }
+    int64_t ClientLimiter::to_ns(std::chrono::steady_clock::time_point time)
+    {
+        return (int64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(time.time_since_epoch()).count();
+    }
+}
@@ -1,4 +1,10 @@
 #include "server/CoreServer.hpp"
+#include "server/AccessLog.hpp"
+#include "server/ClientLimiter.hpp"
+#include "server/ResponseCache.hpp"
+#include "server/EventStream.hpp"
+#include "server/ResponseCompressor.hpp"
+#include "server/WebSocket.hpp"
 #include "core/Parser.hpp"
 #include "core/ParserUtils.hpp"
 #include "core/Writer.hpp"
@@ -7,17 +13,71 @@
 #include "net/TcpListenSocket.hpp"
 #include "net/TcpSocket.hpp"
 #include "net/TlsSocket.hpp"
+#include "util/File.hpp"
+#include "util/Metrics.hpp"
 #include "util/Thread.hpp"
 #include "String.hpp"
 #include "Error.hpp"
 #include <cassert>
+#include <cstdlib>
 #include <cstring>
 #include <chrono>
 #include <iostream>
+#include <stdexcept>
 #include <typeinfo>
 
 namespace http
 {
+    namespace
+    {
+        /**Replace response with a plain text error page.*/
+        void error_response(Response &response, StatusCode sc, const char *msg)
+        {
+            response = Response();
+            response.status.code = sc;
+            response.body = msg;
+            response.headers.add("Content-Type", "text/plain");
+        }
+
+        const char CONTINUE_RESPONSE[] = "HTTP/1.1 100 Continue\r\n\r\n";
+        const char SHED_RESPONSE_BODY[] = "Server overloaded, try again later";
+        const char RATE_LIMITED_RESPONSE_BODY[] = "Too many requests, try again later";
+
+        /**A plain text error page asking the client to retry later.*/
+        Response retry_response(StatusCode sc, const char *msg, unsigned retry_after)
+        {
+            Response response;
+            error_response(response, sc, msg);
+            response.headers.add("Retry-After", std::to_string(retry_after));
+            return response;
+        }
+        /**Pre-serialize a retry_response, to be sent to HTTP/1 clients without any other work.*/
+        std::shared_ptr<const CachedResponse> cached_retry_response(StatusCode sc, const char *msg, unsigned retry_after)
+        {
+            auto cached = std::make_shared<CachedResponse>();
+            cached->body = msg;
+            cached->head = "HTTP/1.1 " + std::to_string((int)sc) + " " + default_status_msg(sc) + "\r\n"
+                "Content-Type: text/plain\r\n"
+                "Retry-After: " + std::to_string(retry_after) + "\r\n"
+                "Content-Length: " + std::to_string(cached->body.size()) + "\r\n";
+            return cached;
+        }
+
+        uint64_t elapsed_us(std::chrono::steady_clock::time_point start)
+        {
+            auto elapsed = std::chrono::steady_clock::now() - start;
+            return (uint64_t)std::chrono::duration_cast<std::chrono::microseconds>(elapsed).count();
+        }
+        /**Set the start time and duration of an access log record for a request started at start.*/
+        void set_request_time(AccessLogRecord &record, std::chrono::steady_clock::time_point start)
+        {
+            auto elapsed = std::chrono::steady_clock::now() - start;
+            record.time = std::chrono::system_clock::now() -
+                std::chrono::duration_cast<std::chrono::system_clock::duration>(elapsed);
+            record.duration_us = (uint64_t)std::chrono::duration_cast<std::chrono::microseconds>(elapsed).count();
+        }
+    }
+
     class CoreServer::Connection
     {
     public:
@@ -25,19 +85,28 @@ namespace http
          * This is seperate from the constructor because calling "delete" on an object before its
          * constructor completes is undefined.
          */
-        void run(CoreServer *_server, Listener *listener, TcpSocket &&raw_socket)
+        void run(CoreServer *_server, Listener *_listener, TcpSocket &&raw_socket, size_t _limiter_slot)
         {
+            server = _server;
+            listener = _listener;
+            limiter_slot = _limiter_slot;
+            body_reserved = 0;
             try
             {
-                server = _server;
+                parser.set_limits(listener->options.parser_limits);
                 keep_alive = false;
+                idle = false;
                 buffer_len = 0;
+                http2_preface = listener->options.http2 && !listener->tls;
+                if (server->access_log) remote_address = raw_socket.address_str();
                 if (listener->tls)
                 {
+                    tls_start = std::chrono::steady_clock::now();
                     auto tls = new TlsServerSocket();
                     socket.reset(tls);
-                    tls->async_create(server->aio, std::move(raw_socket), listener->tls_cert,
-                        std::bind(&CoreServer::Connection::start_request, this),
+                    if (listener->options.http2) tls->set_alpn_protocols({ "h2", "http/1.1" });
+                    tls->async_create(server->aio, std::move(raw_socket), server->tls_cert(*listener),
+                        std::bind(&CoreServer::Connection::tls_connected, this),
                         std::bind(&CoreServer::Connection::io_error, this));
                 }
                 else
@@ -53,66 +122,280 @@ namespace http
             }
         }
 
-        explicit operator bool()const { return (bool)socket; }
+        ~Connection()
+        {
+            // Close the socket before allowing another connection to be accepted
+            socket.reset();
+            if (ws) ws->detach();
+            if (events) events->detach();
+            if (response.websocket) response.websocket->detach();
+            if (response.event_stream) response.event_stream->detach();
+            release_body_memory();
+            if (server->client_limiter) server->client_limiter->close_connection(limiter_slot);
+            server->connection_closed(this, *listener);
+        }
 
+        explicit operator bool()const { return (bool)socket; }
+        /**True if waiting for a request on a keep-alive connection, with no data received yet.
+         * Only valid on the AsyncIo thread.
+         */
+        bool is_idle()const { return idle; }
+        /**True if this is a HTTP/2 connection. Only valid on the AsyncIo thread.*/
+        bool is_http2()const { return (bool)http2; }
+        /**True if this connection was upgraded to a WebSocket, or is sending an event stream.
+         * Only valid on the AsyncIo thread.
+         */
+        bool is_stream()const { return ws || events; }
+        /**Abort any in-progress IO. Only valid on the AsyncIo thread.*/
+        void cancel()
+        {
+            server->aio.cancel(socket->get());
+        }
+        /**Send GOAWAY on a HTTP/2 connection, closing it once in-progress requests complete.
+         * Only valid on the AsyncIo thread.
+         */
+        void http2_shutdown()
+        {
+            ++http2_busy;
+            if (!http2_closing)
+            {
+                http2->shutdown();
+                http2_next();
+            }
+            --http2_busy;
+            http2_check_closed();
+        }
+        /**Start the WebSocket close handshake with CLOSE_GOING_AWAY, or end the event stream.
+         * Only valid on the AsyncIo thread.
+         */
+        void stream_shutdown()
+        {
+            ++stream_busy;
+            if (ws) ws->close(websocket::CLOSE_GOING_AWAY);
+            else events->close();
+            stream_next();
+            --stream_busy;
+            stream_check_closed();
+        }
 
     private:
         CoreServer *server;
+        Listener *listener;
         std::unique_ptr<Socket> socket;
+        /**When the TLS handshake started.*/
+        std::chrono::steady_clock::time_point tls_start;
+        /**Client address for the access log.*/
+        std::string remote_address;
+        /**ClientLimiter slot, if using a client_limiter.*/
+        size_t limiter_slot;
+        /**The current request was counted by client_limiter.*/
+        bool rate_checked;
+        /**Bytes of the body memory budget reserved for the current request.*/
+        size_t body_reserved;
         bool keep_alive;
-        char buffer[RequestParser::LINE_SIZE];
+        bool idle;
+        /**Received data not yet parsed. Only held while reading a request, or if the data is for
+         * a pipelined request.
+         */
+        PooledBuffer buffer;
         size_t buffer_len;
         RequestParser parser;
+        /**The request headers were checked for "Expect: 100-continue".*/
+        bool expect_checked;
+        /**When the first data for the current request was received, if using an access log.*/
+        std::chrono::steady_clock::time_point request_start;
+        /**Bytes of the current request read by parser.*/
+        uint64_t request_bytes;
+        int response_status;
 
         Response response;
+        /**If set, this is sent rather than response.*/
+        std::shared_ptr<const CachedResponse> cached_response;
         bool response_has_body;
         std::string response_header;
 
+        /**The listener accepts HTTP/2 prior knowledge, and no request has been read yet.*/
+        bool http2_preface;
+        /**HTTP/2 state, if this connection is using HTTP/2. Once set, the connection is only
+         * used from the AsyncIo thread, with handler results returned via AsyncIo::post.
+         * Handlers hold a weak_ptr to detect if the connection was since destroyed.
+         */
+        std::shared_ptr<Http2Session> http2;
+        /**HTTP/2 frames being sent.*/
+        std::string http2_out;
+        bool http2_recv_pending;
+        bool http2_send_pending;
+        /**The HTTP/2 connection is closing, and is destroyed once no IO is pending.*/
+        bool http2_closing;
+        bool http2_cancel_posted;
+        /**Number of HTTP/2 callbacks on the stack. Since socket operations may complete
+         * immediately, the connection must not be destroyed until these all return.
+         */
+        int http2_busy;
+
+        /**WebSocket state, if this connection was upgraded. Like http2, once this or events is
+         * set the connection is only used from the AsyncIo thread, with output from other
+         * threads signalled via AsyncIo::post.
+         */
+        std::shared_ptr<WebSocket> ws;
+        /**The event stream this connection is sending, once the response header was sent.*/
+        std::shared_ptr<EventStream> events;
+        /**Expires when this connection is destroyed, for functions posted by the stream.*/
+        std::shared_ptr<bool> stream_alive;
+        /**WebSocket frames or events being sent.*/
+        std::shared_ptr<const std::string> stream_sending;
+        bool stream_recv_pending;
+        bool stream_send_pending;
+        /**The stream is closing, and the connection is destroyed once no IO is pending.*/
+        bool stream_closing;
+        bool stream_cancel_posted;
+        /**Number of stream callbacks on the stack, as for http2_busy.*/
+        int stream_busy;
+
+        /**Called once the TLS handshake is complete, to start HTTP/2 if negotiated by ALPN.*/
+        void tls_connected()
+        {
+            server->server_metrics.tls_handshake_duration.observe(elapsed_us(tls_start));
+            if (socket->alpn_protocol() == "h2") start_http2(nullptr, 0);
+            else start_request();
+        }
+
         /**Start receiving a new request.*/
         void start_request()
         {
+            // Idle until the next request starts arriving, including a new connection that has
+            // not sent its first request yet (e.g. a browser preconnect)
+            idle = buffer_len == 0;
             parser.reset();
+            expect_checked = false;
+            rate_checked = false;
+            request_bytes = 0;
+            request_start = std::chrono::steady_clock::time_point();
+            if (server->access_log && buffer_len) request_start = std::chrono::steady_clock::now();
             keep_alive = true;
-            start_recv_request();
+            if (buffer_len)
+            {
+                // Pipelined data may already contain the whole request
+                try
+                {
+                    parse_request();
+                }
+                catch (const std::exception &e)
+                {
+                    parse_error(e);
+                }
+            }
+            else
+            {
+                // Wait for the request without holding a buffer
+                buffer.reset();
+                socket->async_wait_recv(server->aio,
+                    std::bind(&CoreServer::Connection::start_recv_request, this),
+                    std::bind(&CoreServer::Connection::io_error, this));
+            }
         }
-        /**Start receving part of a request into buffer.
+        /**Start receving part of a request into buffer, leasing one if needed.
          * Completion calls recv_request.
          */
         void start_recv_request()
         {
-            socket->async_recv(server->aio, buffer + buffer_len, sizeof(buffer) - buffer_len,
+            try
+            {
+                if (!buffer) buffer = server->buffer_pool.get(RequestParser::LINE_SIZE);
+            }
+            catch (const std::exception &)
+            {
+                delete this;
+                return;
+            }
+            socket->async_recv(server->aio, buffer.data() + buffer_len, buffer.size() - buffer_len,
                 std::bind(&CoreServer::Connection::recv_request, this, std::placeholders::_1),
                 std::bind(&CoreServer::Connection::io_error, this));
         }
         /**Receive part of a request into buffer.*/
         void recv_request(size_t len)
         {
+            if (len == 0)
+            {
+                // Client closed the connection
+                delete this;
+                return;
+            }
+            idle = false;
+            buffer_len += len;
+            server->server_metrics.request_bytes.inc(len);
+            if (server->access_log && request_start == std::chrono::steady_clock::time_point())
+                request_start = std::chrono::steady_clock::now();
             try
             {
-                if (len == 0)
+                if (http2_preface)
                 {
-                    // Client closed the connection
-                    delete this;
-                    return;
+                    auto n = std::min(buffer_len, http2::PREFACE_LEN);
+                    if (memcmp(buffer.data(), http2::PREFACE, n) == 0)
+                    {
+                        if (n == http2::PREFACE_LEN) start_http2(buffer.data(), buffer_len);
+                        else start_recv_request();
+                        return;
+                    }
+                    http2_preface = false;
                 }
-                else
-                {
-                    buffer_len += len;
-
-                    auto end = parser.read(buffer, buffer + buffer_len);
-                    buffer_len -= end - buffer;
-                    memmove(buffer, end, buffer_len);
+                parse_request();
+            }
+            catch (const std::exception &e)
+            {
+                parse_error(e);
+            }
+        }
+        /**Parse the data in buffer, then handle the request if complete, else receive more.*/
+        void parse_request()
+        {
+            if (!rate_checked && server->client_limiter)
+            {
+                rate_checked = true;
+                if (!server->client_limiter->allow_request(limiter_slot)) return rate_limited();
+            }
 
-                    if (parser.is_completed()) handle_request();
-                    else start_recv_request();
+            auto data = buffer.data();
+            auto end = parser.read(data, data + buffer_len);
+            request_bytes += end - data;
+            buffer_len -= end - data;
+            memmove(data, end, buffer_len);
+            if (buffer_len == buffer.size())
+            {
+                // A single line did not fit in the buffer, so grow it up to the header limit
+                size_t max_size = RequestParser::LINE_SIZE;
+                max_size = std::max(max_size, listener->options.parser_limits.max_headers_size);
+                if (buffer.size() >= max_size)
+                {
+                    throw ParserError("Request line too long",
+                        parser.state() == RequestParser::START ? SC_URI_TOO_LONG : SC_REQUEST_HEADER_FIELDS_TOO_LARGE);
                 }
+                buffer = server->buffer_pool.grow(std::move(buffer), buffer.size() * 2, buffer_len);
             }
-            catch (const std::exception &e)
+
+            if (server->body_memory_budget && !reserve_body_memory()) body_memory_exceeded();
+            else if (parser.is_completed()) handle_request();
+            else if (!expect_checked && parser.state() != RequestParser::START &&
+                parser.state() != RequestParser::HEADERS)
             {
-                std::cerr << typeid(e).name() << ' ' << e.what() << std::endl;
-                delete this;
-                return;
+                expect_checked = true;
+                check_expect();
+            }
+            else start_recv_request();
+        }
+        /**Handle an exception from parse_request. Errors with a status, such as exceeding limits,
+         * get a response, else the connection is closed.
+         */
+        void parse_error(const std::exception &e)
+        {
+            auto parser_error = dynamic_cast<const ParserError*>(&e);
+            if (parser_error)
+            {
+                server->server_metrics.parse_errors.inc();
+                if (parser_error->status_code()) return send_parser_error(*parser_error);
             }
+            std::cerr << typeid(e).name() << ' ' << e.what() << std::endl;
+            delete this;
         }
         /**Handle the request, called once recv_request has parsed the entire request message.
          * Passes the parsed request to owning server, sends the response and either destroys the
@@ -120,78 +403,209 @@ namespace http
          */
         void handle_request()
         {
-            std::unique_lock<std::mutex> lock(server->handle_mutex);
-            for (auto i = server->in_progress_handlers.begin(); i != server->in_progress_handlers.end();)
-            {
-                if (i->wait_for(std::chrono::seconds(0)) != std::future_status::timeout)
-                    i = server->in_progress_handlers.erase(i);
-                else ++i;
-            }
-            server->in_progress_handlers.push_back(std::async([this]()
+            http2_preface = false;
+            // Not needed while the handler runs, unless there is data for a pipelined request
+            if (!buffer_len) buffer.reset();
+            // Don't keep headers etc. from the previous response on this connection
+            response = Response();
+            std::shared_ptr<Request> req;
+            try
             {
-                try
+                req = std::make_shared<Request>(Request
                 {
-                    Request req =
-                    {
-                        method_from_string(parser.method()),
-                        parser.uri(),
-                        Url::parse_request(parser.uri()),
-                        std::move(parser.headers()),
-                        std::move(parser.body())
-                    };
+                    method_from_string(parser.method()),
+                    parser.uri(),
+                    Url::parse_request(parser.uri()),
+                    std::move(parser.headers()),
+                    std::move(parser.body())
+                });
 
-                    keep_alive = ieq(req.headers.get("Connection"), "keep-alive");
+                keep_alive = ieq(req->headers.get("Connection"), "keep-alive") && !server->draining;
 
-                    response = server->handle_request(req);
-                }
-                catch (const ErrorResponse &err)
+                // A hit is sent from this thread, without a handler thread or load shedding
+                if (server->response_cache)
                 {
-                    keep_alive = false;
-                    response.status.code = (StatusCode)err.status_code();
-                    response.body = err.what();
-                    response.headers.add("Content-Type", "text/plain");
+                    cached_response = server->response_cache->get(*req);
+                    if (cached_response) return send_cached_response();
                 }
-                catch (const std::exception &err)
+            }
+            catch (const std::exception &err)
+            {
+                keep_alive = false;
+                error_response(response, SC_INTERNAL_SERVER_ERROR, err.what());
+                return finish_response();
+            }
+            server->dispatch([this, req]()
+            {
+                // The response may be sent from another thread after this returns
+                server->process_request(req, [this](Response &result, bool ok)
                 {
-                    keep_alive = false;
-                    response.status.code = SC_INTERNAL_SERVER_ERROR;
-                    response.body = err.what();
-                    response.headers.add("Content-Type", "text/plain");
-                }
+                    response = std::move(result);
+                    if (!ok) keep_alive = false;
+                    finish_response();
+                });
+            }, std::bind(&CoreServer::Connection::shed_request, this));
+        }
+        /**Send the pre-serialized load shedding response instead of handling the request.*/
+        void shed_request()
+        {
+            keep_alive = keep_alive && !server->draining;
+            response = Response();
+            cached_response = server->shed_response;
+            send_cached_response();
+        }
+        /**Reserve body memory for the current request, if its size is known or the body grew.
+         * @return False if the budget was exceeded.
+         */
+        bool reserve_body_memory()
+        {
+            const RequestParser &req = parser;
+            auto size = req.body().size();
+            if (req.has_content_length()) size = std::max(size, req.content_length());
+            if (size <= body_reserved) return true;
+            if (!server->reserve_body_memory(size - body_reserved)) return false;
+            body_reserved = size;
+            return true;
+        }
+        void release_body_memory()
+        {
+            if (body_reserved) server->release_body_memory(body_reserved);
+            body_reserved = 0;
+        }
+        /**Send an error response for a request exceeding the body memory budget, then close.*/
+        void body_memory_exceeded()
+        {
+            keep_alive = false;
+            response = retry_response(SC_SERVICE_UNAVAILABLE, SHED_RESPONSE_BODY, 1);
+            finish_response();
+        }
+        /**Send an error response for an invalid request, then close.*/
+        void send_parser_error(const ParserError &err)
+        {
+            keep_alive = false;
+            error_response(response, (StatusCode)err.status_code(), err.what());
+            finish_response();
+        }
+        /**Send the pre-serialized rate limit response, without parsing the request, then close.*/
+        void rate_limited()
+        {
+            keep_alive = false;
+            response = Response();
+            cached_response = server->rate_limited_response;
+            send_cached_response();
+        }
+        /**Called once the request headers are read but the body is not, to handle any Expect
+         * header. Either continues reading the request, or sends a final response and closes.
+         */
+        void check_expect()
+        {
+            const RequestParser &head = parser;
+            auto expect = head.headers().get("Expect");
+            if (expect.empty() || head.version().minor < 1) return start_recv_request();
 
-                if (response.status.msg.empty())
+            // Admission runs on a handler thread, so is subject to load shedding like the request
+            server->dispatch([this, expect]()
+            {
+                response = Response();
+                try
                 {
-                    response.status.msg = default_status_msg(response.status.code);
+                    const RequestParser &head = parser;
+                    if (!ieq(expect, "100-continue"))
+                    {
+                        error_response(response, SC_EXPECTATION_FAILED, "Unsupported Expect header");
+                    }
+                    else
+                    {
+                        Request req =
+                        {
+                            method_from_string(head.method()),
+                            head.uri(),
+                            Url::parse_request(head.uri()),
+                            head.headers(),
+                            std::string()
+                        };
+                        if (server->admit_request(req, response))
+                        {
+                            socket->async_send_all(server->aio, CONTINUE_RESPONSE, sizeof(CONTINUE_RESPONSE) - 1,
+                                std::bind(&CoreServer::Connection::start_recv_request, this),
+                                std::bind(&CoreServer::Connection::io_error, this));
+                            return;
+                        }
+                    }
                 }
-                response.headers.set("Connection", keep_alive ? "keep-alive" : "close");
-
-                // Send response
-                auto sc = response.status.code;
-                // For certain response codes, there must not be a message body
-                bool message_body_allowed = sc != 204 && sc != 205 && sc != 304;
-                // For HEAD requests, Content-Length etc. should be determined, but the body must not be sent
-                response_has_body = !response.body.empty() && message_body_allowed && parser.method() != "HEAD";
-
-                if (message_body_allowed)
+                catch (const ErrorResponse &err)
                 {
-                    //TODO: Support chunked streams in the future
-                    response.headers.set("Content-Length", std::to_string(response.body.size()));
+                    error_response(response, (StatusCode)err.status_code(), err.what());
                 }
-                else if (!response.body.empty())
+                catch (const std::exception &err)
                 {
-                    std::cerr << "HTTP forbids this response from having a body" << std::endl;
-                    delete this;
-                    return;
+                    error_response(response, SC_INTERNAL_SERVER_ERROR, err.what());
                 }
+                // The client may not send the body, or may send it anyway, so can't continue
+                keep_alive = false;
+                finish_response();
+            }, [this]()
+            {
+                // A final status before the body, so likewise the connection can't continue
+                keep_alive = false;
+                shed_request();
+            });
+        }
+        /**Complete the headers of response, then send it.*/
+        void finish_response()
+        {
+            if (response.status.msg.empty())
+            {
+                response.status.msg = default_status_msg(response.status.code);
+            }
+            if (response.websocket && response.status.code == SC_SWITCHING_PROTOCOLS)
+            {
+                // The connection continues as a WebSocket, rather than as HTTP
+                response_has_body = false;
+                send_response();
+                return;
+            }
+            if (response.event_stream && response.status.code == SC_OK && parser.method() != "HEAD")
+            {
+                // The body is sent as events until the stream closes, which ends the connection
+                keep_alive = false;
+                response.headers.set("Connection", "close");
+                response_has_body = false;
+                send_response();
+                return;
+            }
+            // drain may have started while the handler ran
+            keep_alive = keep_alive && !server->draining;
+            response.headers.set("Connection", keep_alive ? "keep-alive" : "close");
 
-                add_default_headers(response);
+            // Send response
+            auto sc = response.status.code;
+            // For certain response codes, there must not be a message body
+            bool message_body_allowed = sc != 204 && sc != 205 && sc != 304;
+            assert(!response.body_file || response.body.empty());
+            auto body_size = response.body_file ? response.body_file->size() : response.body.size();
+            // For HEAD requests, Content-Length etc. should be determined, but the body must not be sent
+            response_has_body = body_size > 0 && message_body_allowed && parser.method() != "HEAD";
 
-                send_response();
-            }));
+            if (message_body_allowed)
+            {
+                //TODO: Support chunked streams in the future
+                response.headers.set("Content-Length", std::to_string(body_size));
+            }
+            else if (body_size > 0)
+            {
+                std::cerr << "HTTP forbids this response from having a body" << std::endl;
+                delete this;
+                return;
+            }
+
+            send_response();
         }
         /**Starts sending a response. Calls send_response_body on completion.*/
         void send_response()
         {
+            response_status = response.status.code;
+            server->count_response(response_status);
             std::stringstream ss;
             write_response_header(ss, response);
             response_header = ss.str();
@@ -200,10 +614,42 @@ namespace http
                 std::bind(&CoreServer::Connection::send_response_body, this),
                 std::bind(&CoreServer::Connection::io_error, this));
         }
+        /**Starts sending cached_response. Calls send_response_body on completion.*/
+        void send_cached_response()
+        {
+            char date[TIME_STR_LEN];
+            format_current_time(date);
+            response_header.reserve(cached_response->head.size() + 128);
+            response_header = cached_response->head;
+            response_header += "Date: ";
+            response_header.append(date, TIME_STR_LEN);
+            keep_alive = keep_alive && !server->draining;
+            response_header += keep_alive ? "\r\nConnection: keep-alive\r\n\r\n" : "\r\nConnection: close\r\n\r\n";
+            response_has_body = !cached_response->body.empty() && parser.method() != "HEAD";
+            // head starts with the status line, "HTTP/1.1 200 OK"
+            response_status = std::atoi(cached_response->head.c_str() + 9);
+            server->count_response(response_status);
+
+            socket->async_send_all(server->aio, response_header.data(), response_header.size(),
+                std::bind(&CoreServer::Connection::send_response_body, this),
+                std::bind(&CoreServer::Connection::io_error, this));
+        }
         /**Send the response body if needed, then call complete_response.*/
         void send_response_body()
         {
-            if (response_has_body)
+            if (response_has_body && cached_response)
+            {
+                socket->async_send_all(server->aio, cached_response->body.data(), cached_response->body.size(),
+                    std::bind(&CoreServer::Connection::complete_response, this),
+                    std::bind(&CoreServer::Connection::io_error, this));
+            }
+            else if (response_has_body && response.body_file)
+            {
+                socket->async_send_file(server->aio, *response.body_file, 0, (size_t)response.body_file->size(),
+                    std::bind(&CoreServer::Connection::complete_response, this),
+                    std::bind(&CoreServer::Connection::io_error, this));
+            }
+            else if (response_has_body)
             {
                 socket->async_send_all(server->aio, response.body.data(), response.body.size(),
                     std::bind(&CoreServer::Connection::complete_response, this),
@@ -211,17 +657,529 @@ namespace http
             }
             else complete_response();
         }
-        /**Complete a request-response. If keep_alive, start the next request, else close this connection.*/
+        /**Complete a request-response. If keep_alive and not draining, start the next request, else
+         * close this connection.
+         */
         void complete_response()
         {
-            if (keep_alive) start_request();
+            auto sent = response_header.size();
+            if (response_has_body && cached_response) sent += cached_response->body.size();
+            else if (response_has_body && response.body_file) sent += (size_t)response.body_file->size();
+            else if (response_has_body) sent += response.body.size();
+            server->server_metrics.response_bytes.inc(sent);
+            if (server->access_log) log_request(sent);
+            auto upgrade = std::move(response.websocket);
+            if (upgrade && response_status != SC_SWITCHING_PROTOCOLS)
+            {
+                upgrade->detach();
+                upgrade.reset();
+            }
+            auto event_stream = std::move(response.event_stream);
+            if (event_stream && (response_status != SC_OK || parser.method() == "HEAD"))
+            {
+                // Not sent as an event stream, such as for a HEAD request
+                event_stream->detach();
+                event_stream.reset();
+            }
+            // Don't hold the response, cache entry or body memory while idle
+            release_body_memory();
+            response = Response();
+            std::string().swap(response_header);
+            cached_response.reset();
+            if (upgrade) start_websocket(std::move(upgrade));
+            else if (event_stream) start_event_stream(std::move(event_stream));
+            // If drain started after the response was created, close now rather than going idle
+            else if (keep_alive && !server->draining) start_request();
             else shutdown();
         }
+        /**Record the completed HTTP/1 request in the access log.*/
+        void log_request(uint64_t response_bytes)
+        {
+            AccessLogRecord record;
+            set_request_time(record, request_start);
+            record.request_bytes = request_bytes;
+            record.response_bytes = response_bytes;
+            record.status = response_status;
+            record.version = parser.version();
+            record.set_method(parser.method());
+            record.set_remote(remote_address);
+            record.set_path(parser.uri());
+            server->access_log->log(record);
+        }
         /**Called if any recv or send fails. Destroys this connection.*/
         void io_error()
         {
             delete this;
         }
+        /**Switch this connection to HTTP/2.
+         * @param data Data already received, starting with the client connection preface.
+         */
+        void start_http2(const char *data, size_t len)
+        {
+            http2_preface = false;
+            http2_recv_pending = http2_send_pending = false;
+            http2_closing = http2_cancel_posted = false;
+            http2_busy = 1;
+            try
+            {
+                http2 = std::make_shared<Http2Session>(
+                    std::bind(&CoreServer::Connection::http2_request, this, std::placeholders::_1, std::placeholders::_2),
+                    listener->options.http2_settings);
+                if (len) http2->receive(data, len);
+                buffer_len = 0;
+                buffer.reset();
+                http2_next();
+            }
+            catch (const std::exception &)
+            {
+                server->server_metrics.protocol_errors.inc();
+                http2_closing = true;
+            }
+            --http2_busy;
+            http2_check_closed();
+        }
+        /**Send any pending HTTP/2 output, and make sure a receive is pending unless closing.*/
+        void http2_next()
+        {
+            if (http2_closing) return;
+            if (!http2_send_pending)
+            {
+                http2_out.clear();
+                if (http2->take_output(&http2_out))
+                {
+                    http2_send_pending = true;
+                    socket->async_send_all(server->aio, http2_out.data(), http2_out.size(),
+                        std::bind(&CoreServer::Connection::http2_sent, this),
+                        std::bind(&CoreServer::Connection::http2_send_error, this));
+                }
+            }
+            if (!http2_recv_pending && !http2_closing && !http2->wants_close())
+            {
+                http2_recv_pending = true;
+                // Without requests in progress, wait for data without holding a buffer
+                if (buffer) http2_start_recv();
+                else
+                {
+                    socket->async_wait_recv(server->aio,
+                        std::bind(&CoreServer::Connection::http2_start_recv, this),
+                        std::bind(&CoreServer::Connection::http2_recv_error, this));
+                }
+            }
+        }
+        void http2_start_recv()
+        {
+            try
+            {
+                if (!buffer) buffer = server->buffer_pool.get(RequestParser::LINE_SIZE);
+            }
+            catch (const std::exception &)
+            {
+                return http2_recv_error();
+            }
+            socket->async_recv(server->aio, buffer.data(), buffer.size(),
+                std::bind(&CoreServer::Connection::http2_recv, this, std::placeholders::_1),
+                std::bind(&CoreServer::Connection::http2_recv_error, this));
+        }
+        void http2_recv(size_t len)
+        {
+            http2_recv_pending = false;
+            ++http2_busy;
+            try
+            {
+                if (len == 0) http2_closing = true; // Client closed the connection
+                else if (!http2_closing)
+                {
+                    server->server_metrics.request_bytes.inc(len);
+                    http2->receive(buffer.data(), len);
+                    if (!http2->active_streams()) buffer.reset();
+                    http2_next();
+                }
+            }
+            catch (const std::exception &)
+            {
+                server->server_metrics.protocol_errors.inc();
+                http2_closing = true;
+            }
+            --http2_busy;
+            http2_check_closed();
+        }
+        void http2_sent()
+        {
+            http2_send_pending = false;
+            server->server_metrics.response_bytes.inc(http2_out.size());
+            // Don't keep a large output buffer while idle
+            if (!http2->active_streams()) std::string().swap(http2_out);
+            ++http2_busy;
+            try
+            {
+                http2_next();
+            }
+            catch (const std::exception &)
+            {
+                server->server_metrics.protocol_errors.inc();
+                http2_closing = true;
+            }
+            --http2_busy;
+            http2_check_closed();
+        }
+        void http2_recv_error()
+        {
+            http2_recv_pending = false;
+            http2_closing = true;
+            http2_check_closed();
+        }
+        void http2_send_error()
+        {
+            http2_send_pending = false;
+            http2_closing = true;
+            http2_check_closed();
+        }
+        /**Called by the session for each request. Runs handle_request on another thread.*/
+        void http2_request(uint32_t stream_id, Request &request)
+        {
+            auto server = this->server;
+            auto conn = this;
+            std::weak_ptr<Http2Session> session = http2;
+            if (server->client_limiter && !server->client_limiter->allow_request(limiter_slot))
+            {
+                // Can't send while the session is processing received frames
+                auto response = std::make_shared<Response>(retry_response(SC_TOO_MANY_REQUESTS,
+                    RATE_LIMITED_RESPONSE_BODY, server->client_limiter->retry_after()));
+                post_http2_response(server, conn, session, stream_id, response);
+                return;
+            }
+            auto req = std::make_shared<Request>(std::move(request));
+            auto remote = server->access_log ? remote_address : std::string();
+            auto start = std::chrono::steady_clock::now();
+            // A hit is sent without a handler thread or load shedding
+            auto cached = server->response_cache ? server->response_cache->get(*req) : nullptr;
+            if (cached)
+            {
+                http2_request_done(server, conn, session, stream_id, *req, remote, start,
+                    std::make_shared<Response>(cached->to_response()));
+                return;
+            }
+            auto shed = [server, conn, session, stream_id]()
+            {
+                auto response = std::make_shared<Response>(retry_response(SC_SERVICE_UNAVAILABLE,
+                    SHED_RESPONSE_BODY, (unsigned)server->load_shed.retry_after.count()));
+                post_http2_response(server, conn, session, stream_id, response);
+            };
+            server->dispatch([server, conn, session, stream_id, req, remote, start]()
+            {
+                server->process_request(req, [server, conn, session, stream_id, req, remote, start](Response &result, bool)
+                {
+                    http2_request_done(server, conn, session, stream_id, *req, remote, start,
+                        std::make_shared<Response>(std::move(result)));
+                });
+            }, shed);
+        }
+        /**Log and send the response to a HTTP/2 request, from any thread.*/
+        static void http2_request_done(CoreServer *server, Connection *conn, std::weak_ptr<Http2Session> session,
+            uint32_t stream_id, const Request &req, const std::string &remote,
+            std::chrono::steady_clock::time_point start, std::shared_ptr<Response> response)
+        {
+            if (response->websocket)
+            {
+                // WebSockets over HTTP/2 (RFC8441) are not supported
+                response->websocket->detach();
+                error_response(*response, SC_BAD_REQUEST, "WebSocket requires HTTP/1.1");
+            }
+            else if (response->event_stream)
+            {
+                // Http2Session only sends complete responses
+                response->event_stream->detach();
+                error_response(*response, SC_HTTP_VERSION_NOT_SUPPORTED, "Event streams require HTTP/1.1");
+            }
+            if (server->access_log)
+            {
+                AccessLogRecord record;
+                set_request_time(record, start);
+                record.request_bytes = req.body.size();
+                record.response_bytes = response->body_file ? response->body_file->size() : response->body.size();
+                record.status = response->status.code;
+                record.version = { 2, 0 };
+                record.set_method(to_string(req.method));
+                record.set_remote(remote);
+                record.set_path(req.raw_url);
+                server->access_log->log(record);
+            }
+            post_http2_response(server, conn, session, stream_id, response);
+        }
+        /**Send a response for a HTTP/2 stream from any thread, unless the connection has since
+         * been destroyed.
+         */
+        static void post_http2_response(CoreServer *server, Connection *conn, std::weak_ptr<Http2Session> session,
+            uint32_t stream_id, std::shared_ptr<Response> response)
+        {
+            server->aio.post([conn, session, stream_id, response]()
+            {
+                if (!session.expired()) conn->http2_response(stream_id, std::move(*response));
+            });
+        }
+        /**Send a response from http2_request, on the AsyncIo thread.*/
+        void http2_response(uint32_t stream_id, Response &&response)
+        {
+            ++http2_busy;
+            try
+            {
+                if (!http2_closing)
+                {
+                    server->count_response(response.status.code);
+                    http2->send_response(stream_id, std::move(response));
+                    http2_next();
+                }
+            }
+            catch (const std::exception &)
+            {
+                server->server_metrics.protocol_errors.inc();
+                http2_closing = true;
+            }
+            --http2_busy;
+            http2_check_closed();
+        }
+        /**Destroy this connection if closing and no IO is pending, else cancel the IO.
+         * Must be the last use of this connection by the caller.
+         */
+        void http2_check_closed()
+        {
+            if (http2_busy) return;
+            if (!http2_closing && !http2_send_pending && http2->wants_close()) http2_closing = true;
+            if (!http2_closing) return;
+            if (!http2_recv_pending && !http2_send_pending)
+            {
+                delete this;
+                return;
+            }
+            if (!http2_cancel_posted)
+            {
+                // AsyncIo::cancel can not be used from within a completion handler
+                http2_cancel_posted = true;
+                auto conn = this;
+                std::weak_ptr<Http2Session> session = http2;
+                server->aio.post([conn, session]()
+                {
+                    if (!session.expired()) conn->http2_cancel();
+                });
+            }
+        }
+        void http2_cancel()
+        {
+            ++http2_busy;
+            cancel();
+            --http2_busy;
+            http2_check_closed();
+        }
+        /**Switch this connection to a WebSocket, once the upgrade response was sent.*/
+        void start_websocket(std::shared_ptr<WebSocket> &&upgrade)
+        {
+            ws = std::move(upgrade);
+            start_stream([this]()
+            {
+                ws->attach(stream_notify());
+                ws->open();
+                if (server->draining) ws->close(websocket::CLOSE_GOING_AWAY);
+                // Data may have been pipelined after the upgrade request
+                if (buffer_len) ws_receive();
+            });
+        }
+        /**Start sending events, once the event stream response header was sent.*/
+        void start_event_stream(std::shared_ptr<EventStream> &&stream)
+        {
+            events = std::move(stream);
+            start_stream([this]()
+            {
+                events->attach(stream_notify());
+                if (server->draining) events->close();
+                // The client should not send anything more
+                buffer_len = 0;
+            });
+        }
+        /**Start sending the output of ws or events, and receiving until closed.*/
+        void start_stream(std::function<void()> start)
+        {
+            stream_alive = std::make_shared<bool>(true);
+            stream_recv_pending = stream_send_pending = false;
+            stream_closing = stream_cancel_posted = false;
+            stream_busy = 1;
+            try
+            {
+                start();
+                stream_next();
+            }
+            catch (const std::exception &)
+            {
+                server->server_metrics.protocol_errors.inc();
+                stream_closing = true;
+            }
+            --stream_busy;
+            stream_check_closed();
+        }
+        /**A function for the stream to call from any thread when output is queued, posting
+         * stream_output_ready unless this connection was since destroyed.
+         */
+        std::function<void()> stream_notify()
+        {
+            auto server = this->server;
+            auto conn = this;
+            std::weak_ptr<bool> alive = stream_alive;
+            return [server, conn, alive]()
+            {
+                server->aio.post([conn, alive]()
+                {
+                    if (!alive.expired()) conn->stream_output_ready();
+                });
+            };
+        }
+        bool stream_wants_close()const
+        {
+            // Queued events are sent before an event stream is closed
+            return ws ? ws->wants_close() : events->wants_close() && !events->buffered_amount();
+        }
+        /**Send any pending stream output, and make sure a receive is pending unless closing.*/
+        void stream_next()
+        {
+            if (stream_closing) return;
+            if (!stream_send_pending)
+            {
+                stream_sending = ws ? ws->take_output() : events->take_output();
+                if (stream_sending)
+                {
+                    stream_send_pending = true;
+                    socket->async_send_all(server->aio, stream_sending->data(), stream_sending->size(),
+                        std::bind(&CoreServer::Connection::stream_sent, this),
+                        std::bind(&CoreServer::Connection::stream_send_error, this));
+                }
+            }
+            if (!stream_recv_pending && !stream_closing && !(ws && ws->wants_close()))
+            {
+                stream_recv_pending = true;
+                // Without a partial frame, wait for data without holding a buffer. Event streams
+                // only receive to see the client close the connection.
+                if (buffer_len) stream_start_recv();
+                else
+                {
+                    buffer.reset();
+                    socket->async_wait_recv(server->aio,
+                        std::bind(&CoreServer::Connection::stream_start_recv, this),
+                        std::bind(&CoreServer::Connection::stream_recv_error, this));
+                }
+            }
+        }
+        void stream_start_recv()
+        {
+            try
+            {
+                if (!buffer) buffer = server->buffer_pool.get(RequestParser::LINE_SIZE);
+            }
+            catch (const std::exception &)
+            {
+                return stream_recv_error();
+            }
+            socket->async_recv(server->aio, buffer.data() + buffer_len, buffer.size() - buffer_len,
+                std::bind(&CoreServer::Connection::stream_recv, this, std::placeholders::_1),
+                std::bind(&CoreServer::Connection::stream_recv_error, this));
+        }
+        void stream_recv(size_t len)
+        {
+            stream_recv_pending = false;
+            ++stream_busy;
+            try
+            {
+                if (len == 0) stream_closing = true; // Client closed the connection
+                else if (!stream_closing)
+                {
+                    server->server_metrics.request_bytes.inc(len);
+                    buffer_len += len;
+                    if (ws) ws_receive();
+                    else buffer_len = 0;
+                    stream_next();
+                }
+            }
+            catch (const std::exception &)
+            {
+                server->server_metrics.protocol_errors.inc();
+                stream_closing = true;
+            }
+            --stream_busy;
+            stream_check_closed();
+        }
+        /**Pass buffer to the WebSocket, keeping any partial frame at the start of buffer.*/
+        void ws_receive()
+        {
+            auto data = (uint8_t*)buffer.data();
+            auto used = ws->receive(data, buffer_len, buffer.size());
+            buffer_len -= used;
+            memmove(data, data + used, buffer_len);
+        }
+        void stream_sent()
+        {
+            stream_send_pending = false;
+            server->server_metrics.response_bytes.inc(stream_sending->size());
+            stream_sending.reset();
+            stream_output_ready();
+        }
+        /**Send queued output. Called via AsyncIo::post when output was queued from any thread.*/
+        void stream_output_ready()
+        {
+            ++stream_busy;
+            try
+            {
+                stream_next();
+            }
+            catch (const std::exception &)
+            {
+                server->server_metrics.protocol_errors.inc();
+                stream_closing = true;
+            }
+            --stream_busy;
+            stream_check_closed();
+        }
+        void stream_recv_error()
+        {
+            stream_recv_pending = false;
+            stream_closing = true;
+            stream_check_closed();
+        }
+        void stream_send_error()
+        {
+            stream_send_pending = false;
+            stream_closing = true;
+            stream_check_closed();
+        }
+        /**Destroy this connection if closing and no IO is pending, else cancel the IO.
+         * Must be the last use of this connection by the caller.
+         */
+        void stream_check_closed()
+        {
+            if (stream_busy) return;
+            // Close once the final frames or events were sent
+            if (!stream_closing && !stream_send_pending && stream_wants_close()) stream_closing = true;
+            if (!stream_closing) return;
+            if (!stream_recv_pending && !stream_send_pending)
+            {
+                delete this;
+                return;
+            }
+            if (!stream_cancel_posted)
+            {
+                // AsyncIo::cancel can not be used from within a completion handler
+                stream_cancel_posted = true;
+                auto conn = this;
+                std::weak_ptr<bool> alive = stream_alive;
+                server->aio.post([conn, alive]()
+                {
+                    if (!alive.expired()) conn->stream_cancel();
+                });
+            }
+        }
+        void stream_cancel()
+        {
+            ++stream_busy;
+            cancel();
+            --stream_busy;
+            stream_check_closed();
+        }
         /**Shutdown this connection.*/
         void shutdown()
         {
@@ -240,30 +1198,186 @@ namespace http
         exit();
     }
 
-    void CoreServer::add_tcp_listener(const std::string &bind, uint16_t port)
+    void CoreServer::add_tcp_listener(const std::string &bind, uint16_t port,
+        const ListenerOptions &options)
     {
-        Listener listener = {
-            {bind, port},
-            false, {}
-        };
-        listener.socket.set_non_blocking();
-        listeners.push_back(std::move(listener));
+        add_listener(TcpListenSocket(bind, port, listen_socket_options(options)), bind, port,
+            false, {}, options);
+    }
+    void CoreServer::add_unix_listener(const std::string &path, const ListenerOptions &options)
+    {
+        add_listener(TcpListenSocket::unix_domain(path, options.backlog), path, 0, false, {}, options);
+    }
+    void CoreServer::add_tls_listener(const std::string &bind, uint16_t port, const PrivateCert &cert,
+        const ListenerOptions &options)
+    {
+        add_listener(TcpListenSocket(bind, port, listen_socket_options(options)), bind, port,
+            true, cert, options);
+    }
+    void CoreServer::set_tls_cert(const std::string &bind, uint16_t port, const PrivateCert &cert)
+    {
+        if (!cert) throw std::invalid_argument("Empty TLS certificate");
+        std::unique_lock<std::mutex> lock(tls_cert_mutex);
+        for (auto &listener : listeners)
+        {
+            if (listener.tls && listener.port == port && listener.bind == bind)
+            {
+                listener.tls_cert = cert;
+                return;
+            }
+        }
+        throw std::invalid_argument("No TLS listener for " + bind + ":" + std::to_string(port));
+    }
+    PrivateCert CoreServer::tls_cert(const Listener &listener)
+    {
+        std::unique_lock<std::mutex> lock(tls_cert_mutex);
+        return listener.tls_cert;
     }
-    void CoreServer::add_tls_listener(const std::string &bind, uint16_t port, const PrivateCert &cert)
+    ListenSocketOptions CoreServer::listen_socket_options(const ListenerOptions &options)
+    {
+        ListenSocketOptions listen;
+        listen.backlog = options.backlog;
+        listen.v6_only = options.ipv6_only;
+        listen.reuse_port = options.reuse_port;
+        listen.defer_accept = options.defer_accept;
+        listen.fast_open_queue = options.fast_open_queue;
+        listen.socket = options.socket_options;
+        return listen;
+    }
+    void CoreServer::add_listener(TcpListenSocket &&socket, const std::string &bind, uint16_t port,
+        bool tls, const PrivateCert &cert, const ListenerOptions &options)
     {
         Listener listener = {
-            {bind, port},
-            true, cert
+            std::move(socket), bind, port,
+            tls, cert, options,
+            0, false, {}
         };
+        auto &opts = listener.options;
+        if (!opts.http2_settings.max_body_size) opts.http2_settings.max_body_size = opts.parser_limits.max_body_size;
+        if (!opts.resume_connections) opts.resume_connections = opts.max_connections - opts.max_connections / 10;
         listener.socket.set_non_blocking();
         listeners.push_back(std::move(listener));
     }
-
+    void CoreServer::set_max_connections(size_t max, size_t resume)
+    {
+        std::unique_lock<std::mutex> lock(connections_mutex);
+        max_connections = max;
+        resume_connections = resume ? resume : max - max / 10;
+    }
+    void CoreServer::set_metrics(Metrics *_metrics, const std::string &path)
+    {
+        metrics = _metrics;
+        metrics_path = path;
+        static const char *CLASSES[] = { "1xx", "2xx", "3xx", "4xx", "5xx" };
+        for (int i = 0; i < 5; ++i)
+        {
+            server_metrics.responses[i] = metrics->counter("http_requests_total",
+                "HTTP requests by response status class.", { { "code", CLASSES[i] } });
+        }
+        server_metrics.request_bytes = metrics->counter("http_request_bytes_total",
+            "Bytes received from clients, including HTTP/2 framing.");
+        server_metrics.response_bytes = metrics->counter("http_response_bytes_total",
+            "Bytes sent to clients, including HTTP/2 framing.");
+        server_metrics.connections = metrics->gauge("http_connections", "Open client connections.");
+        // Log-linear from 1us, with a finite bucket up to 2^27us (about 2 minutes)
+        HistogramBuckets latency(27, 1, 1e-6);
+        server_metrics.request_duration = metrics->histogram("http_request_duration_seconds",
+            "Time spent in the request handler.", latency);
+        server_metrics.parse_errors = metrics->counter("http_parse_errors_total",
+            "Connections closed due to an invalid HTTP/1 request.");
+        server_metrics.protocol_errors = metrics->counter("http_protocol_errors_total",
+            "Connections closed due to an error in HTTP/2, WebSocket or event stream handling.");
+        server_metrics.tls_handshake_duration = metrics->histogram("tls_handshake_duration_seconds",
+            "Time from accepting a TLS connection to completing the handshake.", latency);
+        if (load_shed.max_in_flight)
+        {
+            server_metrics.shed_requests = metrics->counter("http_shed_requests_total",
+                "Requests rejected by load shedding.");
+        }
+    }
+    void CoreServer::set_load_shedding(const LoadShedOptions &options)
+    {
+        load_shed = options;
+        shed_response = cached_retry_response(SC_SERVICE_UNAVAILABLE, SHED_RESPONSE_BODY,
+            (unsigned)options.retry_after.count());
+        if (metrics)
+        {
+            server_metrics.shed_requests = metrics->counter("http_shed_requests_total",
+                "Requests rejected by load shedding.");
+        }
+    }
+    void CoreServer::set_client_limiter(ClientLimiter *limiter)
+    {
+        client_limiter = limiter;
+        rate_limited_response = cached_retry_response(SC_TOO_MANY_REQUESTS, RATE_LIMITED_RESPONSE_BODY,
+            limiter->retry_after());
+    }
+    bool CoreServer::reserve_body_memory(size_t bytes)
+    {
+        auto used = body_memory.load(std::memory_order_relaxed);
+        do
+        {
+            if (bytes > body_memory_budget || used > body_memory_budget - bytes) return false;
+        }
+        while (!body_memory.compare_exchange_weak(used, used + bytes, std::memory_order_relaxed));
+        return true;
+    }
+    void CoreServer::release_body_memory(size_t bytes)
+    {
+        body_memory.fetch_sub(bytes, std::memory_order_relaxed);
+    }
+    void CoreServer::count_response(int status_code)
+    {
+        if (status_code >= 100 && status_code < 600) server_metrics.responses[status_code / 100 - 1].inc();
+    }
+    CoreServerStats CoreServer::stats()const
+    {
+        std::unique_lock<std::mutex> lock(connections_mutex);
+        CoreServerStats stats;
+        stats.connections = connections;
+        stats.accept_pauses = accept_pauses;
+        stats.accept_paused_time = accept_paused_time;
+        if (response_compressor)
+        {
+            auto compression = response_compressor->stats();
+            stats.compressed_responses = compression.responses;
+            stats.compression_time = compression.cpu_time;
+        }
+        else
+        {
+            stats.compressed_responses = 0;
+            stats.compression_time = std::chrono::nanoseconds::zero();
+        }
+        auto now = std::chrono::steady_clock::now();
+        for (auto &listener : listeners)
+        {
+            if (listener.paused) stats.accept_paused_time += now - listener.paused_at;
+        }
+        std::unique_lock<std::mutex> lock2(shed_mutex);
+        stats.handlers_in_flight = handlers_in_flight;
+        stats.handlers_queued = queued_requests.size();
+        stats.shed_requests = shed_requests;
+        stats.body_memory = body_memory.load(std::memory_order_relaxed);
+        stats.buffers_in_use = buffer_pool.in_use();
+        return stats;
+    }
 
     void CoreServer::run()
     {
         std::unique_lock<std::mutex> lock(running_mutex, std::try_to_lock);
         if (!lock) throw std::runtime_error("CoreServer::run failed to lock mutex. Is CoreServer already running?");
+        {
+            std::unique_lock<std::mutex> lock2(connections_mutex);
+            exiting = false;
+            draining = false;
+        }
+        {
+            std::unique_lock<std::mutex> lock2(shed_mutex);
+            shed_exiting = false;
+            overloaded = false;
+        }
+        // Responses pending from a previous run are still discarded
+        pending_responses = std::make_shared<PendingResponses>();
         for (auto &i : listeners) accept_next(i);
 
         aio.run();
@@ -273,13 +1387,73 @@ namespace http
         std::unique_lock<std::mutex> lock(running_mutex, std::try_to_lock);
         if (!lock)
         {
+            {
+                // Connections closed by the exit must not start accepting again
+                std::unique_lock<std::mutex> lock2(connections_mutex);
+                exiting = true;
+            }
             aio.exit();
             // Clean up is done by run(). Wait for it.
             lock.lock();
         }
-        std::unique_lock<std::mutex> lock2(handle_mutex);
-        for (auto &i : in_progress_handlers) i.wait();
-        in_progress_handlers.clear();
+        std::deque<QueuedRequest> queued;
+        {
+            // Completing handlers must not start queued requests while waiting for them
+            std::unique_lock<std::mutex> lock2(shed_mutex);
+            shed_exiting = true;
+            queued.swap(queued_requests);
+            shed_requests += queued.size();
+            handlers_in_flight = 0;
+        }
+        // Queued connections have no IO in progress, so were not aborted by the exit. Shedding
+        // starts a send, which fails now AsyncIo has stopped, closing the connection.
+        for (auto &request : queued)
+        {
+            server_metrics.shed_requests.inc();
+            request.shed();
+        }
+        {
+            std::unique_lock<std::mutex> lock2(handle_mutex);
+            for (auto &i : in_progress_handlers) i.wait();
+            in_progress_handlers.clear();
+        }
+        // Wait for responses being sent from other threads, and discard any sent later
+        std::unique_lock<std::mutex> lock2(pending_responses->mutex);
+        pending_responses->closed = true;
+        pending_responses->completed_cv.wait(lock2, [this]() { return pending_responses->completing == 0; });
+    }
+    void CoreServer::drain(std::chrono::steady_clock::duration timeout)
+    {
+        auto deadline = std::chrono::steady_clock::now() + timeout;
+        draining = true;
+        aio.post(std::bind(&CoreServer::drain_start, this));
+        {
+            std::unique_lock<std::mutex> lock(connections_mutex);
+            connection_closed_cv.wait_until(lock, deadline, [this]() { return connections == 0; });
+        }
+        exit();
+    }
+    void CoreServer::drain_start()
+    {
+        for (auto &listener : listeners) aio.cancel(listener.socket.get());
+
+        std::vector<Connection*> idle, http2, streams;
+        {
+            std::unique_lock<std::mutex> lock(connections_mutex);
+            for (auto conn : open_connections)
+            {
+                if (conn->is_http2()) http2.push_back(conn);
+                else if (conn->is_stream()) streams.push_back(conn);
+                else if (conn->is_idle()) idle.push_back(conn);
+            }
+        }
+        // Each cancel only destroys that connection, and connections only become non-idle on
+        // this thread, so the rest remain valid
+        for (auto conn : idle) conn->cancel();
+        // HTTP/2 connections are only destroyed on this thread, and only by their own shutdown
+        for (auto conn : http2) conn->http2_shutdown();
+        // Likewise, WebSocket and event stream connections are only destroyed by their own IO
+        for (auto conn : streams) conn->stream_shutdown();
     }
     void CoreServer::accept_next(Listener &listener)
     {
@@ -290,8 +1464,232 @@ namespace http
     void CoreServer::accept(Listener &listener, TcpSocket &&sock)
     {
         assert(sock);
-        (new Connection())->run(this, &listener, std::move(sock));
-        accept_next(listener);
+        bool options_set = true;
+        if (!sock.is_unix_domain())
+        {
+            try
+            {
+                sock.set_options(listener.options.socket_options);
+            }
+            catch (const std::exception &)
+            {
+                // Most likely the client already reset the connection
+                options_set = false;
+            }
+        }
+        size_t limiter_slot = 0;
+        if (!options_set)
+        {
+            sock.close();
+        }
+        else if (client_limiter && !client_limiter->open_connection(sock.host(), &limiter_slot))
+        {
+            // Over the clients connection limit, so close without doing any more work
+            sock.close();
+        }
+        else
+        {
+            auto conn = new Connection();
+            {
+                std::unique_lock<std::mutex> lock(connections_mutex);
+                ++connections;
+                ++listener.connections;
+                open_connections.insert(conn);
+            }
+            server_metrics.connections.inc();
+            conn->run(this, &listener, std::move(sock), limiter_slot);
+        }
+
+        std::unique_lock<std::mutex> lock(connections_mutex);
+        if (draining) return;
+        if (at_connection_limit(listener))
+        {
+            // Stop accepting, leaving further connections in the OS backlog
+            listener.paused = true;
+            listener.paused_at = std::chrono::steady_clock::now();
+            ++accept_pauses;
+        }
+        else accept_next(listener);
+    }
+    bool CoreServer::at_connection_limit(const Listener &listener)const
+    {
+        if (listener.options.max_connections && listener.connections >= listener.options.max_connections)
+            return true;
+        if (max_connections && connections >= max_connections)
+            return true;
+        return false;
+    }
+    void CoreServer::connection_closed(Connection *connection, Listener &listener)
+    {
+        std::unique_lock<std::mutex> lock(connections_mutex);
+        assert(connections > 0 && listener.connections > 0);
+        --connections;
+        --listener.connections;
+        open_connections.erase(connection);
+        server_metrics.connections.dec();
+        connection_closed_cv.notify_all();
+        if (exiting || draining) return;
+        if (max_connections && connections > resume_connections) return;
+        for (auto &i : listeners)
+        {
+            if (i.paused && (!i.options.max_connections || i.connections <= i.options.resume_connections))
+            {
+                i.paused = false;
+                accept_paused_time += std::chrono::steady_clock::now() - i.paused_at;
+                accept_next(i);
+            }
+        }
+    }
+    void CoreServer::start_handler(std::function<void()> func)
+    {
+        std::unique_lock<std::mutex> lock(handle_mutex);
+        for (auto i = in_progress_handlers.begin(); i != in_progress_handlers.end();)
+        {
+            if (i->wait_for(std::chrono::seconds(0)) != std::future_status::timeout)
+                i = in_progress_handlers.erase(i);
+            else ++i;
+        }
+        in_progress_handlers.push_back(std::async(func));
+    }
+    void CoreServer::dispatch(std::function<void()> handle, std::function<void()> shed)
+    {
+        if (!load_shed.max_in_flight) return start_handler(handle);
+        {
+            std::unique_lock<std::mutex> lock(shed_mutex);
+            // Once exit() has shed the queue, nothing may be queued or started
+            if (!shed_exiting && handlers_in_flight < load_shed.max_in_flight)
+            {
+                ++handlers_in_flight;
+                start_admitted(handle);
+                return;
+            }
+            if (!shed_exiting && queued_requests.size() < load_shed.max_queued)
+            {
+                queued_requests.push_back({ std::chrono::steady_clock::now(), handle, shed });
+                return;
+            }
+            ++shed_requests;
+        }
+        server_metrics.shed_requests.inc();
+        shed();
+    }
+    void CoreServer::start_admitted(std::function<void()> handle)
+    {
+        start_handler([this, handle]()
+        {
+            handle();
+            handler_done();
+        });
+    }
+    void CoreServer::handler_done()
+    {
+        std::vector<std::function<void()>> rejected;
+        {
+            std::unique_lock<std::mutex> lock(shed_mutex);
+            if (shed_exiting) return;
+            bool started = false;
+            auto now = std::chrono::steady_clock::now();
+            while (!queued_requests.empty() && !started)
+            {
+                auto request = std::move(queued_requests.front());
+                queued_requests.pop_front();
+                auto sojourn = now - request.queued;
+                // CoDel: overloaded if no request in the last interval waited less than target
+                if (now >= shed_interval_end)
+                {
+                    overloaded = shed_interval_min > load_shed.target;
+                    shed_interval_min = sojourn;
+                    shed_interval_end = now + load_shed.interval;
+                }
+                else if (sojourn < shed_interval_min) shed_interval_min = sojourn;
+
+                auto timeout = overloaded ?
+                    std::chrono::steady_clock::duration(load_shed.target) :
+                    std::chrono::steady_clock::duration(load_shed.interval);
+                if (sojourn > timeout)
+                {
+                    ++shed_requests;
+                    rejected.push_back(std::move(request.shed));
+                }
+                else
+                {
+                    start_admitted(std::move(request.handle));
+                    started = true;
+                }
+            }
+            if (!started) --handlers_in_flight;
+            // An empty queue means there is no standing queue delay
+            if (queued_requests.empty()) shed_interval_min = std::chrono::steady_clock::duration::zero();
+        }
+        for (auto &shed : rejected)
+        {
+            server_metrics.shed_requests.inc();
+            shed();
+        }
+    }
+    void CoreServer::process_request(const std::shared_ptr<Request> &request,
+        std::function<void(Response &response, bool ok)> complete)
+    {
+        auto pending = pending_responses;
+        auto start = std::chrono::steady_clock::now();
+        bool metrics_request = !metrics_path.empty() && request->url.path == metrics_path &&
+            (request->method == GET || request->method == HEAD);
+        Responder responder([this, pending, request, start, metrics_request, complete](Response &&response, bool failed)
+        {
+            {
+                // After exit the server may no longer exist
+                std::unique_lock<std::mutex> lock(pending->mutex);
+                if (pending->closed) return;
+                ++pending->completing;
+            }
+            if (!metrics_request) server_metrics.request_duration.observe(elapsed_us(start));
+            if (!failed)
+            {
+                try
+                {
+                    if (response_compressor) response_compressor->compress(*request, response);
+                    if (response_cache) response_cache->put(*request, response);
+                }
+                catch (const std::exception &err)
+                {
+                    error_response(response, SC_INTERNAL_SERVER_ERROR, err.what());
+                    failed = true;
+                }
+            }
+            complete(response, !failed);
+            std::unique_lock<std::mutex> lock(pending->mutex);
+            --pending->completing;
+            pending->completed_cv.notify_all();
+        });
+        try
+        {
+            if (metrics_request)
+            {
+                Response response;
+                response.status.code = SC_OK;
+                response.headers.add("Content-Type", Metrics::CONTENT_TYPE);
+                response.headers.add("Cache-Control", "no-store");
+                response.body = metrics_snapshot ? metrics_snapshot().render() : metrics->render();
+                responder.send(std::move(response));
+            }
+            else handle_request_async(*request, responder);
+        }
+        catch (const std::exception &)
+        {
+            responder.send_error(std::current_exception());
+        }
+    }
+    Response CoreServer::handle_request(Request &)
+    {
+        throw std::logic_error("CoreServer::handle_request is not implemented");
+    }
+    void CoreServer::handle_request_async(Request &request, Responder responder)
+    {
+        responder.send(handle_request(request));
+    }
+    bool CoreServer::admit_request(const Request &, Response &)
+    {
+        return true;
     }
     void CoreServer::accept_error()
     {
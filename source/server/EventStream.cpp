@@ -0,0 +1,153 @@
+#include "server/EventStream.hpp"
+#include "Response.hpp"
+#include <algorithm>
+#include <stdexcept>
+namespace http
+{
+    namespace
+    {
+        void check_field(const std::string &value, const char *name)
+        {
+            if (value.find_first_of("\r\n") != std::string::npos)
+                throw std::invalid_argument(std::string("Event ") + name + " must not contain a line break");
+        }
+        /**Append a field for each line of value, ending lines at CRLF, LF or CR.*/
+        void write_lines(std::string *out, const char *field, const std::string &value)
+        {
+            size_t i = 0;
+            while (true)
+            {
+                auto end = value.find_first_of("\r\n", i);
+                *out += field;
+                out->append(value, i, end == std::string::npos ? std::string::npos : end - i);
+                out->push_back('\n');
+                if (end == std::string::npos) break;
+                i = end + (value.compare(end, 2, "\r\n") == 0 ? 2 : 1);
+            }
+        }
+    }
+
+    ServerEvent::ServerEvent(const std::string &data, const std::string &event, const std::string &id)
+    {
+        check_field(event, "type");
+        check_field(id, "ID");
+        auto out = std::make_shared<std::string>();
+        out->reserve(data.size() + event.size() + id.size() + 32);
+        if (!id.empty()) *out += "id: " + id + "\n";
+        if (!event.empty()) *out += "event: " + event + "\n";
+        write_lines(out.get(), "data: ", data);
+        out->push_back('\n');
+        buffer = out;
+    }
+    ServerEvent ServerEvent::comment(const std::string &text)
+    {
+        auto out = std::make_shared<std::string>();
+        write_lines(out.get(), ": ", text);
+        out->push_back('\n');
+        ServerEvent event;
+        event.buffer = out;
+        return event;
+    }
+
+    EventStream::EventStream(Request &&request, const EventStreamOptions &options)
+        : stream_request(std::move(request)), output(options.max_buffered, options.disconnect_slow)
+    {
+        if (options.retry.count())
+            output.queue(std::make_shared<std::string>("retry: " + std::to_string(options.retry.count()) + "\n\n"));
+    }
+    const std::string &EventStream::last_event_id()const
+    {
+        return stream_request.headers.get("Last-Event-ID");
+    }
+
+    bool EventStream::send(const ServerEvent &event)
+    {
+        return output.queue(event.serialized()) == StreamOutput::QUEUED;
+    }
+    bool EventStream::send(const std::string &data, const std::string &event, const std::string &id)
+    {
+        return send(ServerEvent(data, event, id));
+    }
+    void EventStream::close()
+    {
+        output.close();
+    }
+    size_t EventStream::buffered_amount()const
+    {
+        return output.buffered_amount();
+    }
+    bool EventStream::is_open()const
+    {
+        return output.is_open();
+    }
+    uint64_t EventStream::dropped()const
+    {
+        return output.dropped();
+    }
+
+    void EventStream::attach(std::function<void()> notify)
+    {
+        output.attach(notify);
+    }
+    void EventStream::detach()
+    {
+        output.detach();
+    }
+    std::shared_ptr<const std::string> EventStream::take_output()
+    {
+        return output.take();
+    }
+    bool EventStream::wants_close()const
+    {
+        return output.closed();
+    }
+
+    void EventTopic::subscribe(std::shared_ptr<EventStream> stream)
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        streams.push_back(std::move(stream));
+    }
+    void EventTopic::unsubscribe(const std::shared_ptr<EventStream> &stream)
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        streams.erase(std::remove(streams.begin(), streams.end(), stream), streams.end());
+    }
+    size_t EventTopic::subscribers()const
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        return streams.size();
+    }
+    size_t EventTopic::publish(const ServerEvent &event)
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        size_t sent = 0;
+        for (size_t i = 0; i < streams.size();)
+        {
+            if (streams[i]->send(event)) ++sent;
+            if (streams[i]->is_open()) ++i;
+            else
+            {
+                // Order does not matter, so swap with the last rather than shifting the rest
+                streams[i] = std::move(streams.back());
+                streams.pop_back();
+            }
+        }
+        return sent;
+    }
+    size_t EventTopic::publish(const std::string &data, const std::string &event, const std::string &id)
+    {
+        return publish(ServerEvent(data, event, id));
+    }
+
+    Response event_stream(const Request &request, const EventStreamOptions &options)
+    {
+        Response response;
+        response.status_code(SC_OK);
+        response.headers.add("Content-Type", "text/event-stream");
+        response.headers.add("Cache-Control", "no-cache");
+        Request stream_request = request;
+        stream_request.body.clear();
+        response.event_stream = std::make_shared<EventStream>(std::move(stream_request), options);
+        return response;
+    }
+}
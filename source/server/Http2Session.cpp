@@ -0,0 +1,665 @@
+#include "server/Http2Session.hpp"
+#include "util/File.hpp"
+#include "Error.hpp"
+#include "Response.hpp"
+#include "Time.hpp"
+#include <algorithm>
+#include <cassert>
+#include <cstring>
+namespace http
+{
+    using namespace http2;
+    namespace
+    {
+        /**Convert a HTTP/2 header name to the capitalisation typically used by HTTP/1, since
+         * Headers is case sensitive. e.g. "content-type" to "Content-Type".
+         */
+        std::string canonical_name(const std::string &name)
+        {
+            std::string out = name;
+            bool upper = true;
+            for (auto &c : out)
+            {
+                if (upper && c >= 'a' && c <= 'z') c = (char)(c - 'a' + 'A');
+                upper = c == '-';
+            }
+            return out;
+        }
+        std::string lower_name(const std::string &name)
+        {
+            std::string out = name;
+            for (auto &c : out)
+            {
+                if (c >= 'A' && c <= 'Z') c = (char)(c - 'A' + 'a');
+            }
+            return out;
+        }
+        /**Headers that are specific to a HTTP/1 connection, and not allowed in HTTP/2.*/
+        bool is_connection_header(const std::string &lower)
+        {
+            return lower == "connection" || lower == "keep-alive" || lower == "proxy-connection" ||
+                lower == "transfer-encoding" || lower == "upgrade";
+        }
+        /**Remove the padding from a PADDED frame payload.*/
+        void strip_padding(const FrameHeader &header, const uint8_t **payload, size_t *len)
+        {
+            if (!(header.flags & FLAG_PADDED)) return;
+            if (*len < 1) throw Http2Error(ERR_FRAME_SIZE_ERROR, "Padded frame too small");
+            size_t pad = (*payload)[0];
+            if (pad >= *len) throw Http2Error(ERR_PROTOCOL_ERROR, "Padding exceeds frame payload");
+            *payload += 1;
+            *len -= 1 + pad;
+        }
+    }
+
+    Http2Session::Http2Session(RequestHandler on_request, const Http2Settings &settings)
+        : on_request(on_request), settings(settings)
+        , decoder(settings.header_table_size, settings.max_header_list_size), encoder()
+        , preface_received(false), settings_received(false)
+        , last_stream_id(0), continuation_stream(0), continuation_end_stream(false)
+        , next_data_stream(0)
+        , conn_send_window(DEFAULT_WINDOW_SIZE), conn_recv_window(DEFAULT_WINDOW_SIZE)
+        , peer_initial_window(DEFAULT_WINDOW_SIZE), peer_max_frame_size(DEFAULT_MAX_FRAME_SIZE)
+        , goaway_sent(false), goaway_received(false), failed(false)
+    {
+        auto &s = this->settings;
+        s.initial_window_size = std::max<uint32_t>(s.initial_window_size, DEFAULT_WINDOW_SIZE);
+        s.initial_window_size = std::min<uint32_t>(s.initial_window_size, (uint32_t)MAX_WINDOW_SIZE);
+        s.max_frame_size = std::max(s.max_frame_size, DEFAULT_MAX_FRAME_SIZE);
+        s.max_frame_size = std::min(s.max_frame_size, MAX_MAX_FRAME_SIZE);
+
+        std::string payload;
+        auto add_setting = [&payload](SettingsId id, uint32_t value)
+        {
+            payload.push_back((char)(id >> 8));
+            payload.push_back((char)id);
+            write_u32(&payload, value);
+        };
+        add_setting(SETTINGS_MAX_CONCURRENT_STREAMS, s.max_concurrent_streams);
+        add_setting(SETTINGS_INITIAL_WINDOW_SIZE, s.initial_window_size);
+        add_setting(SETTINGS_MAX_FRAME_SIZE, s.max_frame_size);
+        add_setting(SETTINGS_MAX_HEADER_LIST_SIZE, s.max_header_list_size);
+        if (s.header_table_size != DEFAULT_HEADER_TABLE_SIZE)
+            add_setting(SETTINGS_HEADER_TABLE_SIZE, s.header_table_size);
+        write_frame(SETTINGS, 0, 0, payload.data(), payload.size());
+        // The connection window can only be changed by WINDOW_UPDATE
+        if (s.initial_window_size > (uint32_t)DEFAULT_WINDOW_SIZE)
+        {
+            std::string inc;
+            write_u32(&inc, s.initial_window_size - DEFAULT_WINDOW_SIZE);
+            write_frame(WINDOW_UPDATE, 0, 0, inc.data(), inc.size());
+            conn_recv_window = s.initial_window_size;
+        }
+    }
+
+    void Http2Session::receive(const void *data, size_t len)
+    {
+        if (failed) return;
+        input.append((const char*)data, len);
+        size_t pos = 0;
+        try
+        {
+            if (!preface_received)
+            {
+                auto n = std::min(input.size(), PREFACE_LEN);
+                if (input.compare(0, n, PREFACE, n) != 0)
+                    throw Http2Error(ERR_PROTOCOL_ERROR, "Invalid connection preface");
+                if (n < PREFACE_LEN) return;
+                preface_received = true;
+                pos = PREFACE_LEN;
+            }
+            while (!failed && input.size() - pos >= FRAME_HEADER_LEN)
+            {
+                auto p = (const uint8_t*)input.data() + pos;
+                auto header = FrameHeader::read(p);
+                if (header.length > settings.max_frame_size)
+                    throw Http2Error(ERR_FRAME_SIZE_ERROR, "Frame exceeds SETTINGS_MAX_FRAME_SIZE");
+                if (input.size() - pos - FRAME_HEADER_LEN < header.length) break;
+                pos += FRAME_HEADER_LEN + header.length;
+                try
+                {
+                    process_frame(header, p + FRAME_HEADER_LEN);
+                }
+                catch (const Http2Error &err)
+                {
+                    if (!err.stream_id()) throw;
+                    on_error(err);
+                }
+            }
+        }
+        catch (const Http2Error &err)
+        {
+            on_error(err);
+        }
+        if (failed) input.clear();
+        else input.erase(0, pos);
+    }
+
+    void Http2Session::send_response(uint32_t stream_id, Response &&response)
+    {
+        auto it = streams.find(stream_id);
+        if (failed || it == streams.end() || it->second.responded) return;
+        auto &stream = it->second;
+        stream.responded = true;
+
+        auto sc = response.status.code;
+        // For certain response codes, there must not be a message body
+        bool message_body_allowed = sc != 204 && sc != 205 && sc != 304;
+        assert(!response.body_file || response.body.empty());
+        uint64_t body_size = response.body_file ? response.body_file->size() : response.body.size();
+        bool has_body = message_body_allowed && body_size > 0 && !stream.head;
+
+        HeaderList fields;
+        fields.push_back({":status", std::to_string((int)sc)});
+        for (auto &header : response.headers)
+        {
+            auto name = lower_name(header.first);
+            if (is_connection_header(name) || name == "content-length") continue;
+            fields.push_back({name, header.second});
+        }
+        if (!response.headers.has("Date"))
+        {
+            char date[TIME_STR_LEN];
+            format_current_time(date);
+            fields.push_back({"date", std::string(date, TIME_STR_LEN)});
+        }
+        if (message_body_allowed) fields.push_back({"content-length", std::to_string(body_size)});
+
+        std::string block;
+        encoder.encode(fields, &block);
+        size_t pos = 0;
+        do
+        {
+            auto len = std::min<size_t>(block.size() - pos, peer_max_frame_size);
+            uint8_t flags = pos + len == block.size() ? FLAG_END_HEADERS : 0;
+            if (pos == 0 && !has_body) flags |= FLAG_END_STREAM;
+            write_frame(pos == 0 ? HEADERS : CONTINUATION, flags, stream_id, block.data() + pos, len);
+            pos += len;
+        }
+        while (pos < block.size());
+
+        if (has_body)
+        {
+            stream.body = std::move(response.body);
+            stream.body_file = std::move(response.body_file);
+            stream.body_offset = 0;
+            stream.body_size = body_size;
+        }
+        else close_stream(it);
+    }
+
+    bool Http2Session::take_output(std::string *out)
+    {
+        auto start = out->size();
+        out->append(output);
+        output.clear();
+        // Send one DATA frame at a time from each stream in turn
+        bool progress = true;
+        while (progress && conn_send_window > 0 && out->size() - start < OUTPUT_BATCH_SIZE)
+        {
+            progress = false;
+            auto it = streams.upper_bound(next_data_stream);
+            for (size_t i = 0, n = streams.size(); i < n && conn_send_window > 0; ++i)
+            {
+                if (it == streams.end()) it = streams.begin();
+                auto &stream = it->second;
+                if (stream.responded && stream.body_offset < stream.body_size && stream.send_window > 0)
+                {
+                    progress = true;
+                    next_data_stream = it->first;
+                    if (write_data(it->first, stream, out))
+                    {
+                        it = close_stream(it);
+                        continue;
+                    }
+                }
+                ++it;
+            }
+        }
+        // Any RST_STREAM from completing streams
+        out->append(output);
+        output.clear();
+        return out->size() > start;
+    }
+
+    void Http2Session::shutdown()
+    {
+        if (!goaway_sent && !failed) write_goaway(ERR_NO_ERROR, std::string());
+    }
+
+    bool Http2Session::wants_close()const
+    {
+        return failed || ((goaway_sent || goaway_received) && streams.empty());
+    }
+
+    void Http2Session::process_frame(const FrameHeader &header, const uint8_t *payload)
+    {
+        if (continuation_stream && header.type != CONTINUATION)
+            throw Http2Error(ERR_PROTOCOL_ERROR, "Expected CONTINUATION frame");
+        if (!settings_received && header.type != SETTINGS)
+            throw Http2Error(ERR_PROTOCOL_ERROR, "Expected SETTINGS frame after preface");
+        switch (header.type)
+        {
+        case DATA: return on_data(header, payload);
+        case HEADERS: return on_headers(header, payload);
+        case PRIORITY:
+            // Prioritisation is not implemented, responses are sent round-robin
+            if (!header.stream_id) throw Http2Error(ERR_PROTOCOL_ERROR, "PRIORITY on stream 0");
+            if (header.length != 5)
+                throw Http2Error(ERR_FRAME_SIZE_ERROR, "Invalid PRIORITY frame", header.stream_id);
+            return;
+        case RST_STREAM: return on_rst_stream(header, payload);
+        case SETTINGS: return on_settings(header, payload);
+        case PUSH_PROMISE: throw Http2Error(ERR_PROTOCOL_ERROR, "PUSH_PROMISE from client");
+        case PING: return on_ping(header, payload);
+        case GOAWAY: return on_goaway(header, payload);
+        case WINDOW_UPDATE: return on_window_update(header, payload);
+        case CONTINUATION: return on_continuation(header, payload);
+        default: return; // Unknown frame types must be ignored
+        }
+    }
+
+    void Http2Session::on_data(const FrameHeader &header, const uint8_t *payload)
+    {
+        auto id = header.stream_id;
+        if (!id) throw Http2Error(ERR_PROTOCOL_ERROR, "DATA on stream 0");
+        size_t len = header.length;
+        strip_padding(header, &payload, &len);
+        // Flow control includes any padding
+        if (header.length > conn_recv_window)
+            throw Http2Error(ERR_FLOW_CONTROL_ERROR, "DATA exceeds connection window");
+        conn_recv_window -= header.length;
+        update_recv_window(0, &conn_recv_window);
+
+        auto it = streams.find(id);
+        if (it == streams.end())
+        {
+            if (id > last_stream_id) throw Http2Error(ERR_PROTOCOL_ERROR, "DATA on idle stream");
+            return; // Closed or reset stream
+        }
+        auto &stream = it->second;
+        if (stream.remote_closed) throw Http2Error(ERR_STREAM_CLOSED, "DATA after END_STREAM", id);
+        if (header.length > stream.recv_window)
+            throw Http2Error(ERR_FLOW_CONTROL_ERROR, "DATA exceeds stream window", id);
+        stream.recv_window -= header.length;
+
+        // If already responded with an error, the body is not needed
+        if (!stream.responded && settings.max_body_size && stream.request.body.size() + len > settings.max_body_size)
+        {
+            stream.request.body.clear();
+            send_error(id, SC_PAYLOAD_TOO_LARGE);
+        }
+        if (!stream.responded)
+        {
+            auto &body = stream.request.body;
+            body.append((const char*)payload, len);
+            if (stream.content_length >= 0 && body.size() > (uint64_t)stream.content_length)
+                throw Http2Error(ERR_PROTOCOL_ERROR, "DATA exceeds content-length", id);
+        }
+        if (header.flags & FLAG_END_STREAM)
+        {
+            stream.remote_closed = true;
+            if (!stream.responded) dispatch(id, stream);
+        }
+        else update_recv_window(id, &stream.recv_window);
+    }
+
+    void Http2Session::on_headers(const FrameHeader &header, const uint8_t *payload)
+    {
+        auto id = header.stream_id;
+        if (!id) throw Http2Error(ERR_PROTOCOL_ERROR, "HEADERS on stream 0");
+        if (!streams.count(id) && (id % 2 == 0 || id <= last_stream_id))
+            throw Http2Error(ERR_PROTOCOL_ERROR, "Invalid stream id for HEADERS");
+        size_t len = header.length;
+        strip_padding(header, &payload, &len);
+        if (header.flags & FLAG_PRIORITY)
+        {
+            if (len < 5) throw Http2Error(ERR_FRAME_SIZE_ERROR, "HEADERS too small for priority");
+            if ((read_u32(payload) & 0x7FFFFFFF) == id)
+                throw Http2Error(ERR_PROTOCOL_ERROR, "Stream depends on itself", id);
+            payload += 5;
+            len -= 5;
+        }
+        header_block.assign((const char*)payload, len);
+        if (header.flags & FLAG_END_HEADERS) on_header_block(id, (header.flags & FLAG_END_STREAM) != 0);
+        else
+        {
+            continuation_stream = id;
+            continuation_end_stream = (header.flags & FLAG_END_STREAM) != 0;
+        }
+    }
+
+    void Http2Session::on_continuation(const FrameHeader &header, const uint8_t *payload)
+    {
+        if (!continuation_stream || header.stream_id != continuation_stream)
+            throw Http2Error(ERR_PROTOCOL_ERROR, "Unexpected CONTINUATION frame");
+        // Limit memory for incomplete blocks. The encoded block is rarely larger than the list.
+        if (header_block.size() + header.length > 2 * (size_t)settings.max_header_list_size + settings.max_frame_size)
+            throw Http2Error(ERR_ENHANCE_YOUR_CALM, "Header block too large");
+        header_block.append((const char*)payload, header.length);
+        if (header.flags & FLAG_END_HEADERS)
+        {
+            auto id = continuation_stream;
+            continuation_stream = 0;
+            on_header_block(id, continuation_end_stream);
+        }
+    }
+
+    void Http2Session::on_header_block(uint32_t stream_id, bool end_stream)
+    {
+        // Always decode to keep the HPACK dynamic table in sync, even if the stream is not used
+        HeaderList fields;
+        auto begin = (const uint8_t*)header_block.data();
+        bool complete = decoder.decode(begin, begin + header_block.size(), &fields);
+        header_block.clear();
+
+        auto it = streams.find(stream_id);
+        if (it != streams.end())
+        {
+            // Trailers. These are not passed to the handler.
+            auto &stream = it->second;
+            if (stream.remote_closed) throw Http2Error(ERR_STREAM_CLOSED, "HEADERS after END_STREAM", stream_id);
+            if (!end_stream) throw Http2Error(ERR_PROTOCOL_ERROR, "Trailers without END_STREAM", stream_id);
+            for (auto &field : fields)
+            {
+                if (!field.name.empty() && field.name[0] == ':')
+                    throw Http2Error(ERR_PROTOCOL_ERROR, "Pseudo header in trailers", stream_id);
+            }
+            stream.remote_closed = true;
+            if (!stream.responded) dispatch(stream_id, stream);
+            return;
+        }
+
+        last_stream_id = stream_id;
+        if (goaway_sent) return;
+        if (streams.size() >= settings.max_concurrent_streams)
+            throw Http2Error(ERR_REFUSED_STREAM, "Too many concurrent streams", stream_id);
+
+        auto &stream = streams[stream_id];
+        stream.content_length = -1;
+        stream.remote_closed = end_stream;
+        stream.responded = false;
+        stream.head = false;
+        stream.send_window = peer_initial_window;
+        stream.recv_window = settings.initial_window_size;
+        stream.body_offset = stream.body_size = 0;
+
+        if (!complete) return send_error(stream_id, SC_REQUEST_HEADER_FIELDS_TOO_LARGE);
+        try
+        {
+            make_request(stream_id, fields, stream);
+        }
+        catch (const ErrorResponse &err)
+        {
+            return send_error(stream_id, err.status_code());
+        }
+        if (settings.max_body_size && stream.content_length > (int64_t)settings.max_body_size)
+            return send_error(stream_id, SC_PAYLOAD_TOO_LARGE);
+        if (end_stream) dispatch(stream_id, stream);
+    }
+
+    void Http2Session::make_request(uint32_t stream_id, const HeaderList &fields, Stream &stream)
+    {
+        std::string method, scheme, path, authority;
+        bool regular = false;
+        auto &headers = stream.request.headers;
+        for (auto &field : fields)
+        {
+            auto &name = field.name;
+            if (name.empty()) throw Http2Error(ERR_PROTOCOL_ERROR, "Empty header name", stream_id);
+            if (name[0] == ':')
+            {
+                std::string *pseudo;
+                if (name == ":method") pseudo = &method;
+                else if (name == ":scheme") pseudo = &scheme;
+                else if (name == ":path") pseudo = &path;
+                else if (name == ":authority") pseudo = &authority;
+                else throw Http2Error(ERR_PROTOCOL_ERROR, "Unknown pseudo header " + name, stream_id);
+                if (regular || !pseudo->empty())
+                    throw Http2Error(ERR_PROTOCOL_ERROR, "Misplaced pseudo header " + name, stream_id);
+                *pseudo = field.value;
+                continue;
+            }
+            regular = true;
+            for (auto c : name)
+            {
+                if (c >= 'A' && c <= 'Z')
+                    throw Http2Error(ERR_PROTOCOL_ERROR, "Upper case header name", stream_id);
+            }
+            if (is_connection_header(name) || (name == "te" && field.value != "trailers"))
+                throw Http2Error(ERR_PROTOCOL_ERROR, "Connection specific header " + name, stream_id);
+            if (name == "content-length")
+            {
+                auto &value = field.value;
+                if (value.empty() || value.size() > 18 || value.find_first_not_of("0123456789") != std::string::npos)
+                    throw Http2Error(ERR_PROTOCOL_ERROR, "Invalid content-length", stream_id);
+                stream.content_length = std::stoll(value);
+            }
+
+            auto key = canonical_name(name);
+            if (headers.has(key))
+            {
+                // Cookies may be split into separate fields (RFC7540 8.1.2.5)
+                headers.set(key, headers.get(key) + (name == "cookie" ? "; " : ", ") + field.value);
+            }
+            else headers.add(key, field.value);
+        }
+        if (method.empty() || scheme.empty() || path.empty())
+            throw Http2Error(ERR_PROTOCOL_ERROR, "Missing request pseudo header", stream_id);
+        if (!authority.empty() && !headers.has("Host")) headers.add("Host", authority);
+
+        auto &request = stream.request;
+        try
+        {
+            request.method = method_from_string(method);
+        }
+        catch (const std::exception &)
+        {
+            throw ErrorResponse("Unsupported method " + method, SC_NOT_IMPLEMENTED);
+        }
+        request.raw_url = path;
+        try
+        {
+            request.url = Url::parse_request(path);
+        }
+        catch (const std::exception &err)
+        {
+            throw BadRequest(err.what());
+        }
+        stream.head = request.method == HEAD;
+    }
+
+    void Http2Session::dispatch(uint32_t stream_id, Stream &stream)
+    {
+        if (stream.content_length >= 0 && stream.request.body.size() != (uint64_t)stream.content_length)
+            throw Http2Error(ERR_PROTOCOL_ERROR, "Body does not match content-length", stream_id);
+        on_request(stream_id, stream.request);
+    }
+
+    void Http2Session::send_error(uint32_t stream_id, int status_code)
+    {
+        Response response;
+        response.status_code(status_code);
+        response.headers.add("Content-Type", "text/plain");
+        response.body = response.status.msg;
+        send_response(stream_id, std::move(response));
+    }
+
+    Http2Session::StreamMap::iterator Http2Session::close_stream(StreamMap::iterator stream)
+    {
+        // The response is complete, so the rest of the request is not needed (RFC7540 8.1)
+        if (!stream->second.remote_closed) write_rst_stream(stream->first, ERR_NO_ERROR);
+        return streams.erase(stream);
+    }
+
+    bool Http2Session::write_data(uint32_t stream_id, Stream &stream, std::string *out)
+    {
+        auto remaining = stream.body_size - stream.body_offset;
+        auto len = (uint32_t)std::min<uint64_t>(std::min<uint64_t>(remaining, peer_max_frame_size),
+            (uint64_t)std::min(conn_send_window, stream.send_window));
+        bool end = len == remaining;
+        FrameHeader header = { len, DATA, (uint8_t)(end ? FLAG_END_STREAM : 0), stream_id };
+        header.write(out);
+        if (stream.body_file)
+        {
+            auto pos = out->size();
+            out->resize(pos + len);
+            for (size_t read = 0; read < len;)
+            {
+                auto n = stream.body_file->read(&(*out)[pos + read], len - read, stream.body_offset + read);
+                if (!n) throw std::runtime_error("Unexpected end of response body file");
+                read += n;
+            }
+        }
+        else out->append(stream.body, (size_t)stream.body_offset, len);
+        stream.body_offset += len;
+        stream.send_window -= len;
+        conn_send_window -= len;
+        return end;
+    }
+
+    void Http2Session::on_rst_stream(const FrameHeader &header, const uint8_t *)
+    {
+        if (header.length != 4) throw Http2Error(ERR_FRAME_SIZE_ERROR, "Invalid RST_STREAM frame");
+        if (!header.stream_id || header.stream_id > last_stream_id)
+            throw Http2Error(ERR_PROTOCOL_ERROR, "RST_STREAM on idle stream");
+        // Any response the handler later sends is discarded
+        streams.erase(header.stream_id);
+    }
+
+    void Http2Session::on_settings(const FrameHeader &header, const uint8_t *payload)
+    {
+        if (header.stream_id) throw Http2Error(ERR_PROTOCOL_ERROR, "SETTINGS on a stream");
+        if (header.flags & FLAG_ACK)
+        {
+            if (header.length) throw Http2Error(ERR_FRAME_SIZE_ERROR, "SETTINGS ACK with payload");
+            return;
+        }
+        if (header.length % 6) throw Http2Error(ERR_FRAME_SIZE_ERROR, "Invalid SETTINGS frame");
+        settings_received = true;
+        for (auto p = payload; p < payload + header.length; p += 6)
+        {
+            auto id = (uint16_t)((p[0] << 8) | p[1]);
+            auto value = read_u32(p + 2);
+            switch (id)
+            {
+            case SETTINGS_HEADER_TABLE_SIZE:
+                encoder.set_max_table_size(value);
+                break;
+            case SETTINGS_ENABLE_PUSH:
+                if (value > 1) throw Http2Error(ERR_PROTOCOL_ERROR, "Invalid SETTINGS_ENABLE_PUSH");
+                break;
+            case SETTINGS_INITIAL_WINDOW_SIZE:
+            {
+                if (value > MAX_WINDOW_SIZE)
+                    throw Http2Error(ERR_FLOW_CONTROL_ERROR, "Invalid SETTINGS_INITIAL_WINDOW_SIZE");
+                auto delta = (int64_t)value - peer_initial_window;
+                for (auto &stream : streams)
+                {
+                    stream.second.send_window += delta;
+                    if (stream.second.send_window > MAX_WINDOW_SIZE)
+                        throw Http2Error(ERR_FLOW_CONTROL_ERROR, "Stream window too large");
+                }
+                peer_initial_window = value;
+                break;
+            }
+            case SETTINGS_MAX_FRAME_SIZE:
+                if (value < DEFAULT_MAX_FRAME_SIZE || value > MAX_MAX_FRAME_SIZE)
+                    throw Http2Error(ERR_PROTOCOL_ERROR, "Invalid SETTINGS_MAX_FRAME_SIZE");
+                peer_max_frame_size = value;
+                break;
+            default:
+                // SETTINGS_MAX_CONCURRENT_STREAMS and SETTINGS_MAX_HEADER_LIST_SIZE limit
+                // requests the server makes, so do not apply. Unknown settings are ignored.
+                break;
+            }
+        }
+        write_frame(SETTINGS, FLAG_ACK, 0, nullptr, 0);
+    }
+
+    void Http2Session::on_ping(const FrameHeader &header, const uint8_t *payload)
+    {
+        if (header.stream_id) throw Http2Error(ERR_PROTOCOL_ERROR, "PING on a stream");
+        if (header.length != 8) throw Http2Error(ERR_FRAME_SIZE_ERROR, "Invalid PING frame");
+        if (!(header.flags & FLAG_ACK)) write_frame(PING, FLAG_ACK, 0, payload, 8);
+    }
+
+    void Http2Session::on_goaway(const FrameHeader &header, const uint8_t *)
+    {
+        if (header.stream_id) throw Http2Error(ERR_PROTOCOL_ERROR, "GOAWAY on a stream");
+        if (header.length < 8) throw Http2Error(ERR_FRAME_SIZE_ERROR, "Invalid GOAWAY frame");
+        goaway_received = true;
+    }
+
+    void Http2Session::on_window_update(const FrameHeader &header, const uint8_t *payload)
+    {
+        if (header.length != 4) throw Http2Error(ERR_FRAME_SIZE_ERROR, "Invalid WINDOW_UPDATE frame");
+        auto id = header.stream_id;
+        auto inc = read_u32(payload) & 0x7FFFFFFF;
+        if (!id)
+        {
+            if (!inc) throw Http2Error(ERR_PROTOCOL_ERROR, "Zero WINDOW_UPDATE");
+            conn_send_window += inc;
+            if (conn_send_window > MAX_WINDOW_SIZE)
+                throw Http2Error(ERR_FLOW_CONTROL_ERROR, "Connection window too large");
+            return;
+        }
+        if (id > last_stream_id) throw Http2Error(ERR_PROTOCOL_ERROR, "WINDOW_UPDATE on idle stream");
+        auto it = streams.find(id);
+        if (it == streams.end()) return;
+        if (!inc) throw Http2Error(ERR_PROTOCOL_ERROR, "Zero WINDOW_UPDATE", id);
+        it->second.send_window += inc;
+        if (it->second.send_window > MAX_WINDOW_SIZE)
+            throw Http2Error(ERR_FLOW_CONTROL_ERROR, "Stream window too large", id);
+    }
+
+    void Http2Session::update_recv_window(uint32_t stream_id, int64_t *window)
+    {
+        int64_t initial = settings.initial_window_size;
+        if (*window > initial / 2) return;
+        std::string payload;
+        write_u32(&payload, (uint32_t)(initial - *window));
+        write_frame(WINDOW_UPDATE, 0, stream_id, payload.data(), payload.size());
+        *window = initial;
+    }
+
+    void Http2Session::write_frame(FrameType type, uint8_t flags, uint32_t stream_id,
+        const void *payload, size_t len)
+    {
+        assert(len <= MAX_MAX_FRAME_SIZE);
+        FrameHeader header = { (uint32_t)len, type, flags, stream_id };
+        header.write(&output);
+        if (len) output.append((const char*)payload, len);
+    }
+
+    void Http2Session::write_rst_stream(uint32_t stream_id, ErrorCode code)
+    {
+        std::string payload;
+        write_u32(&payload, code);
+        write_frame(RST_STREAM, 0, stream_id, payload.data(), payload.size());
+    }
+
+    void Http2Session::write_goaway(ErrorCode code, const std::string &debug)
+    {
+        std::string payload;
+        write_u32(&payload, last_stream_id);
+        write_u32(&payload, code);
+        payload += debug;
+        write_frame(GOAWAY, 0, 0, payload.data(), payload.size());
+        goaway_sent = true;
+    }
+
+    void Http2Session::on_error(const Http2Error &err)
+    {
+        if (err.stream_id())
+        {
+            write_rst_stream(err.stream_id(), err.code());
+            streams.erase(err.stream_id());
+        }
+        else
+        {
+            write_goaway(err.code(), err.what());
+            failed = true;
+        }
+    }
+}
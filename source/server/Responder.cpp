@@ -0,0 +1,83 @@
+#include "server/Responder.hpp"
+#include "Error.hpp"
+#include "Response.hpp"
+#include <mutex>
+namespace http
+{
+    namespace
+    {
+        Response error_response(StatusCode sc, const char *msg)
+        {
+            Response response;
+            response.status.code = sc;
+            response.body = msg;
+            response.headers.add("Content-Type", "text/plain");
+            return response;
+        }
+    }
+
+    struct Responder::State
+    {
+        std::mutex mutex;
+        /**Null once a response was sent.*/
+        std::function<void(Response &&response, bool failed)> complete;
+
+        ~State()
+        {
+            if (complete)
+            {
+                try
+                {
+                    complete(error_response(SC_INTERNAL_SERVER_ERROR, "No response was sent"), true);
+                }
+                catch (const std::exception &) {}
+            }
+        }
+        bool send(Response &&response, bool failed)
+        {
+            std::function<void(Response &&response, bool failed)> func;
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                if (!complete) return false;
+                func = std::move(complete);
+                complete = nullptr;
+            }
+            func(std::move(response), failed);
+            return true;
+        }
+    };
+
+    Responder::Responder(std::function<void(Response &&response, bool failed)> complete)
+        : state(std::make_shared<State>())
+    {
+        state->complete = std::move(complete);
+    }
+    bool Responder::send(Response &&response)
+    {
+        return state->send(std::move(response), false);
+    }
+    bool Responder::send_error(std::exception_ptr error)
+    {
+        try
+        {
+            std::rethrow_exception(error);
+        }
+        catch (const ErrorResponse &err)
+        {
+            return state->send(error_response((StatusCode)err.status_code(), err.what()), true);
+        }
+        catch (const std::exception &err)
+        {
+            return state->send(error_response(SC_INTERNAL_SERVER_ERROR, err.what()), true);
+        }
+        catch (...)
+        {
+            return state->send(error_response(SC_INTERNAL_SERVER_ERROR, "Unknown error"), true);
+        }
+    }
+    bool Responder::completed()const
+    {
+        std::unique_lock<std::mutex> lock(state->mutex);
+        return !state->complete;
+    }
+}
@@ -0,0 +1,236 @@
+#include "server/ResponseCache.hpp"
+#include "core/ParserUtils.hpp"
+#include "headers/CacheControl.hpp"
+#include "Request.hpp"
+#include "Response.hpp"
+#include "String.hpp"
+#include <cassert>
+#include <cstdlib>
+#include <functional>
+namespace http
+{
+    namespace
+    {
+        /**Bookkeeping overhead per entry, in addition to the strings.*/
+        const size_t ENTRY_OVERHEAD = 128;
+
+        /**Status codes cacheable by default, RFC 7231 6.1.*/
+        bool cacheable_status(int sc)
+        {
+            switch (sc)
+            {
+            case 200: case 203: case 204: case 206: case 300: case 301:
+            case 404: case 405: case 410: case 414: case 501:
+                return true;
+            default:
+                return false;
+            }
+        }
+        /**Parse the Vary header field names.
+         * @return False if the Vary header is "*" or invalid.
+         */
+        bool parse_vary(const std::string &value, std::vector<std::string> *names)
+        {
+            auto p = value.c_str(), end = value.c_str() + value.size();
+            try
+            {
+                while (p < end)
+                {
+                    if (*p == '*') return false;
+                    auto p2 = parser::read_token(p, end);
+                    if (p2 == p) return false;
+                    names->emplace_back(p, p2);
+                    p = parser::read_list_sep(p2, end);
+                }
+            }
+            catch (const ParserError &)
+            {
+                return false;
+            }
+            return true;
+        }
+    }
+
+    Response CachedResponse::to_response()const
+    {
+        Response response;
+        // "HTTP/1.1 200 OK\r\n", the status code is always 3 digits
+        auto line_end = head.find("\r\n");
+        response.status.code = (StatusCode)std::atoi(head.c_str() + 9);
+        response.status.msg = head.substr(13, line_end - 13);
+        for (auto pos = line_end + 2; pos < head.size();)
+        {
+            auto end = head.find("\r\n", pos);
+            auto colon = head.find(':', pos);
+            response.headers.add(head.substr(pos, colon - pos), head.substr(colon + 2, end - colon - 2));
+            pos = end + 2;
+        }
+        response.body = body;
+        return response;
+    }
+
+    ResponseCache::ResponseCache(size_t max_bytes, size_t shards)
+        : max_shard_bytes(max_bytes / (shards ? shards : 1))
+        , shards(new Shard[shards ? shards : 1])
+        , shard_count(shards ? shards : 1)
+        , hits(0), misses(0), stores(0), evictions(0)
+    {}
+
+    std::shared_ptr<const CachedResponse> ResponseCache::get(const Request &request)
+    {
+        if (request.method != GET && request.method != HEAD) return nullptr;
+        auto key = make_key(request);
+        auto &shard = get_shard(key);
+        auto now = clock::now();
+
+        std::unique_lock<std::mutex> lock(shard.mutex);
+        auto range = shard.index.equal_range(key);
+        for (auto i = range.first; i != range.second;)
+        {
+            auto entry = i->second;
+            ++i;
+            if (entry->expires <= now) erase(shard, entry);
+            else if (vary_matches(*entry, request))
+            {
+                shard.lru.splice(shard.lru.begin(), shard.lru, entry);
+                ++hits;
+                return entry->response;
+            }
+        }
+        ++misses;
+        return nullptr;
+    }
+
+    bool ResponseCache::put(const Request &request, const Response &response)
+    {
+        if (request.method != GET && request.method != HEAD) return false;
+        auto sc = response.status.code;
+        if (!cacheable_status(sc) || response.body_file || response.headers.has("Set-Cookie"))
+            return false;
+
+        CacheControl cache_control;
+        try
+        {
+            cache_control = CacheControl(response.headers.get("Cache-Control"));
+        }
+        catch (const ParserError &)
+        {
+            return false;
+        }
+        auto max_age = cache_control.shared_max_age();
+        if (cache_control.no_store || cache_control.no_cache || cache_control.is_private || max_age <= 0)
+            return false;
+        // RFC 7234 3.2, responses to authenticated requests need explicit permission
+        if (request.headers.has("Authorization") && !cache_control.is_public && cache_control.s_maxage < 0)
+            return false;
+
+        Entry entry;
+        entry.key = make_key(request);
+        std::vector<std::string> vary_names;
+        if (!parse_vary(response.headers.get("Vary"), &vary_names)) return false;
+        for (auto &name : vary_names) entry.vary.emplace_back(name, request.headers.get(name));
+        entry.expires = clock::now() + std::chrono::seconds(max_age);
+
+        auto cached = std::make_shared<CachedResponse>();
+        auto &head = cached->head;
+        auto msg = response.status.msg.empty() ? default_status_msg(sc) : response.status.msg;
+        head = "HTTP/1.1 " + std::to_string((int)sc) + " " + msg + "\r\n";
+        for (auto &header : response.headers)
+        {
+            if (ieq(header.first, "Connection") || ieq(header.first, "Date") || ieq(header.first, "Content-Length"))
+                continue;
+            head += header.first;
+            head += ": ";
+            head += header.second;
+            head += "\r\n";
+        }
+        if (sc != 204 && sc != 205 && sc != 304)
+        {
+            head += "Content-Length: " + std::to_string(response.body.size()) + "\r\n";
+        }
+        cached->body = response.body;
+        entry.response = cached;
+
+        entry.size = ENTRY_OVERHEAD + entry.key.size() + head.size() + cached->body.size();
+        for (auto &vary : entry.vary) entry.size += vary.first.size() + vary.second.size();
+        if (entry.size > max_shard_bytes) return false;
+
+        auto &shard = get_shard(entry.key);
+        std::unique_lock<std::mutex> lock(shard.mutex);
+        // Replace any existing entry for the same variant
+        auto range = shard.index.equal_range(entry.key);
+        for (auto i = range.first; i != range.second; ++i)
+        {
+            if (i->second->vary == entry.vary)
+            {
+                erase(shard, i->second);
+                break;
+            }
+        }
+        while (shard.bytes + entry.size > max_shard_bytes)
+        {
+            assert(!shard.lru.empty());
+            erase(shard, --shard.lru.end());
+            ++evictions;
+        }
+        shard.bytes += entry.size;
+        shard.lru.push_front(std::move(entry));
+        shard.index.emplace(shard.lru.front().key, shard.lru.begin());
+        ++stores;
+        return true;
+    }
+
+    void ResponseCache::clear()
+    {
+        for (size_t i = 0; i < shard_count; ++i)
+        {
+            std::unique_lock<std::mutex> lock(shards[i].mutex);
+            shards[i].index.clear();
+            shards[i].lru.clear();
+            shards[i].bytes = 0;
+        }
+    }
+
+    ResponseCacheStats ResponseCache::stats()const
+    {
+        ResponseCacheStats stats = { hits, misses, stores, evictions, 0, 0 };
+        for (size_t i = 0; i < shard_count; ++i)
+        {
+            std::unique_lock<std::mutex> lock(shards[i].mutex);
+            stats.entries += shards[i].lru.size();
+            stats.bytes += shards[i].bytes;
+        }
+        return stats;
+    }
+
+    std::string ResponseCache::make_key(const Request &request)
+    {
+        return to_string(request.method) + " " + request.raw_url;
+    }
+    ResponseCache::Shard &ResponseCache::get_shard(const std::string &key)
+    {
+        return shards[std::hash<std::string>()(key) % shard_count];
+    }
+    bool ResponseCache::vary_matches(const Entry &entry, const Request &request)
+    {
+        for (auto &vary : entry.vary)
+        {
+            if (request.headers.get(vary.first) != vary.second) return false;
+        }
+        return true;
+    }
+    void ResponseCache::erase(Shard &shard, EntryList::iterator entry)
+    {
+        auto range = shard.index.equal_range(entry->key);
+        for (auto i = range.first; i != range.second; ++i)
+        {
+            if (i->second == entry)
+            {
+                shard.index.erase(i);
+                break;
+            }
+        }
+        shard.bytes -= entry->size;
+        shard.lru.erase(entry);
+    }
+}
@@ -0,0 +1,244 @@
+#include "server/ResponseCompressor.hpp"
+#include "headers/AcceptEncoding.hpp"
+#include "net/Os.hpp"
+#include "util/Compressor.hpp"
+#include "util/File.hpp"
+#include "Request.hpp"
+#include "Response.hpp"
+#include "String.hpp"
+#include <ctime>
+namespace http
+{
+    namespace
+    {
+        /**Size of blocks read from Response::body_file.*/
+        const size_t FILE_BLOCK_SIZE = 64 * 1024;
+        /**Bookkeeping overhead per cache entry, in addition to the strings.*/
+        const size_t CACHE_ENTRY_OVERHEAD = 128;
+
+        /**CPU time used by the calling thread.*/
+        std::chrono::nanoseconds thread_cpu_time()
+        {
+#ifdef _WIN32
+            FILETIME creation, exit, kernel, user;
+            if (!GetThreadTimes(GetCurrentThread(), &creation, &exit, &kernel, &user))
+                return std::chrono::nanoseconds::zero();
+            auto to_ns = [](const FILETIME &ft) -> int64_t
+            {
+                // 100ns intervals
+                return (int64_t)(((uint64_t)ft.dwHighDateTime << 32) | ft.dwLowDateTime) * 100;
+            };
+            return std::chrono::nanoseconds(to_ns(kernel) + to_ns(user));
+#else
+            timespec ts;
+            if (clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts) != 0)
+                return std::chrono::nanoseconds::zero();
+            return std::chrono::seconds(ts.tv_sec) + std::chrono::nanoseconds(ts.tv_nsec);
+#endif
+        }
+        /**True if a list header value contains the token, case insensitively.*/
+        bool list_contains(const std::string &list, const std::string &token)
+        {
+            size_t i = 0;
+            while (i < list.size())
+            {
+                auto end = list.find(',', i);
+                if (end == std::string::npos) end = list.size();
+                auto begin = list.find_first_not_of(" \t", i);
+                auto last = list.find_last_not_of(" \t", end - 1);
+                if (begin < end && last != std::string::npos && last >= begin &&
+                    ieq(list.substr(begin, last - begin + 1), token))
+                {
+                    return true;
+                }
+                i = end + 1;
+            }
+            return false;
+        }
+    }
+
+    CompressionOptions::CompressionOptions()
+        : codings({ "br", "gzip", "deflate" })
+        , level(Compressor::DEFAULT_LEVEL)
+        , min_size(1024)
+        , max_size(1024 * 1024)
+        , content_types(
+        {
+            "text/",
+            "application/javascript",
+            "application/json",
+            "application/xml",
+            "image/svg+xml"
+        })
+        , cache_bytes(16 * 1024 * 1024)
+    {}
+
+    ResponseCompressor::ResponseCompressor(const CompressionOptions &options)
+        : options(options)
+        , responses(0), cache_hits(0), bytes_in(0), bytes_out(0), cpu_time_ns(0)
+    {
+        auto &codings = this->options.codings;
+        for (auto i = codings.begin(); i != codings.end();)
+        {
+            if (Compressor::supported(*i)) ++i;
+            else i = codings.erase(i);
+        }
+    }
+
+    bool ResponseCompressor::compress(const Request &request, Response &response)
+    {
+        if (!compressible(response)) return false;
+
+        auto &vary = response.headers.get("Vary");
+        if (vary.empty()) response.headers.set("Vary", "Accept-Encoding");
+        else if (!list_contains(vary, "Accept-Encoding") && vary != "*")
+            response.headers.set("Vary", vary + ", Accept-Encoding");
+
+        auto coding = select_coding(request);
+        if (coding.empty()) return false;
+
+        // A strong ETag identifies the exact body, so the compressed body can be reused
+        auto &etag = response.headers.get("ETag");
+        bool cacheable = options.cache_bytes && !etag.empty() && etag.compare(0, 2, "W/") != 0;
+        std::string cache_key;
+        std::string body;
+        bool cached = false;
+        if (cacheable)
+        {
+            cache_key = coding + " " + request.raw_url + " " + etag;
+            cached = cache_get(cache_key, &body);
+            if (cached) ++cache_hits;
+        }
+        if (!cached)
+        {
+            body = compress_body(coding, response);
+            if (cacheable) cache_put(cache_key, body);
+        }
+        // Incompressible content, such as already compressed data with a text type
+        auto size = response.body_file ? response.body_file->size() : response.body.size();
+        if (body.size() >= size) return false;
+
+        ++responses;
+        response.body = std::move(body);
+        response.body_file.reset();
+        response.headers.set("Content-Encoding", coding);
+        if (!etag.empty() && etag.compare(0, 2, "W/") != 0) response.headers.set("ETag", "W/" + etag);
+        return true;
+    }
+
+    CompressionStats ResponseCompressor::stats()const
+    {
+        CompressionStats stats;
+        stats.responses = responses;
+        stats.cache_hits = cache_hits;
+        stats.bytes_in = bytes_in;
+        stats.bytes_out = bytes_out;
+        stats.cpu_time = std::chrono::nanoseconds(cpu_time_ns.load());
+        return stats;
+    }
+
+    bool ResponseCompressor::compressible(const Response &response)const
+    {
+        auto sc = response.status.code;
+        // 206 ranges refer to the identity body
+        if (sc < 200 || sc == 204 || sc == 206 || sc == 304) return false;
+        if (response.headers.has("Content-Encoding")) return false;
+
+        auto size = response.body_file ? response.body_file->size() : response.body.size();
+        if (size < options.min_size || size > options.max_size) return false;
+
+        auto &content_type = response.headers.get("Content-Type");
+        auto mime = content_type.substr(0, content_type.find(';'));
+        while (!mime.empty() && (mime.back() == ' ' || mime.back() == '\t')) mime.pop_back();
+        for (auto &type : options.content_types)
+        {
+            if (!type.empty() && type.back() == '/')
+            {
+                if (mime.size() > type.size() && ieq(mime.substr(0, type.size()), type)) return true;
+            }
+            else if (ieq(mime, type)) return true;
+        }
+        return false;
+    }
+
+    std::string ResponseCompressor::select_coding(const Request &request)const
+    {
+        // Without the header any coding is allowed, but in practice such clients are often not
+        // browsers and may not expect it
+        auto it = request.headers.find("Accept-Encoding");
+        if (it == request.headers.end() || options.codings.empty()) return std::string();
+        try
+        {
+            AcceptEncoding accept(it->second);
+            auto codings = options.codings;
+            // Last, so compressing is preferred over identity of equal quality
+            codings.push_back("identity");
+            auto coding = accept.preferred(codings);
+            return coding == "identity" ? std::string() : coding;
+        }
+        catch (const std::exception &)
+        {
+            // Invalid header, or identity not acceptable. Either way, send it uncompressed
+            return std::string();
+        }
+    }
+
+    std::string ResponseCompressor::compress_body(const std::string &coding, const Response &response)
+    {
+        auto start = thread_cpu_time();
+        std::string out;
+        Compressor compressor(coding, options.level);
+        uint64_t in_size;
+        if (response.body_file)
+        {
+            auto &file = *response.body_file;
+            in_size = file.size();
+            std::unique_ptr<char[]> buffer(new char[FILE_BLOCK_SIZE]);
+            for (uint64_t offset = 0; offset < in_size;)
+            {
+                auto len = file.read(buffer.get(), FILE_BLOCK_SIZE, offset);
+                if (len == 0) throw FileError(file.path(), "File truncated");
+                compressor.write(buffer.get(), len, &out);
+                offset += len;
+            }
+        }
+        else
+        {
+            in_size = response.body.size();
+            compressor.write(response.body.data(), response.body.size(), &out);
+        }
+        compressor.finish(&out);
+        cpu_time_ns += (thread_cpu_time() - start).count();
+        bytes_in += in_size;
+        bytes_out += out.size();
+        return out;
+    }
+
+    bool ResponseCompressor::cache_get(const std::string &key, std::string *body)
+    {
+        std::unique_lock<std::mutex> lock(cache.mutex);
+        auto it = cache.index.find(key);
+        if (it == cache.index.end()) return false;
+        cache.lru.splice(cache.lru.begin(), cache.lru, it->second);
+        *body = it->second->second;
+        return true;
+    }
+    void ResponseCompressor::cache_put(const std::string &key, const std::string &body)
+    {
+        auto size = CACHE_ENTRY_OVERHEAD + key.size() + body.size();
+        if (size > options.cache_bytes) return;
+
+        std::unique_lock<std::mutex> lock(cache.mutex);
+        if (cache.index.count(key)) return; // Another thread compressed it at the same time
+        while (cache.bytes + size > options.cache_bytes)
+        {
+            auto &last = cache.lru.back();
+            cache.bytes -= CACHE_ENTRY_OVERHEAD + last.first.size() + last.second.size();
+            cache.index.erase(last.first);
+            cache.lru.pop_back();
+        }
+        cache.lru.emplace_front(key, body);
+        cache.index[key] = cache.lru.begin();
+        cache.bytes += size;
+    }
+}
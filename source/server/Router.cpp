@@ -1,4 +1,5 @@
 #include "server/Router.hpp"
+#include "server/WebSocket.hpp"
 #include "Request.hpp"
 #include "Response.hpp"
 #include "Status.hpp"
@@ -7,6 +8,36 @@
 
 namespace http
 {
+#ifdef HTTP_USE_COROUTINES
+    namespace
+    {
+        Task<void> respond_coroutine(Task<Response> task, Responder responder)
+        {
+            try
+            {
+                responder.send(co_await task);
+            }
+            catch (const std::exception &)
+            {
+                responder.send_error(std::current_exception());
+            }
+        }
+    }
+#endif
+
+    void MatchedRoute::respond(Request &request, Responder responder)
+    {
+        try
+        {
+            if (async_handler) async_handler(request, path_params, responder);
+            else responder.send(handler(request, path_params));
+        }
+        catch (const std::exception &)
+        {
+            responder.send_error(std::current_exception());
+        }
+    }
+
     Router::PathParts Router::get_parts(const std::string &path)const
     {
         if (path.empty() || path[0] != '/') throw UrlError(path, "Expect URL path to begin with '/'");
@@ -47,12 +78,31 @@ namespace http
         // Find method
         auto handler = node->methods.find(method);
         if (handler == node->methods.end()) throw MethodNotAllowed(method, path);
-        route.handler = handler->second;
+        route.handler = handler->second.first;
+        route.async_handler = handler->second.second;
 
         return route;
     }
 
     void Router::add(const std::string &method, const std::string &path, RequestHandler handler)
+    {
+        add_route(method, path, std::move(handler), nullptr);
+    }
+    void Router::add_async(const std::string &method, const std::string &path, AsyncRequestHandler handler)
+    {
+        add_route(method, path, nullptr, std::move(handler));
+    }
+#ifdef HTTP_USE_COROUTINES
+    void Router::add_coroutine(const std::string &method, const std::string &path, CoroutineRequestHandler handler)
+    {
+        add_async(method, path, [handler](Request &request, PathParams &params, Responder responder)
+        {
+            spawn(respond_coroutine(handler(request, params), std::move(responder)));
+        });
+    }
+#endif
+    void Router::add_route(const std::string &method, const std::string &path,
+        RequestHandler handler, AsyncRequestHandler async_handler)
     {
         auto parts = get_parts(path);
         bool prefix;
@@ -100,9 +150,22 @@ namespace http
             node->prefix = true;
         }
         // Add the method handler to node
-        if (!node->methods.emplace(method, handler).second)
+        if (!node->methods.emplace(method, std::make_pair(std::move(handler), std::move(async_handler))).second)
         {
             throw InvalidRouteError(method, path, "Route already exists");
         }
     }
+
+    void Router::add_websocket(const std::string &path, const WebSocketHandler &handler)
+    {
+        add_websocket(path, handler, WebSocketOptions());
+    }
+    void Router::add_websocket(const std::string &path, const WebSocketHandler &handler,
+        const WebSocketOptions &options)
+    {
+        add("GET", path, [handler, options](Request &request, PathParams &params)
+        {
+            return websocket_upgrade(request, params, handler, options);
+        });
+    }
 }
@@ -0,0 +1,233 @@
+#include "server/StaticFiles.hpp"
+#include "util/File.hpp"
+#include "Error.hpp"
+#include "Response.hpp"
+#include "Time.hpp"
+#include "Url.hpp"
+#include <cstdio>
+#include <cstring>
+namespace http
+{
+    namespace
+    {
+        /**Split a list header value such as If-None-Match by commas, trimming whitespace.*/
+        std::vector<std::string> split_list(const std::string &value)
+        {
+            std::vector<std::string> items;
+            size_t i = 0;
+            while (i < value.size())
+            {
+                auto end = value.find(',', i);
+                if (end == std::string::npos) end = value.size();
+                auto begin = value.find_first_not_of(" \t", i);
+                auto last = value.find_last_not_of(" \t", end - 1);
+                if (begin < end && last != std::string::npos && last >= begin)
+                    items.push_back(value.substr(begin, last - begin + 1));
+                i = end + 1;
+            }
+            return items;
+        }
+        /**Weak comparison of entity tags, as required for If-None-Match.*/
+        bool etag_weak_eq(const std::string &a, const std::string &b)
+        {
+            auto strip = [](const std::string &etag) -> std::string
+            {
+                return etag.compare(0, 2, "W/") == 0 ? etag.substr(2) : etag;
+            };
+            return strip(a) == strip(b);
+        }
+    }
+
+    StaticFiles::StaticFiles(const std::string &url_prefix, const std::string &directory)
+        : url_prefix(url_prefix), directory(directory)
+        , content_types(
+        {
+            { "css", "text/css" },
+            { "gif", "image/gif" },
+            { "htm", "text/html" },
+            { "html", "text/html" },
+            { "ico", "image/x-icon" },
+            { "jpeg", "image/jpeg" },
+            { "jpg", "image/jpeg" },
+            { "js", "application/javascript" },
+            { "json", "application/json" },
+            { "map", "application/json" },
+            { "mjs", "application/javascript" },
+            { "pdf", "application/pdf" },
+            { "png", "image/png" },
+            { "svg", "image/svg+xml" },
+            { "txt", "text/plain" },
+            { "wasm", "application/wasm" },
+            { "webp", "image/webp" },
+            { "woff", "font/woff" },
+            { "woff2", "font/woff2" },
+            { "xml", "application/xml" }
+        })
+        , revalidate_interval(std::chrono::seconds(1))
+        , cache(std::make_shared<Cache>())
+    {
+        // "/assets/" and "/assets" are the same prefix
+        while (!this->url_prefix.empty() && this->url_prefix.back() == '/') this->url_prefix.pop_back();
+        if (this->directory.empty()) this->directory = ".";
+    }
+
+    Response StaticFiles::operator()(Request &request, PathParams &)const
+    {
+        auto file = get_file(file_path(request.url.path));
+
+        Response resp;
+        resp.headers.add("ETag", file->etag);
+        resp.headers.add("Last-Modified", file->last_modified);
+        if (not_modified(request, *file))
+        {
+            resp.status_code(SC_NOT_MODIFIED);
+        }
+        else
+        {
+            resp.status_code(SC_OK);
+            resp.headers.add("Content-Type", content_type(file->file->path()));
+            resp.body_file = file->file;
+        }
+        return resp;
+    }
+
+    void StaticFiles::set_content_type(const std::string &extension, const std::string &content_type)
+    {
+        content_types[extension] = content_type;
+    }
+    void StaticFiles::set_max_cached_files(size_t max)
+    {
+        std::unique_lock<std::mutex> lock(cache->mutex);
+        cache->max_files = max;
+        while (cache->files.size() > max) cache->files.erase(cache->files.begin());
+    }
+    std::string StaticFiles::make_etag(uint64_t size, time_t mtime)
+    {
+        char buffer[64];
+        snprintf(buffer, sizeof(buffer), "\"%llx-%llx\"", (unsigned long long)size, (unsigned long long)mtime);
+        return buffer;
+    }
+
+    std::string StaticFiles::file_path(const std::string &url_path)const
+    {
+        if (url_path.compare(0, url_prefix.size(), url_prefix) != 0) throw NotFound(url_path);
+        // The prefix must be whole segments, so "/files" does not match "/filesX/y"
+        if (url_path.size() > url_prefix.size() && url_path[url_prefix.size()] != '/')
+            throw NotFound(url_path);
+
+        std::string path = directory;
+        for (size_t i = url_prefix.size(), next = i; i < url_path.size(); i = next + 1)
+        {
+            next = url_path.find('/', i);
+            if (next == std::string::npos) next = url_path.size();
+            if (next == i) continue; // Remove adjacent '/'
+
+            // Already decoded by Url::parse_request, so "%" is a literal character here
+            auto segment = url_path.substr(i, next - i);
+            if (segment == "." || segment == ".." || segment.find_first_of("/\\:", 0) != std::string::npos ||
+                segment.find('\0') != std::string::npos)
+            {
+                throw NotFound(url_path);
+            }
+            path += '/';
+            path += segment;
+        }
+        if (path.size() == directory.size()) throw NotFound(url_path);
+        return path;
+    }
+
+    std::shared_ptr<StaticFiles::CachedFile> StaticFiles::get_file(const std::string &path)const
+    {
+        auto now = std::chrono::steady_clock::now();
+        std::shared_ptr<CachedFile> cached;
+        {
+            std::unique_lock<std::mutex> lock(cache->mutex);
+            auto it = cache->files.find(path);
+            if (it != cache->files.end())
+            {
+                cached = it->second;
+                if (now - cached->checked < revalidate_interval) return cached;
+            }
+        }
+
+        FileInfo info;
+        if (!File::stat(path, &info))
+        {
+            std::unique_lock<std::mutex> lock(cache->mutex);
+            cache->files.erase(path);
+            throw NotFound(path);
+        }
+        if (cached && cached->file->info() == info)
+        {
+            // Unchanged. Replace rather than modify checked, another thread may be reading it
+            auto updated = std::make_shared<CachedFile>(*cached);
+            updated->checked = now;
+            std::unique_lock<std::mutex> lock(cache->mutex);
+            cache->files[path] = updated;
+            return updated;
+        }
+
+        std::shared_ptr<const File> file;
+        try
+        {
+            file = std::make_shared<File>(path);
+        }
+        catch (const FileError &)
+        {
+            throw NotFound(path);
+        }
+        char last_modified[TIME_STR_LEN];
+        format_time(file->info().mtime, last_modified);
+
+        cached = std::make_shared<CachedFile>();
+        cached->file = file;
+        cached->etag = make_etag(file->info().size, file->info().mtime);
+        cached->last_modified.assign(last_modified, TIME_STR_LEN);
+        cached->checked = now;
+
+        std::unique_lock<std::mutex> lock(cache->mutex);
+        if (cache->max_files == 0) return cached;
+        if (cache->files.size() >= cache->max_files && !cache->files.count(path))
+        {
+            // In-flight responses keep their own reference, so any entry is safe to drop
+            cache->files.erase(cache->files.begin());
+        }
+        cache->files[path] = cached;
+        return cached;
+    }
+
+    const std::string &StaticFiles::content_type(const std::string &path)const
+    {
+        static const std::string DEFAULT_TYPE = "application/octet-stream";
+        auto dot = path.rfind('.');
+        auto slash = path.rfind('/');
+        if (dot == std::string::npos || (slash != std::string::npos && dot < slash)) return DEFAULT_TYPE;
+        auto it = content_types.find(path.substr(dot + 1));
+        return it != content_types.end() ? it->second : DEFAULT_TYPE;
+    }
+
+    bool StaticFiles::not_modified(const Request &request, const CachedFile &file)
+    {
+        // If-None-Match takes precedence, and If-Modified-Since is ignored if it is present
+        if (request.headers.has("If-None-Match"))
+        {
+            for (auto &etag : split_list(request.headers.get("If-None-Match")))
+            {
+                if (etag == "*" || etag_weak_eq(etag, file.etag)) return true;
+            }
+            return false;
+        }
+        if (request.headers.has("If-Modified-Since"))
+        {
+            try
+            {
+                return file.file->info().mtime <= parse_time(request.headers.get("If-Modified-Since"));
+            }
+            catch (const std::exception &)
+            {
+                return false; // Invalid dates are ignored
+            }
+        }
+        return false;
+    }
+}
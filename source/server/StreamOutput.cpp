@@ -0,0 +1,106 @@
+#include "server/StreamOutput.hpp"
+namespace http
+{
+    StreamOutput::StreamOutput(size_t max_bytes, bool close_when_full)
+        : max_bytes(max_bytes), close_when_full(close_when_full)
+        , output(), output_bytes(0), notify(), is_closed(false), detached(false), dropped_count(0)
+    {}
+
+    StreamOutput::QueueResult StreamOutput::queue(std::shared_ptr<const std::string> data, bool close)
+    {
+        std::function<void()> notify_func;
+        QueueResult result;
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            if (is_closed || detached) return CLOSED;
+            if (data->size() > max_bytes - output_bytes)
+            {
+                ++dropped_count;
+                if (close_when_full)
+                {
+                    // Data already queued is still sent, so the client can resume after it
+                    is_closed = true;
+                    notify_func = notify;
+                }
+                result = FULL;
+            }
+            else
+            {
+                if (output.empty()) notify_func = notify;
+                output_bytes += data->size();
+                output.push_back(std::move(data));
+                if (close) is_closed = true;
+                result = QUEUED;
+            }
+        }
+        if (notify_func) notify_func();
+        return result;
+    }
+    bool StreamOutput::close()
+    {
+        std::function<void()> notify_func;
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            if (is_closed || detached) return false;
+            is_closed = true;
+            // The connection may be waiting for output, not for the close
+            notify_func = notify;
+        }
+        if (notify_func) notify_func();
+        return true;
+    }
+    size_t StreamOutput::buffered_amount()const
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        return output_bytes;
+    }
+    bool StreamOutput::closed()const
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        return is_closed;
+    }
+    bool StreamOutput::is_open()const
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        return !is_closed && !detached;
+    }
+    uint64_t StreamOutput::dropped()const
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        return dropped_count;
+    }
+
+    void StreamOutput::attach(std::function<void()> _notify)
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        notify = _notify;
+    }
+    void StreamOutput::detach()
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        detached = true;
+        notify = nullptr;
+        output.clear();
+        output_bytes = 0;
+    }
+    std::shared_ptr<const std::string> StreamOutput::take()
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        if (output.empty()) return nullptr;
+        size_t count = 1, size = output.front()->size();
+        while (count < output.size() && size + output[count]->size() <= BATCH_SIZE)
+            size += output[count++]->size();
+        std::shared_ptr<const std::string> ret;
+        if (count == 1) ret = std::move(output.front());
+        else
+        {
+            auto batch = std::make_shared<std::string>();
+            batch->reserve(size);
+            for (size_t i = 0; i < count; ++i) *batch += *output[i];
+            ret = std::move(batch);
+        }
+        output.erase(output.begin(), output.begin() + count);
+        output_bytes -= size;
+        return ret;
+    }
+}
@@ -0,0 +1,409 @@
+#include "server/Supervisor.hpp"
+#include <algorithm>
+#include <cassert>
+#include <cstring>
+#include <new>
+#include <stdexcept>
+#include <thread>
+#ifndef _WIN32
+#include <cerrno>
+#include <csignal>
+#include <poll.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#endif
+namespace http
+{
+    /**Lock-free atomics work across processes sharing the memory.*/
+    struct Supervisor::SharedStats
+    {
+        std::atomic<uint64_t> connections;
+        std::atomic<uint64_t> accept_pauses;
+        std::atomic<uint64_t> accept_paused_time_ns;
+        std::atomic<uint64_t> compressed_responses;
+        std::atomic<uint64_t> compression_time_ns;
+        std::atomic<uint64_t> handlers_in_flight;
+        std::atomic<uint64_t> handlers_queued;
+        std::atomic<uint64_t> shed_requests;
+        std::atomic<uint64_t> body_memory;
+        std::atomic<uint64_t> buffers_in_use;
+
+        void clear()
+        {
+            store(CoreServerStats());
+        }
+        void store(const CoreServerStats &stats)
+        {
+            connections.store(stats.connections, std::memory_order_relaxed);
+            accept_pauses.store(stats.accept_pauses, std::memory_order_relaxed);
+            accept_paused_time_ns.store((uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(
+                stats.accept_paused_time).count(), std::memory_order_relaxed);
+            compressed_responses.store(stats.compressed_responses, std::memory_order_relaxed);
+            compression_time_ns.store((uint64_t)stats.compression_time.count(), std::memory_order_relaxed);
+            handlers_in_flight.store(stats.handlers_in_flight, std::memory_order_relaxed);
+            handlers_queued.store(stats.handlers_queued, std::memory_order_relaxed);
+            shed_requests.store(stats.shed_requests, std::memory_order_relaxed);
+            body_memory.store(stats.body_memory, std::memory_order_relaxed);
+            buffers_in_use.store(stats.buffers_in_use, std::memory_order_relaxed);
+        }
+        CoreServerStats load()const
+        {
+            CoreServerStats stats;
+            stats.connections = (size_t)connections.load(std::memory_order_relaxed);
+            stats.accept_pauses = accept_pauses.load(std::memory_order_relaxed);
+            stats.accept_paused_time = std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+                std::chrono::nanoseconds(accept_paused_time_ns.load(std::memory_order_relaxed)));
+            stats.compressed_responses = compressed_responses.load(std::memory_order_relaxed);
+            stats.compression_time = std::chrono::nanoseconds(compression_time_ns.load(std::memory_order_relaxed));
+            stats.handlers_in_flight = (size_t)handlers_in_flight.load(std::memory_order_relaxed);
+            stats.handlers_queued = (size_t)handlers_queued.load(std::memory_order_relaxed);
+            stats.shed_requests = shed_requests.load(std::memory_order_relaxed);
+            stats.body_memory = (size_t)body_memory.load(std::memory_order_relaxed);
+            stats.buffers_in_use = (size_t)buffers_in_use.load(std::memory_order_relaxed);
+            return stats;
+        }
+    };
+    namespace
+    {
+        void add_stats(CoreServerStats &total, const CoreServerStats &stats)
+        {
+            total.connections += stats.connections;
+            total.accept_pauses += stats.accept_pauses;
+            total.accept_paused_time += stats.accept_paused_time;
+            total.compressed_responses += stats.compressed_responses;
+            total.compression_time += stats.compression_time;
+            total.handlers_in_flight += stats.handlers_in_flight;
+            total.handlers_queued += stats.handlers_queued;
+            total.shed_requests += stats.shed_requests;
+            total.body_memory += stats.body_memory;
+            total.buffers_in_use += stats.buffers_in_use;
+        }
+    }
+
+    Supervisor::Supervisor(const SupervisorOptions &options, ServerFactory factory)
+        : opts(options), factory(factory), worker_count(options.workers), shared(nullptr)
+        , shared_metrics(nullptr), metrics_words(options.metrics_bytes / sizeof(uint64_t)), exiting(false)
+    {
+        if (!worker_count) worker_count = std::max(1U, std::thread::hardware_concurrency());
+#ifdef _WIN32
+        throw std::runtime_error("Supervisor is not supported on Windows");
+#else
+        static_assert(ATOMIC_LLONG_LOCK_FREE == 2, "Shared stats require lock-free atomics");
+        auto mem = mmap(nullptr, sizeof(SharedStats) * worker_count, PROT_READ | PROT_WRITE,
+            MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+        if (mem == MAP_FAILED) throw std::runtime_error("Supervisor failed to map shared memory");
+        shared = (SharedStats*)mem;
+        for (unsigned i = 0; i < worker_count; ++i) new (&shared[i]) SharedStats();
+        for (unsigned i = 0; i < worker_count; ++i) shared[i].clear();
+        if (metrics_words < 3) metrics_words = 0; // No room for any metrics
+        else
+        {
+            mem = mmap(nullptr, sizeof(uint64_t) * metrics_words * worker_count, PROT_READ | PROT_WRITE,
+                MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+            if (mem == MAP_FAILED)
+            {
+                munmap(shared, sizeof(SharedStats) * worker_count);
+                throw std::runtime_error("Supervisor failed to map shared memory");
+            }
+            shared_metrics = (std::atomic<uint64_t>*)mem;
+            for (size_t i = 0; i < metrics_words * worker_count; ++i)
+                new (&shared_metrics[i]) std::atomic<uint64_t>(0);
+        }
+        worker_state.resize(worker_count, Worker{ 0, -1, 0, {} });
+#endif
+    }
+    Supervisor::~Supervisor()
+    {
+#ifndef _WIN32
+        exit();
+        for (unsigned i = 0; i < worker_count; ++i) shared[i].~SharedStats();
+        munmap(shared, sizeof(SharedStats) * worker_count);
+        if (shared_metrics) munmap(shared_metrics, sizeof(uint64_t) * metrics_words * worker_count);
+#endif
+    }
+
+    std::vector<WorkerStats> Supervisor::stats()const
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        std::vector<WorkerStats> ret(worker_count);
+        for (unsigned i = 0; i < worker_count; ++i)
+        {
+            ret[i].pid = worker_state[i].pid;
+            ret[i].restarts = worker_state[i].restarts;
+            ret[i].server = shared[i].load();
+        }
+        return ret;
+    }
+    CoreServerStats Supervisor::server_stats()const
+    {
+        CoreServerStats total = {};
+        for (auto &i : stats()) add_stats(total, i.server);
+        return total;
+    }
+    MetricsSnapshot Supervisor::metrics()const
+    {
+        MetricsSnapshot total;
+        for (unsigned i = 0; i < worker_count; ++i) total.add(load_metrics(i));
+        return total;
+    }
+
+#ifdef _WIN32
+    void Supervisor::run()
+    {
+        throw std::runtime_error("Supervisor is not supported on Windows");
+    }
+    void Supervisor::exit() {}
+    void Supervisor::start_worker(unsigned) {}
+    void Supervisor::run_worker(unsigned, int) {}
+    void Supervisor::stop_workers() {}
+    void Supervisor::publish_metrics(unsigned, const std::string &) {}
+    MetricsSnapshot Supervisor::load_metrics(unsigned)const { return MetricsSnapshot(); }
+    void Supervisor::clear_metrics(unsigned) {}
+#else
+    void Supervisor::run()
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        for (unsigned i = 0; i < worker_count; ++i) start_worker(i);
+
+        auto poll_interval = std::chrono::milliseconds(20);
+        while (!exiting)
+        {
+            // Reap exited workers, and restart them once restart_delay has passed. Only waits
+            // for the workers, leaving any other child processes alone.
+            auto now = std::chrono::steady_clock::now();
+            for (unsigned i = 0; i < worker_count; ++i)
+            {
+                auto &worker = worker_state[i];
+                int status;
+                if (worker.pid && waitpid(worker.pid, &status, WNOHANG) == worker.pid)
+                {
+                    worker.pid = 0;
+                    if (worker.control >= 0) close(worker.control);
+                    worker.control = -1;
+                    shared[i].clear();
+                    clear_metrics(i);
+                }
+                if (!worker.pid && now - worker.started >= opts.restart_delay)
+                {
+                    ++worker.restarts;
+                    start_worker(i);
+                }
+            }
+            exit_cv.wait_for(lock, poll_interval);
+        }
+        lock.unlock();
+        stop_workers();
+    }
+    void Supervisor::exit()
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        exiting = true;
+        exit_cv.notify_all();
+        // Closing the control pipes tells the workers to drain
+        for (auto &worker : worker_state)
+        {
+            if (worker.control >= 0) close(worker.control);
+            worker.control = -1;
+        }
+    }
+    void Supervisor::start_worker(unsigned index)
+    {
+        auto &worker = worker_state[index];
+        assert(!worker.pid);
+        shared[index].clear();
+        clear_metrics(index);
+        worker.started = std::chrono::steady_clock::now();
+
+        int control[2];
+        if (pipe(control)) throw std::runtime_error("Supervisor failed to create pipe");
+        auto pid = fork();
+        if (pid < 0)
+        {
+            close(control[0]);
+            close(control[1]);
+            throw std::runtime_error("Supervisor failed to fork");
+        }
+        if (pid == 0)
+        {
+            // Only the supervisor may hold the write ends, else workers would not see them closed
+            close(control[1]);
+            for (auto &other : worker_state)
+            {
+                if (other.control >= 0) close(other.control);
+            }
+            run_worker(index, control[0]);
+        }
+        close(control[0]);
+        worker.pid = pid;
+        worker.control = control[1];
+    }
+    void Supervisor::run_worker(unsigned index, int control)
+    {
+        signal(SIGPIPE, SIG_IGN);
+        int code = 0;
+        try
+        {
+            auto server = factory(index);
+            auto metrics = shared_metrics ? server->metrics_registry() : nullptr;
+            if (metrics)
+            {
+                // This worker's own values are current, the others are as last published
+                server->set_metrics_snapshot([this, index, metrics]()
+                {
+                    auto total = metrics->snapshot();
+                    for (unsigned i = 0; i < worker_count; ++i)
+                    {
+                        if (i != index) total.add(load_metrics(i));
+                    }
+                    return total;
+                });
+            }
+            std::atomic<bool> stopped{false};
+            auto &stats = shared[index];
+            std::thread control_thread([this, &server, &stopped, &stats, metrics, index, control]()
+            {
+                pollfd fd = { control, POLLIN, 0 };
+                while (!stopped)
+                {
+                    stats.store(server->stats());
+                    if (metrics) publish_metrics(index, metrics->snapshot().serialize());
+                    auto ret = poll(&fd, 1, (int)opts.stats_interval.count());
+                    if (ret < 0 && errno != EINTR) break;
+                    if (ret > 0)
+                    {
+                        char c;
+                        if (read(control, &c, 1) <= 0) break; // Closed by the supervisor
+                    }
+                }
+                // drain does not stop a server that has not started running yet, so retry
+                while (!stopped)
+                {
+                    server->drain(opts.drain_timeout);
+                    if (!stopped) std::this_thread::sleep_for(std::chrono::milliseconds(10));
+                }
+            });
+            try
+            {
+                server->run();
+            }
+            catch (...)
+            {
+                stopped = true;
+                control_thread.join();
+                throw;
+            }
+            stopped = true;
+            control_thread.join();
+            stats.clear();
+            clear_metrics(index);
+        }
+        catch (...)
+        {
+            code = 1;
+        }
+        // Do not run the supervisors atexit handlers and static destructors
+        _exit(code);
+    }
+    void Supervisor::stop_workers()
+    {
+        auto deadline = std::chrono::steady_clock::now() + opts.drain_timeout + std::chrono::seconds(1);
+        std::unique_lock<std::mutex> lock(mutex);
+        while (true)
+        {
+            bool running = false;
+            for (auto &worker : worker_state)
+            {
+                if (!worker.pid) continue;
+                int status;
+                auto ret = waitpid(worker.pid, &status, WNOHANG);
+                if (ret == worker.pid || (ret < 0 && errno == ECHILD)) worker.pid = 0;
+                else running = true;
+            }
+            if (!running) break;
+            if (std::chrono::steady_clock::now() >= deadline)
+            {
+                for (auto &worker : worker_state)
+                {
+                    if (!worker.pid) continue;
+                    kill(worker.pid, SIGKILL);
+                    waitpid(worker.pid, nullptr, 0);
+                    worker.pid = 0;
+                }
+                break;
+            }
+            exit_cv.wait_for(lock, std::chrono::milliseconds(20));
+        }
+        for (unsigned i = 0; i < worker_count; ++i)
+        {
+            shared[i].clear();
+            clear_metrics(i);
+        }
+    }
+    void Supervisor::publish_metrics(unsigned index, const std::string &data)
+    {
+        auto region = shared_metrics + metrics_words * index;
+        auto words = (data.size() + sizeof(uint64_t) - 1) / sizeof(uint64_t);
+        if (words > metrics_words - 2)
+        {
+            // Rather than leave old values that no longer change
+            clear_metrics(index);
+            return;
+        }
+        // A seqlock, so the readers never block this worker
+        auto seq = region[0].load(std::memory_order_relaxed);
+        region[0].store(seq + 1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+        region[1].store(data.size(), std::memory_order_relaxed);
+        for (size_t i = 0; i < words; ++i)
+        {
+            uint64_t word = 0;
+            auto offset = i * sizeof(uint64_t);
+            memcpy(&word, data.data() + offset, std::min(sizeof(uint64_t), data.size() - offset));
+            region[i + 2].store(word, std::memory_order_relaxed);
+        }
+        region[0].store(seq + 2, std::memory_order_release);
+    }
+    MetricsSnapshot Supervisor::load_metrics(unsigned index)const
+    {
+        if (!shared_metrics) return MetricsSnapshot();
+        auto region = shared_metrics + metrics_words * index;
+        std::string data;
+        // The worker only writes every stats_interval, so retrying rarely fails twice
+        for (int attempt = 0; attempt < 100; ++attempt)
+        {
+            auto seq = region[0].load(std::memory_order_acquire);
+            if (seq % 2)
+            {
+                std::this_thread::yield();
+                continue;
+            }
+            auto size = region[1].load(std::memory_order_relaxed);
+            auto words = std::min<uint64_t>((size + sizeof(uint64_t) - 1) / sizeof(uint64_t), metrics_words - 2);
+            data.resize((size_t)words * sizeof(uint64_t));
+            for (size_t i = 0; i < words; ++i)
+            {
+                auto word = region[i + 2].load(std::memory_order_relaxed);
+                memcpy(&data[i * sizeof(uint64_t)], &word, sizeof(word));
+            }
+            std::atomic_thread_fence(std::memory_order_acquire);
+            if (region[0].load(std::memory_order_relaxed) != seq) continue;
+            if (!size) return MetricsSnapshot();
+            data.resize((size_t)size);
+            return MetricsSnapshot::parse(data);
+        }
+        return MetricsSnapshot();
+    }
+    void Supervisor::clear_metrics(unsigned index)
+    {
+        if (!shared_metrics) return;
+        auto region = shared_metrics + metrics_words * index;
+        // The worker may have died while writing, leaving the sequence odd
+        auto seq = region[0].load(std::memory_order_relaxed) | 1;
+        region[0].store(seq, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+        region[1].store(0, std::memory_order_relaxed);
+        region[0].store(seq + 1, std::memory_order_release);
+    }
+#endif
+}
@@ -0,0 +1,601 @@
+#include "server/WebSocket.hpp"
+#include "util/Compressor.hpp"
+#include "Error.hpp"
+#include "Response.hpp"
+#include "String.hpp"
+#include <algorithm>
+#include <cassert>
+#include <cstring>
+#include <iostream>
+#include <limits>
+#include <typeinfo>
+#include <zlib.h>
+namespace http
+{
+    using namespace websocket;
+    namespace
+    {
+        /**The empty stored block ending each compressed message, removed by the sender.*/
+        const uint8_t DEFLATE_TAIL[4] = { 0x00, 0x00, 0xFF, 0xFF };
+        /**Size of each output block when compressing or decompressing.*/
+        const size_t ZLIB_BLOCK_SIZE = 16 * 1024;
+        /**Maximum input given to zlib at once, since avail_in is a uInt.*/
+        const size_t MAX_ZLIB_INPUT = std::numeric_limits<uInt>::max();
+
+        /**Raw deflate for permessage-deflate, reset for each message.*/
+        class Deflater
+        {
+        public:
+            explicit Deflater(int level)
+                : level(level)
+            {
+                zlib.zalloc = Z_NULL;
+                zlib.zfree = Z_NULL;
+                zlib.opaque = Z_NULL;
+                auto ret = deflateInit2(&zlib, level < 0 ? Z_DEFAULT_COMPRESSION : level, Z_DEFLATED,
+                    -15, 8, Z_DEFAULT_STRATEGY);
+                if (ret != Z_OK) throw CompressionError("deflateInit2 failed");
+            }
+            ~Deflater()
+            {
+                deflateEnd(&zlib);
+            }
+            Deflater(const Deflater&) = delete;
+            Deflater& operator = (const Deflater&) = delete;
+
+            const int level;
+
+            /**Compress a complete message, without the DEFLATE_TAIL (RFC7692 7.2.1).*/
+            std::string compress(const void *data, size_t len)
+            {
+                deflateReset(&zlib);
+                std::string out;
+                auto p = (const uint8_t*)data;
+                do
+                {
+                    auto in_len = std::min(len, MAX_ZLIB_INPUT);
+                    bool last = in_len == len;
+                    zlib.next_in = const_cast<Bytef*>(p);
+                    zlib.avail_in = (uInt)in_len;
+                    p += in_len;
+                    len -= in_len;
+                    do
+                    {
+                        auto old_size = out.size();
+                        out.resize(old_size + ZLIB_BLOCK_SIZE);
+                        zlib.next_out = (Bytef*)&out[old_size];
+                        zlib.avail_out = (uInt)ZLIB_BLOCK_SIZE;
+                        auto ret = deflate(&zlib, last ? Z_SYNC_FLUSH : Z_NO_FLUSH);
+                        out.resize(out.size() - zlib.avail_out);
+                        if (ret == Z_STREAM_ERROR) throw CompressionError("deflate failed");
+                    }
+                    while (zlib.avail_out == 0);
+                }
+                while (len > 0);
+                assert(out.size() >= 4 && memcmp(out.data() + out.size() - 4, DEFLATE_TAIL, 4) == 0);
+                out.resize(out.size() - 4);
+                return out;
+            }
+        private:
+            z_stream zlib;
+        };
+        /**Compress a message with a deflater reused by the calling thread.*/
+        std::string deflate_message(const void *data, size_t len, int level)
+        {
+            static thread_local std::unique_ptr<Deflater> deflater;
+            if (!deflater || deflater->level != level) deflater.reset(new Deflater(level));
+            return deflater->compress(data, len);
+        }
+        std::shared_ptr<const std::string> plain_frame(Opcode opcode, const void *data, size_t len)
+        {
+            auto frame = std::make_shared<std::string>();
+            write_frame(frame.get(), opcode, data, len);
+            return frame;
+        }
+        /**A compressed frame, or null if the message is too small or did not compress.*/
+        std::shared_ptr<const std::string> deflated_frame(Opcode opcode, const void *data, size_t len,
+            const WebSocketOptions &options)
+        {
+            if (len < options.deflate_min_size) return nullptr;
+            auto compressed = deflate_message(data, len, options.deflate_level);
+            if (compressed.size() >= len) return nullptr;
+            auto frame = std::make_shared<std::string>();
+            write_frame(frame.get(), opcode, compressed.data(), compressed.size(), true, true);
+            return frame;
+        }
+        std::shared_ptr<const std::string> close_frame(uint16_t code, const std::string &reason)
+        {
+            std::string payload;
+            if (code != CLOSE_NO_STATUS)
+            {
+                payload.push_back((char)(code >> 8));
+                payload.push_back((char)code);
+                payload += reason;
+            }
+            return plain_frame(OP_CLOSE, payload.data(), payload.size());
+        }
+        /**Codes a peer may send in a close frame (RFC6455 7.4).*/
+        bool valid_close_code(uint16_t code)
+        {
+            if (code >= 3000 && code <= 4999) return true;
+            return code >= 1000 && code <= 1014 && code != 1004 && code != 1005 && code != 1006;
+        }
+
+        std::string trim(const std::string &str)
+        {
+            auto begin = str.find_first_not_of(" \t");
+            if (begin == std::string::npos) return std::string();
+            return str.substr(begin, str.find_last_not_of(" \t") - begin + 1);
+        }
+        /**Split a header value on sep, trimming whitespace, and skipping empty items.*/
+        std::vector<std::string> split_list(const std::string &list, char sep)
+        {
+            std::vector<std::string> items;
+            size_t i = 0;
+            while (i <= list.size())
+            {
+                auto end = list.find(sep, i);
+                if (end == std::string::npos) end = list.size();
+                auto item = trim(list.substr(i, end - i));
+                if (!item.empty()) items.push_back(item);
+                i = end + 1;
+            }
+            return items;
+        }
+        /**Get a header, ignoring case, since some clients normalise header names differently.*/
+        const std::string &get_header(const Headers &headers, const std::string &name)
+        {
+            auto &value = headers.get(name);
+            if (!value.empty()) return value;
+            for (auto &header : headers)
+            {
+                if (ieq(header.first, name)) return header.second;
+            }
+            return value;
+        }
+        bool list_contains(const std::string &list, const std::string &token)
+        {
+            for (auto &item : split_list(list, ','))
+            {
+                if (ieq(item, token)) return true;
+            }
+            return false;
+        }
+        /**A Sec-WebSocket-Key must be 16 base64 encoded bytes.*/
+        bool valid_key(const std::string &key)
+        {
+            if (key.size() != 24 || key[22] != '=' || key[23] != '=') return false;
+            for (size_t i = 0; i < 22; ++i)
+            {
+                auto c = key[i];
+                bool base64 = (c >= 'A' && c <= 'Z') || (c >= 'a' && c <= 'z') ||
+                    (c >= '0' && c <= '9') || c == '+' || c == '/';
+                if (!base64) return false;
+            }
+            return true;
+        }
+        /**True if any permessage-deflate offer can be accepted. Sent messages use the full window
+         * and no context takeover, so offers limiting server_max_window_bits are declined.
+         */
+        bool negotiate_deflate(const std::string &extensions)
+        {
+            for (auto &offer : split_list(extensions, ','))
+            {
+                auto params = split_list(offer, ';');
+                if (params.empty() || !ieq(params[0], "permessage-deflate")) continue;
+                bool ok = true;
+                for (size_t i = 1; i < params.size() && ok; ++i)
+                {
+                    auto &param = params[i];
+                    auto eq = param.find('=');
+                    auto name = trim(param.substr(0, eq));
+                    auto value = eq == std::string::npos ? std::string() : trim(param.substr(eq + 1));
+                    if (value.size() >= 2 && value.front() == '"' && value.back() == '"')
+                        value = value.substr(1, value.size() - 2);
+                    if (ieq(name, "server_no_context_takeover") || ieq(name, "client_no_context_takeover")) continue;
+                    // The client's window size does not matter, since inflate accepts any size
+                    else if (ieq(name, "client_max_window_bits")) continue;
+                    else if (ieq(name, "server_max_window_bits")) ok = value == "15";
+                    else ok = false;
+                }
+                if (ok) return true;
+            }
+            return false;
+        }
+        std::string select_protocol(const std::string &offered, const std::vector<std::string> &supported)
+        {
+            auto offers = split_list(offered, ',');
+            for (auto &protocol : supported)
+            {
+                if (std::find(offers.begin(), offers.end(), protocol) != offers.end()) return protocol;
+            }
+            return std::string();
+        }
+    }
+
+    /**Decompression for received permessage-deflate messages.*/
+    class WebSocket::Inflater
+    {
+    public:
+        Inflater()
+        {
+            zlib.zalloc = Z_NULL;
+            zlib.zfree = Z_NULL;
+            zlib.opaque = Z_NULL;
+            zlib.next_in = Z_NULL;
+            zlib.avail_in = 0;
+            if (inflateInit2(&zlib, -15) != Z_OK) throw CompressionError("inflateInit2 failed");
+        }
+        ~Inflater()
+        {
+            inflateEnd(&zlib);
+        }
+        /**Decompress a message, restoring the DEFLATE_TAIL removed by the sender.
+         * @throws WebSocketError If the data is invalid, or decompresses to more than max_size.
+         */
+        void inflate(const std::string &in, size_t max_size, std::string *out)
+        {
+            run((const uint8_t*)in.data(), in.size(), max_size, out);
+            run(DEFLATE_TAIL, sizeof(DEFLATE_TAIL), max_size, out);
+        }
+    private:
+        z_stream zlib;
+
+        void run(const uint8_t *data, size_t len, size_t max_size, std::string *out)
+        {
+            do
+            {
+                auto in_len = std::min(len, MAX_ZLIB_INPUT);
+                zlib.next_in = const_cast<Bytef*>(data);
+                zlib.avail_in = (uInt)in_len;
+                data += in_len;
+                len -= in_len;
+                do
+                {
+                    auto old_size = out->size();
+                    out->resize(old_size + ZLIB_BLOCK_SIZE);
+                    zlib.next_out = (Bytef*)&(*out)[old_size];
+                    zlib.avail_out = (uInt)ZLIB_BLOCK_SIZE;
+                    auto ret = ::inflate(&zlib, Z_SYNC_FLUSH);
+                    out->resize(out->size() - zlib.avail_out);
+                    // A client may end a message with a final block, losing the context anyway
+                    if (ret == Z_STREAM_END) inflateReset(&zlib);
+                    else if (ret != Z_OK && ret != Z_BUF_ERROR)
+                        throw WebSocketError(CLOSE_INVALID_DATA, "Invalid compressed message");
+                    if (out->size() > max_size) throw WebSocketError(CLOSE_MESSAGE_TOO_BIG, "Message too big");
+                }
+                while (zlib.avail_in > 0 || zlib.avail_out == 0);
+            }
+            while (len > 0);
+        }
+    };
+
+    WebSocketMessage::WebSocketMessage(Opcode opcode, const void *data, size_t len,
+        const WebSocketOptions &options)
+        : plain(plain_frame(opcode, data, len))
+    {
+        if (options.permessage_deflate) deflated = deflated_frame(opcode, data, len, options);
+    }
+
+    WebSocket::WebSocket(Request &&request, PathParams &&params, const WebSocketHandler &handler,
+        const WebSocketOptions &options, bool deflate, const std::string &protocol)
+        : upgrade_request(std::move(request)), params(std::move(params)), handler(handler)
+        , options(options), deflate_enabled(deflate), selected_protocol(protocol)
+        , output()
+        , opened(false), close_received(false), close_reported(false)
+        , failed(false), in_frame(false), frame(), frame_pos(0), in_message(false)
+        , message_opcode(OP_BINARY), message_compressed(false), message()
+    {}
+    WebSocket::~WebSocket()
+    {}
+
+    size_t WebSocket::broadcast(const std::vector<std::shared_ptr<WebSocket>> &sockets,
+        const WebSocketMessage &message)
+    {
+        size_t sent = 0;
+        for (auto &socket : sockets)
+        {
+            if (socket->send(message)) ++sent;
+        }
+        return sent;
+    }
+
+    bool WebSocket::send_text(const std::string &text)
+    {
+        auto frame = deflate_enabled ? deflated_frame(OP_TEXT, text.data(), text.size(), options) : nullptr;
+        return queue(frame ? frame : plain_frame(OP_TEXT, text.data(), text.size()));
+    }
+    bool WebSocket::send_binary(const void *data, size_t len)
+    {
+        auto frame = deflate_enabled ? deflated_frame(OP_BINARY, data, len, options) : nullptr;
+        return queue(frame ? frame : plain_frame(OP_BINARY, data, len));
+    }
+    bool WebSocket::send(const WebSocketMessage &message)
+    {
+        return queue(message.frame(deflate_enabled));
+    }
+    bool WebSocket::ping(const std::string &payload)
+    {
+        if (payload.size() > MAX_CONTROL_PAYLOAD) throw std::invalid_argument("WebSocket ping payload too long");
+        return queue(plain_frame(OP_PING, payload.data(), payload.size()));
+    }
+    bool WebSocket::close(uint16_t code, const std::string &reason)
+    {
+        if (reason.size() + 2 > MAX_CONTROL_PAYLOAD) throw std::invalid_argument("WebSocket close reason too long");
+        return queue(close_frame(code, reason), true);
+    }
+    size_t WebSocket::buffered_amount()const
+    {
+        return output.buffered_amount();
+    }
+    bool WebSocket::is_open()const
+    {
+        return output.is_open();
+    }
+
+    void WebSocket::attach(std::function<void()> notify)
+    {
+        output.attach(notify);
+    }
+    void WebSocket::open()
+    {
+        opened = true;
+        if (!handler.on_open) return;
+        try
+        {
+            handler.on_open(shared_from_this());
+        }
+        catch (const std::exception &e)
+        {
+            fail(CLOSE_INTERNAL_ERROR, e.what());
+        }
+    }
+    void WebSocket::detach()
+    {
+        output.detach();
+        inflater.reset();
+        std::string().swap(message);
+        report_close(CLOSE_ABNORMAL, std::string());
+    }
+
+    size_t WebSocket::receive(uint8_t *data, size_t len, size_t capacity)
+    {
+        size_t pos = 0;
+        try
+        {
+            while (pos < len && !close_received && !failed)
+            {
+                if (in_frame)
+                {
+                    // Payload of a data frame too large for the buffer
+                    auto n = (size_t)std::min<uint64_t>(len - pos, frame.length - frame_pos);
+                    apply_mask(data + pos, n, frame.mask, frame_pos);
+                    message.append((const char*)data + pos, n);
+                    pos += n;
+                    frame_pos += n;
+                    if (frame_pos == frame.length)
+                    {
+                        in_frame = false;
+                        if (frame.fin) message_received();
+                    }
+                    continue;
+                }
+
+                FrameHeader header;
+                auto header_len = FrameHeader::read(data + pos, len - pos, &header);
+                if (!header_len) break;
+                check_header(header);
+                if (header.length <= len - pos - header_len)
+                {
+                    auto payload = data + pos + header_len;
+                    apply_mask(payload, (size_t)header.length, header.mask);
+                    pos += header_len + (size_t)header.length;
+                    frame_received(header, payload, (size_t)header.length);
+                }
+                else if (header_len + header.length <= capacity || is_control(header.opcode))
+                {
+                    break; // Wait for the rest of the frame
+                }
+                else
+                {
+                    if (header.opcode != OP_CONTINUATION)
+                    {
+                        in_message = true;
+                        message_opcode = header.opcode;
+                        message_compressed = header.rsv1;
+                        message.clear();
+                    }
+                    frame = header;
+                    frame_pos = 0;
+                    in_frame = true;
+                    pos += header_len;
+                }
+            }
+        }
+        catch (const WebSocketError &e)
+        {
+            fail(e.code(), e.what());
+        }
+        // Anything after a close frame is ignored
+        return close_received || failed ? len : pos;
+    }
+    std::shared_ptr<const std::string> WebSocket::take_output()
+    {
+        return output.take();
+    }
+    bool WebSocket::wants_close()const
+    {
+        return failed || (close_received && output.closed());
+    }
+
+    bool WebSocket::queue(std::shared_ptr<const std::string> frame, bool closing)
+    {
+        return output.queue(std::move(frame), closing) == StreamOutput::QUEUED;
+    }
+    void WebSocket::check_header(const FrameHeader &header)
+    {
+        if (!header.masked) throw WebSocketError(CLOSE_PROTOCOL_ERROR, "Client frames must be masked");
+        if (header.rsv23) throw WebSocketError(CLOSE_PROTOCOL_ERROR, "Unexpected reserved bits");
+        switch (header.opcode)
+        {
+        case OP_CLOSE:
+        case OP_PING:
+        case OP_PONG:
+            if (!header.fin || header.rsv1 || header.length > MAX_CONTROL_PAYLOAD)
+                throw WebSocketError(CLOSE_PROTOCOL_ERROR, "Invalid control frame");
+            return;
+        case OP_CONTINUATION:
+            if (!in_message) throw WebSocketError(CLOSE_PROTOCOL_ERROR, "Unexpected continuation frame");
+            if (header.rsv1) throw WebSocketError(CLOSE_PROTOCOL_ERROR, "Unexpected reserved bits");
+            break;
+        case OP_TEXT:
+        case OP_BINARY:
+            if (in_message) throw WebSocketError(CLOSE_PROTOCOL_ERROR, "Expected continuation frame");
+            if (header.rsv1 && !deflate_enabled) throw WebSocketError(CLOSE_PROTOCOL_ERROR, "Unexpected reserved bits");
+            break;
+        default:
+            throw WebSocketError(CLOSE_PROTOCOL_ERROR, "Unknown opcode");
+        }
+        auto received = header.opcode == OP_CONTINUATION ? message.size() : 0;
+        if (header.length > options.max_message_size - received)
+            throw WebSocketError(CLOSE_MESSAGE_TOO_BIG, "Message too big");
+    }
+    void WebSocket::frame_received(const FrameHeader &header, const uint8_t *payload, size_t len)
+    {
+        switch (header.opcode)
+        {
+        case OP_CLOSE:
+            return close_received_frame(payload, len);
+        case OP_PING:
+            queue(plain_frame(OP_PONG, payload, len));
+            return;
+        case OP_PONG:
+            return;
+        case OP_CONTINUATION:
+            message.append((const char*)payload, len);
+            if (header.fin) message_received();
+            return;
+        default:
+            break;
+        }
+        if (header.fin && !header.rsv1)
+        {
+            // An unfragmented, uncompressed message can be used directly from the buffer
+            deliver(header.opcode, (const char*)payload, len);
+            return;
+        }
+        in_message = true;
+        message_opcode = header.opcode;
+        message_compressed = header.rsv1;
+        message.assign((const char*)payload, len);
+        if (header.fin) message_received();
+    }
+    void WebSocket::message_received()
+    {
+        in_message = false;
+        if (message_compressed)
+        {
+            if (!inflater) inflater.reset(new Inflater());
+            std::string decompressed;
+            inflater->inflate(message, options.max_message_size, &decompressed);
+            message.swap(decompressed);
+        }
+        deliver(message_opcode, message.data(), message.size());
+        // Don't hold a large buffer between messages
+        if (message.capacity() > StreamOutput::BATCH_SIZE) std::string().swap(message);
+        else message.clear();
+    }
+    void WebSocket::close_received_frame(const uint8_t *payload, size_t len)
+    {
+        uint16_t code = CLOSE_NO_STATUS;
+        std::string reason;
+        if (len == 1) throw WebSocketError(CLOSE_PROTOCOL_ERROR, "Invalid close frame");
+        if (len >= 2)
+        {
+            code = (uint16_t)((payload[0] << 8) | payload[1]);
+            if (!valid_close_code(code)) throw WebSocketError(CLOSE_PROTOCOL_ERROR, "Invalid close code");
+            reason.assign((const char*)payload + 2, len - 2);
+            if (!valid_utf8(reason.data(), reason.size()))
+                throw WebSocketError(CLOSE_INVALID_DATA, "Invalid UTF-8 in close reason");
+        }
+        close_received = true;
+        // Echo the code to complete the handshake, unless the server started it
+        queue(close_frame(code, std::string()), true);
+        report_close(code, reason);
+    }
+    void WebSocket::deliver(Opcode opcode, const char *data, size_t len)
+    {
+        if (opcode == OP_TEXT && !valid_utf8(data, len))
+            throw WebSocketError(CLOSE_INVALID_DATA, "Invalid UTF-8 in text message");
+        if (!handler.on_message) return;
+        try
+        {
+            handler.on_message(shared_from_this(), opcode, data, len);
+        }
+        catch (const WebSocketError &)
+        {
+            throw;
+        }
+        catch (const std::exception &e)
+        {
+            throw WebSocketError(CLOSE_INTERNAL_ERROR, e.what());
+        }
+    }
+    void WebSocket::fail(uint16_t code, const std::string &reason)
+    {
+        failed = true;
+        queue(close_frame(code, std::string()), true);
+        report_close(code, reason);
+    }
+    void WebSocket::report_close(uint16_t code, const std::string &reason)
+    {
+        if (!opened || close_reported) return;
+        close_reported = true;
+        if (!handler.on_close) return;
+        try
+        {
+            handler.on_close(shared_from_this(), code, reason);
+        }
+        catch (const std::exception &e)
+        {
+            std::cerr << typeid(e).name() << ' ' << e.what() << std::endl;
+        }
+    }
+
+    Response websocket_upgrade(Request &request, PathParams &params, const WebSocketHandler &handler,
+        const WebSocketOptions &options)
+    {
+        Response response;
+        if (!list_contains(get_header(request.headers, "Upgrade"), "websocket") ||
+            !list_contains(get_header(request.headers, "Connection"), "upgrade") ||
+            get_header(request.headers, "Sec-WebSocket-Version") != VERSION)
+        {
+            response.status_code(SC_UPGRADE_REQUIRED);
+            response.headers.add("Upgrade", "websocket");
+            response.headers.add("Sec-WebSocket-Version", VERSION);
+            response.headers.add("Content-Type", "text/plain");
+            response.body = "WebSocket upgrade required";
+            return response;
+        }
+        if (request.method != GET) throw MethodNotAllowed(request.method, request.url.path);
+        auto &key = get_header(request.headers, "Sec-WebSocket-Key");
+        if (!valid_key(key)) throw BadRequest("Invalid Sec-WebSocket-Key");
+
+        bool deflate = options.permessage_deflate &&
+            negotiate_deflate(get_header(request.headers, "Sec-WebSocket-Extensions"));
+        auto protocol = select_protocol(get_header(request.headers, "Sec-WebSocket-Protocol"), options.protocols);
+
+        response.status_code(SC_SWITCHING_PROTOCOLS);
+        response.headers.add("Upgrade", "websocket");
+        response.headers.add("Connection", "Upgrade");
+        response.headers.add("Sec-WebSocket-Accept", accept_key(key));
+        if (deflate) response.headers.add("Sec-WebSocket-Extensions", "permessage-deflate; server_no_context_takeover");
+        if (!protocol.empty()) response.headers.add("Sec-WebSocket-Protocol", protocol);
+
+        Request upgrade_request = request;
+        PathParams upgrade_params = params;
+        response.websocket = std::make_shared<WebSocket>(std::move(upgrade_request), std::move(upgrade_params),
+            handler, options, deflate, protocol);
+        return response;
+    }
+}
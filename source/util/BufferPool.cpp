@@ -0,0 +1,110 @@
+#include "util/BufferPool.hpp"
+#include <cassert>
+#include <cstring>
+namespace http
+{
+    void PooledBuffer::reset()
+    {
+        if (_data) pool->put(_data, _size);
+        pool = nullptr;
+        _data = nullptr;
+        _size = 0;
+    }
+
+    BufferPool::BufferPool(size_t max_pooled_size, size_t max_free)
+        : max_pooled_size(size_class(max_pooled_size)), max_free(max_free)
+        , free_buffers(class_index(this->max_pooled_size) + 1), leased(0)
+    {
+        // So put never needs to allocate
+        for (auto &buffers : free_buffers) buffers.reserve(max_free);
+    }
+    BufferPool::~BufferPool()
+    {
+        for (auto &buffers : free_buffers)
+            for (auto data : buffers) delete[] data;
+    }
+
+    PooledBuffer BufferPool::get(size_t size)
+    {
+        size = size_class(size);
+        char *data = nullptr;
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            ++leased;
+            if (size <= max_pooled_size)
+            {
+                auto &buffers = free_buffers[class_index(size)];
+                if (!buffers.empty())
+                {
+                    data = buffers.back();
+                    buffers.pop_back();
+                }
+            }
+        }
+        if (!data)
+        {
+            try
+            {
+                data = new char[size];
+            }
+            catch (...)
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                --leased;
+                throw;
+            }
+        }
+        return PooledBuffer(this, data, size);
+    }
+    PooledBuffer BufferPool::grow(PooledBuffer &&buffer, size_t size, size_t len)
+    {
+        assert(len <= buffer.size());
+        auto larger = get(size);
+        if (len) memcpy(larger.data(), buffer.data(), len);
+        buffer.reset();
+        return larger;
+    }
+    size_t BufferPool::in_use()const
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        return leased;
+    }
+    size_t BufferPool::free_bytes()const
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        size_t total = 0;
+        for (size_t i = 0; i < free_buffers.size(); ++i) total += free_buffers[i].size() * (MIN_SIZE << i);
+        return total;
+    }
+    size_t BufferPool::size_class(size_t size)
+    {
+        size_t ret = MIN_SIZE;
+        while (ret < size) ret <<= 1;
+        return ret;
+    }
+
+    void BufferPool::put(char *data, size_t size)
+    {
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            assert(leased > 0);
+            --leased;
+            if (size <= max_pooled_size)
+            {
+                auto &buffers = free_buffers[class_index(size)];
+                if (buffers.size() < max_free)
+                {
+                    buffers.push_back(data);
+                    return;
+                }
+            }
+        }
+        delete[] data;
+    }
+    size_t BufferPool::class_index(size_t size)
+    {
+        size_t index = 0;
+        while ((MIN_SIZE << index) < size) ++index;
+        return index;
+    }
+}
@@ -0,0 +1,164 @@
+#include "util/Compressor.hpp"
+#include <algorithm>
+#include <cassert>
+#include <cstdint>
+#include <limits>
+#include <zlib.h>
+#ifdef HTTP_USE_BROTLI
+#include <brotli/encode.h>
+#endif
+namespace http
+{
+    namespace
+    {
+        /**Size of each output block appended to the output string.*/
+        const size_t OUTPUT_BLOCK_SIZE = 16 * 1024;
+        /**Maximum input given to zlib at once, since avail_in is a uInt.*/
+        const size_t MAX_ZLIB_INPUT = std::numeric_limits<uInt>::max();
+    }
+
+    class Compressor::Impl
+    {
+    public:
+        /**zlib using windowBits + 16 to write a gzip header and trailer instead of zlib.*/
+        Impl(bool gzip, int level)
+            : brotli(nullptr)
+        {
+            zlib.zalloc = Z_NULL;
+            zlib.zfree = Z_NULL;
+            zlib.opaque = Z_NULL;
+            if (level == DEFAULT_LEVEL) level = Z_DEFAULT_COMPRESSION;
+            auto ret = deflateInit2(&zlib, level, Z_DEFLATED, gzip ? 15 + 16 : 15, 8, Z_DEFAULT_STRATEGY);
+            if (ret != Z_OK) throw CompressionError("deflateInit2 failed");
+        }
+#ifdef HTTP_USE_BROTLI
+        explicit Impl(int level)
+            : brotli(BrotliEncoderCreateInstance(nullptr, nullptr, nullptr))
+        {
+            if (!brotli) throw CompressionError("BrotliEncoderCreateInstance failed");
+            // The brotli default of 11 is too slow for dynamic responses
+            if (level == DEFAULT_LEVEL) level = 5;
+            BrotliEncoderSetParameter(brotli, BROTLI_PARAM_QUALITY, (uint32_t)level);
+        }
+#endif
+        ~Impl()
+        {
+#ifdef HTTP_USE_BROTLI
+            if (brotli)
+            {
+                BrotliEncoderDestroyInstance(brotli);
+                return;
+            }
+#endif
+            deflateEnd(&zlib);
+        }
+
+        void write(const uint8_t *data, size_t len, bool finish, std::string *out)
+        {
+#ifdef HTTP_USE_BROTLI
+            if (brotli) return write_brotli(data, len, finish, out);
+#endif
+            write_zlib(data, len, finish, out);
+        }
+    private:
+        z_stream zlib;
+#ifdef HTTP_USE_BROTLI
+        BrotliEncoderState *brotli;
+#else
+        void *brotli;
+#endif
+
+        void write_zlib(const uint8_t *data, size_t len, bool finish, std::string *out)
+        {
+            do
+            {
+                auto in_len = std::min(len, MAX_ZLIB_INPUT);
+                bool last = finish && in_len == len;
+                zlib.next_in = const_cast<Bytef*>(data);
+                zlib.avail_in = (uInt)in_len;
+                data += in_len;
+                len -= in_len;
+                int ret;
+                do
+                {
+                    auto old_size = out->size();
+                    out->resize(old_size + OUTPUT_BLOCK_SIZE);
+                    zlib.next_out = (Bytef*)&(*out)[old_size];
+                    zlib.avail_out = (uInt)OUTPUT_BLOCK_SIZE;
+                    ret = deflate(&zlib, last ? Z_FINISH : Z_NO_FLUSH);
+                    out->resize(out->size() - zlib.avail_out);
+                    if (ret == Z_STREAM_ERROR) throw CompressionError("deflate failed");
+                }
+                while (zlib.avail_out == 0 || (last && ret != Z_STREAM_END));
+                assert(zlib.avail_in == 0);
+            }
+            while (len > 0);
+        }
+#ifdef HTTP_USE_BROTLI
+        void write_brotli(const uint8_t *data, size_t len, bool finish, std::string *out)
+        {
+            auto op = finish ? BROTLI_OPERATION_FINISH : BROTLI_OPERATION_PROCESS;
+            while (true)
+            {
+                auto old_size = out->size();
+                out->resize(old_size + OUTPUT_BLOCK_SIZE);
+                size_t avail_out = OUTPUT_BLOCK_SIZE;
+                auto next_out = (uint8_t*)&(*out)[old_size];
+                if (!BrotliEncoderCompressStream(brotli, op, &len, &data, &avail_out, &next_out, nullptr))
+                    throw CompressionError("BrotliEncoderCompressStream failed");
+                out->resize(out->size() - avail_out);
+                if (len == 0 && !BrotliEncoderHasMoreOutput(brotli) &&
+                    (!finish || BrotliEncoderIsFinished(brotli)))
+                {
+                    break;
+                }
+            }
+        }
+#endif
+    };
+
+    bool Compressor::supported(const std::string &coding)
+    {
+#ifdef HTTP_USE_BROTLI
+        if (coding == "br") return true;
+#endif
+        return coding == "gzip" || coding == "deflate";
+    }
+    std::string Compressor::compress(const std::string &coding, const void *data, size_t len, int level)
+    {
+        std::string out;
+        Compressor compressor(coding, level);
+        compressor.write(data, len, &out);
+        compressor.finish(&out);
+        return out;
+    }
+
+    Compressor::Compressor(const std::string &coding, int level)
+    {
+        if (coding == "gzip") impl.reset(new Impl(true, level));
+        else if (coding == "deflate") impl.reset(new Impl(false, level));
+#ifdef HTTP_USE_BROTLI
+        else if (coding == "br") impl.reset(new Impl(level));
+#endif
+        else throw std::invalid_argument("Unsupported content coding " + coding);
+    }
+    Compressor::~Compressor()
+    {}
+    Compressor::Compressor(Compressor &&mv)
+        : impl(std::move(mv.impl))
+    {}
+    Compressor& Compressor::operator = (Compressor &&mv)
+    {
+        impl = std::move(mv.impl);
+        return *this;
+    }
+
+    void Compressor::write(const void *data, size_t len, std::string *out)
+    {
+        impl->write((const uint8_t*)data, len, false, out);
+    }
+    void Compressor::finish(std::string *out)
+    {
+        impl->write(nullptr, 0, true, out);
+    }
+}
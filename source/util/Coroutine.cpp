@@ -0,0 +1,89 @@
+#include "util/Coroutine.hpp"
+#ifdef HTTP_USE_COROUTINES
+#include <atomic>
+#include <new>
+namespace http
+{
+    namespace
+    {
+        const size_t SIZE_CLASSES = FrameAllocator::MAX_POOLED_SIZE / FrameAllocator::GRANULARITY;
+
+        /**Free frames of one size class, shared by all threads.
+         * Each slot holds a frame or null. Frames are taken with an exchange and returned with a
+         * compare exchange into an empty slot, so unlike a linked free list there is no ABA
+         * problem. Frames are kept until the process exits.
+         */
+        struct FreeFrames
+        {
+            std::atomic<void*> slots[FrameAllocator::MAX_FREE];
+            /**Approximate number of frames in slots, to skip scanning an empty or full pool.*/
+            std::atomic<int> count;
+        };
+        /**Zero initialized, as a static.*/
+        FreeFrames free_frames_pool[SIZE_CLASSES];
+        std::atomic<uint64_t> allocated_count(0);
+
+        /**Index of the size class for size, or SIZE_CLASSES if not pooled.*/
+        size_t size_class(size_t size)
+        {
+            return size ? (size - 1) / FrameAllocator::GRANULARITY : 0;
+        }
+        void *take_frame(FreeFrames &pool)
+        {
+            if (pool.count.load(std::memory_order_relaxed) <= 0) return nullptr;
+            for (auto &slot : pool.slots)
+            {
+                if (!slot.load(std::memory_order_relaxed)) continue;
+                auto frame = slot.exchange(nullptr, std::memory_order_acquire);
+                if (frame)
+                {
+                    pool.count.fetch_sub(1, std::memory_order_relaxed);
+                    return frame;
+                }
+            }
+            return nullptr;
+        }
+        bool put_frame(FreeFrames &pool, void *frame)
+        {
+            if (pool.count.load(std::memory_order_relaxed) >= (int)FrameAllocator::MAX_FREE) return false;
+            for (auto &slot : pool.slots)
+            {
+                void *expected = nullptr;
+                if (!slot.load(std::memory_order_relaxed) &&
+                    slot.compare_exchange_strong(expected, frame, std::memory_order_release, std::memory_order_relaxed))
+                {
+                    pool.count.fetch_add(1, std::memory_order_relaxed);
+                    return true;
+                }
+            }
+            return false;
+        }
+    }
+
+    void *FrameAllocator::allocate(size_t size)
+    {
+        auto i = size_class(size);
+        if (i >= SIZE_CLASSES) return ::operator new(size);
+        auto frame = take_frame(free_frames_pool[i]);
+        if (frame) return frame;
+        allocated_count.fetch_add(1, std::memory_order_relaxed);
+        return ::operator new((i + 1) * GRANULARITY);
+    }
+    void FrameAllocator::deallocate(void *frame, size_t size)noexcept
+    {
+        auto i = size_class(size);
+        if (i < SIZE_CLASSES && put_frame(free_frames_pool[i], frame)) return;
+        ::operator delete(frame);
+    }
+    size_t FrameAllocator::free_frames()
+    {
+        int count = 0;
+        for (auto &pool : free_frames_pool) count += pool.count.load(std::memory_order_relaxed);
+        return count > 0 ? (size_t)count : 0;
+    }
+    uint64_t FrameAllocator::allocated_frames()
+    {
+        return allocated_count.load(std::memory_order_relaxed);
+    }
+}
+#endif
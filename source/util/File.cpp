@@ -0,0 +1,159 @@
+#include "util/File.hpp"
+#include "net/Net.hpp"
+#include "String.hpp"
+#include <algorithm>
+#include <cassert>
+#include <cerrno>
+#include <limits>
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/stat.h>
+#endif
+namespace http
+{
+#ifdef _WIN32
+    namespace
+    {
+        time_t filetime_to_time(const FILETIME &ft)
+        {
+            // FILETIME is 100ns intervals since 1601-01-01
+            ULARGE_INTEGER i;
+            i.LowPart = ft.dwLowDateTime;
+            i.HighPart = ft.dwHighDateTime;
+            return (time_t)((i.QuadPart - 116444736000000000ULL) / 10000000ULL);
+        }
+    }
+    bool File::stat(const std::string &path, FileInfo *info)
+    {
+        WIN32_FILE_ATTRIBUTE_DATA data;
+        if (!GetFileAttributesExW(utf8_to_utf16(path).c_str(), GetFileExInfoStandard, &data))
+            return false;
+        if (data.dwFileAttributes & (FILE_ATTRIBUTE_DIRECTORY | FILE_ATTRIBUTE_DEVICE))
+            return false;
+        info->size = ((uint64_t)data.nFileSizeHigh << 32) | data.nFileSizeLow;
+        info->mtime = filetime_to_time(data.ftLastWriteTime);
+        return true;
+    }
+    File::File(const std::string &path)
+        : handle(INVALID_FILE), _path(path), _info()
+    {
+        // Overlapped so that TransmitFile and ReadFile use an explicit offset
+        handle = CreateFileW(utf8_to_utf16(path).c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_DELETE,
+            nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL | FILE_FLAG_OVERLAPPED | FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+        if (handle == INVALID_FILE) throw FileError(path, win_error_string(GetLastError()));
+
+        BY_HANDLE_FILE_INFORMATION data;
+        if (!GetFileInformationByHandle(handle, &data))
+        {
+            auto err = GetLastError();
+            close();
+            throw FileError(path, win_error_string(err));
+        }
+        if (data.dwFileAttributes & (FILE_ATTRIBUTE_DIRECTORY | FILE_ATTRIBUTE_DEVICE))
+        {
+            close();
+            throw FileError(path, "Not a regular file");
+        }
+        _info.size = ((uint64_t)data.nFileSizeHigh << 32) | data.nFileSizeLow;
+        _info.mtime = filetime_to_time(data.ftLastWriteTime);
+    }
+    void File::close()
+    {
+        if (handle != INVALID_FILE) CloseHandle(handle);
+        handle = INVALID_FILE;
+    }
+    size_t File::read(FileHandle handle, void *buffer, size_t len, uint64_t offset)
+    {
+        assert(handle != INVALID_FILE);
+        OVERLAPPED overlapped = { 0 };
+        overlapped.Offset = (DWORD)offset;
+        overlapped.OffsetHigh = (DWORD)(offset >> 32);
+        overlapped.hEvent = CreateEventW(nullptr, TRUE, FALSE, nullptr);
+        if (!overlapped.hEvent) throw FileError(win_error_string(GetLastError()));
+
+        auto dwlen = (DWORD)std::min<size_t>(len, std::numeric_limits<DWORD>::max());
+        DWORD read = 0;
+        auto ok = ReadFile(handle, buffer, dwlen, nullptr, &overlapped);
+        auto err = GetLastError();
+        if (ok || err == ERROR_IO_PENDING)
+        {
+            ok = GetOverlappedResult(handle, &overlapped, &read, TRUE);
+            err = GetLastError();
+        }
+        CloseHandle(overlapped.hEvent);
+        if (!ok && err != ERROR_HANDLE_EOF) throw FileError(win_error_string(err));
+        return read;
+    }
+#else
+    bool File::stat(const std::string &path, FileInfo *info)
+    {
+        struct stat st;
+        if (::stat(path.c_str(), &st) || !S_ISREG(st.st_mode)) return false;
+        info->size = (uint64_t)st.st_size;
+        info->mtime = st.st_mtime;
+        return true;
+    }
+    File::File(const std::string &path)
+        : handle(INVALID_FILE), _path(path), _info()
+    {
+        handle = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+        if (handle == INVALID_FILE) throw FileError(path, errno_string(errno));
+
+        struct stat st;
+        if (fstat(handle, &st))
+        {
+            auto err = errno;
+            close();
+            throw FileError(path, errno_string(err));
+        }
+        if (!S_ISREG(st.st_mode))
+        {
+            close();
+            throw FileError(path, "Not a regular file");
+        }
+        _info.size = (uint64_t)st.st_size;
+        _info.mtime = st.st_mtime;
+    }
+    void File::close()
+    {
+        if (handle != INVALID_FILE) ::close(handle);
+        handle = INVALID_FILE;
+    }
+    size_t File::read(FileHandle handle, void *buffer, size_t len, uint64_t offset)
+    {
+        assert(handle != INVALID_FILE);
+        while (true)
+        {
+            auto ret = ::pread(handle, buffer, len, (off_t)offset);
+            if (ret >= 0) return (size_t)ret;
+            if (errno != EINTR) throw FileError(errno_string(errno));
+        }
+    }
+#endif
+
+    File::File()
+        : handle(INVALID_FILE), _path(), _info()
+    {}
+    File::~File()
+    {
+        close();
+    }
+    File::File(File &&mv)
+        : handle(mv.handle), _path(std::move(mv._path)), _info(mv._info)
+    {
+        mv.handle = INVALID_FILE;
+    }
+    File& File::operator = (File &&mv)
+    {
+        close();
+        handle = mv.handle;
+        _path = std::move(mv._path);
+        _info = mv._info;
+        mv.handle = INVALID_FILE;
+        return *this;
+    }
+    bool File::is_open()const
+    {
+        return handle != INVALID_FILE;
+    }
+}
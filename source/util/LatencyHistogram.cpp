@@ -0,0 +1,71 @@
+#include "util/LatencyHistogram.hpp"
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <stdexcept>
+namespace http
+{
+    LatencyHistogram::LatencyHistogram(int max_power, int sub_bucket_bits)
+        : buckets(max_power, sub_bucket_bits), counts()
+        , total(0), sum(0), min_value(std::numeric_limits<uint64_t>::max()), max_value(0)
+        , saturated_count(0)
+    {
+        if (sub_bucket_bits < 1 || max_power <= sub_bucket_bits || max_power > 63)
+            throw std::invalid_argument("Invalid LatencyHistogram range");
+        counts.resize(buckets.count());
+    }
+
+    void LatencyHistogram::record(uint64_t value)
+    {
+        auto index = buckets.index(value);
+        if (index == counts.size())
+        {
+            ++saturated_count;
+            value = ((uint64_t)1 << buckets.max_power) - 1;
+            index = counts.size() - 1;
+        }
+        ++counts[index];
+        ++total;
+        sum += value;
+        min_value = std::min(min_value, value);
+        max_value = std::max(max_value, value);
+    }
+
+    void LatencyHistogram::merge(const LatencyHistogram &other)
+    {
+        if (buckets.max_power != other.buckets.max_power ||
+            buckets.sub_bucket_bits != other.buckets.sub_bucket_bits)
+        {
+            throw std::invalid_argument("LatencyHistogram layouts differ");
+        }
+        for (size_t i = 0; i < counts.size(); ++i) counts[i] += other.counts[i];
+        total += other.total;
+        sum += other.sum;
+        min_value = std::min(min_value, other.min_value);
+        max_value = std::max(max_value, other.max_value);
+        saturated_count += other.saturated_count;
+    }
+
+    void LatencyHistogram::reset()
+    {
+        std::fill(counts.begin(), counts.end(), 0);
+        total = sum = max_value = saturated_count = 0;
+        min_value = std::numeric_limits<uint64_t>::max();
+    }
+
+    uint64_t LatencyHistogram::percentile(double percent)const
+    {
+        if (!total) return 0;
+        percent = std::min(std::max(percent, 0.0), 100.0);
+        // The rank of the value, at least the first
+        auto rank = (uint64_t)std::ceil(percent / 100 * (double)total);
+        rank = std::max<uint64_t>(rank, 1);
+        uint64_t seen = 0;
+        for (size_t i = 0; i < counts.size(); ++i)
+        {
+            seen += counts[i];
+            if (seen >= rank) return std::min(buckets.upper_bound(i), max_value);
+        }
+        return max_value;
+    }
+}
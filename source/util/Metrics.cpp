@@ -0,0 +1,439 @@
+#include "util/Metrics.hpp"
+#include <cassert>
+#include <cstdio>
+#include <cstring>
+#include <stdexcept>
+namespace http
+{
+    namespace
+    {
+        bool valid_name(const std::string &name, bool label)
+        {
+            if (name.empty()) return false;
+            for (size_t i = 0; i < name.size(); ++i)
+            {
+                auto c = name[i];
+                bool ok = (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || c == '_' ||
+                    (c == ':' && !label) || (c >= '0' && c <= '9' && i > 0);
+                if (!ok) return false;
+            }
+            return true;
+        }
+        /**Escape a HELP string or label value. Only label values escape quotes.*/
+        void append_escaped(std::string *out, const std::string &str, bool quotes)
+        {
+            for (auto c : str)
+            {
+                if (c == '\\') *out += "\\\\";
+                else if (c == '\n') *out += "\\n";
+                else if (c == '"' && quotes) *out += "\\\"";
+                else out->push_back(c);
+            }
+        }
+        void append_number(std::string *out, double value)
+        {
+            char buffer[32];
+            snprintf(buffer, sizeof(buffer), "%.15g", value);
+            *out += buffer;
+        }
+        /**Append a series name and labels, with an optional extra "le" label.*/
+        void append_series(std::string *out, const std::string &name, const char *suffix,
+            const MetricLabels &labels, const char *le = nullptr)
+        {
+            *out += name;
+            *out += suffix;
+            if (labels.empty() && !le) return;
+            out->push_back('{');
+            for (auto &label : labels)
+            {
+                if (out->back() != '{') out->push_back(',');
+                *out += label.first;
+                *out += "=\"";
+                append_escaped(out, label.second, true);
+                out->push_back('"');
+            }
+            if (le)
+            {
+                if (out->back() != '{') out->push_back(',');
+                *out += "le=\"";
+                *out += le;
+                out->push_back('"');
+            }
+            out->push_back('}');
+        }
+        bool same_buckets(const HistogramBuckets &a, const HistogramBuckets &b)
+        {
+            return a.max_power == b.max_power && a.sub_bucket_bits == b.sub_bucket_bits && a.scale == b.scale;
+        }
+        void write_u64(std::string *out, uint64_t value)
+        {
+            out->append((const char*)&value, sizeof(value));
+        }
+        void write_string(std::string *out, const std::string &str)
+        {
+            write_u64(out, str.size());
+            *out += str;
+        }
+        /**Reads the output of write_u64 and write_string, in the same process or another on the
+         * same machine.
+         */
+        class SnapshotReader
+        {
+        public:
+            explicit SnapshotReader(const std::string &data) : data(data), pos(0) {}
+            uint64_t u64()
+            {
+                if (data.size() - pos < sizeof(uint64_t)) throw std::invalid_argument("Truncated metrics snapshot");
+                uint64_t value;
+                memcpy(&value, data.data() + pos, sizeof(value));
+                pos += sizeof(value);
+                return value;
+            }
+            /**A count of items that each take at least min_size bytes.*/
+            size_t count(size_t min_size)
+            {
+                auto n = u64();
+                if (n > (data.size() - pos) / min_size) throw std::invalid_argument("Invalid metrics snapshot");
+                return (size_t)n;
+            }
+            std::string string()
+            {
+                auto len = count(1);
+                std::string str = data.substr(pos, len);
+                pos += len;
+                return str;
+            }
+            bool done()const { return pos == data.size(); }
+        private:
+            const std::string &data;
+            size_t pos;
+        };
+        bool same_label_names(const MetricLabels &a, const MetricLabels &b)
+        {
+            if (a.size() != b.size()) return false;
+            for (size_t i = 0; i < a.size(); ++i)
+                if (a[i].first != b[i].first) return false;
+            return true;
+        }
+    }
+
+    uint64_t HistogramBuckets::upper_bound(size_t index)const
+    {
+        assert(index < count());
+        auto sub_count = (size_t)1 << sub_bucket_bits;
+        if (index < sub_count) return index;
+        auto shift = (int)(index >> sub_bucket_bits) - 1;
+        auto lower = (uint64_t)(sub_count + (index & (sub_count - 1))) << shift;
+        return lower + ((uint64_t)1 << shift) - 1;
+    }
+
+    const char Metrics::CONTENT_TYPE[] = "text/plain; version=0.0.4; charset=utf-8";
+
+    Metrics::Shard::Shard(size_t size)
+        : values(new std::atomic<uint64_t>[size])
+    {
+        for (size_t i = 0; i < size; ++i) values[i].store(0, std::memory_order_relaxed);
+    }
+
+    Metrics::Metrics(size_t max_values)
+        : max_values(max_values), used_values(0)
+    {
+        for (auto &shard : shards) shard.store(nullptr, std::memory_order_relaxed);
+    }
+    Metrics::~Metrics()
+    {
+        for (auto &shard : shards) delete shard.load(std::memory_order_relaxed);
+    }
+
+    Counter Metrics::counter(const std::string &name, const std::string &help, const MetricLabels &labels)
+    {
+        Counter counter;
+        counter.slot = add_series(name, help, MetricsSnapshot::COUNTER, HistogramBuckets(), labels);
+        counter.metrics = this;
+        return counter;
+    }
+    Gauge Metrics::gauge(const std::string &name, const std::string &help, const MetricLabels &labels)
+    {
+        Gauge gauge;
+        gauge.slot = add_series(name, help, MetricsSnapshot::GAUGE, HistogramBuckets(), labels);
+        gauge.metrics = this;
+        return gauge;
+    }
+    Histogram Metrics::histogram(const std::string &name, const std::string &help,
+        const HistogramBuckets &buckets, const MetricLabels &labels)
+    {
+        if (buckets.sub_bucket_bits < 0 || buckets.sub_bucket_bits > 8 ||
+            buckets.max_power < buckets.sub_bucket_bits || buckets.max_power > 64)
+        {
+            throw std::invalid_argument("Invalid histogram buckets for " + name);
+        }
+        Histogram histogram;
+        histogram.slot = add_series(name, help, MetricsSnapshot::HISTOGRAM, buckets, labels);
+        histogram.buckets = buckets;
+        histogram.metrics = this;
+        return histogram;
+    }
+
+    size_t Metrics::add_series(const std::string &name, const std::string &help, Type type,
+        const HistogramBuckets &buckets, const MetricLabels &labels)
+    {
+        if (!valid_name(name, false)) throw std::invalid_argument("Invalid metric name " + name);
+        for (auto &label : labels)
+        {
+            if (!valid_name(label.first, true) || label.first.compare(0, 2, "__") == 0 || label.first == "le")
+                throw std::invalid_argument("Invalid label name " + label.first + " for " + name);
+        }
+        size_t size = type == MetricsSnapshot::HISTOGRAM ? buckets.count() + 2 : 1;
+
+        std::unique_lock<std::mutex> lock(mutex);
+        Family *family = nullptr;
+        for (auto &i : families)
+        {
+            if (i.name == name)
+            {
+                family = &i;
+                break;
+            }
+        }
+        if (family)
+        {
+            if (family->type != type || (type == MetricsSnapshot::HISTOGRAM && !same_buckets(family->buckets, buckets)))
+                throw std::invalid_argument("Metric " + name + " already exists with a different type");
+            if (!same_label_names(family->series.front().labels, labels))
+                throw std::invalid_argument("Metric " + name + " already exists with different labels");
+            for (auto &series : family->series)
+                if (series.labels == labels) return series.slot;
+        }
+        if (max_values - used_values < size) throw std::length_error("Too many metric values");
+        if (!family)
+        {
+            families.push_back(Family{ name, help, type, buckets, {} });
+            family = &families.back();
+        }
+        family->series.push_back(Series{ labels, used_values });
+        used_values += size;
+        return family->series.back().slot;
+    }
+
+    Metrics::Shard *Metrics::create_shard(std::atomic<Shard*> &shard)
+    {
+        std::unique_ptr<Shard> created(new Shard(max_values));
+        Shard *expected = nullptr;
+        if (shard.compare_exchange_strong(expected, created.get(), std::memory_order_acq_rel))
+            return created.release();
+        return expected;
+    }
+    std::vector<Metrics::Shard*> Metrics::all_shards()const
+    {
+        std::vector<Shard*> all;
+        for (auto &shard : shards)
+        {
+            auto p = shard.load(std::memory_order_acquire);
+            if (p) all.push_back(p);
+        }
+        return all;
+    }
+    uint64_t Metrics::sum(const std::vector<Shard*> &all, size_t slot)
+    {
+        uint64_t total = 0;
+        for (auto shard : all) total += shard->values[slot].load(std::memory_order_relaxed);
+        return total;
+    }
+
+    std::string Metrics::render()const
+    {
+        return snapshot().render();
+    }
+    MetricsSnapshot Metrics::snapshot()const
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        auto all = all_shards();
+        MetricsSnapshot snapshot;
+        snapshot.families.reserve(families.size());
+        for (auto &family : families)
+        {
+            MetricsSnapshot::Family out = { family.name, family.help, family.type, family.buckets, {} };
+            size_t size = family.type == MetricsSnapshot::HISTOGRAM ? family.buckets.count() + 2 : 1;
+            for (auto &series : family.series)
+            {
+                MetricsSnapshot::Series values = { series.labels, std::vector<uint64_t>(size) };
+                for (size_t i = 0; i < size; ++i) values.values[i] = sum(all, series.slot + i);
+                out.series.push_back(std::move(values));
+            }
+            snapshot.families.push_back(std::move(out));
+        }
+        return snapshot;
+    }
+
+    void MetricsSnapshot::add(const MetricsSnapshot &other)
+    {
+        for (auto &other_family : other.families)
+        {
+            Family *family = nullptr;
+            for (auto &i : families)
+            {
+                if (i.name == other_family.name)
+                {
+                    family = &i;
+                    break;
+                }
+            }
+            if (!family)
+            {
+                families.push_back(other_family);
+                continue;
+            }
+            if (family->type != other_family.type ||
+                (family->type == HISTOGRAM && !same_buckets(family->buckets, other_family.buckets)))
+            {
+                throw std::invalid_argument("Metric " + family->name + " has a different type");
+            }
+            for (auto &other_series : other_family.series)
+            {
+                Series *series = nullptr;
+                for (auto &i : family->series)
+                {
+                    if (i.labels == other_series.labels)
+                    {
+                        series = &i;
+                        break;
+                    }
+                }
+                if (!series) family->series.push_back(other_series);
+                else
+                {
+                    // Gauges wrap like the shard values they are summed from
+                    for (size_t i = 0; i < series->values.size(); ++i) series->values[i] += other_series.values[i];
+                }
+            }
+        }
+    }
+    std::string MetricsSnapshot::render()const
+    {
+        std::string out;
+        for (auto &family : families)
+        {
+            static const char *TYPE_NAMES[] = { "counter", "gauge", "histogram" };
+            out += "# HELP ";
+            out += family.name;
+            out.push_back(' ');
+            append_escaped(&out, family.help, false);
+            out += "\n# TYPE ";
+            out += family.name;
+            out.push_back(' ');
+            out += TYPE_NAMES[family.type];
+            out.push_back('\n');
+
+            for (auto &series : family.series)
+            {
+                auto &values = series.values;
+                if (family.type == COUNTER)
+                {
+                    append_series(&out, family.name, "", series.labels);
+                    out += ' ' + std::to_string(values[0]) + '\n';
+                }
+                else if (family.type == GAUGE)
+                {
+                    append_series(&out, family.name, "", series.labels);
+                    out += ' ' + std::to_string((int64_t)values[0]) + '\n';
+                }
+                else
+                {
+                    auto &buckets = family.buckets;
+                    auto count = buckets.count();
+                    uint64_t total = 0;
+                    for (size_t i = 0; i < count; ++i)
+                    {
+                        total += values[i];
+                        std::string le;
+                        append_number(&le, (double)buckets.upper_bound(i) * buckets.scale);
+                        append_series(&out, family.name, "_bucket", series.labels, le.c_str());
+                        out += ' ' + std::to_string(total) + '\n';
+                    }
+                    total += values[count];
+                    append_series(&out, family.name, "_bucket", series.labels, "+Inf");
+                    out += ' ' + std::to_string(total) + '\n';
+                    append_series(&out, family.name, "_sum", series.labels);
+                    out.push_back(' ');
+                    append_number(&out, (double)values[count + 1] * buckets.scale);
+                    out.push_back('\n');
+                    append_series(&out, family.name, "_count", series.labels);
+                    out += ' ' + std::to_string(total) + '\n';
+                }
+            }
+        }
+        return out;
+    }
+    std::string MetricsSnapshot::serialize()const
+    {
+        std::string out;
+        write_u64(&out, families.size());
+        for (auto &family : families)
+        {
+            write_string(&out, family.name);
+            write_string(&out, family.help);
+            write_u64(&out, (uint64_t)family.type);
+            write_u64(&out, (uint64_t)family.buckets.max_power);
+            write_u64(&out, (uint64_t)family.buckets.sub_bucket_bits);
+            uint64_t scale;
+            memcpy(&scale, &family.buckets.scale, sizeof(scale));
+            write_u64(&out, scale);
+            write_u64(&out, family.series.size());
+            for (auto &series : family.series)
+            {
+                write_u64(&out, series.labels.size());
+                for (auto &label : series.labels)
+                {
+                    write_string(&out, label.first);
+                    write_string(&out, label.second);
+                }
+                write_u64(&out, series.values.size());
+                for (auto value : series.values) write_u64(&out, value);
+            }
+        }
+        return out;
+    }
+    MetricsSnapshot MetricsSnapshot::parse(const std::string &data)
+    {
+        static_assert(sizeof(double) == sizeof(uint64_t), "Histogram scale is stored as 64 bits");
+        SnapshotReader reader(data);
+        MetricsSnapshot snapshot;
+        auto family_count = reader.count(8);
+        for (size_t i = 0; i < family_count; ++i)
+        {
+            Family family;
+            family.name = reader.string();
+            family.help = reader.string();
+            auto type = reader.u64();
+            family.buckets.max_power = (int)reader.u64();
+            family.buckets.sub_bucket_bits = (int)reader.u64();
+            uint64_t scale = reader.u64();
+            memcpy(&family.buckets.scale, &scale, sizeof(scale));
+            bool valid_buckets = family.buckets.sub_bucket_bits >= 0 && family.buckets.sub_bucket_bits <= 8 &&
+                family.buckets.max_power >= family.buckets.sub_bucket_bits && family.buckets.max_power <= 64;
+            if (type > HISTOGRAM || (type == HISTOGRAM && !valid_buckets))
+                throw std::invalid_argument("Invalid metrics snapshot");
+            family.type = (Type)type;
+            size_t size = family.type == HISTOGRAM ? family.buckets.count() + 2 : 1;
+
+            auto series_count = reader.count(16);
+            for (size_t j = 0; j < series_count; ++j)
+            {
+                Series series;
+                auto label_count = reader.count(16);
+                for (size_t k = 0; k < label_count; ++k)
+                {
+                    auto name = reader.string();
+                    series.labels.emplace_back(name, reader.string());
+                }
+                if (reader.count(8) != size) throw std::invalid_argument("Invalid metrics snapshot");
+                series.values.resize(size);
+                for (auto &value : series.values) value = reader.u64();
+                family.series.push_back(std::move(series));
+            }
+            snapshot.families.push_back(std::move(family));
+        }
+        if (!reader.done()) throw std::invalid_argument("Invalid metrics snapshot");
+        return snapshot;
+    }
+}
@@ -1,6 +1,7 @@
 #include <boost/test/unit_test.hpp>
 #include "Time.hpp"
 #include <stdexcept>
+#include <string>
 
 BOOST_AUTO_TEST_SUITE(TestTime)
 BOOST_AUTO_TEST_CASE(test)
@@ -25,4 +26,48 @@ BOOST_AUTO_TEST_CASE(test)
     BOOST_CHECK_THROW(http::parse_time("Fri, 24 Jun 2016 09:65:55 GMT"), std::runtime_error);
     BOOST_CHECK_THROW(http::parse_time("Fri, 24 Jun 2016 09:47:62 GMT"), std::runtime_error);
 }
+BOOST_AUTO_TEST_CASE(format_buffer)
+{
+    char buffer[http::TIME_STR_LEN];
+    auto format = [&buffer](time_t t) -> std::string
+    {
+        auto end = http::format_time(t, buffer);
+        BOOST_REQUIRE_EQUAL(http::TIME_STR_LEN, (size_t)(end - buffer));
+        return {buffer, end};
+    };
+    BOOST_CHECK_EQUAL("Thu, 01 Jan 1970 00:00:00 GMT", format(0));
+    BOOST_CHECK_EQUAL("Sun, 06 Nov 1994 08:49:37 GMT", format(784111777));
+    BOOST_CHECK_EQUAL("Tue, 29 Feb 2000 23:59:59 GMT", format(951868799));
+    BOOST_CHECK_EQUAL("Sun, 01 Mar 2020 00:00:00 GMT", format(1583020800));
+    BOOST_CHECK_EQUAL("Wed, 31 Dec 1969 23:59:59 GMT", format(-1));
+
+    // Compare against the C library for a range of values
+    for (time_t t = 0; t < 4102444800; t += 7654321)
+    {
+        tm tm;
+#ifdef _MSC_VER
+        gmtime_s(&tm, &t);
+#else
+        gmtime_r(&t, &tm);
+#endif
+        char expected[64];
+        auto len = strftime(expected, sizeof(expected), "%a, %d %b %Y %H:%M:%S GMT", &tm);
+        BOOST_CHECK_EQUAL(std::string(expected, len), format(t));
+    }
+}
+BOOST_AUTO_TEST_CASE(format_current)
+{
+    char buffer[http::TIME_STR_LEN];
+    auto before = time(nullptr);
+    auto end = http::format_current_time(buffer);
+    auto after = time(nullptr);
+    BOOST_REQUIRE_EQUAL(http::TIME_STR_LEN, (size_t)(end - buffer));
+    auto t = http::parse_time(std::string(buffer, end));
+    BOOST_CHECK(t >= before && t <= after);
+
+    // Later calls return the same cached value or a newer one
+    char buffer2[http::TIME_STR_LEN];
+    end = http::format_current_time(buffer2);
+    BOOST_CHECK(http::parse_time(std::string(buffer2, end)) >= t);
+}
 BOOST_AUTO_TEST_SUITE_END()
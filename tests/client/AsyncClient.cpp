@@ -250,4 +250,41 @@ BOOST_AUTO_TEST_CASE(parallel)
 }
 
 
+#ifdef HTTP_USE_COROUTINES
+Task<void> get_twice(AsyncClient *client, std::promise<std::string> *done)
+{
+    AsyncRequest req;
+    req.method = GET;
+    req.raw_url = "/index.html";
+    std::string bodies;
+    auto response = co_await client->co_queue(req);
+    bodies += response->body;
+    req.reset();
+    response = co_await client->co_queue(req);
+    bodies += response->body;
+    done->set_value(bodies);
+}
+BOOST_AUTO_TEST_CASE(coroutine)
+{
+    TestSocketFactory socket_factory;
+    socket_factory.recv_buffer =
+        "HTTP/1.1 200 OK\r\n"
+        "Content-Type: text/plain\r\n"
+        "Content-Length: 10\r\n"
+        "\r\n"
+        "0123456789";
+
+    AsyncClientParams params;
+    params.host = "localhost";
+    params.port = 80;
+    params.max_connections = 2;
+    params.socket_factory = &socket_factory;
+
+    AsyncClient client(params);
+    std::promise<std::string> done;
+    spawn(get_twice(&client, &done));
+    BOOST_CHECK_EQUAL("01234567890123456789", done.get_future().get());
+}
+#endif
+
 BOOST_AUTO_TEST_SUITE_END()
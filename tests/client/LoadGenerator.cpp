@@ -0,0 +1,153 @@
+#include <boost/test/unit_test.hpp>
+#include "client/LoadGenerator.hpp"
+#include "server/CoreServer.hpp"
+#include "net/Cert.hpp"
+#include "net/Net.hpp"
+#include "Error.hpp"
+#include "Response.hpp"
+#include "../TestThread.hpp"
+#include <atomic>
+#include <chrono>
+#include <thread>
+
+using namespace http;
+
+BOOST_AUTO_TEST_SUITE(TestLoadGenerator)
+
+static const uint16_t BASE_PORT = 5370;
+
+class LoadServer : public CoreServer
+{
+public:
+    LoadServer() : requests(0) {}
+    std::atomic<unsigned> requests;
+protected:
+    virtual Response handle_request(Request &request)override
+    {
+        ++requests;
+        Response response;
+        response.headers.add("Content-Type", "text/plain");
+        if (request.url.path == "/missing") response.status_code(SC_NOT_FOUND);
+        else
+        {
+            response.status_code(SC_OK);
+            if (request.method != HEAD) response.body = "Hello";
+        }
+        return response;
+    }
+    virtual Response parser_error_page(const ParserError &)override
+    {
+        throw std::runtime_error("Unexpected parser_error_page");
+    }
+};
+
+BOOST_AUTO_TEST_CASE(closed_loop)
+{
+    TestThread server_thread;
+    LoadServer server;
+    // Otherwise each pipelined response waits for the previous one to be acknowledged
+    ListenerOptions listener;
+    listener.socket_options.no_delay = true;
+    server.add_tcp_listener("127.0.0.1", BASE_PORT, listener);
+    server.add_tls_listener("127.0.0.1", BASE_PORT + 1, load_pfx_cert("localhost.pfx", "password"), listener);
+    server_thread = TestThread(std::bind(&LoadServer::run, &server));
+
+    LoadOptions options;
+    options.host = "localhost";
+    options.port = BASE_PORT;
+    options.connections = 4;
+    options.pipeline = 8;
+    options.duration = std::chrono::milliseconds(300);
+    options.warmup = std::chrono::milliseconds(50);
+    Request get, head, missing;
+    get.method = GET;
+    get.raw_url = "/";
+    head.method = HEAD;
+    head.raw_url = "/";
+    missing.method = GET;
+    missing.raw_url = "/missing";
+    options.requests = { get, head, missing };
+
+    auto result = LoadGenerator(options).run();
+    BOOST_CHECK(result.completed > 100);
+    BOOST_CHECK_EQUAL(0U, result.errors);
+    // Every third request is a 404
+    BOOST_CHECK(result.status_errors > result.completed / 4);
+    BOOST_CHECK(result.status_errors < result.completed / 2);
+    BOOST_CHECK_EQUAL(result.completed, result.latency.count());
+    BOOST_CHECK(result.latency.percentile(50) > 0);
+    BOOST_CHECK(result.latency.percentile(50) <= result.latency.percentile(99.99));
+    BOOST_CHECK(result.elapsed >= 0.29 && result.elapsed < 2);
+    BOOST_CHECK(result.throughput() > 0);
+    BOOST_CHECK(result.bytes_received > 0);
+    // Warmup and incomplete requests are not counted
+    BOOST_CHECK(server.requests >= result.completed);
+
+    // TLS
+    options.port = BASE_PORT + 1;
+    options.tls = true;
+    options.requests.clear();
+    options.duration = std::chrono::milliseconds(200);
+    result = LoadGenerator(options).run();
+    BOOST_CHECK(result.completed > 10);
+    BOOST_CHECK_EQUAL(0U, result.errors);
+    BOOST_CHECK_EQUAL(0U, result.status_errors);
+
+    server.exit();
+    server_thread.join();
+}
+
+BOOST_AUTO_TEST_CASE(open_loop)
+{
+    TestThread server_thread;
+    LoadServer server;
+    ListenerOptions listener;
+    listener.socket_options.no_delay = true;
+    server.add_tcp_listener("127.0.0.1", BASE_PORT + 2, listener);
+    server_thread = TestThread(std::bind(&LoadServer::run, &server));
+
+    LoadOptions options;
+    options.host = "localhost";
+    options.port = BASE_PORT + 2;
+    options.connections = 2;
+    options.pipeline = 4;
+    options.rate = 1000;
+    options.duration = std::chrono::milliseconds(500);
+
+    LoadGenerator generator(options);
+    auto result = generator.run();
+    // About rate * duration requests are sent, regardless of the server speed
+    BOOST_CHECK(result.completed + result.incomplete >= 450);
+    BOOST_CHECK(result.completed + result.incomplete <= 510);
+    BOOST_CHECK_EQUAL(0U, result.errors);
+    BOOST_CHECK_CLOSE(1000.0, result.throughput(), 25);
+
+    // stop ends a run early
+    options.duration = std::chrono::seconds(30);
+    LoadGenerator long_run(options);
+    std::thread stopper([&long_run]()
+    {
+        std::this_thread::sleep_for(std::chrono::milliseconds(100));
+        long_run.stop();
+    });
+    auto start = std::chrono::steady_clock::now();
+    result = long_run.run();
+    stopper.join();
+    BOOST_CHECK(std::chrono::steady_clock::now() - start < std::chrono::seconds(5));
+    BOOST_CHECK(result.completed > 0);
+
+    server.exit();
+    server_thread.join();
+}
+
+BOOST_AUTO_TEST_CASE(connect_failure)
+{
+    LoadOptions options;
+    options.host = "localhost";
+    options.port = BASE_PORT + 3;
+    BOOST_CHECK_THROW(LoadGenerator(options).run(), NetworkError);
+    options.connections = 0;
+    BOOST_CHECK_THROW(LoadGenerator generator(options), std::invalid_argument);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,242 @@
+#include <boost/test/unit_test.hpp>
+#include "core/Hpack.hpp"
+
+using namespace http;
+using namespace http::http2;
+
+namespace http
+{
+    namespace http2
+    {
+        bool operator == (const HeaderField &a, const HeaderField &b)
+        {
+            return a.name == b.name && a.value == b.value;
+        }
+        bool operator != (const HeaderField &a, const HeaderField &b)
+        {
+            return !(a == b);
+        }
+        std::ostream& operator << (std::ostream &os, const HeaderField &field)
+        {
+            return os << field.name << ": " << field.value;
+        }
+    }
+}
+
+BOOST_AUTO_TEST_SUITE(TestCoreHpack)
+
+std::string hex(const std::string &str)
+{
+    std::string out;
+    for (size_t i = 0; i < str.size();)
+    {
+        if (str[i] == ' ') { ++i; continue; }
+        out.push_back((char)std::stoi(str.substr(i, 2), nullptr, 16));
+        i += 2;
+    }
+    return out;
+}
+HeaderList decode(HpackDecoder &decoder, const std::string &block)
+{
+    HeaderList headers;
+    auto p = (const uint8_t*)block.data();
+    BOOST_CHECK(decoder.decode(p, p + block.size(), &headers));
+    return headers;
+}
+void check_headers(const HeaderList &expected, const HeaderList &actual)
+{
+    BOOST_CHECK_EQUAL_COLLECTIONS(expected.begin(), expected.end(), actual.begin(), actual.end());
+}
+
+BOOST_AUTO_TEST_CASE(integers)
+{
+    // RFC7541 C.1
+    std::string out;
+    hpack_write_int(&out, 0, 5, 10);
+    BOOST_CHECK_EQUAL(hex("0a"), out);
+    out.clear();
+    hpack_write_int(&out, 0, 5, 1337);
+    BOOST_CHECK_EQUAL(hex("1f9a0a"), out);
+    out.clear();
+    hpack_write_int(&out, 0, 8, 42);
+    BOOST_CHECK_EQUAL(hex("2a"), out);
+
+    uint64_t value;
+    auto in = hex("1f9a0aff");
+    auto p = (const uint8_t*)in.data();
+    BOOST_CHECK(hpack_read_int(p, p + in.size(), 5, &value) == p + 3);
+    BOOST_CHECK_EQUAL(1337U, value);
+    BOOST_CHECK_THROW(hpack_read_int(p, p + 2, 5, &value), Http2Error);
+    in = hex("1f ffffffffffffffffffff 01");
+    p = (const uint8_t*)in.data();
+    BOOST_CHECK_THROW(hpack_read_int(p, p + in.size(), 5, &value), Http2Error);
+}
+
+BOOST_AUTO_TEST_CASE(huffman)
+{
+    std::string out;
+    huffman_encode("www.example.com", &out);
+    BOOST_CHECK_EQUAL(hex("f1e3 c2e5 f23a 6ba0 ab90 f4ff"), out);
+    BOOST_CHECK_EQUAL(out.size(), huffman_encoded_len("www.example.com"));
+
+    std::string decoded;
+    auto p = (const uint8_t*)out.data();
+    huffman_decode(p, p + out.size(), &decoded);
+    BOOST_CHECK_EQUAL("www.example.com", decoded);
+
+    std::string binary("\x00\x01\xff\x80 test\n", 9);
+    out.clear();
+    decoded.clear();
+    huffman_encode(binary, &out);
+    p = (const uint8_t*)out.data();
+    huffman_decode(p, p + out.size(), &decoded);
+    BOOST_CHECK(binary == decoded);
+
+    // Padding must be the most significant bits of EOS, and less than 8 bits
+    auto bad = hex("f1e3 c2e5 f23a 6ba0 ab90 f4fe");
+    p = (const uint8_t*)bad.data();
+    BOOST_CHECK_THROW(huffman_decode(p, p + bad.size(), &decoded), Http2Error);
+    bad = hex("f1e3 c2e5 f23a 6ba0 ab90 f4ff ff");
+    p = (const uint8_t*)bad.data();
+    BOOST_CHECK_THROW(huffman_decode(p, p + bad.size(), &decoded), Http2Error);
+}
+
+BOOST_AUTO_TEST_CASE(decode_requests)
+{
+    // RFC7541 C.3, without Huffman coding
+    HpackDecoder decoder;
+    check_headers(
+        { { ":method", "GET" }, { ":scheme", "http" }, { ":path", "/" }, { ":authority", "www.example.com" } },
+        decode(decoder, hex("8286 8441 0f77 7777 2e65 7861 6d70 6c65 2e63 6f6d")));
+    check_headers(
+        { { ":method", "GET" }, { ":scheme", "http" }, { ":path", "/" }, { ":authority", "www.example.com" },
+          { "cache-control", "no-cache" } },
+        decode(decoder, hex("8286 84be 5808 6e6f 2d63 6163 6865")));
+    check_headers(
+        { { ":method", "GET" }, { ":scheme", "https" }, { ":path", "/index.html" },
+          { ":authority", "www.example.com" }, { "custom-key", "custom-value" } },
+        decode(decoder, hex("8287 85bf 400a 6375 7374 6f6d 2d6b 6579 0c63 7573 746f 6d2d 7661 6c75 65")));
+
+    // RFC7541 C.4, with Huffman coding
+    HpackDecoder huffman_decoder;
+    check_headers(
+        { { ":method", "GET" }, { ":scheme", "http" }, { ":path", "/" }, { ":authority", "www.example.com" } },
+        decode(huffman_decoder, hex("8286 8441 8cf1 e3c2 e5f2 3a6b a0ab 90f4 ff")));
+    check_headers(
+        { { ":method", "GET" }, { ":scheme", "http" }, { ":path", "/" }, { ":authority", "www.example.com" },
+          { "cache-control", "no-cache" } },
+        decode(huffman_decoder, hex("8286 84be 5886 a8eb 1064 9cbf")));
+    check_headers(
+        { { ":method", "GET" }, { ":scheme", "https" }, { ":path", "/index.html" },
+          { ":authority", "www.example.com" }, { "custom-key", "custom-value" } },
+        decode(huffman_decoder, hex("8287 85bf 4088 25a8 49e9 5ba9 7d7f 8925 a849 e95b b8e8 b4bf")));
+}
+
+BOOST_AUTO_TEST_CASE(decode_errors)
+{
+    HeaderList headers;
+    auto check_error = [&headers](const std::string &block)
+    {
+        HpackDecoder decoder;
+        auto p = (const uint8_t*)block.data();
+        BOOST_CHECK_THROW(decoder.decode(p, p + block.size(), &headers), Http2Error);
+    };
+    check_error(hex("80")); // Index 0
+    check_error(hex("be")); // Empty dynamic table
+    check_error(hex("410f 7777")); // Truncated string
+    check_error(hex("3fe2 1f")); // Table size update larger than the setting
+    check_error(hex("82 20")); // Table size update after a field
+
+    // Too large lists are still decoded
+    HpackDecoder decoder(4096, 64);
+    auto block = hex("8286 8441 0f77 7777 2e65 7861 6d70 6c65 2e63 6f6d");
+    auto p = (const uint8_t*)block.data();
+    headers.clear();
+    BOOST_CHECK(!decoder.decode(p, p + block.size(), &headers));
+    block = hex("be");
+    p = (const uint8_t*)block.data();
+    headers.clear();
+    BOOST_CHECK(decoder.decode(p, p + block.size(), &headers));
+    BOOST_CHECK_EQUAL(HeaderField({ ":authority", "www.example.com" }), headers.at(0));
+}
+
+BOOST_AUTO_TEST_CASE(table)
+{
+    HpackTable table(100);
+    BOOST_CHECK_EQUAL(":authority", table.get(1).name);
+    BOOST_CHECK_EQUAL("www-authenticate", table.get(61).name);
+    BOOST_CHECK_THROW(table.get(62), Http2Error);
+
+    table.add("name", "value"); // 41 bytes
+    table.add("name2", "value2"); // 43 bytes
+    BOOST_CHECK_EQUAL(84U, table.size());
+    BOOST_CHECK_EQUAL("name2", table.get(62).name);
+    BOOST_CHECK_EQUAL("name", table.get(63).name);
+
+    bool value_match;
+    BOOST_CHECK_EQUAL(63U, table.find("name", "value", &value_match));
+    BOOST_CHECK(value_match);
+    BOOST_CHECK_EQUAL(62U, table.find("name2", "other", &value_match));
+    BOOST_CHECK(!value_match);
+    BOOST_CHECK_EQUAL(2U, table.find(":method", "GET", &value_match));
+    BOOST_CHECK(value_match);
+    BOOST_CHECK_EQUAL(0U, table.find("unknown", "", &value_match));
+
+    // Evicts the oldest
+    table.add("name3", "value3");
+    BOOST_CHECK_EQUAL(86U, table.size());
+    BOOST_CHECK_EQUAL("name3", table.get(62).name);
+    BOOST_CHECK_EQUAL("name2", table.get(63).name);
+    BOOST_CHECK_THROW(table.get(64), Http2Error);
+
+    // Entries larger than the table empty it
+    table.add("large", std::string(100, 'x'));
+    BOOST_CHECK_EQUAL(0U, table.size());
+}
+
+BOOST_AUTO_TEST_CASE(round_trip)
+{
+    HpackEncoder encoder;
+    HpackDecoder decoder;
+    HeaderList headers =
+    {
+        { ":status", "200" },
+        { "content-type", "text/html; charset=utf-8" },
+        { "server", "cpphttp" },
+        { "set-cookie", "a=b" },
+        { "x-binary", std::string("\x01\xff\x80 test", 8) }
+    };
+    size_t first_size = 0;
+    for (int i = 0; i < 3; ++i)
+    {
+        std::string block;
+        encoder.encode(headers, &block);
+        if (i == 0) first_size = block.size();
+        else BOOST_CHECK_LT(block.size(), first_size);
+        check_headers(headers, decode(decoder, block));
+    }
+
+    // Table size changes are signalled, including the smallest
+    encoder.set_max_table_size(0);
+    encoder.set_max_table_size(100);
+    std::string block;
+    encoder.encode({ { "a", "b" } }, &block);
+    BOOST_CHECK_EQUAL(hex("20 3f45"), block.substr(0, 3));
+    check_headers({ { "a", "b" } }, decode(decoder, block));
+}
+
+BOOST_AUTO_TEST_CASE(frame_header)
+{
+    FrameHeader header = { 0x123456, HEADERS, FLAG_END_HEADERS | FLAG_END_STREAM, 0x7FFFFFFF };
+    std::string out;
+    header.write(&out);
+    BOOST_CHECK_EQUAL(hex("123456 01 05 7fffffff"), out);
+    out[5] = (char)0xFF; // Reserved bit is ignored
+    auto header2 = FrameHeader::read((const uint8_t*)out.data());
+    BOOST_CHECK_EQUAL(0x123456U, header2.length);
+    BOOST_CHECK_EQUAL(HEADERS, header2.type);
+    BOOST_CHECK_EQUAL(FLAG_END_HEADERS | FLAG_END_STREAM, header2.flags);
+    BOOST_CHECK_EQUAL(0x7FFFFFFFU, header2.stream_id);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
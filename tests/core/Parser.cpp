@@ -207,6 +207,54 @@ BOOST_AUTO_TEST_CASE(test_request_parser_errors)
     BOOST_CHECK_THROW(read_str("POST /x HTTP/1.1\r\nTransfer-Encoding: gzip\r\n\r\n"), ParserError);
 }
 
+int parser_error_status(RequestParser &parser, const std::string &str)
+{
+    try
+    {
+        parser.reset();
+        parser.read(str.c_str(), str.c_str() + str.size());
+    }
+    catch (const ParserError &err)
+    {
+        return err.status_code();
+    }
+    return 0;
+}
+BOOST_AUTO_TEST_CASE(test_request_parser_limits)
+{
+    RequestParser parser;
+    ParserLimits limits;
+    limits.max_header_count = 2;
+    limits.max_headers_size = 40;
+    limits.max_body_size = 10;
+    parser.set_limits(limits);
+
+    BOOST_CHECK_EQUAL(0, parser_error_status(parser, "GET / HTTP/1.1\r\nA: 1\r\nB: 2\r\n\r\n"));
+    BOOST_CHECK(parser.is_completed());
+    BOOST_CHECK_EQUAL(431, parser_error_status(parser, "GET / HTTP/1.1\r\nA: 1\r\nB: 2\r\nC: 3\r\n\r\n"));
+    // Size includes each CRLF
+    BOOST_CHECK_EQUAL(0, parser_error_status(parser, "GET / HTTP/1.1\r\nA: " + std::string(35, 'x') + "\r\n\r\n"));
+    BOOST_CHECK_EQUAL(431, parser_error_status(parser, "GET / HTTP/1.1\r\nA: " + std::string(36, 'x') + "\r\n\r\n"));
+
+    // Rejected before the body is received
+    BOOST_CHECK_EQUAL(0, parser_error_status(parser, "POST / HTTP/1.1\r\nContent-Length: 10\r\n\r\n"));
+    BOOST_CHECK_EQUAL(RequestParser::BODY, parser.state());
+    BOOST_CHECK_EQUAL(413, parser_error_status(parser, "POST / HTTP/1.1\r\nContent-Length: 11\r\n\r\n"));
+    BOOST_CHECK_EQUAL(0, parser_error_status(parser,
+        "POST / HTTP/1.1\r\nTransfer-Encoding: chunked\r\n\r\n5\r\n01234\r\n5\r\n56789\r\n0\r\n\r\n"));
+    BOOST_CHECK(parser.is_completed());
+    BOOST_CHECK_EQUAL(413, parser_error_status(parser,
+        "POST / HTTP/1.1\r\nTransfer-Encoding: chunked\r\n\r\n5\r\n01234\r\n6\r\n"));
+    BOOST_CHECK_EQUAL(413, parser_error_status(parser,
+        "POST / HTTP/1.1\r\nTransfer-Encoding: chunked\r\n\r\n7fffffff\r\n"));
+
+    // Default limits
+    parser.set_limits(ParserLimits());
+    std::string many = "GET / HTTP/1.1\r\n";
+    for (size_t i = 0; i <= BaseParser::MAX_HEADER_COUNT; ++i) many += "X" + std::to_string(i) + ": y\r\n";
+    BOOST_CHECK_EQUAL(431, parser_error_status(parser, many + "\r\n"));
+}
+
 
 BOOST_AUTO_TEST_CASE(test_response_parser) //only considers differences
 {
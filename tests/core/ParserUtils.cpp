@@ -145,6 +145,31 @@ BOOST_AUTO_TEST_CASE(test_skip_ows)
     BOOST_CHECK_EQUAL("value", f("   \tvalue"));
 }
 
+BOOST_AUTO_TEST_CASE(test_read_qvalue)
+{
+    float q = -1;
+    auto f = [&q](std::string str) { return read_str(str, [&q](const char *begin, const char *end)
+    {
+        return read_qvalue(begin, end, &q);
+    }); };
+    BOOST_CHECK_EQUAL("", f("0"));
+    BOOST_CHECK_EQUAL(0, q);
+    BOOST_CHECK_EQUAL("", f("0."));
+    BOOST_CHECK_EQUAL(0, q);
+    BOOST_CHECK_EQUAL("", f("0.5"));
+    BOOST_CHECK_CLOSE(0.5, q, 0.00001);
+    BOOST_CHECK_EQUAL(", gzip", f("0.123, gzip"));
+    BOOST_CHECK_CLOSE(0.123, q, 0.00001);
+    BOOST_CHECK_EQUAL("4", f("0.1234"));
+    BOOST_CHECK_EQUAL("", f("1.000"));
+    BOOST_CHECK_EQUAL(1, q);
+    BOOST_CHECK_EQUAL("5", f("1.5"));
+
+    BOOST_CHECK_THROW(f(""), ParserError);
+    BOOST_CHECK_THROW(f("2"), ParserError);
+    BOOST_CHECK_THROW(f(".5"), ParserError);
+}
+
 BOOST_AUTO_TEST_CASE(test_read_header_name)
 {
     auto f = [](std::string str) { return read_str(str, read_header_name); };
@@ -0,0 +1,90 @@
+#include <boost/test/unit_test.hpp>
+#include "core/WebSocket.hpp"
+#include <vector>
+
+using namespace http;
+using namespace http::websocket;
+
+BOOST_AUTO_TEST_SUITE(TestCoreWebSocket)
+
+BOOST_AUTO_TEST_CASE(accept_key)
+{
+    // RFC6455 1.3
+    BOOST_CHECK_EQUAL("s3pPLMBiTxaQ9kYGzzhZRbK+xOo=", websocket::accept_key("dGhlIHNhbXBsZSBub25jZQ=="));
+}
+
+BOOST_AUTO_TEST_CASE(frame_header)
+{
+    for (uint64_t length : { 0ULL, 125ULL, 126ULL, 65535ULL, 65536ULL, 5000000000ULL })
+    {
+        FrameHeader header = { true, false, 0, OP_BINARY, true, { 1, 2, 3, 4 }, length };
+        std::string encoded;
+        header.write(&encoded);
+        BOOST_CHECK_EQUAL(length < 126 ? 6U : length <= 65535 ? 8U : 14U, encoded.size());
+
+        FrameHeader read;
+        auto p = (const uint8_t*)encoded.data();
+        // Incomplete headers need more data
+        for (size_t i = 0; i < encoded.size(); ++i) BOOST_CHECK_EQUAL(0U, FrameHeader::read(p, i, &read));
+        BOOST_CHECK_EQUAL(encoded.size(), FrameHeader::read(p, encoded.size(), &read));
+        BOOST_CHECK(read.fin);
+        BOOST_CHECK(!read.rsv1);
+        BOOST_CHECK_EQUAL(OP_BINARY, read.opcode);
+        BOOST_CHECK(read.masked);
+        BOOST_CHECK_EQUAL(4, read.mask[3]);
+        BOOST_CHECK_EQUAL(length, read.length);
+    }
+    // RFC6455 5.7, unmasked "Hello" and the first fragment of a compressed message
+    std::string frame;
+    write_frame(&frame, OP_TEXT, "Hello", 5);
+    BOOST_CHECK_EQUAL(std::string("\x81\x05Hello"), frame);
+    frame.clear();
+    write_frame(&frame, OP_TEXT, "Hel", 3, false, true);
+    BOOST_CHECK_EQUAL(std::string("\x41\x03Hel"), frame);
+
+    // Lengths must use the shortest encoding
+    FrameHeader read;
+    const uint8_t overlong[] = { 0x82, 126, 0, 5 };
+    BOOST_CHECK_THROW(FrameHeader::read(overlong, sizeof(overlong), &read), WebSocketError);
+}
+
+BOOST_AUTO_TEST_CASE(mask)
+{
+    // RFC6455 5.7, masked "Hello"
+    const uint8_t key[4] = { 0x37, 0xfa, 0x21, 0x3d };
+    uint8_t hello[] = { 0x7f, 0x9f, 0x4d, 0x51, 0x58 };
+    apply_mask(hello, sizeof(hello), key);
+    BOOST_CHECK_EQUAL("Hello", std::string((const char*)hello, sizeof(hello)));
+
+    // All lengths and alignments used by the SIMD, word and byte paths
+    for (size_t len = 0; len < 200; len += 7)
+    {
+        for (size_t offset = 0; offset < 4; ++offset)
+        {
+            std::vector<uint8_t> data(len + 1), expected(len + 1);
+            for (size_t i = 0; i < data.size(); ++i) data[i] = (uint8_t)(i * 31);
+            for (size_t i = 0; i < len; ++i) expected[i + 1] = data[i + 1] ^ key[(offset + i) % 4];
+            expected[0] = data[0];
+            // Start at data + 1 so the data is unaligned
+            apply_mask(data.data() + 1, len, key, offset);
+            BOOST_CHECK(data == expected);
+        }
+    }
+}
+
+BOOST_AUTO_TEST_CASE(utf8)
+{
+    BOOST_CHECK(valid_utf8("", 0));
+    BOOST_CHECK(valid_utf8("Hello, world. Longer than a word", 32));
+    BOOST_CHECK(valid_utf8("\xC2\xA3\xE2\x82\xAC\xF0\x9F\x98\x80", 9));
+    BOOST_CHECK(valid_utf8("\xF4\x8F\xBF\xBF", 4)); // U+10FFFF
+    BOOST_CHECK(!valid_utf8("\x80", 1));
+    BOOST_CHECK(!valid_utf8("abcdefgh\xC2", 9)); // Truncated
+    BOOST_CHECK(!valid_utf8("\xC0\xAF", 2)); // Overlong
+    BOOST_CHECK(!valid_utf8("\xE0\x80\xAF", 3));
+    BOOST_CHECK(!valid_utf8("\xED\xA0\x80", 3)); // Surrogate
+    BOOST_CHECK(!valid_utf8("\xF4\x90\x80\x80", 4)); // Past U+10FFFF
+    BOOST_CHECK(!valid_utf8("\xE2\x28\xA1", 3));
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,63 @@
+#include <boost/test/unit_test.hpp>
+#include "headers/AcceptEncoding.hpp"
+using namespace http;
+
+BOOST_AUTO_TEST_SUITE(TestHeadersAcceptEncoding)
+BOOST_AUTO_TEST_CASE(parse)
+{
+    AcceptEncoding accept;
+    BOOST_CHECK(accept.accepts().empty());
+
+    BOOST_REQUIRE_NO_THROW(accept = AcceptEncoding("gzip"));
+    BOOST_REQUIRE_EQUAL(1, accept.accepts().size());
+    BOOST_CHECK_EQUAL("gzip", accept.accepts()[0].coding);
+    BOOST_CHECK_EQUAL(1, accept.accepts()[0].quality);
+
+    BOOST_REQUIRE_NO_THROW(accept = AcceptEncoding("GZip;q=0.5, br ;  Q=1.0,,*;q=0"));
+    BOOST_REQUIRE_EQUAL(3, accept.accepts().size());
+    BOOST_CHECK_EQUAL("gzip", accept.accepts()[0].coding);
+    BOOST_CHECK_CLOSE(0.5, accept.accepts()[0].quality, 0.00001);
+    BOOST_CHECK_EQUAL("br", accept.accepts()[1].coding);
+    BOOST_CHECK_EQUAL(1, accept.accepts()[1].quality);
+    BOOST_CHECK_EQUAL("*", accept.accepts()[2].coding);
+    BOOST_CHECK_EQUAL(0, accept.accepts()[2].quality);
+
+    BOOST_REQUIRE_NO_THROW(accept = AcceptEncoding(""));
+    BOOST_CHECK(accept.accepts().empty());
+
+    BOOST_CHECK_THROW(AcceptEncoding("gzip;"), ParserError);
+    BOOST_CHECK_THROW(AcceptEncoding("gzip;q="), ParserError);
+    BOOST_CHECK_THROW(AcceptEncoding("gzip;q=2"), ParserError);
+    BOOST_CHECK_THROW(AcceptEncoding("gzip;level=1"), ParserError);
+    BOOST_CHECK_THROW(AcceptEncoding("gzip br"), ParserError);
+    BOOST_CHECK_THROW(AcceptEncoding("[gzip]"), ParserError);
+}
+BOOST_AUTO_TEST_CASE(quality)
+{
+    AcceptEncoding accept("gzip;q=0.5, deflate;q=0");
+    BOOST_CHECK_CLOSE(0.5, accept.quality("gzip"), 0.00001);
+    BOOST_CHECK_CLOSE(0.5, accept.quality("GZIP"), 0.00001);
+    BOOST_CHECK(!accept.accepts("deflate"));
+    BOOST_CHECK(!accept.accepts("br"));
+    // identity is always acceptable unless excluded
+    BOOST_CHECK(accept.accepts("identity"));
+    BOOST_CHECK(AcceptEncoding("").accepts("identity"));
+    BOOST_CHECK(!AcceptEncoding("").accepts("gzip"));
+    BOOST_CHECK(!AcceptEncoding("identity;q=0").accepts("identity"));
+    BOOST_CHECK(!AcceptEncoding("*;q=0").accepts("identity"));
+    BOOST_CHECK(AcceptEncoding("*;q=0, identity").accepts("identity"));
+    BOOST_CHECK(AcceptEncoding("*").accepts("br"));
+    BOOST_CHECK(!AcceptEncoding("*, br;q=0").accepts("br"));
+}
+BOOST_AUTO_TEST_CASE(preferred)
+{
+    std::vector<std::string> codings = { "br", "gzip", "identity" };
+    BOOST_CHECK_EQUAL("gzip", AcceptEncoding("gzip").preferred(codings));
+    BOOST_CHECK_EQUAL("br", AcceptEncoding("gzip, deflate, br").preferred(codings));
+    BOOST_CHECK_EQUAL("gzip", AcceptEncoding("gzip, br;q=0.9").preferred(codings));
+    BOOST_CHECK_EQUAL("br", AcceptEncoding("*").preferred(codings));
+    BOOST_CHECK_EQUAL("identity", AcceptEncoding("").preferred(codings));
+    BOOST_CHECK_EQUAL("identity", AcceptEncoding("compress").preferred(codings));
+    BOOST_CHECK_THROW(AcceptEncoding("compress, identity;q=0").preferred(codings), NotAcceptable);
+}
+BOOST_AUTO_TEST_SUITE_END()
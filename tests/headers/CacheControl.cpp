@@ -0,0 +1,43 @@
+#include <boost/test/unit_test.hpp>
+#include "headers/CacheControl.hpp"
+#include <limits>
+using namespace http;
+
+BOOST_AUTO_TEST_SUITE(TestHeadersCacheControl)
+BOOST_AUTO_TEST_CASE(parse)
+{
+    CacheControl cc;
+    BOOST_CHECK(!cc.no_store && !cc.no_cache && !cc.is_private && !cc.is_public);
+    BOOST_CHECK_EQUAL(-1, cc.max_age);
+    BOOST_CHECK_EQUAL(-1, cc.shared_max_age());
+
+    BOOST_REQUIRE_NO_THROW(cc = CacheControl("max-age=60"));
+    BOOST_CHECK_EQUAL(60, cc.max_age);
+    BOOST_CHECK_EQUAL(-1, cc.s_maxage);
+    BOOST_CHECK_EQUAL(60, cc.shared_max_age());
+
+    BOOST_REQUIRE_NO_THROW(cc = CacheControl("public, max-age=60, S-MAXAGE=\"120\""));
+    BOOST_CHECK(cc.is_public);
+    BOOST_CHECK_EQUAL(60, cc.max_age);
+    BOOST_CHECK_EQUAL(120, cc.s_maxage);
+    BOOST_CHECK_EQUAL(120, cc.shared_max_age());
+
+    BOOST_REQUIRE_NO_THROW(cc = CacheControl("no-store,no-cache,,private=\"Set-Cookie\",must-revalidate"));
+    BOOST_CHECK(cc.no_store);
+    BOOST_CHECK(cc.no_cache);
+    BOOST_CHECK(cc.is_private);
+    BOOST_CHECK(!cc.is_public);
+
+    // Overflow is capped
+    BOOST_REQUIRE_NO_THROW(cc = CacheControl("max-age=99999999999999"));
+    BOOST_CHECK_EQUAL(std::numeric_limits<int>::max(), cc.max_age);
+}
+BOOST_AUTO_TEST_CASE(invalid)
+{
+    BOOST_CHECK_THROW(CacheControl("max-age=abc"), ParserError);
+    BOOST_CHECK_THROW(CacheControl("max-age="), ParserError);
+    BOOST_CHECK_THROW(CacheControl("max-age=-1"), ParserError);
+    BOOST_CHECK_THROW(CacheControl("public max-age=5"), ParserError);
+    BOOST_CHECK_THROW(CacheControl("=5"), ParserError);
+}
+BOOST_AUTO_TEST_SUITE_END()
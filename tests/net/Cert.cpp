@@ -1,5 +1,6 @@
 #include <boost/test/unit_test.hpp>
 #include "net/Cert.hpp"
+#include "net/Os.hpp"
 
 using namespace http;
 
@@ -10,4 +11,14 @@ BOOST_AUTO_TEST_CASE(file_cert)
     BOOST_CHECK_THROW(load_pfx_cert("localhost.pfx", "wrong"), std::runtime_error);
 }
 
+#ifdef HTTP_USE_OPENSSL
+BOOST_AUTO_TEST_CASE(pem_cert)
+{
+    BOOST_CHECK(load_pem_priv_cert("localhost.crt", "localhost.key"));
+    BOOST_CHECK_THROW(load_pem_priv_cert("localhost.crt", "wrong-host.key"), std::runtime_error);
+    BOOST_CHECK_THROW(load_pem_priv_cert("localhost.key", "localhost.key"), std::runtime_error);
+    BOOST_CHECK_THROW(load_pem_priv_cert("missing.crt", "localhost.key"), std::runtime_error);
+}
+#endif
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,86 @@
+#include <boost/test/unit_test.hpp>
+#include "net/CertWatcher.hpp"
+#include "net/Os.hpp"
+#include <condition_variable>
+#include <cstdio>
+#include <fstream>
+#include <mutex>
+
+using namespace http;
+
+BOOST_AUTO_TEST_SUITE(TestCertWatcher)
+
+static void copy_file(const char *from, const char *to)
+{
+    std::ifstream is(from, std::ios::binary);
+    std::ofstream os(to, std::ios::binary);
+    os << is.rdbuf();
+}
+
+#ifdef HTTP_USE_OPENSSL
+BOOST_AUTO_TEST_CASE(pem_check)
+{
+    const char *CRT = "cert-watcher-test.crt", *KEY = "cert-watcher-test.key";
+    copy_file("localhost.crt", CRT);
+    copy_file("localhost.key", KEY);
+    int loaded = 0, errors = 0;
+    {
+        CertWatcher watcher(pem_cert_source(CRT, KEY),
+            [&loaded](const PrivateCert &cert) { BOOST_CHECK(cert); ++loaded; },
+            [&errors](const std::exception &) { ++errors; },
+            std::chrono::hours(1));
+        BOOST_CHECK(!watcher.check());
+
+        copy_file("wrong-host.crt", CRT);
+        copy_file("wrong-host.key", KEY);
+        BOOST_CHECK(watcher.check());
+        BOOST_CHECK_EQUAL(1, loaded);
+        BOOST_CHECK(!watcher.check());
+
+        // A failed load is reported once, and the files are loaded again on the next change
+        {
+            std::ofstream os(CRT, std::ios::binary);
+            os << "invalid";
+        }
+        BOOST_CHECK(!watcher.check());
+        BOOST_CHECK_EQUAL(1, errors);
+        BOOST_CHECK(!watcher.check());
+        BOOST_CHECK_EQUAL(1, errors);
+
+        copy_file("localhost.key", KEY);
+        copy_file("localhost.crt", CRT);
+        BOOST_CHECK(watcher.check());
+        BOOST_CHECK_EQUAL(2, loaded);
+        BOOST_CHECK_EQUAL(2U, watcher.reloads());
+    }
+    std::remove(CRT);
+    std::remove(KEY);
+}
+#endif
+
+BOOST_AUTO_TEST_CASE(pfx_background)
+{
+    const char *PFX = "cert-watcher-test.pfx";
+    copy_file("localhost.pfx", PFX);
+    {
+        std::mutex mutex;
+        std::condition_variable cv;
+        int loaded = 0;
+        CertWatcher watcher(pfx_cert_source(PFX, "password"),
+            [&](const PrivateCert &)
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                ++loaded;
+                cv.notify_all();
+            },
+            nullptr, std::chrono::milliseconds(10));
+
+        copy_file("wrong-host.pfx", PFX);
+        std::unique_lock<std::mutex> lock(mutex);
+        BOOST_CHECK(cv.wait_for(lock, std::chrono::seconds(5), [&loaded]() { return loaded > 0; }));
+        BOOST_CHECK_EQUAL(1, loaded);
+    }
+    std::remove(PFX);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,103 @@
+#include <boost/test/unit_test.hpp>
+#include "server/AccessLog.hpp"
+#include <cstring>
+#include <sstream>
+#include <thread>
+#include <vector>
+
+using namespace http;
+
+BOOST_AUTO_TEST_SUITE(TestAccessLog)
+
+AccessLogRecord make_record(const std::string &path)
+{
+    AccessLogRecord record;
+    record.time = std::chrono::system_clock::from_time_t(784111777);
+    record.duration_us = 250;
+    record.request_bytes = 96;
+    record.response_bytes = 1024;
+    record.status = 200;
+    record.version = { 1, 1 };
+    record.set_method("GET");
+    record.set_remote("127.0.0.1:51000");
+    record.set_path(path);
+    return record;
+}
+
+BOOST_AUTO_TEST_CASE(format)
+{
+    std::string out;
+    AccessLog::format(make_record("/index.html"), &out);
+    BOOST_CHECK_EQUAL(
+        "127.0.0.1:51000 - - [Sun, 06 Nov 1994 08:49:37 GMT] \"GET /index.html HTTP/1.1\" 200 1024 96 250\n",
+        out);
+
+    out.clear();
+    AccessLog::format(make_record("/a\"b\n"), &out);
+    BOOST_CHECK(out.find("\"GET /a\\x22b\\x0A HTTP/1.1\"") != std::string::npos);
+
+    // Long strings are truncated
+    auto record = make_record(std::string(1000, 'x'));
+    BOOST_CHECK_EQUAL(sizeof(record.path) - 1, strlen(record.path));
+}
+
+BOOST_AUTO_TEST_CASE(write)
+{
+    std::stringstream ss;
+    {
+        AccessLog log(ss);
+        log.log(make_record("/a"));
+        log.log(make_record("/b"));
+        log.flush();
+        BOOST_CHECK_EQUAL(2U, log.written());
+        auto str = ss.str();
+        BOOST_CHECK(str.find("\"GET /a HTTP/1.1\"") < str.find("\"GET /b HTTP/1.1\""));
+
+        // Destroying writes queued records
+        log.log(make_record("/c"));
+    }
+    BOOST_CHECK(ss.str().find("\"GET /c HTTP/1.1\"") != std::string::npos);
+}
+
+BOOST_AUTO_TEST_CASE(dropped)
+{
+    std::string out;
+    AccessLog log([&out](const std::string &data) { out += data; }, 2, std::chrono::hours(1));
+    // Make sure the background thread has done its first pass, so won't run again until flush
+    log.flush();
+    for (int i = 0; i < 5; ++i) log.log(make_record("/" + std::to_string(i)));
+    BOOST_CHECK_EQUAL(3U, log.dropped());
+    log.flush();
+    BOOST_CHECK_EQUAL(2U, log.written());
+    BOOST_CHECK(out.find("/0 ") != std::string::npos);
+    BOOST_CHECK(out.find("/1 ") != std::string::npos);
+
+    // Space is available again
+    log.log(make_record("/5"));
+    log.flush();
+    BOOST_CHECK_EQUAL(3U, log.written());
+    BOOST_CHECK_EQUAL(3U, log.dropped());
+}
+
+BOOST_AUTO_TEST_CASE(threads)
+{
+    size_t lines = 0;
+    AccessLog log([&lines](const std::string &data)
+    {
+        for (auto c : data) if (c == '\n') ++lines;
+    });
+    std::vector<std::thread> threads;
+    for (int i = 0; i < 4; ++i)
+    {
+        threads.emplace_back([&log]()
+        {
+            for (int j = 0; j < 200; ++j) log.log(make_record("/"));
+        });
+    }
+    for (auto &thread : threads) thread.join();
+    log.flush();
+    BOOST_CHECK_EQUAL(800U, log.written() + log.dropped());
+    BOOST_CHECK_EQUAL(log.written(), lines);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
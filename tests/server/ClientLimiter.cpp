@@ -0,0 +1,81 @@
+#include <boost/test/unit_test.hpp>
+#include "server/ClientLimiter.hpp"
+
+using namespace http;
+
+BOOST_AUTO_TEST_SUITE(TestClientLimiter)
+
+BOOST_AUTO_TEST_CASE(connections)
+{
+    ClientLimitOptions opts;
+    opts.max_connections = 2;
+    ClientLimiter limiter(opts);
+
+    size_t a1, a2, a3, b1;
+    BOOST_CHECK(limiter.open_connection("10.0.0.1", &a1));
+    BOOST_CHECK(limiter.open_connection("10.0.0.1", &a2));
+    BOOST_CHECK(!limiter.open_connection("10.0.0.1", &a3));
+    BOOST_CHECK_EQUAL(a1, a2);
+    // Other clients are not affected
+    BOOST_CHECK(limiter.open_connection("10.0.0.2", &b1));
+
+    limiter.close_connection(a1);
+    BOOST_CHECK(limiter.open_connection("10.0.0.1", &a3));
+    BOOST_CHECK_EQUAL(1U, limiter.stats().rejected_connections);
+    BOOST_CHECK_EQUAL(0U, limiter.stats().rejected_requests);
+}
+
+BOOST_AUTO_TEST_CASE(rate)
+{
+    ClientLimitOptions opts;
+    opts.requests_per_second = 10;
+    opts.burst = 3;
+    ClientLimiter limiter(opts);
+    BOOST_CHECK_EQUAL(1U, limiter.retry_after());
+
+    size_t a, b;
+    limiter.open_connection("10.0.0.1", &a);
+    limiter.open_connection("10.0.0.2", &b);
+    auto now = std::chrono::steady_clock::now();
+    // The burst is allowed at once
+    BOOST_CHECK(limiter.allow_request(a, now));
+    BOOST_CHECK(limiter.allow_request(a, now));
+    BOOST_CHECK(limiter.allow_request(a, now));
+    BOOST_CHECK(!limiter.allow_request(a, now));
+    BOOST_CHECK(limiter.allow_request(b, now));
+    // Then one request every 100ms
+    BOOST_CHECK(!limiter.allow_request(a, now + std::chrono::milliseconds(50)));
+    BOOST_CHECK(limiter.allow_request(a, now + std::chrono::milliseconds(100)));
+    BOOST_CHECK(!limiter.allow_request(a, now + std::chrono::milliseconds(100)));
+    // Refills to the burst size
+    now += std::chrono::seconds(10);
+    BOOST_CHECK(limiter.allow_request(a, now));
+    BOOST_CHECK(limiter.allow_request(a, now));
+    BOOST_CHECK(limiter.allow_request(a, now));
+    BOOST_CHECK(!limiter.allow_request(a, now));
+    BOOST_CHECK_EQUAL(4U, limiter.stats().rejected_requests);
+}
+
+BOOST_AUTO_TEST_CASE(bounded)
+{
+    ClientLimitOptions opts;
+    opts.max_connections = 1;
+    opts.max_clients = 4;
+    ClientLimiter limiter(opts);
+
+    // Every client maps to the same set of 4 slots. Once all are in use, clients share a slot.
+    size_t slots[6];
+    for (int i = 0; i < 4; ++i)
+    {
+        BOOST_CHECK(limiter.open_connection("10.0.0." + std::to_string(i), &slots[i]));
+        BOOST_CHECK(slots[i] < ClientLimiter::SET_SIZE);
+    }
+    BOOST_CHECK(!limiter.open_connection("10.0.0.10", &slots[4]));
+
+    // Idle slots are reused
+    limiter.close_connection(slots[2]);
+    BOOST_CHECK(limiter.open_connection("10.0.0.11", &slots[5]));
+    BOOST_CHECK_EQUAL(slots[2], slots[5]);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
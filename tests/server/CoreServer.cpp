@@ -1,12 +1,23 @@
 #include <boost/test/unit_test.hpp>
 #include "client/Client.hpp"
 #include "client/SocketFactory.hpp"
+#include "server/AccessLog.hpp"
+#include "server/ClientLimiter.hpp"
 #include "server/CoreServer.hpp"
 #include "net/Cert.hpp"
 #include "net/Net.hpp"
+#include "net/TcpListenSocket.hpp"
 #include "net/TcpSocket.hpp"
+#include "Error.hpp"
 #include "Response.hpp"
 #include "../TestThread.hpp"
+#include <chrono>
+#include <condition_variable>
+#ifndef _WIN32
+#include <netinet/tcp.h>
+#endif
+#include <mutex>
+#include <sstream>
 #include <thread>
 
 using namespace http;
@@ -86,6 +97,40 @@ BOOST_AUTO_TEST_CASE(success)
     server_thread.join();
 }
 
+BOOST_AUTO_TEST_CASE(tls_cert_reload)
+{
+    TestThread server_thread;
+    Server server;
+    server.add_tls_listener("127.0.0.1", BASE_PORT + 17, load_pfx_cert("localhost.pfx", "password"));
+    BOOST_CHECK_THROW(server.set_tls_cert("127.0.0.1", BASE_PORT + 18, load_pfx_cert("localhost.pfx", "password")),
+        std::invalid_argument);
+    BOOST_CHECK_THROW(server.set_tls_cert("127.0.0.1", BASE_PORT + 17, PrivateCert()), std::invalid_argument);
+
+    server_thread = TestThread(std::bind(&Server::run, &server));
+
+    http::DefaultSocketFactory socket_factory;
+    Request req;
+    req.method = GET;
+    req.headers.add("Host", "localhost");
+    req.headers.add("Connection", "keep-alive");
+    req.raw_url = "/index.html";
+    ClientConnection conn(socket_factory.connect("localhost", BASE_PORT + 17, true));
+    BOOST_CHECK_EQUAL(200, conn.make_request(req).status.code);
+
+    // New handshakes use the new certificate, while the existing connection is unaffected
+    server.set_tls_cert("127.0.0.1", BASE_PORT + 17, load_pfx_cert("wrong-host.pfx", "password"));
+    BOOST_CHECK_THROW(socket_factory.connect("localhost", BASE_PORT + 17, true), CertificateVerificationError);
+    BOOST_CHECK_EQUAL(200, conn.make_request(req).status.code);
+    BOOST_CHECK(conn.is_connected());
+
+    server.set_tls_cert("127.0.0.1", BASE_PORT + 17, load_pem_priv_cert("localhost.crt", "localhost.key"));
+    ClientConnection conn2(socket_factory.connect("localhost", BASE_PORT + 17, true));
+    BOOST_CHECK_EQUAL(200, conn2.make_request(req).status.code);
+
+    server.exit();
+    server_thread.join();
+}
+
 BOOST_AUTO_TEST_CASE(keep_alive)
 {
     TestThread server_thread;
@@ -124,4 +169,763 @@ BOOST_AUTO_TEST_CASE(keep_alive)
     server.exit();
     server_thread.join();
 }
+
+BOOST_AUTO_TEST_CASE(connection_limit)
+{
+    TestThread server_thread;
+    Server server;
+    ListenerOptions opts;
+    opts.max_connections = 1;
+    server.add_tcp_listener("127.0.0.1", BASE_PORT + 4, opts);
+
+    server_thread = TestThread(std::bind(&Server::run, &server));
+
+    Request req;
+    req.method = GET;
+    req.headers.add("Host", "localhost");
+    req.headers.add("Connection", "keep-alive");
+    req.raw_url = "/index.html";
+
+    std::unique_ptr<ClientConnection> conn1(new ClientConnection(
+        std::unique_ptr<Socket>(new TcpSocket("localhost", BASE_PORT + 4))));
+    BOOST_CHECK_EQUAL(200, conn1->make_request(req).status.code);
+
+    // Second connection is left in the backlog while the first is open
+    ClientConnection conn2(std::unique_ptr<Socket>(new TcpSocket("localhost", BASE_PORT + 4)));
+    conn2.send_request(req);
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    auto stats = server.stats();
+    BOOST_CHECK_EQUAL(1U, stats.connections);
+    BOOST_CHECK_EQUAL(1U, stats.accept_pauses);
+    BOOST_CHECK(stats.accept_paused_time > std::chrono::steady_clock::duration::zero());
+
+    // Closing the first resumes accepting
+    conn1.reset();
+    BOOST_CHECK_EQUAL(200, conn2.recv_response().status.code);
+    stats = server.stats();
+    BOOST_CHECK_EQUAL(1U, stats.connections);
+
+    server.exit();
+    server_thread.join();
+}
+class BlockingServer : public Server
+{
+public:
+    /**Block requests for path, or every request if empty, until released.*/
+    explicit BlockingServer(const std::string &path = std::string()) : blocked_path(path) {}
+    void release()
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        released = true;
+        cv.notify_all();
+    }
+protected:
+    virtual http::Response handle_request(http::Request &req)override
+    {
+        if (blocked_path.empty() || req.url.path == blocked_path)
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            cv.wait(lock, [this]() { return released; });
+        }
+        return Server::handle_request(req);
+    }
+private:
+    std::string blocked_path;
+    std::mutex mutex;
+    std::condition_variable cv;
+    bool released = false;
+};
+std::string recv_all(TcpSocket &sock)
+{
+    std::string str;
+    char buffer[1024];
+    size_t len;
+    while ((len = sock.recv(buffer, sizeof(buffer))) > 0) str.append(buffer, len);
+    return str;
+}
+BOOST_AUTO_TEST_CASE(drain)
+{
+    TestThread server_thread;
+    BlockingServer server("/block");
+    server.add_tcp_listener("127.0.0.1", BASE_PORT + 5);
+
+    server_thread = TestThread(std::bind(&Server::run, &server));
+
+    Request req;
+    req.method = GET;
+    req.headers.add("Host", "localhost");
+    req.headers.add("Connection", "keep-alive");
+    req.raw_url = "/index.html";
+
+    // An idle keep-alive connection, and one part way through a request
+    ClientConnection idle(std::unique_ptr<Socket>(new TcpSocket("localhost", BASE_PORT + 5)));
+    BOOST_CHECK_EQUAL(200, idle.make_request(req).status.code);
+
+    // A new connection that has not sent a request yet, like a browser preconnect
+    TcpSocket preconnect("localhost", BASE_PORT + 5);
+
+    std::unique_ptr<TcpSocket> partial(new TcpSocket("localhost", BASE_PORT + 5));
+    std::string partial_req = "GET /index.html HTTP/1.1\r\nHost: localhost\r\n";
+    partial->send_all(partial_req.data(), partial_req.size());
+
+    // A keep-alive request still in its handler when drain starts
+    std::unique_ptr<TcpSocket> blocked(new TcpSocket("localhost", BASE_PORT + 5));
+    std::string blocked_req = "GET /block HTTP/1.1\r\nHost: localhost\r\nConnection: keep-alive\r\n\r\n";
+    blocked->send_all(blocked_req.data(), blocked_req.size());
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+
+    auto start = std::chrono::steady_clock::now();
+    std::thread drain_thread([&server]() { server.drain(std::chrono::seconds(5)); });
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+
+    // The idle connections were closed
+    BOOST_CHECK(!idle.is_connected());
+    char buffer[1024];
+    BOOST_CHECK_EQUAL(0U, preconnect.recv(buffer, sizeof(buffer)));
+
+    // The in-progress request completes, but the connection is then closed
+    partial_req = "Connection: keep-alive\r\n\r\n";
+    partial->send_all(partial_req.data(), partial_req.size());
+    std::string resp_str;
+    size_t len;
+    while ((len = partial->recv(buffer, sizeof(buffer))) > 0) resp_str.append(buffer, len);
+    BOOST_CHECK(resp_str.find("HTTP/1.1 200 OK\r\n") == 0);
+    BOOST_CHECK(resp_str.find("Connection: close\r\n") != std::string::npos);
+    partial.reset();
+
+    // Told the connection will close, rather than finding out on its next request
+    server.release();
+    resp_str = recv_all(*blocked);
+    BOOST_CHECK(resp_str.find("HTTP/1.1 200 OK\r\n") == 0);
+    BOOST_CHECK(resp_str.find("Connection: close\r\n") != std::string::npos);
+    blocked.reset();
+
+    drain_thread.join();
+    BOOST_CHECK(std::chrono::steady_clock::now() - start < std::chrono::seconds(5));
+    BOOST_CHECK_EQUAL(0U, server.stats().connections);
+    server_thread.join();
+}
+class ExpectServer : public Server
+{
+protected:
+    virtual http::Response handle_request(http::Request &req)override
+    {
+        http::Response resp;
+        resp.status_code(200);
+        resp.headers.add("Content-Type", "text/plain");
+        resp.body = req.body;
+        return resp;
+    }
+    virtual bool admit_request(const http::Request &req, http::Response &resp)override
+    {
+        if (std::stoi(req.headers.get("Content-Length")) <= 10) return true;
+        resp.status_code(413);
+        resp.body = "Too large";
+        return false;
+    }
+};
+std::string recv_some(TcpSocket &sock)
+{
+    char buffer[1024];
+    auto len = sock.recv(buffer, sizeof(buffer));
+    return std::string(buffer, len);
+}
+BOOST_AUTO_TEST_CASE(expect_continue)
+{
+    TestThread server_thread;
+    ExpectServer server;
+    server.add_tcp_listener("127.0.0.1", BASE_PORT + 6);
+
+    server_thread = TestThread(std::bind(&Server::run, &server));
+
+    {
+        // Admitted, gets 100 Continue before sending the body
+        TcpSocket sock("localhost", BASE_PORT + 6);
+        std::string req = "POST / HTTP/1.1\r\nHost: localhost\r\nExpect: 100-continue\r\n"
+            "Connection: keep-alive\r\nContent-Length: 5\r\n\r\n";
+        sock.send_all(req.data(), req.size());
+        BOOST_CHECK_EQUAL("HTTP/1.1 100 Continue\r\n\r\n", recv_some(sock));
+        sock.send_all("Hello", 5);
+        // The body may arrive seperately from the header
+        auto resp = recv_some(sock);
+        if (resp.find("\r\n\r\nHello") == std::string::npos) resp += recv_some(sock);
+        BOOST_CHECK(resp.find("HTTP/1.1 200 OK\r\n") == 0);
+        BOOST_CHECK(resp.find("Connection: keep-alive\r\n") != std::string::npos);
+        BOOST_CHECK(resp.find("\r\n\r\nHello") != std::string::npos);
+    }
+    {
+        // Rejected with a final response, and the connection is closed
+        TcpSocket sock("localhost", BASE_PORT + 6);
+        std::string req = "POST / HTTP/1.1\r\nHost: localhost\r\nExpect: 100-continue\r\n"
+            "Connection: keep-alive\r\nContent-Length: 50\r\n\r\n";
+        sock.send_all(req.data(), req.size());
+        std::string resp;
+        std::string part;
+        while (!(part = recv_some(sock)).empty()) resp += part;
+        BOOST_CHECK(resp.find("HTTP/1.1 413 Payload Too Large\r\n") == 0);
+        BOOST_CHECK(resp.find("Connection: close\r\n") != std::string::npos);
+        BOOST_CHECK(resp.find("\r\n\r\nToo large") != std::string::npos);
+    }
+    {
+        // Unknown expectations
+        TcpSocket sock("localhost", BASE_PORT + 6);
+        std::string req = "POST / HTTP/1.1\r\nHost: localhost\r\nExpect: something\r\n"
+            "Content-Length: 5\r\n\r\n";
+        sock.send_all(req.data(), req.size());
+        BOOST_CHECK(recv_some(sock).find("HTTP/1.1 417 Expectation Failed\r\n") == 0);
+    }
+    {
+        // HTTP/1.0 clients don't support 100 Continue
+        TcpSocket sock("localhost", BASE_PORT + 6);
+        std::string req = "POST / HTTP/1.0\r\nHost: localhost\r\nExpect: 100-continue\r\n"
+            "Content-Length: 50\r\n\r\n";
+        sock.send_all(req.data(), req.size());
+        sock.send_all(std::string(50, 'x').data(), 50);
+        BOOST_CHECK(recv_some(sock).find("HTTP/1.1 200 OK\r\n") == 0);
+    }
+
+    server.exit();
+    server_thread.join();
+}
+BOOST_AUTO_TEST_CASE(metrics)
+{
+    TestThread server_thread;
+    Server server;
+    Metrics metrics;
+    server.set_metrics(&metrics);
+    server.add_tcp_listener("127.0.0.1", BASE_PORT + 7);
+
+    server_thread = TestThread(std::bind(&Server::run, &server));
+
+    Request req;
+    req.method = GET;
+    req.headers.add("Host", "localhost");
+    req.headers.add("Connection", "keep-alive");
+    req.raw_url = "/index.html";
+    ClientConnection conn(std::unique_ptr<Socket>(new TcpSocket("localhost", BASE_PORT + 7)));
+    BOOST_CHECK_EQUAL(200, conn.make_request(req).status.code);
+    BOOST_CHECK_EQUAL(200, conn.make_request(req).status.code);
+
+    {
+        // Invalid requests are counted
+        TcpSocket sock("localhost", BASE_PORT + 7);
+        std::string bad = "GET / HTTP/1.1\r\nContent-Length: abc\r\n\r\n";
+        sock.send_all(bad.data(), bad.size());
+        char buffer[1024];
+        while (sock.recv(buffer, sizeof(buffer)) > 0);
+    }
+
+    req.raw_url = "/metrics";
+    auto resp = conn.make_request(req);
+    BOOST_CHECK_EQUAL(200, resp.status.code);
+    BOOST_CHECK_EQUAL(Metrics::CONTENT_TYPE, resp.headers.get("Content-Type"));
+    auto &body = resp.body;
+    BOOST_CHECK(body.find("http_requests_total{code=\"2xx\"} 2\n") != std::string::npos);
+    BOOST_CHECK(body.find("http_requests_total{code=\"4xx\"} 0\n") != std::string::npos);
+    BOOST_CHECK(body.find("http_connections 1\n") != std::string::npos);
+    BOOST_CHECK(body.find("http_parse_errors_total 1\n") != std::string::npos);
+    BOOST_CHECK(body.find("http_protocol_errors_total 0\n") != std::string::npos);
+    BOOST_CHECK(body.find("http_request_duration_seconds_count 2\n") != std::string::npos);
+    BOOST_CHECK(body.find("# TYPE tls_handshake_duration_seconds histogram\n") != std::string::npos);
+    BOOST_CHECK(body.find("http_request_bytes_total 0\n") == std::string::npos);
+    BOOST_CHECK(body.find("http_response_bytes_total 0\n") == std::string::npos);
+
+    server.exit();
+    server_thread.join();
+}
+BOOST_AUTO_TEST_CASE(access_log)
+{
+    TestThread server_thread;
+    Server server;
+    std::stringstream log_stream;
+    AccessLog log(log_stream);
+    server.set_access_log(&log);
+    server.add_tcp_listener("127.0.0.1", BASE_PORT + 8);
+
+    server_thread = TestThread(std::bind(&Server::run, &server));
+
+    Request req;
+    req.method = GET;
+    req.headers.add("Host", "localhost");
+    req.raw_url = "/index.html?a=b";
+    http::DefaultSocketFactory socket_factory;
+    BOOST_CHECK_EQUAL(200, http::Client("localhost", BASE_PORT + 8, false, &socket_factory).make_request(req).status.code);
+
+    server.exit();
+    server_thread.join();
+
+    log.flush();
+    auto str = log_stream.str();
+    BOOST_CHECK(str.find("127.0.0.1:") == 0);
+    BOOST_CHECK(str.find(" \"GET /index.html?a=b HTTP/1.1\" 200 ") != std::string::npos);
+    BOOST_CHECK_EQUAL(1U, log.written());
+}
+BOOST_AUTO_TEST_CASE(load_shedding)
+{
+    TestThread server_thread;
+    BlockingServer server;
+    LoadShedOptions opts;
+    opts.max_in_flight = 1;
+    opts.max_queued = 1;
+    opts.interval = std::chrono::milliseconds(200);
+    opts.retry_after = std::chrono::seconds(2);
+    server.set_load_shedding(opts);
+    server.add_tcp_listener("127.0.0.1", BASE_PORT + 9);
+
+    server_thread = TestThread(std::bind(&Server::run, &server));
+
+    std::string req_str = "GET / HTTP/1.1\r\nHost: localhost\r\nConnection: close\r\n\r\n";
+    auto wait_for = [&server](size_t in_flight, size_t queued)
+    {
+        for (int i = 0; i < 100; ++i)
+        {
+            auto stats = server.stats();
+            if (stats.handlers_in_flight == in_flight && stats.handlers_queued == queued) return true;
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        }
+        return false;
+    };
+
+    // First request is handled, second waits for it
+    TcpSocket first("localhost", BASE_PORT + 9);
+    first.send_all(req_str.data(), req_str.size());
+    BOOST_CHECK(wait_for(1, 0));
+    TcpSocket second("localhost", BASE_PORT + 9);
+    second.send_all(req_str.data(), req_str.size());
+    BOOST_CHECK(wait_for(1, 1));
+
+    // Third is rejected immediately
+    {
+        TcpSocket third("localhost", BASE_PORT + 9);
+        third.send_all(req_str.data(), req_str.size());
+        auto resp = recv_all(third);
+        BOOST_CHECK(resp.find("HTTP/1.1 503 Service Unavailable\r\n") == 0);
+        BOOST_CHECK(resp.find("Retry-After: 2\r\n") != std::string::npos);
+        BOOST_CHECK(resp.find("Connection: close\r\n") != std::string::npos);
+        BOOST_CHECK_EQUAL(1U, server.stats().shed_requests);
+    }
+    {
+        // Expect: 100-continue is answered with the final status, before the body is sent
+        TcpSocket expect("localhost", BASE_PORT + 9);
+        std::string expect_str = "POST / HTTP/1.1\r\nHost: localhost\r\nExpect: 100-continue\r\n"
+            "Content-Length: 5\r\n\r\n";
+        expect.send_all(expect_str.data(), expect_str.size());
+        auto resp = recv_all(expect);
+        BOOST_CHECK(resp.find("HTTP/1.1 503 Service Unavailable\r\n") == 0);
+        BOOST_CHECK(resp.find("Connection: close\r\n") != std::string::npos);
+        BOOST_CHECK_EQUAL(2U, server.stats().shed_requests);
+    }
+
+    // Second request waited longer than the interval, so is rejected once it leaves the queue
+    std::this_thread::sleep_for(std::chrono::milliseconds(300));
+    server.release();
+    BOOST_CHECK(recv_all(first).find("HTTP/1.1 200 OK\r\n") == 0);
+    BOOST_CHECK(recv_all(second).find("HTTP/1.1 503 Service Unavailable\r\n") == 0);
+    BOOST_CHECK(wait_for(0, 0));
+    BOOST_CHECK_EQUAL(3U, server.stats().shed_requests);
+
+    // Once idle requests are handled again
+    TcpSocket fourth("localhost", BASE_PORT + 9);
+    fourth.send_all(req_str.data(), req_str.size());
+    BOOST_CHECK(recv_all(fourth).find("HTTP/1.1 200 OK\r\n") == 0);
+
+    server.exit();
+    server_thread.join();
+}
+class AsyncServer : public Server
+{
+public:
+    /**Wait for a "/later" request, and take its responder.*/
+    Responder take_responder()
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        cv.wait(lock, [this]() { return (bool)pending; });
+        auto responder = std::move(pending);
+        pending = Responder();
+        return responder;
+    }
+protected:
+    virtual void handle_request_async(http::Request &req, Responder responder)override
+    {
+        if (req.raw_url == "/later")
+        {
+            // Returns without responding, so the handler does not hold a thread
+            std::unique_lock<std::mutex> lock(mutex);
+            pending = std::move(responder);
+            cv.notify_all();
+        }
+        else if (req.raw_url == "/thread")
+        {
+            std::thread([responder]() mutable { responder.send(ok_response("thread")); }).detach();
+        }
+        else if (req.raw_url == "/throw") throw NotFound(req.raw_url);
+        else if (req.raw_url != "/drop") Server::handle_request_async(req, std::move(responder));
+    }
+private:
+    std::mutex mutex;
+    std::condition_variable cv;
+    Responder pending;
+
+    static http::Response ok_response(const std::string &body)
+    {
+        http::Response resp;
+        resp.status_code(200);
+        resp.headers.add("Content-Type", "text/plain");
+        resp.body = body;
+        return resp;
+    }
+};
+BOOST_AUTO_TEST_CASE(exit_load_shedding_queue)
+{
+    TestThread server_thread;
+    BlockingServer server;
+    LoadShedOptions opts;
+    opts.max_in_flight = 1;
+    opts.max_queued = 2;
+    opts.interval = std::chrono::seconds(10);
+    server.set_load_shedding(opts);
+    server.add_tcp_listener("127.0.0.1", BASE_PORT + 19);
+
+    server_thread = TestThread(std::bind(&Server::run, &server));
+
+    std::string req_str = "GET / HTTP/1.1\r\nHost: localhost\r\n\r\n";
+    auto wait_for = [&server](size_t in_flight, size_t queued)
+    {
+        for (int i = 0; i < 100; ++i)
+        {
+            auto stats = server.stats();
+            if (stats.handlers_in_flight == in_flight && stats.handlers_queued == queued) return true;
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        }
+        return false;
+    };
+
+    // One request being handled and two queued behind it
+    TcpSocket first("localhost", BASE_PORT + 19);
+    first.send_all(req_str.data(), req_str.size());
+    BOOST_CHECK(wait_for(1, 0));
+    TcpSocket second("localhost", BASE_PORT + 19);
+    second.send_all(req_str.data(), req_str.size());
+    TcpSocket third("localhost", BASE_PORT + 19);
+    third.send_all(req_str.data(), req_str.size());
+    BOOST_CHECK(wait_for(1, 2));
+
+    // The queued connections are closed rather than left open
+    std::thread exit_thread([&server]() { server.exit(); });
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    server.release();
+    exit_thread.join();
+    server_thread.join();
+
+    auto stats = server.stats();
+    BOOST_CHECK_EQUAL(0U, stats.connections);
+    BOOST_CHECK_EQUAL(0U, stats.handlers_queued);
+    BOOST_CHECK_EQUAL(2U, stats.shed_requests);
+    for (auto sock : { &second, &third })
+    {
+        try
+        {
+            BOOST_CHECK_EQUAL("", recv_all(*sock));
+        }
+        catch (const std::exception &) {}
+    }
+}
+
+BOOST_AUTO_TEST_CASE(async_handler)
+{
+    TestThread server_thread;
+    AsyncServer server;
+    // A pending response does not count as in flight
+    LoadShedOptions opts;
+    opts.max_in_flight = 1;
+    server.set_load_shedding(opts);
+    server.add_tcp_listener("127.0.0.1", BASE_PORT + 16);
+
+    server_thread = TestThread(std::bind(&Server::run, &server));
+
+    auto request = [](const std::string &path)
+    {
+        return "GET " + path + " HTTP/1.1\r\nHost: localhost\r\nConnection: close\r\n\r\n";
+    };
+    auto get = [&request](const std::string &path)
+    {
+        TcpSocket sock("localhost", BASE_PORT + 16);
+        auto req = request(path);
+        sock.send_all(req.data(), req.size());
+        return recv_all(sock);
+    };
+
+    TcpSocket later("localhost", BASE_PORT + 16);
+    auto req = request("/later");
+    later.send_all(req.data(), req.size());
+    auto responder = server.take_responder();
+    BOOST_CHECK(!responder.completed());
+
+    auto resp = get("/");
+    BOOST_CHECK(resp.find("HTTP/1.1 200 OK\r\n") == 0);
+    BOOST_CHECK(resp.find("\r\n\r\nOK") != std::string::npos);
+    resp = get("/thread");
+    BOOST_CHECK(resp.find("HTTP/1.1 200 OK\r\n") == 0);
+    BOOST_CHECK(resp.find("\r\n\r\nthread") != std::string::npos);
+    BOOST_CHECK(get("/throw").find("HTTP/1.1 404 Not Found\r\n") == 0);
+    // Dropping the responder without responding is an error
+    BOOST_CHECK(get("/drop").find("HTTP/1.1 500 Internal Server Error\r\n") == 0);
+
+    // Complete the first request from this thread. Only the first response is used.
+    http::Response later_resp;
+    later_resp.status_code(202);
+    later_resp.body = "done";
+    BOOST_CHECK(responder.send(std::move(later_resp)));
+    BOOST_CHECK(responder.completed());
+    BOOST_CHECK(!responder.send(http::Response()));
+    resp = recv_all(later);
+    BOOST_CHECK(resp.find("HTTP/1.1 202 Accepted\r\n") == 0);
+    BOOST_CHECK(resp.find("\r\n\r\ndone") != std::string::npos);
+    BOOST_CHECK_EQUAL(0U, server.stats().shed_requests);
+
+    // Responses sent after exit are discarded
+    TcpSocket abandoned("localhost", BASE_PORT + 16);
+    abandoned.send_all(req.data(), req.size());
+    responder = server.take_responder();
+    server.exit();
+    server_thread.join();
+    BOOST_CHECK(responder.send(http::Response()));
+}
+BOOST_AUTO_TEST_CASE(client_limiter)
+{
+    TestThread server_thread;
+    Server server;
+    ClientLimitOptions opts;
+    opts.max_connections = 1;
+    opts.requests_per_second = 0.5;
+    opts.burst = 2;
+    ClientLimiter limiter(opts);
+    server.set_client_limiter(&limiter);
+    server.add_tcp_listener("127.0.0.1", BASE_PORT + 10);
+
+    server_thread = TestThread(std::bind(&Server::run, &server));
+
+    Request req;
+    req.method = GET;
+    req.headers.add("Host", "localhost");
+    req.headers.add("Connection", "keep-alive");
+    req.raw_url = "/index.html";
+    ClientConnection conn(std::unique_ptr<Socket>(new TcpSocket("localhost", BASE_PORT + 10)));
+    BOOST_CHECK_EQUAL(200, conn.make_request(req).status.code);
+
+    // A second connection is closed once accepted
+    {
+        TcpSocket second("localhost", BASE_PORT + 10);
+        std::string req_str = "GET / HTTP/1.1\r\nHost: localhost\r\n\r\n";
+        try
+        {
+            second.send_all(req_str.data(), req_str.size());
+            BOOST_CHECK_EQUAL("", recv_all(second));
+        }
+        catch (const std::exception &) {}
+        BOOST_CHECK_EQUAL(1U, limiter.stats().rejected_connections);
+    }
+
+    // The burst is used up by the second request
+    BOOST_CHECK_EQUAL(200, conn.make_request(req).status.code);
+    auto resp = conn.make_request(req);
+    BOOST_CHECK_EQUAL(429, resp.status.code);
+    BOOST_CHECK_EQUAL("2", resp.headers.get("Retry-After"));
+    BOOST_CHECK_EQUAL("close", resp.headers.get("Connection"));
+    BOOST_CHECK_EQUAL(1U, limiter.stats().rejected_requests);
+
+    server.exit();
+    server_thread.join();
+}
+BOOST_AUTO_TEST_CASE(parser_limits)
+{
+    TestThread server_thread;
+    ExpectServer server;
+    ListenerOptions opts;
+    opts.parser_limits.max_body_size = 100;
+    opts.parser_limits.max_header_count = 5;
+    opts.parser_limits.max_headers_size = 16384;
+    server.add_tcp_listener("127.0.0.1", BASE_PORT + 11, opts);
+    server.set_body_memory_budget(20);
+
+    server_thread = TestThread(std::bind(&Server::run, &server));
+
+    auto request = [](const std::string &str)
+    {
+        TcpSocket sock("localhost", BASE_PORT + 11);
+        sock.send_all(str.data(), str.size());
+        return recv_all(sock);
+    };
+    // Rejected without sending the body
+    auto resp = request("POST / HTTP/1.1\r\nHost: localhost\r\nContent-Length: 150\r\n\r\n");
+    BOOST_CHECK(resp.find("HTTP/1.1 413 Payload Too Large\r\n") == 0);
+    BOOST_CHECK(resp.find("Connection: close\r\n") != std::string::npos);
+
+    resp = request("GET / HTTP/1.1\r\nA: 1\r\nB: 2\r\nC: 3\r\nD: 4\r\nE: 5\r\nF: 6\r\n\r\n");
+    BOOST_CHECK(resp.find("HTTP/1.1 431 ") == 0);
+    // Fills the largest buffer without completing the line. Sending more would reset the connection.
+    resp = request("GET /" + std::string(opts.parser_limits.max_headers_size - 5, 'x'));
+    BOOST_CHECK(resp.find("HTTP/1.1 414 ") == 0);
+
+    // Within the request limit, but over the server budget
+    resp = request("POST / HTTP/1.1\r\nHost: localhost\r\nContent-Length: 30\r\n\r\n");
+    BOOST_CHECK(resp.find("HTTP/1.1 503 Service Unavailable\r\n") == 0);
+    BOOST_CHECK(resp.find("Retry-After: 1\r\n") != std::string::npos);
+
+    resp = request("POST / HTTP/1.1\r\nHost: localhost\r\nContent-Length: 5\r\n\r\nhello");
+    BOOST_CHECK(resp.find("HTTP/1.1 200 OK\r\n") == 0);
+    BOOST_CHECK(resp.find("\r\n\r\nhello") != std::string::npos);
+    BOOST_CHECK_EQUAL(0U, server.stats().body_memory);
+
+    server.exit();
+    server_thread.join();
+}
+BOOST_AUTO_TEST_CASE(buffers)
+{
+    TestThread server_thread;
+    ExpectServer server;
+    server.add_tcp_listener("127.0.0.1", BASE_PORT + 12);
+
+    server_thread = TestThread(std::bind(&Server::run, &server));
+
+    Request req;
+    req.method = GET;
+    req.headers.add("Host", "localhost");
+    req.headers.add("Connection", "keep-alive");
+    req.raw_url = "/index.html";
+    ClientConnection conn(std::unique_ptr<Socket>(new TcpSocket("localhost", BASE_PORT + 12)));
+    BOOST_CHECK_EQUAL(200, conn.make_request(req).status.code);
+    // Headers larger than the initial buffer
+    req.headers.add("Cookie", std::string(20000, 'x'));
+    BOOST_CHECK_EQUAL(200, conn.make_request(req).status.code);
+    // Idle keep-alive connections hold no buffer
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    BOOST_CHECK_EQUAL(1U, server.stats().connections);
+    BOOST_CHECK_EQUAL(0U, server.stats().buffers_in_use);
+
+    // Pipelined requests already received are handled
+    TcpSocket sock("localhost", BASE_PORT + 12);
+    std::string pipelined =
+        "POST / HTTP/1.1\r\nConnection: keep-alive\r\nContent-Length: 5\r\n\r\nfirst"
+        "POST / HTTP/1.1\r\nConnection: close\r\nContent-Length: 6\r\n\r\nsecond";
+    sock.send_all(pipelined.data(), pipelined.size());
+    auto resp = recv_all(sock);
+    BOOST_CHECK(resp.find("\r\n\r\nfirst") != std::string::npos);
+    BOOST_CHECK(resp.find("\r\n\r\nsecond") != std::string::npos);
+
+    server.exit();
+    server_thread.join();
+}
+BOOST_AUTO_TEST_CASE(ipv6_listener)
+{
+    TestThread server_thread;
+    Server server;
+    std::stringstream log_stream;
+    AccessLog log(log_stream);
+    server.set_access_log(&log);
+    server.add_tcp_listener("::", BASE_PORT + 13);
+    ListenerOptions v6_only;
+    v6_only.ipv6_only = true;
+    server.add_tcp_listener("[::1]", BASE_PORT + 14, v6_only);
+
+    server_thread = TestThread(std::bind(&Server::run, &server));
+
+    Request req;
+    req.method = GET;
+    req.headers.add("Host", "localhost");
+    req.raw_url = "/";
+    http::DefaultSocketFactory socket_factory;
+    // Dual-stack
+    BOOST_CHECK_EQUAL(200, http::Client("127.0.0.1", BASE_PORT + 13, false, &socket_factory).make_request(req).status.code);
+    BOOST_CHECK_EQUAL(200, http::Client("::1", BASE_PORT + 13, false, &socket_factory).make_request(req).status.code);
+    // IPv6 only
+    BOOST_CHECK_EQUAL(200, http::Client("[::1]", BASE_PORT + 14, false, &socket_factory).make_request(req).status.code);
+    BOOST_CHECK_THROW(TcpSocket("127.0.0.1", BASE_PORT + 14), ConnectionError);
+
+    TcpSocket sock("::1", BASE_PORT + 13);
+    BOOST_CHECK_EQUAL("[::1]:" + std::to_string(BASE_PORT + 13), sock.address_str());
+
+    server.exit();
+    server_thread.join();
+
+    log.flush();
+    auto str = log_stream.str();
+    BOOST_CHECK(str.find("127.0.0.1:") == 0);
+    BOOST_CHECK(str.find("\n[::1]:") != std::string::npos);
+    BOOST_CHECK_EQUAL(3U, log.written());
+}
+BOOST_AUTO_TEST_CASE(socket_options)
+{
+    TestThread server_thread;
+    Server server;
+    ListenerOptions opts;
+    opts.reuse_port = true;
+    opts.defer_accept = std::chrono::seconds(1);
+    opts.fast_open_queue = 16;
+    opts.socket_options.no_delay = true;
+    opts.socket_options.recv_buffer_size = 65536;
+    opts.socket_options.send_buffer_size = 65536;
+    opts.socket_options.user_timeout = std::chrono::seconds(10);
+    server.add_tcp_listener("127.0.0.1", BASE_PORT + 15, opts);
+    // Another socket may share the port
+    ListenSocketOptions listen_opts;
+    listen_opts.reuse_port = true;
+    BOOST_CHECK_NO_THROW(TcpListenSocket("127.0.0.1", BASE_PORT + 15, listen_opts));
+
+    server_thread = TestThread(std::bind(&Server::run, &server));
+
+    SocketOptions client_opts;
+    client_opts.no_delay = true;
+    client_opts.fast_open = true;
+    DefaultSocketFactory socket_factory(client_opts);
+    auto sock = socket_factory.connect("localhost", BASE_PORT + 15, false);
+    int no_delay = 0;
+    socklen_t len = sizeof(no_delay);
+    getsockopt(sock->get(), IPPROTO_TCP, TCP_NODELAY, (char*)&no_delay, &len);
+    BOOST_CHECK(no_delay != 0);
+
+    Request req;
+    req.method = GET;
+    req.headers.add("Host", "localhost");
+    req.raw_url = "/";
+    BOOST_CHECK_EQUAL(200, http::Client("localhost", BASE_PORT + 15, false, &socket_factory).make_request(req).status.code);
+
+    server.exit();
+    server_thread.join();
+}
+#ifndef _WIN32
+BOOST_AUTO_TEST_CASE(unix_listener)
+{
+    const char *PATH = "cpphttp-test.sock";
+    {
+        TestThread server_thread;
+        ExpectServer server;
+        server.add_unix_listener(PATH);
+
+        server_thread = TestThread(std::bind(&Server::run, &server));
+
+        Request req;
+        req.method = POST;
+        req.headers.add("Host", "localhost");
+        req.raw_url = "/";
+        req.body = "hello";
+        UnixSocketFactory socket_factory(PATH);
+        auto resp = http::Client("localhost", 80, false, &socket_factory).make_request(req);
+        BOOST_CHECK_EQUAL(200, resp.status.code);
+        BOOST_CHECK_EQUAL("hello", resp.body);
+        BOOST_CHECK_THROW(socket_factory.connect("localhost", 443, true), ConnectionError);
+
+        TcpSocket sock;
+        sock.connect_unix(PATH);
+        BOOST_CHECK(sock.is_unix_domain());
+        BOOST_CHECK_EQUAL(std::string("unix:") + PATH, sock.address_str());
+
+        server.exit();
+        server_thread.join();
+    }
+    // The socket file is removed with the server
+    TcpSocket sock;
+    BOOST_CHECK_THROW(sock.connect_unix(PATH), ConnectionError);
+}
+#endif
 BOOST_AUTO_TEST_SUITE_END()
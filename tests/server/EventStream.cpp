@@ -0,0 +1,198 @@
+#include <boost/test/unit_test.hpp>
+#include "server/CoreServer.hpp"
+#include "server/EventStream.hpp"
+#include "net/TcpSocket.hpp"
+#include "Error.hpp"
+#include "Response.hpp"
+#include "../TestThread.hpp"
+#include <thread>
+
+using namespace http;
+
+BOOST_AUTO_TEST_SUITE(TestEventStream)
+
+static const uint16_t BASE_PORT = 5350;
+
+Request stream_request()
+{
+    Request req;
+    req.method = GET;
+    req.raw_url = "/events";
+    req.url = Url::parse_request(req.raw_url);
+    req.headers.add("Host", "localhost");
+    req.headers.add("Last-Event-ID", "41");
+    return req;
+}
+
+BOOST_AUTO_TEST_CASE(serialize)
+{
+    BOOST_CHECK_EQUAL("data: Hello\n\n", *ServerEvent("Hello").serialized());
+    BOOST_CHECK_EQUAL("data: \n\n", *ServerEvent("").serialized());
+    BOOST_CHECK_EQUAL("id: 42\nevent: update\ndata: a\ndata: b\ndata: c\ndata: \n\n",
+        *ServerEvent("a\nb\r\nc\r", "update", "42").serialized());
+    BOOST_CHECK_EQUAL(": keep-alive\n\n", *ServerEvent::comment("keep-alive").serialized());
+    BOOST_CHECK_THROW(ServerEvent("x", "a\nb"), std::invalid_argument);
+    BOOST_CHECK_THROW(ServerEvent("x", "", "4\r2"), std::invalid_argument);
+}
+
+BOOST_AUTO_TEST_CASE(response)
+{
+    EventStreamOptions options;
+    options.retry = std::chrono::milliseconds(2500);
+    auto response = event_stream(stream_request(), options);
+    BOOST_CHECK_EQUAL(200, response.status.code);
+    BOOST_CHECK_EQUAL("text/event-stream", response.headers.get("Content-Type"));
+    BOOST_CHECK_EQUAL("no-cache", response.headers.get("Cache-Control"));
+    auto stream = response.event_stream;
+    BOOST_REQUIRE(stream);
+    BOOST_CHECK_EQUAL("41", stream->last_event_id());
+    BOOST_CHECK_EQUAL("/events", stream->request().raw_url);
+
+    int notified = 0;
+    stream->attach([&notified]() { ++notified; });
+    BOOST_CHECK(stream->send("one"));
+    BOOST_CHECK(stream->send("two"));
+    BOOST_CHECK_EQUAL(0, notified); // The retry field was already queued
+    BOOST_CHECK_EQUAL(35U, stream->buffered_amount());
+    BOOST_CHECK_EQUAL("retry: 2500\n\ndata: one\n\ndata: two\n\n", *stream->take_output());
+    BOOST_CHECK(!stream->take_output());
+    BOOST_CHECK_EQUAL(0U, stream->buffered_amount());
+
+    // Queued events are still sent after close
+    BOOST_CHECK(stream->send("three"));
+    BOOST_CHECK_EQUAL(1, notified);
+    stream->close();
+    BOOST_CHECK_EQUAL(2, notified);
+    BOOST_CHECK(stream->wants_close());
+    BOOST_CHECK(!stream->is_open());
+    BOOST_CHECK(!stream->send("four"));
+    BOOST_CHECK_EQUAL("data: three\n\n", *stream->take_output());
+
+    stream->detach();
+    BOOST_CHECK(!stream->send("five"));
+}
+
+BOOST_AUTO_TEST_CASE(topic)
+{
+    EventTopic topic;
+    auto a = event_stream(stream_request()).event_stream;
+    auto b = event_stream(stream_request()).event_stream;
+    topic.subscribe(a);
+    topic.subscribe(b);
+    BOOST_CHECK_EQUAL(2U, topic.subscribers());
+
+    // The serialized event is shared rather than copied
+    ServerEvent event("shared", "tick");
+    BOOST_CHECK_EQUAL(2U, topic.publish(event));
+    auto out_a = a->take_output(), out_b = b->take_output();
+    BOOST_CHECK(out_a == event.serialized());
+    BOOST_CHECK(out_b == event.serialized());
+
+    // Closed streams are removed
+    a->close();
+    BOOST_CHECK_EQUAL(1U, topic.publish("next"));
+    BOOST_CHECK_EQUAL(1U, topic.subscribers());
+    BOOST_CHECK_EQUAL("data: next\n\n", *b->take_output());
+    topic.unsubscribe(b);
+    BOOST_CHECK_EQUAL(0U, topic.subscribers());
+}
+
+BOOST_AUTO_TEST_CASE(backpressure)
+{
+    EventStreamOptions options;
+    options.max_buffered = 40;
+    auto stream = event_stream(stream_request(), options).event_stream;
+    ServerEvent event("0123456789"); // 18 bytes
+    BOOST_CHECK(stream->send(event));
+    BOOST_CHECK(stream->send(event));
+    BOOST_CHECK(!stream->send(event));
+    BOOST_CHECK(!stream->send(event));
+    BOOST_CHECK_EQUAL(2U, stream->dropped());
+    BOOST_CHECK(stream->is_open());
+    // Once the client catches up, events are queued again
+    stream->take_output();
+    BOOST_CHECK(stream->send(event));
+    BOOST_CHECK_EQUAL(2U, stream->dropped());
+
+    options.disconnect_slow = true;
+    stream = event_stream(stream_request(), options).event_stream;
+    BOOST_CHECK(stream->send(event));
+    BOOST_CHECK(stream->send(event));
+    BOOST_CHECK(!stream->send(event));
+    BOOST_CHECK_EQUAL(1U, stream->dropped());
+    BOOST_CHECK(!stream->is_open());
+    BOOST_CHECK(stream->wants_close());
+    BOOST_CHECK_EQUAL(36U, stream->take_output()->size());
+}
+
+class EventServer : public CoreServer
+{
+public:
+    EventTopic topic;
+    std::shared_ptr<EventStream> last;
+protected:
+    virtual Response handle_request(Request &request)override
+    {
+        if (request.url.path != "/events") throw NotFound(request.url.path);
+        auto response = event_stream(request);
+        response.event_stream->send("welcome");
+        topic.subscribe(response.event_stream);
+        last = response.event_stream;
+        return response;
+    }
+    virtual Response parser_error_page(const ParserError &)override
+    {
+        throw std::runtime_error("Unexpected parser_error_page");
+    }
+};
+std::string recv_until(TcpSocket &sock, const std::string &end)
+{
+    std::string data;
+    char buffer[4096];
+    while (data.find(end) == std::string::npos)
+    {
+        auto n = sock.recv(buffer, sizeof(buffer));
+        if (!n) break;
+        data.append(buffer, n);
+    }
+    return data;
+}
+
+BOOST_AUTO_TEST_CASE(server)
+{
+    TestThread server_thread;
+    EventServer server;
+    server.add_tcp_listener("127.0.0.1", BASE_PORT);
+    server_thread = TestThread(std::bind(&EventServer::run, &server));
+
+    TcpSocket sock("localhost", BASE_PORT);
+    std::string req = "GET /events HTTP/1.1\r\nHost: localhost\r\nConnection: keep-alive\r\n\r\n";
+    sock.send_all(req.data(), req.size());
+    auto resp = recv_until(sock, "data: welcome\n\n");
+    BOOST_CHECK_EQUAL(0U, resp.find("HTTP/1.1 200 OK\r\n"));
+    BOOST_CHECK(resp.find("Content-Type: text/event-stream\r\n") != std::string::npos);
+    BOOST_CHECK(resp.find("Connection: close\r\n") != std::string::npos);
+    BOOST_CHECK(resp.find("Content-Length") == std::string::npos);
+
+    // Published from another thread
+    std::thread publisher([&server]()
+    {
+        for (int i = 0; i < 3; ++i) server.topic.publish("update " + std::to_string(i), "", std::to_string(i));
+    });
+    publisher.join();
+    auto events = recv_until(sock, "data: update 2\n\n");
+    BOOST_CHECK_EQUAL("id: 0\ndata: update 0\n\nid: 1\ndata: update 1\n\nid: 2\ndata: update 2\n\n", events);
+
+    // Closing the stream sends the queued events, then closes the connection
+    server.last->send("bye");
+    server.last->close();
+    BOOST_CHECK_EQUAL("data: bye\n\n", recv_until(sock, "\n\n"));
+    char buffer[16];
+    BOOST_CHECK_EQUAL(0U, sock.recv(buffer, sizeof(buffer)));
+    BOOST_CHECK_EQUAL(0U, server.topic.publish("after"));
+
+    server.exit();
+    server_thread.join();
+}
+
+BOOST_AUTO_TEST_SUITE_END()
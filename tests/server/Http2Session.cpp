@@ -0,0 +1,655 @@
+#include <boost/test/unit_test.hpp>
+#include "client/Client.hpp"
+#include "client/SocketFactory.hpp"
+#include "server/CoreServer.hpp"
+#include "server/Http2Session.hpp"
+#include "server/ResponseCache.hpp"
+#include "net/Net.hpp"
+#include "net/TcpSocket.hpp"
+#include "Response.hpp"
+#include "../TestThread.hpp"
+#include <atomic>
+#include <map>
+#include <vector>
+
+using namespace http;
+using namespace http::http2;
+
+BOOST_AUTO_TEST_SUITE(TestHttp2Session)
+
+static const uint16_t BASE_PORT = 5320;
+
+struct Frame
+{
+    FrameHeader header;
+    std::string payload;
+};
+std::string make_frame(FrameType type, uint8_t flags, uint32_t stream_id, const std::string &payload = std::string())
+{
+    std::string out;
+    FrameHeader header = { (uint32_t)payload.size(), type, flags, stream_id };
+    header.write(&out);
+    return out + payload;
+}
+std::string u32(uint32_t value)
+{
+    std::string out;
+    write_u32(&out, value);
+    return out;
+}
+std::string setting(SettingsId id, uint32_t value)
+{
+    return std::string{ (char)(id >> 8), (char)id } + u32(value);
+}
+/**Split data into complete frames.*/
+std::vector<Frame> parse_frames(const std::string &data)
+{
+    std::vector<Frame> frames;
+    for (size_t pos = 0; pos < data.size();)
+    {
+        BOOST_REQUIRE(data.size() - pos >= FRAME_HEADER_LEN);
+        Frame frame;
+        frame.header = FrameHeader::read((const uint8_t*)data.data() + pos);
+        pos += FRAME_HEADER_LEN;
+        BOOST_REQUIRE(data.size() - pos >= frame.header.length);
+        frame.payload = data.substr(pos, frame.header.length);
+        pos += frame.header.length;
+        frames.push_back(frame);
+    }
+    return frames;
+}
+std::string get_header(const HeaderList &headers, const std::string &name)
+{
+    for (auto &field : headers) if (field.name == name) return field.value;
+    return "<missing>";
+}
+
+/**A HTTP/2 client talking directly to a session.*/
+struct TestClient
+{
+    std::vector<std::pair<uint32_t, Request>> requests;
+    Http2Session session;
+    HpackEncoder encoder;
+    HpackDecoder decoder;
+
+    explicit TestClient(const Http2Settings &settings = Http2Settings())
+        : session([this](uint32_t stream_id, Request &request)
+            {
+                requests.emplace_back(stream_id, std::move(request));
+            }, settings)
+    {}
+
+    void receive(const std::string &data)
+    {
+        session.receive(data.data(), data.size());
+    }
+    std::vector<Frame> output()
+    {
+        std::string out;
+        session.take_output(&out);
+        return parse_frames(out);
+    }
+    /**Send the preface and default settings, and discard the servers settings.*/
+    void start(const std::string &settings = std::string())
+    {
+        receive(std::string(PREFACE, PREFACE_LEN) + make_frame(SETTINGS, 0, 0, settings));
+        output();
+    }
+    std::string headers(uint32_t stream_id, const HeaderList &headers, uint8_t flags)
+    {
+        std::string block;
+        encoder.encode(headers, &block);
+        return make_frame(HEADERS, flags | FLAG_END_HEADERS, stream_id, block);
+    }
+    std::string get(uint32_t stream_id, const std::string &path, const HeaderList &extra = HeaderList())
+    {
+        HeaderList fields = { { ":method", "GET" }, { ":scheme", "http" }, { ":path", path },
+            { ":authority", "example.com" } };
+        fields.insert(fields.end(), extra.begin(), extra.end());
+        return headers(stream_id, fields, FLAG_END_STREAM);
+    }
+    HeaderList decode(const Frame &frame)
+    {
+        HeaderList fields;
+        auto p = (const uint8_t*)frame.payload.data();
+        decoder.decode(p, p + frame.payload.size(), &fields);
+        return fields;
+    }
+};
+Response text_response(const std::string &body)
+{
+    Response response;
+    response.status_code(200);
+    response.headers.add("Content-Type", "text/plain");
+    response.body = body;
+    return response;
+}
+
+BOOST_AUTO_TEST_CASE(request_response)
+{
+    TestClient client;
+    client.receive(std::string(PREFACE, PREFACE_LEN));
+    auto frames = client.output();
+    BOOST_REQUIRE_EQUAL(2U, frames.size());
+    BOOST_CHECK_EQUAL(SETTINGS, frames[0].header.type);
+    BOOST_CHECK_EQUAL(WINDOW_UPDATE, frames[1].header.type);
+    BOOST_CHECK_EQUAL(u32(1024 * 1024 - 65535), frames[1].payload);
+
+    client.receive(make_frame(SETTINGS, 0, 0));
+    frames = client.output();
+    BOOST_REQUIRE_EQUAL(1U, frames.size());
+    BOOST_CHECK_EQUAL(SETTINGS, frames[0].header.type);
+    BOOST_CHECK_EQUAL(FLAG_ACK, frames[0].header.flags);
+
+    // Can be received a byte at a time
+    auto request = client.get(1, "/path?x=1",
+        { { "accept", "text/plain" }, { "cookie", "a=1" }, { "cookie", "b=2" }, { "x-custom-header", "value" } });
+    for (auto c : request) client.receive(std::string(1, c));
+    BOOST_REQUIRE_EQUAL(1U, client.requests.size());
+    BOOST_CHECK_EQUAL(1U, client.requests[0].first);
+    auto &req = client.requests[0].second;
+    BOOST_CHECK_EQUAL(GET, req.method);
+    BOOST_CHECK_EQUAL("/path?x=1", req.raw_url);
+    BOOST_CHECK_EQUAL("/path", req.url.path);
+    BOOST_CHECK_EQUAL("example.com", req.headers.get("Host"));
+    BOOST_CHECK_EQUAL("text/plain", req.headers.get("Accept"));
+    BOOST_CHECK_EQUAL("a=1; b=2", req.headers.get("Cookie"));
+    BOOST_CHECK_EQUAL("value", req.headers.get("X-Custom-Header"));
+    BOOST_CHECK_EQUAL(1U, client.session.active_streams());
+
+    auto response = text_response("Hello World");
+    response.headers.add("Connection", "keep-alive");
+    client.session.send_response(1, std::move(response));
+    frames = client.output();
+    BOOST_REQUIRE_EQUAL(2U, frames.size());
+    BOOST_CHECK_EQUAL(HEADERS, frames[0].header.type);
+    BOOST_CHECK_EQUAL(FLAG_END_HEADERS, frames[0].header.flags);
+    BOOST_CHECK_EQUAL(1U, frames[0].header.stream_id);
+    auto headers = client.decode(frames[0]);
+    BOOST_CHECK_EQUAL(":status", headers.at(0).name);
+    BOOST_CHECK_EQUAL("200", headers.at(0).value);
+    BOOST_CHECK_EQUAL("text/plain", get_header(headers, "content-type"));
+    BOOST_CHECK_EQUAL("11", get_header(headers, "content-length"));
+    BOOST_CHECK_EQUAL("<missing>", get_header(headers, "connection"));
+    BOOST_CHECK_NE("<missing>", get_header(headers, "date"));
+    BOOST_CHECK_EQUAL(DATA, frames[1].header.type);
+    BOOST_CHECK_EQUAL(FLAG_END_STREAM, frames[1].header.flags);
+    BOOST_CHECK_EQUAL("Hello World", frames[1].payload);
+    BOOST_CHECK_EQUAL(0U, client.session.active_streams());
+    BOOST_CHECK(!client.session.wants_close());
+
+    // HEAD gets the headers only
+    client.receive(client.headers(3, { { ":method", "HEAD" }, { ":scheme", "http" }, { ":path", "/" } }, FLAG_END_STREAM));
+    BOOST_REQUIRE_EQUAL(2U, client.requests.size());
+    client.session.send_response(3, text_response("Hello World"));
+    frames = client.output();
+    BOOST_REQUIRE_EQUAL(1U, frames.size());
+    BOOST_CHECK_EQUAL(FLAG_END_HEADERS | FLAG_END_STREAM, frames[0].header.flags);
+    BOOST_CHECK_EQUAL("11", get_header(client.decode(frames[0]), "content-length"));
+
+    // PING is acknowledged
+    client.receive(make_frame(PING, 0, 0, "12345678"));
+    frames = client.output();
+    BOOST_REQUIRE_EQUAL(1U, frames.size());
+    BOOST_CHECK_EQUAL(PING, frames[0].header.type);
+    BOOST_CHECK_EQUAL(FLAG_ACK, frames[0].header.flags);
+    BOOST_CHECK_EQUAL("12345678", frames[0].payload);
+}
+
+BOOST_AUTO_TEST_CASE(request_body)
+{
+    TestClient client;
+    client.start();
+    HeaderList post = { { ":method", "POST" }, { ":scheme", "http" }, { ":path", "/" }, { "content-length", "10" } };
+    client.receive(client.headers(1, post, 0));
+    client.receive(make_frame(DATA, 0, 1, "12345"));
+    // Padding is removed
+    client.receive(make_frame(DATA, FLAG_PADDED, 1, std::string(1, '\x03') + "678" + std::string(3, '\0')));
+    BOOST_CHECK(client.requests.empty());
+    client.receive(make_frame(DATA, 0, 1, "90"));
+    // Trailers end the request
+    client.receive(client.headers(1, { { "x-trailer", "value" } }, FLAG_END_STREAM));
+    BOOST_REQUIRE_EQUAL(1U, client.requests.size());
+    BOOST_CHECK_EQUAL(POST, client.requests[0].second.method);
+    BOOST_CHECK_EQUAL("1234567890", client.requests[0].second.body);
+    BOOST_CHECK(client.output().empty());
+
+    // Body must match content-length
+    client.receive(client.headers(3, post, 0));
+    client.receive(make_frame(DATA, FLAG_END_STREAM, 3, "12345"));
+    auto frames = client.output();
+    BOOST_REQUIRE_EQUAL(1U, frames.size());
+    BOOST_CHECK_EQUAL(RST_STREAM, frames[0].header.type);
+    BOOST_CHECK_EQUAL(3U, frames[0].header.stream_id);
+    BOOST_CHECK_EQUAL(u32(ERR_PROTOCOL_ERROR), frames[0].payload);
+    BOOST_CHECK_EQUAL(1U, client.requests.size());
+
+    // Response before the request is complete resets the rest of the request
+    client.receive(client.headers(5, post, 0));
+    client.session.send_response(5, Response());
+    frames = client.output();
+    BOOST_REQUIRE_EQUAL(2U, frames.size());
+    BOOST_CHECK_EQUAL(HEADERS, frames[0].header.type);
+    BOOST_CHECK_EQUAL(RST_STREAM, frames[1].header.type);
+    BOOST_CHECK_EQUAL(u32(ERR_NO_ERROR), frames[1].payload);
+    // Further DATA on the closed stream is ignored
+    client.receive(make_frame(DATA, 0, 5, "12345"));
+    BOOST_CHECK(client.output().empty());
+    BOOST_CHECK(!client.session.wants_close());
+}
+
+BOOST_AUTO_TEST_CASE(body_limit)
+{
+    Http2Settings settings;
+    settings.max_body_size = 8;
+    TestClient client(settings);
+    client.start();
+
+    // Rejected by content-length before any DATA
+    HeaderList post = { { ":method", "POST" }, { ":scheme", "http" }, { ":path", "/" }, { "content-length", "10" } };
+    client.receive(client.headers(1, post, 0));
+    auto frames = client.output();
+    BOOST_REQUIRE(!frames.empty());
+    BOOST_CHECK_EQUAL("413", get_header(client.decode(frames[0]), ":status"));
+
+    // Or once the DATA exceeds the limit
+    post.pop_back();
+    client.receive(client.headers(3, post, 0));
+    client.receive(make_frame(DATA, 0, 3, "12345"));
+    BOOST_CHECK(client.output().empty());
+    client.receive(make_frame(DATA, 0, 3, "6789"));
+    frames = client.output();
+    BOOST_REQUIRE(!frames.empty());
+    BOOST_CHECK_EQUAL(3U, frames[0].header.stream_id);
+    BOOST_CHECK_EQUAL("413", get_header(client.decode(frames[0]), ":status"));
+    client.receive(make_frame(DATA, FLAG_END_STREAM, 3, "0"));
+    BOOST_CHECK(client.requests.empty());
+    BOOST_CHECK(!client.session.wants_close());
+}
+
+BOOST_AUTO_TEST_CASE(flow_control)
+{
+    TestClient client;
+    client.start(setting(SETTINGS_INITIAL_WINDOW_SIZE, 10));
+    client.receive(client.get(1, "/"));
+    client.session.send_response(1, text_response(std::string(25, 'x')));
+    auto frames = client.output();
+    BOOST_REQUIRE_EQUAL(2U, frames.size());
+    BOOST_CHECK_EQUAL(DATA, frames[1].header.type);
+    BOOST_CHECK_EQUAL(10U, frames[1].payload.size());
+    BOOST_CHECK_EQUAL(0, frames[1].header.flags);
+    BOOST_CHECK(client.output().empty());
+
+    client.receive(make_frame(WINDOW_UPDATE, 0, 1, u32(5)));
+    frames = client.output();
+    BOOST_REQUIRE_EQUAL(1U, frames.size());
+    BOOST_CHECK_EQUAL(5U, frames[0].payload.size());
+
+    // Changing SETTINGS_INITIAL_WINDOW_SIZE adjusts open streams
+    client.receive(make_frame(SETTINGS, 0, 0, setting(SETTINGS_INITIAL_WINDOW_SIZE, 20)));
+    frames = client.output();
+    BOOST_REQUIRE_EQUAL(2U, frames.size());
+    BOOST_CHECK_EQUAL(SETTINGS, frames[0].header.type);
+    BOOST_CHECK_EQUAL(DATA, frames[1].header.type);
+    BOOST_CHECK_EQUAL(FLAG_END_STREAM, frames[1].header.flags);
+    BOOST_CHECK_EQUAL(10U, frames[1].payload.size());
+    BOOST_CHECK_EQUAL(0U, client.session.active_streams());
+
+    // Request bodies get WINDOW_UPDATE once half the window is used
+    Http2Settings settings;
+    settings.initial_window_size = 65535;
+    TestClient client2(settings);
+    client2.start();
+    client2.receive(client2.headers(1, { { ":method", "POST" }, { ":scheme", "http" }, { ":path", "/" } }, 0));
+    client2.receive(make_frame(DATA, 0, 1, std::string(16000, 'x')));
+    client2.receive(make_frame(DATA, 0, 1, std::string(16000, 'x')));
+    BOOST_CHECK(client2.output().empty());
+    client2.receive(make_frame(DATA, 0, 1, std::string(16000, 'x')));
+    frames = client2.output();
+    BOOST_REQUIRE_EQUAL(2U, frames.size());
+    BOOST_CHECK_EQUAL(WINDOW_UPDATE, frames[0].header.type);
+    BOOST_CHECK_EQUAL(0U, frames[0].header.stream_id);
+    BOOST_CHECK_EQUAL(u32(16000 * 3), frames[0].payload);
+    BOOST_CHECK_EQUAL(1U, frames[1].header.stream_id);
+    BOOST_CHECK_EQUAL(u32(16000 * 3), frames[1].payload);
+
+    // Exceeding the window is an error
+    settings.max_frame_size = 131072;
+    TestClient client3(settings);
+    client3.start();
+    client3.receive(client3.headers(1, { { ":method", "POST" }, { ":scheme", "http" }, { ":path", "/" } }, 0));
+    client3.receive(make_frame(DATA, 0, 1, std::string(70000, 'x')));
+    frames = client3.output();
+    BOOST_REQUIRE(!frames.empty());
+    BOOST_CHECK_EQUAL(GOAWAY, frames.back().header.type);
+    BOOST_CHECK_EQUAL(u32(ERR_FLOW_CONTROL_ERROR), frames.back().payload.substr(4, 4));
+    BOOST_CHECK(client3.session.wants_close());
+}
+
+BOOST_AUTO_TEST_CASE(continuation)
+{
+    TestClient client;
+    client.start();
+    std::string block;
+    client.encoder.encode({ { ":method", "GET" }, { ":scheme", "https" }, { ":path", "/continuation" },
+        { "x-long", std::string(300, 'x') } }, &block);
+    client.receive(make_frame(HEADERS, FLAG_END_STREAM, 1, block.substr(0, 10)));
+    client.receive(make_frame(CONTINUATION, 0, 1, block.substr(10, 100)));
+    BOOST_CHECK(client.requests.empty());
+    client.receive(make_frame(CONTINUATION, FLAG_END_HEADERS, 1, block.substr(110)));
+    BOOST_REQUIRE_EQUAL(1U, client.requests.size());
+    BOOST_CHECK_EQUAL("/continuation", client.requests[0].second.raw_url);
+    BOOST_CHECK_EQUAL(std::string(300, 'x'), client.requests[0].second.headers.get("X-Long"));
+
+    // Large response headers are split
+    auto response = text_response("");
+    response.headers.add("X-Large", std::string(20000, 'y'));
+    client.session.send_response(1, std::move(response));
+    auto frames = client.output();
+    BOOST_REQUIRE_EQUAL(2U, frames.size());
+    BOOST_CHECK_EQUAL(HEADERS, frames[0].header.type);
+    BOOST_CHECK_EQUAL(FLAG_END_STREAM, frames[0].header.flags);
+    BOOST_CHECK_EQUAL(16384U, frames[0].header.length);
+    BOOST_CHECK_EQUAL(CONTINUATION, frames[1].header.type);
+    BOOST_CHECK_EQUAL(FLAG_END_HEADERS, frames[1].header.flags);
+    Frame combined = frames[0];
+    combined.payload += frames[1].payload;
+    BOOST_CHECK_EQUAL(std::string(20000, 'y'), get_header(client.decode(combined), "x-large"));
+
+    // Any other frame interrupting a header block is a connection error
+    client.receive(make_frame(HEADERS, 0, 3, block.substr(0, 10)));
+    client.receive(make_frame(PING, 0, 0, "12345678"));
+    frames = client.output();
+    BOOST_REQUIRE_EQUAL(1U, frames.size());
+    BOOST_CHECK_EQUAL(GOAWAY, frames[0].header.type);
+    BOOST_CHECK_EQUAL(u32(1) + u32(ERR_PROTOCOL_ERROR), frames[0].payload.substr(0, 8));
+    BOOST_CHECK(client.session.wants_close());
+}
+
+BOOST_AUTO_TEST_CASE(stream_errors)
+{
+    Http2Settings settings;
+    settings.max_concurrent_streams = 2;
+    settings.max_header_list_size = 1000;
+    TestClient client(settings);
+    client.start();
+
+    auto check_reset = [&client](uint32_t stream_id, ErrorCode code)
+    {
+        auto frames = client.output();
+        BOOST_REQUIRE_EQUAL(1U, frames.size());
+        BOOST_CHECK_EQUAL(RST_STREAM, frames[0].header.type);
+        BOOST_CHECK_EQUAL(stream_id, frames[0].header.stream_id);
+        BOOST_CHECK_EQUAL(u32(code), frames[0].payload);
+    };
+    client.receive(client.get(1, "/", { { "X-Upper", "value" } }));
+    check_reset(1, ERR_PROTOCOL_ERROR);
+    client.receive(client.get(3, "/", { { "connection", "keep-alive" } }));
+    check_reset(3, ERR_PROTOCOL_ERROR);
+    client.receive(client.headers(5, { { ":method", "GET" }, { ":path", "/" } }, FLAG_END_STREAM));
+    check_reset(5, ERR_PROTOCOL_ERROR);
+    client.receive(client.headers(7, { { ":method", "GET" }, { "accept", "*/*" }, { ":scheme", "http" }, { ":path", "/" } }, FLAG_END_STREAM));
+    check_reset(7, ERR_PROTOCOL_ERROR);
+    BOOST_CHECK(client.requests.empty());
+
+    // Too large headers get a 431 response
+    client.receive(client.get(9, "/", { { "x-large", std::string(1000, 'x') } }));
+    auto frames = client.output();
+    BOOST_REQUIRE_EQUAL(2U, frames.size());
+    BOOST_CHECK_EQUAL("431", get_header(client.decode(frames[0]), ":status"));
+    // Unsupported method gets 501
+    client.receive(client.headers(11, { { ":method", "BREW" }, { ":scheme", "http" }, { ":path", "/" } }, FLAG_END_STREAM));
+    frames = client.output();
+    BOOST_REQUIRE_EQUAL(2U, frames.size());
+    BOOST_CHECK_EQUAL("501", get_header(client.decode(frames[0]), ":status"));
+    BOOST_CHECK(client.requests.empty());
+
+    // Concurrent stream limit
+    client.receive(client.get(13, "/a"));
+    client.receive(client.get(15, "/b"));
+    client.receive(client.get(17, "/c"));
+    check_reset(17, ERR_REFUSED_STREAM);
+    BOOST_CHECK_EQUAL(2U, client.requests.size());
+    BOOST_CHECK_EQUAL(2U, client.session.active_streams());
+
+    // Responses after a client reset are discarded
+    client.receive(make_frame(RST_STREAM, 0, 13, u32(ERR_CANCEL)));
+    client.session.send_response(13, text_response("a"));
+    BOOST_CHECK(client.output().empty());
+    // Responses may be sent in any order
+    client.receive(client.get(19, "/d"));
+    client.session.send_response(19, text_response("d"));
+    client.session.send_response(15, text_response("b"));
+    frames = client.output();
+    BOOST_REQUIRE_EQUAL(4U, frames.size());
+    BOOST_CHECK_EQUAL(19U, frames[0].header.stream_id);
+    BOOST_CHECK_EQUAL(15U, frames[1].header.stream_id);
+    BOOST_CHECK_EQUAL(0U, client.session.active_streams());
+    BOOST_CHECK(!client.session.wants_close());
+}
+
+BOOST_AUTO_TEST_CASE(connection_errors)
+{
+    auto check_goaway = [](const std::string &data, ErrorCode code)
+    {
+        TestClient client;
+        client.receive(std::string(PREFACE, PREFACE_LEN));
+        client.output();
+        client.receive(data);
+        auto frames = client.output();
+        BOOST_REQUIRE(!frames.empty());
+        BOOST_CHECK_EQUAL(GOAWAY, frames.back().header.type);
+        BOOST_CHECK_EQUAL(u32(code), frames.back().payload.substr(4, 4));
+        BOOST_CHECK(client.session.wants_close());
+        // Nothing more is processed
+        client.receive(make_frame(PING, 0, 0, "12345678"));
+        BOOST_CHECK(client.output().empty());
+    };
+    auto settings = make_frame(SETTINGS, 0, 0);
+    check_goaway(make_frame(PING, 0, 0, "12345678"), ERR_PROTOCOL_ERROR);
+    check_goaway(make_frame(SETTINGS, 0, 0, "12345"), ERR_FRAME_SIZE_ERROR);
+    check_goaway(make_frame(SETTINGS, 0, 0, setting(SETTINGS_ENABLE_PUSH, 2)), ERR_PROTOCOL_ERROR);
+    check_goaway(make_frame(SETTINGS, 0, 0, setting(SETTINGS_MAX_FRAME_SIZE, 100)), ERR_PROTOCOL_ERROR);
+    check_goaway(make_frame(SETTINGS, 0, 0, setting(SETTINGS_INITIAL_WINDOW_SIZE, 0x80000000)), ERR_FLOW_CONTROL_ERROR);
+    check_goaway(settings + make_frame(PING, 0, 0, "1234"), ERR_FRAME_SIZE_ERROR);
+    check_goaway(settings + make_frame(DATA, 0, 1, "data"), ERR_PROTOCOL_ERROR);
+    check_goaway(settings + make_frame(HEADERS, FLAG_END_HEADERS, 2, ""), ERR_PROTOCOL_ERROR);
+    check_goaway(settings + make_frame(PUSH_PROMISE, 0, 1, u32(2)), ERR_PROTOCOL_ERROR);
+    check_goaway(settings + make_frame(CONTINUATION, FLAG_END_HEADERS, 1, ""), ERR_PROTOCOL_ERROR);
+    check_goaway(settings + make_frame(WINDOW_UPDATE, 0, 0, u32(0)), ERR_PROTOCOL_ERROR);
+    check_goaway(settings + make_frame(WINDOW_UPDATE, 0, 0, u32(0x7FFFFFFF)), ERR_FLOW_CONTROL_ERROR);
+    check_goaway(settings + make_frame(HEADERS, FLAG_END_HEADERS, 1, "\xff"), ERR_COMPRESSION_ERROR);
+    check_goaway(settings + make_frame(DATA, 0, 1, std::string(16385, 'x')), ERR_FRAME_SIZE_ERROR);
+
+    TestClient client;
+    client.receive("GET / HTTP/1.1\r\n");
+    auto frames = client.output();
+    BOOST_REQUIRE_EQUAL(3U, frames.size());
+    BOOST_CHECK_EQUAL(GOAWAY, frames[2].header.type);
+    BOOST_CHECK(client.session.wants_close());
+
+    // Unknown frame types and PRIORITY are ignored
+    TestClient client2;
+    client2.start();
+    client2.receive(make_frame((FrameType)0xF0, 0xFF, 1, "unknown"));
+    client2.receive(make_frame(PRIORITY, 0, 1, u32(3) + "\x10"));
+    BOOST_CHECK(client2.output().empty());
+    client2.receive(client2.get(1, "/"));
+    BOOST_CHECK_EQUAL(1U, client2.requests.size());
+}
+
+BOOST_AUTO_TEST_CASE(shutdown)
+{
+    TestClient client;
+    client.start();
+    client.receive(client.get(1, "/"));
+    client.session.shutdown();
+    auto frames = client.output();
+    BOOST_REQUIRE_EQUAL(1U, frames.size());
+    BOOST_CHECK_EQUAL(GOAWAY, frames[0].header.type);
+    BOOST_CHECK_EQUAL(u32(1) + u32(ERR_NO_ERROR), frames[0].payload);
+    BOOST_CHECK(!client.session.wants_close());
+
+    // New streams are ignored, but existing ones complete
+    client.receive(client.get(3, "/"));
+    BOOST_CHECK_EQUAL(1U, client.requests.size());
+    client.session.send_response(1, text_response("OK"));
+    BOOST_CHECK_EQUAL(2U, client.output().size());
+    BOOST_CHECK(client.session.wants_close());
+}
+
+class Server : public CoreServer
+{
+protected:
+    virtual Response handle_request(Request &request)override
+    {
+        auto response = text_response(request.raw_url + " " + request.body);
+        response.headers.add("X-Protocol-Host", request.headers.get("Host"));
+        return response;
+    }
+    virtual Response parser_error_page(const ParserError &)override
+    {
+        throw std::runtime_error("Unexpected parser_error_page");
+    }
+};
+
+struct StreamResponse
+{
+    HeaderList headers;
+    std::string body;
+};
+/**Read frames from a blocking socket until count streams have ended.*/
+std::map<uint32_t, StreamResponse> read_responses(TcpSocket &socket, HpackDecoder &decoder, size_t count)
+{
+    std::map<uint32_t, StreamResponse> responses;
+    std::string buffer;
+    while (count > 0)
+    {
+        char tmp[4096];
+        auto len = socket.recv(tmp, sizeof(tmp));
+        BOOST_REQUIRE(len > 0);
+        buffer.append(tmp, len);
+        while (count > 0 && buffer.size() >= FRAME_HEADER_LEN)
+        {
+            auto header = FrameHeader::read((const uint8_t*)buffer.data());
+            if (buffer.size() < FRAME_HEADER_LEN + header.length) break;
+            auto payload = (const uint8_t*)buffer.data() + FRAME_HEADER_LEN;
+            auto &response = responses[header.stream_id];
+            if (header.type == HEADERS)
+            {
+                // Must be decoded in order, to keep the HPACK table in sync
+                BOOST_REQUIRE(header.flags & FLAG_END_HEADERS);
+                decoder.decode(payload, payload + header.length, &response.headers);
+            }
+            else if (header.type == DATA) response.body.append((const char*)payload, header.length);
+            if ((header.type == DATA || header.type == HEADERS) && (header.flags & FLAG_END_STREAM)) --count;
+            buffer.erase(0, FRAME_HEADER_LEN + header.length);
+        }
+    }
+    return responses;
+}
+
+BOOST_AUTO_TEST_CASE(server)
+{
+    TestThread server_thread;
+    Server server;
+    ListenerOptions options;
+    options.http2 = true;
+    server.add_tcp_listener("127.0.0.1", BASE_PORT, options);
+    server_thread = TestThread(std::bind(&Server::run, &server));
+
+    {
+        // HTTP/1.1 still works on the same listener
+        DefaultSocketFactory socket_factory;
+        Request req;
+        req.method = GET;
+        req.headers.add("Host", "localhost");
+        req.raw_url = "/http1";
+        auto resp = Client("localhost", BASE_PORT, false, &socket_factory).make_request(req);
+        BOOST_CHECK_EQUAL(200, resp.status.code);
+        BOOST_CHECK_EQUAL("/http1 ", resp.body);
+    }
+    {
+        TcpSocket socket("localhost", BASE_PORT);
+        HpackEncoder encoder;
+        HpackDecoder decoder;
+        std::string data(PREFACE, PREFACE_LEN);
+        data += make_frame(SETTINGS, 0, 0);
+        std::string block;
+        encoder.encode({ { ":method", "GET" }, { ":scheme", "http" }, { ":path", "/first" },
+            { ":authority", "localhost" } }, &block);
+        data += make_frame(HEADERS, FLAG_END_HEADERS | FLAG_END_STREAM, 1, block);
+        block.clear();
+        encoder.encode({ { ":method", "POST" }, { ":scheme", "http" }, { ":path", "/second" } }, &block);
+        data += make_frame(HEADERS, FLAG_END_HEADERS, 3, block);
+        data += make_frame(DATA, FLAG_END_STREAM, 3, "body");
+        socket.send_all(data.data(), data.size());
+
+        auto responses = read_responses(socket, decoder, 2);
+        auto &first = responses[1];
+        BOOST_CHECK_EQUAL("200", get_header(first.headers, ":status"));
+        BOOST_CHECK_EQUAL("localhost", get_header(first.headers, "x-protocol-host"));
+        BOOST_CHECK_EQUAL("/first ", first.body);
+        auto &second = responses[3];
+        BOOST_CHECK_EQUAL("200", get_header(second.headers, ":status"));
+        BOOST_CHECK_EQUAL("/second body", second.body);
+    }
+
+    server.exit();
+    server_thread.join();
+}
+
+class CachingServer : public Server
+{
+public:
+    std::atomic<int> calls{0};
+protected:
+    virtual Response handle_request(Request &request)override
+    {
+        ++calls;
+        auto response = Server::handle_request(request);
+        response.headers.add("Cache-Control", "max-age=60");
+        return response;
+    }
+};
+
+BOOST_AUTO_TEST_CASE(response_cache)
+{
+    TestThread server_thread;
+    ResponseCache cache(1024 * 1024);
+    CachingServer server;
+    server.set_response_cache(&cache);
+    ListenerOptions options;
+    options.http2 = true;
+    server.add_tcp_listener("127.0.0.1", BASE_PORT + 1, options);
+    server_thread = TestThread(std::bind(&Server::run, &server));
+
+    TcpSocket socket("localhost", BASE_PORT + 1);
+    HpackEncoder encoder;
+    HpackDecoder decoder;
+    std::string data(PREFACE, PREFACE_LEN);
+    data += make_frame(SETTINGS, 0, 0);
+    for (uint32_t stream_id = 1; stream_id <= 3; stream_id += 2)
+    {
+        std::string block;
+        encoder.encode({ { ":method", "GET" }, { ":scheme", "http" }, { ":path", "/cached" },
+            { ":authority", "localhost" } }, &block);
+        data += make_frame(HEADERS, FLAG_END_HEADERS | FLAG_END_STREAM, stream_id, block);
+        socket.send_all(data.data(), data.size());
+        data.clear();
+
+        auto responses = read_responses(socket, decoder, 1);
+        auto &response = responses[stream_id];
+        BOOST_CHECK_EQUAL("200", get_header(response.headers, ":status"));
+        BOOST_CHECK_EQUAL("max-age=60", get_header(response.headers, "cache-control"));
+        BOOST_CHECK_EQUAL("8", get_header(response.headers, "content-length"));
+        BOOST_CHECK_EQUAL("/cached ", response.body);
+    }
+    BOOST_CHECK_EQUAL(1, server.calls);
+    BOOST_CHECK_EQUAL(1U, cache.stats().hits);
+
+    server.exit();
+    server_thread.join();
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,275 @@
+#include <boost/test/unit_test.hpp>
+#include "client/ClientConnection.hpp"
+#include "server/CoreServer.hpp"
+#include "server/ResponseCache.hpp"
+#include "net/TcpSocket.hpp"
+#include "Request.hpp"
+#include "Response.hpp"
+#include "../TestThread.hpp"
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+
+using namespace http;
+
+BOOST_AUTO_TEST_SUITE(TestResponseCache)
+
+static const uint16_t BASE_PORT = 5300;
+
+Request make_request(Method method, const std::string &url)
+{
+    Request req;
+    req.method = method;
+    req.raw_url = url;
+    req.url = Url::parse_request(url);
+    return req;
+}
+Response make_response(const std::string &cache_control, const std::string &body = "body")
+{
+    Response resp;
+    resp.status_code(200);
+    resp.headers.add("Content-Type", "text/plain");
+    resp.headers.add("Cache-Control", cache_control);
+    resp.body = body;
+    return resp;
+}
+
+BOOST_AUTO_TEST_CASE(cacheable)
+{
+    ResponseCache cache(1024 * 1024);
+    auto req = make_request(GET, "/index.html?x=1");
+    BOOST_CHECK(!cache.get(req));
+    BOOST_CHECK(cache.put(req, make_response("max-age=60")));
+
+    auto cached = cache.get(req);
+    BOOST_REQUIRE(cached);
+    BOOST_CHECK_EQUAL("body", cached->body);
+    BOOST_CHECK(cached->head.find("HTTP/1.1 200 OK\r\n") == 0);
+    BOOST_CHECK(cached->head.find("Content-Type: text/plain\r\n") != std::string::npos);
+    BOOST_CHECK(cached->head.find("Content-Length: 4\r\n") != std::string::npos);
+
+    // Headers set by the server are not stored, whatever their case
+    auto lower = make_response("max-age=60");
+    lower.headers.add("connection", "close");
+    lower.headers.add("content-length", "4");
+    lower.headers.add("date", "Thu, 01 Jan 1970 00:00:00 GMT");
+    BOOST_CHECK(cache.put(make_request(GET, "/lower"), lower));
+    auto lower_cached = cache.get(make_request(GET, "/lower"));
+    BOOST_REQUIRE(lower_cached);
+    BOOST_CHECK(lower_cached->head.find("connection") == std::string::npos);
+    BOOST_CHECK(lower_cached->head.find("content-length") == std::string::npos);
+    BOOST_CHECK(lower_cached->head.find("date") == std::string::npos);
+
+    // Different URL or method
+    BOOST_CHECK(!cache.get(make_request(GET, "/index.html")));
+    BOOST_CHECK(!cache.get(make_request(HEAD, "/index.html?x=1")));
+    BOOST_CHECK(!cache.get(make_request(POST, "/index.html?x=1")));
+
+    // Not cacheable
+    BOOST_CHECK(!cache.put(make_request(POST, "/post"), make_response("max-age=60")));
+    BOOST_CHECK(!cache.put(make_request(GET, "/a"), make_response("")));
+    BOOST_CHECK(!cache.put(make_request(GET, "/a"), make_response("max-age=0")));
+    BOOST_CHECK(!cache.put(make_request(GET, "/a"), make_response("no-store, max-age=60")));
+    BOOST_CHECK(!cache.put(make_request(GET, "/a"), make_response("private, max-age=60")));
+    BOOST_CHECK(!cache.put(make_request(GET, "/a"), make_response("max-age=invalid")));
+    auto resp = make_response("max-age=60");
+    resp.headers.add("Set-Cookie", "a=b");
+    BOOST_CHECK(!cache.put(make_request(GET, "/a"), resp));
+    resp = make_response("max-age=60");
+    resp.status_code(500);
+    BOOST_CHECK(!cache.put(make_request(GET, "/a"), resp));
+    resp = make_response("max-age=60");
+    resp.headers.add("Vary", "*");
+    BOOST_CHECK(!cache.put(make_request(GET, "/a"), resp));
+    auto auth_req = make_request(GET, "/a");
+    auth_req.headers.add("Authorization", "Basic eDp5");
+    BOOST_CHECK(!cache.put(auth_req, make_response("max-age=60")));
+    BOOST_CHECK(cache.put(auth_req, make_response("public, max-age=60")));
+
+    auto stats = cache.stats();
+    BOOST_CHECK_EQUAL(3U, stats.stores);
+    BOOST_CHECK_EQUAL(3U, stats.entries);
+    BOOST_CHECK_EQUAL(2U, stats.hits);
+    BOOST_CHECK_EQUAL(3U, stats.misses); // POST is not a cache lookup
+
+    cache.clear();
+    BOOST_CHECK(!cache.get(req));
+    BOOST_CHECK_EQUAL(0U, cache.stats().bytes);
+}
+
+BOOST_AUTO_TEST_CASE(vary)
+{
+    ResponseCache cache(1024 * 1024);
+    auto resp = make_response("max-age=60", "gzip");
+    resp.headers.add("Vary", "Accept-Encoding, Accept-Language");
+
+    auto gzip_req = make_request(GET, "/");
+    gzip_req.headers.add("Accept-Encoding", "gzip");
+    BOOST_CHECK(cache.put(gzip_req, resp));
+
+    auto plain_req = make_request(GET, "/");
+    BOOST_CHECK(!cache.get(plain_req));
+    resp.body = "plain";
+    BOOST_CHECK(cache.put(plain_req, resp));
+
+    BOOST_REQUIRE(cache.get(gzip_req));
+    BOOST_CHECK_EQUAL("gzip", cache.get(gzip_req)->body);
+    BOOST_REQUIRE(cache.get(plain_req));
+    BOOST_CHECK_EQUAL("plain", cache.get(plain_req)->body);
+
+    gzip_req.headers.add("Accept-Language", "en");
+    BOOST_CHECK(!cache.get(gzip_req));
+
+    // Replaces the existing variant
+    resp.body = "plain2";
+    BOOST_CHECK(cache.put(plain_req, resp));
+    BOOST_CHECK_EQUAL("plain2", cache.get(plain_req)->body);
+    BOOST_CHECK_EQUAL(2U, cache.stats().entries);
+}
+
+BOOST_AUTO_TEST_CASE(eviction)
+{
+    // Single shard to make the LRU order predictable
+    ResponseCache cache(2000, 1);
+    std::string body(500, 'x');
+    BOOST_CHECK(cache.put(make_request(GET, "/1"), make_response("max-age=60", body)));
+    BOOST_CHECK(cache.put(make_request(GET, "/2"), make_response("max-age=60", body)));
+    BOOST_CHECK(cache.get(make_request(GET, "/1")));
+    BOOST_CHECK(cache.put(make_request(GET, "/3"), make_response("max-age=60", body)));
+
+    // "/2" was least recently used
+    BOOST_CHECK(cache.get(make_request(GET, "/1")));
+    BOOST_CHECK(!cache.get(make_request(GET, "/2")));
+    BOOST_CHECK(cache.get(make_request(GET, "/3")));
+    BOOST_CHECK_EQUAL(1U, cache.stats().evictions);
+    BOOST_CHECK(cache.stats().bytes <= 2000);
+
+    // Larger than the budget
+    BOOST_CHECK(!cache.put(make_request(GET, "/4"), make_response("max-age=60", std::string(2000, 'x'))));
+}
+
+class Server : public CoreServer
+{
+public:
+    std::atomic<int> calls{0};
+protected:
+    virtual Response handle_request(Request &)override
+    {
+        ++calls;
+        return make_response("max-age=60", "cached body");
+    }
+    virtual Response parser_error_page(const ParserError &)override
+    {
+        throw std::runtime_error("Unexpected parser_error_page");
+    }
+};
+
+BOOST_AUTO_TEST_CASE(server)
+{
+    TestThread server_thread;
+    ResponseCache cache(1024 * 1024);
+    Server server;
+    server.set_response_cache(&cache);
+    server.add_tcp_listener("127.0.0.1", BASE_PORT);
+    server_thread = TestThread(std::bind(&Server::run, &server));
+
+    ClientConnection conn(std::unique_ptr<Socket>(new TcpSocket("localhost", BASE_PORT)));
+    Request req;
+    req.method = GET;
+    req.headers.add("Host", "localhost");
+    req.raw_url = "/index.html";
+    for (int i = 0; i < 3; ++i)
+    {
+        auto resp = conn.make_request(req);
+        BOOST_CHECK_EQUAL(200, resp.status.code);
+        BOOST_CHECK_EQUAL("cached body", resp.body);
+        BOOST_CHECK_EQUAL("keep-alive", resp.headers.get("Connection"));
+        BOOST_CHECK(resp.headers.has("Date"));
+    }
+    BOOST_CHECK_EQUAL(1, server.calls);
+
+    req.method = HEAD;
+    auto resp = conn.make_request(req);
+    BOOST_CHECK_EQUAL(200, resp.status.code);
+    BOOST_CHECK(resp.body.empty());
+    resp = conn.make_request(req);
+    BOOST_CHECK_EQUAL("11", resp.headers.get("Content-Length"));
+    BOOST_CHECK(resp.body.empty());
+    BOOST_CHECK_EQUAL(2, server.calls);
+
+    BOOST_CHECK_EQUAL(3U, cache.stats().hits);
+
+    server.exit();
+    server_thread.join();
+}
+
+class BlockingServer : public Server
+{
+public:
+    void release()
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        released = true;
+        cv.notify_all();
+    }
+protected:
+    virtual Response handle_request(Request &req)override
+    {
+        if (req.raw_url == "/block")
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            cv.wait(lock, [this]() { return released; });
+        }
+        return Server::handle_request(req);
+    }
+private:
+    std::mutex mutex;
+    std::condition_variable cv;
+    bool released = false;
+};
+
+BOOST_AUTO_TEST_CASE(load_shedding)
+{
+    TestThread server_thread;
+    ResponseCache cache(1024 * 1024);
+    BlockingServer server;
+    server.set_response_cache(&cache);
+    LoadShedOptions opts;
+    opts.max_in_flight = 1;
+    opts.max_queued = 0;
+    server.set_load_shedding(opts);
+    server.add_tcp_listener("127.0.0.1", BASE_PORT + 1);
+    server_thread = TestThread(std::bind(&Server::run, &server));
+
+    ClientConnection conn(std::unique_ptr<Socket>(new TcpSocket("localhost", BASE_PORT + 1)));
+    Request req;
+    req.method = GET;
+    req.headers.add("Host", "localhost");
+    req.headers.add("Connection", "keep-alive");
+    req.raw_url = "/index.html";
+    BOOST_CHECK_EQUAL(200, conn.make_request(req).status.code);
+
+    // With the only handler busy, a miss is shed but a hit is still sent
+    TcpSocket blocked("localhost", BASE_PORT + 1);
+    std::string block_req = "GET /block HTTP/1.1\r\nHost: localhost\r\n\r\n";
+    blocked.send_all(block_req.data(), block_req.size());
+    for (int i = 0; i < 100 && server.stats().handlers_in_flight == 0; ++i)
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    BOOST_CHECK_EQUAL(1U, server.stats().handlers_in_flight);
+
+    auto resp = conn.make_request(req);
+    BOOST_CHECK_EQUAL(200, resp.status.code);
+    BOOST_CHECK_EQUAL("cached body", resp.body);
+    req.raw_url = "/other";
+    BOOST_CHECK_EQUAL(503, conn.make_request(req).status.code);
+    BOOST_CHECK_EQUAL(1U, cache.stats().hits);
+    BOOST_CHECK_EQUAL(1U, server.stats().shed_requests);
+
+    server.release();
+    server.exit();
+    server_thread.join();
+}
+
+BOOST_AUTO_TEST_SUITE_END()
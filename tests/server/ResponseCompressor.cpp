@@ -0,0 +1,260 @@
+#include <boost/test/unit_test.hpp>
+#include "client/ClientConnection.hpp"
+#include "server/CoreServer.hpp"
+#include "server/ResponseCompressor.hpp"
+#include "util/Compressor.hpp"
+#include "util/File.hpp"
+#include "net/TcpSocket.hpp"
+#include "Request.hpp"
+#include "Response.hpp"
+#include "../TestThread.hpp"
+#include <fstream>
+#include <sstream>
+#include <zlib.h>
+
+using namespace http;
+
+BOOST_AUTO_TEST_SUITE(TestResponseCompressor)
+
+static const uint16_t BASE_PORT = 5310;
+
+/**Decompress gzip or zlib format data.*/
+std::string inflate(const std::string &data)
+{
+    z_stream stream = {};
+    // +32 detects gzip or zlib headers
+    BOOST_REQUIRE_EQUAL(Z_OK, inflateInit2(&stream, 15 + 32));
+    std::string out;
+    stream.next_in = (Bytef*)data.data();
+    stream.avail_in = (uInt)data.size();
+    int ret;
+    do
+    {
+        char buffer[4096];
+        stream.next_out = (Bytef*)buffer;
+        stream.avail_out = sizeof(buffer);
+        ret = inflate(&stream, Z_NO_FLUSH);
+        out.append(buffer, sizeof(buffer) - stream.avail_out);
+    }
+    while (ret == Z_OK);
+    inflateEnd(&stream);
+    BOOST_CHECK_EQUAL(Z_STREAM_END, ret);
+    return out;
+}
+std::string make_text(size_t len)
+{
+    std::string text;
+    for (size_t i = 0; text.size() < len; ++i) text += "Line " + std::to_string(i % 100) + " of text\n";
+    text.resize(len);
+    return text;
+}
+Request make_request(const std::string &accept_encoding)
+{
+    Request req;
+    req.method = GET;
+    req.raw_url = "/";
+    req.url = Url::parse_request("/");
+    if (!accept_encoding.empty()) req.headers.add("Accept-Encoding", accept_encoding);
+    return req;
+}
+Response make_response(const std::string &content_type, const std::string &body)
+{
+    Response resp;
+    resp.status_code(200);
+    resp.headers.add("Content-Type", content_type);
+    resp.body = body;
+    return resp;
+}
+
+BOOST_AUTO_TEST_CASE(compressor)
+{
+    auto text = make_text(100000);
+    BOOST_CHECK(Compressor::supported("gzip"));
+    BOOST_CHECK(Compressor::supported("deflate"));
+    BOOST_CHECK(!Compressor::supported("compress"));
+    BOOST_CHECK_THROW(Compressor("compress"), std::invalid_argument);
+
+    auto gzip = Compressor::compress("gzip", text.data(), text.size());
+    BOOST_CHECK(gzip.size() < text.size() / 5);
+    BOOST_CHECK_EQUAL('\x1f', gzip[0]); // gzip magic
+    BOOST_CHECK(inflate(gzip) == text);
+
+    // Incremental input gives the same data
+    Compressor compressor("deflate", 9);
+    std::string deflate;
+    for (size_t i = 0; i < text.size(); i += 1000) compressor.write(text.data() + i, 1000, &deflate);
+    compressor.finish(&deflate);
+    BOOST_CHECK_EQUAL('\x78', deflate[0]); // zlib header
+    BOOST_CHECK(inflate(deflate) == text);
+
+    BOOST_CHECK(inflate(Compressor::compress("gzip", "", 0)).empty());
+
+#ifdef HTTP_USE_BROTLI
+    BOOST_CHECK(Compressor::supported("br"));
+    auto br = Compressor::compress("br", text.data(), text.size());
+    BOOST_CHECK(!br.empty() && br.size() < text.size() / 5);
+#else
+    BOOST_CHECK(!Compressor::supported("br"));
+#endif
+}
+
+BOOST_AUTO_TEST_CASE(negotiate)
+{
+    ResponseCompressor compressor;
+    auto text = make_text(4000);
+
+    auto resp = make_response("text/html; charset=utf-8", text);
+    BOOST_CHECK(compressor.compress(make_request("deflate, gzip;q=0.5"), resp));
+    BOOST_CHECK_EQUAL("deflate", resp.headers.get("Content-Encoding"));
+    BOOST_CHECK_EQUAL("Accept-Encoding", resp.headers.get("Vary"));
+    BOOST_CHECK(inflate(resp.body) == text);
+
+    resp = make_response("application/json", text);
+    resp.headers.add("Vary", "Accept-Language");
+    BOOST_CHECK(compressor.compress(make_request("gzip, deflate"), resp));
+    BOOST_CHECK_EQUAL("gzip", resp.headers.get("Content-Encoding"));
+    BOOST_CHECK_EQUAL("Accept-Language, Accept-Encoding", resp.headers.get("Vary"));
+
+    // Not accepted, but still varies
+    resp = make_response("text/plain", text);
+    BOOST_CHECK(!compressor.compress(make_request("compress"), resp));
+    BOOST_CHECK(!resp.headers.has("Content-Encoding"));
+    BOOST_CHECK_EQUAL("Accept-Encoding", resp.headers.get("Vary"));
+    BOOST_CHECK(resp.body == text);
+    BOOST_CHECK(!compressor.compress(make_request(""), resp));
+    BOOST_CHECK(!compressor.compress(make_request("gzip;q=0"), resp));
+    BOOST_CHECK(!compressor.compress(make_request("gzip;invalid"), resp));
+    BOOST_CHECK_EQUAL("Accept-Encoding", resp.headers.get("Vary"));
+
+    // Not compressible
+    resp = make_response("image/png", text);
+    BOOST_CHECK(!compressor.compress(make_request("gzip"), resp));
+    BOOST_CHECK(!resp.headers.has("Vary"));
+    resp = make_response("text/plain", text.substr(0, 100));
+    BOOST_CHECK(!compressor.compress(make_request("gzip"), resp));
+    resp = make_response("text/plain", text);
+    resp.status_code(206);
+    BOOST_CHECK(!compressor.compress(make_request("gzip"), resp));
+    resp = make_response("text/plain", text);
+    resp.headers.add("Content-Encoding", "br");
+    BOOST_CHECK(!compressor.compress(make_request("gzip"), resp));
+
+    CompressionOptions options;
+    options.codings = { "gzip" };
+    options.min_size = 10;
+    options.content_types = { "image/png" };
+    ResponseCompressor compressor2(options);
+    resp = make_response("image/png", text.substr(0, 100));
+    BOOST_CHECK(compressor2.compress(make_request("deflate, gzip;q=0.1"), resp));
+    BOOST_CHECK_EQUAL("gzip", resp.headers.get("Content-Encoding"));
+
+    auto stats = compressor.stats();
+    BOOST_CHECK_EQUAL(2U, stats.responses);
+    BOOST_CHECK_EQUAL(8000U, stats.bytes_in);
+    BOOST_CHECK(stats.bytes_out < stats.bytes_in);
+    BOOST_CHECK(stats.cpu_time.count() > 0);
+}
+
+BOOST_AUTO_TEST_CASE(file_and_cache)
+{
+    const char *path = "compressor-test.txt";
+    auto text = make_text(300000);
+    {
+        std::ofstream os(path, std::ios::binary);
+        os << text;
+    }
+    ResponseCompressor compressor;
+    for (int i = 0; i < 2; ++i)
+    {
+        Response resp;
+        resp.status_code(200);
+        resp.headers.add("Content-Type", "text/plain");
+        resp.headers.add("ETag", "\"v1\"");
+        resp.body_file = std::make_shared<File>(path);
+        BOOST_CHECK(compressor.compress(make_request("gzip"), resp));
+        BOOST_CHECK(!resp.body_file);
+        BOOST_CHECK_EQUAL("W/\"v1\"", resp.headers.get("ETag"));
+        BOOST_CHECK(inflate(resp.body) == text);
+    }
+    std::remove(path);
+
+    auto stats = compressor.stats();
+    BOOST_CHECK_EQUAL(2U, stats.responses);
+    BOOST_CHECK_EQUAL(1U, stats.cache_hits);
+    BOOST_CHECK_EQUAL(text.size(), stats.bytes_in);
+
+    // Weak ETags are not cached
+    for (int i = 0; i < 2; ++i)
+    {
+        auto resp = make_response("text/plain", text);
+        resp.headers.add("ETag", "W/\"v1\"");
+        BOOST_CHECK(compressor.compress(make_request("gzip"), resp));
+        BOOST_CHECK_EQUAL("W/\"v1\"", resp.headers.get("ETag"));
+    }
+    BOOST_CHECK_EQUAL(1U, compressor.stats().cache_hits);
+
+    // Larger than max_size, so sent from the file rather than buffered compressed
+    {
+        std::ofstream os(path, std::ios::binary);
+        os << make_text(CompressionOptions().max_size + 1);
+    }
+    Response large;
+    large.status_code(200);
+    large.headers.add("Content-Type", "text/plain");
+    large.body_file = std::make_shared<File>(path);
+    BOOST_CHECK(!compressor.compress(make_request("gzip"), large));
+    BOOST_CHECK(large.body_file);
+    large.body_file.reset();
+    std::remove(path);
+}
+
+class Server : public CoreServer
+{
+public:
+    std::string text = make_text(50000);
+protected:
+    virtual Response handle_request(Request &)override
+    {
+        return make_response("text/plain", text);
+    }
+    virtual Response parser_error_page(const ParserError &)override
+    {
+        throw std::runtime_error("Unexpected parser_error_page");
+    }
+};
+
+BOOST_AUTO_TEST_CASE(server)
+{
+    TestThread server_thread;
+    ResponseCompressor compressor;
+    Server server;
+    server.set_response_compressor(&compressor);
+    server.add_tcp_listener("127.0.0.1", BASE_PORT);
+    server_thread = TestThread(std::bind(&Server::run, &server));
+
+    ClientConnection conn(std::unique_ptr<Socket>(new TcpSocket("localhost", BASE_PORT)));
+    Request req;
+    req.method = GET;
+    req.headers.add("Host", "localhost");
+    req.raw_url = "/";
+    auto resp = conn.make_request(req);
+    BOOST_CHECK_EQUAL(200, resp.status.code);
+    BOOST_CHECK(!resp.headers.has("Content-Encoding"));
+    BOOST_CHECK(resp.body == server.text);
+
+    req.headers.add("Accept-Encoding", "gzip");
+    resp = conn.make_request(req);
+    BOOST_CHECK_EQUAL(200, resp.status.code);
+    BOOST_CHECK_EQUAL("gzip", resp.headers.get("Content-Encoding"));
+    BOOST_CHECK_EQUAL(std::to_string(resp.body.size()), resp.headers.get("Content-Length"));
+    BOOST_CHECK(inflate(resp.body) == server.text);
+
+    auto stats = server.stats();
+    BOOST_CHECK_EQUAL(1U, stats.compressed_responses);
+    BOOST_CHECK(stats.compression_time.count() > 0);
+
+    server.exit();
+    server_thread.join();
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -82,4 +82,74 @@ BOOST_AUTO_TEST_CASE(path_params)
     BOOST_CHECK_THROW(router.add("GET", "/forums/:forum_name2/unread", handler), InvalidRouteError);
 }
 
+BOOST_AUTO_TEST_CASE(async)
+{
+    Router router;
+    BOOST_CHECK_NO_THROW(router.add("GET", "/items/:id", handler));
+    BOOST_CHECK_NO_THROW(router.add_async("POST", "/items/:id", [](Request &, PathParams &params, Responder responder)
+    {
+        Response resp;
+        resp.status_code(201);
+        resp.body = params["id"];
+        responder.send(std::move(resp));
+    }));
+    BOOST_CHECK_THROW(router.add_async("GET", "/items/:id", nullptr), InvalidRouteError);
+
+    Request req;
+    Response result;
+    bool failed = true;
+    Responder responder([&](Response &&resp, bool f) { result = std::move(resp); failed = f; });
+    auto route = router.get("POST", "/items/5");
+    BOOST_CHECK(route);
+    BOOST_CHECK(!route.handler);
+    route.respond(req, responder);
+    BOOST_CHECK(!failed);
+    BOOST_CHECK_EQUAL(201, result.status.code);
+    BOOST_CHECK_EQUAL("5", result.body);
+
+    // Exceptions from synchronous handlers are sent as errors
+    route = router.get("GET", "/items/5");
+    BOOST_CHECK(route.handler);
+    BOOST_CHECK(!route.async_handler);
+    route.respond(req, Responder([&](Response &&resp, bool f) { result = std::move(resp); failed = f; }));
+    BOOST_CHECK(failed);
+    BOOST_CHECK_EQUAL(500, result.status.code);
+    BOOST_CHECK_EQUAL("Not implemented", result.body);
+
+    // A responder dropped without responding sends an error
+    Responder([&](Response &&resp, bool f) { result = std::move(resp); failed = f; });
+    BOOST_CHECK_EQUAL(500, result.status.code);
+}
+
+#ifdef HTTP_USE_COROUTINES
+Task<std::string> load_item(const std::string &id)
+{
+    if (id == "missing") throw NotFound("/items/" + id);
+    co_return "item " + id;
+}
+BOOST_AUTO_TEST_CASE(coroutine)
+{
+    Router router;
+    router.add_coroutine("GET", "/items/:id", [](Request &, PathParams params) -> Task<Response>
+    {
+        Response resp;
+        resp.status_code(200);
+        resp.body = co_await load_item(params["id"]);
+        co_return resp;
+    });
+
+    Request req;
+    Response result;
+    auto respond = [&](const std::string &path)
+    {
+        router.get("GET", path).respond(req, Responder([&](Response &&resp, bool) { result = std::move(resp); }));
+    };
+    respond("/items/5");
+    BOOST_CHECK_EQUAL(200, result.status.code);
+    BOOST_CHECK_EQUAL("item 5", result.body);
+    respond("/items/missing");
+    BOOST_CHECK_EQUAL(404, result.status.code);
+}
+#endif
+
 BOOST_AUTO_TEST_SUITE_END()
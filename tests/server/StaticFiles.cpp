@@ -0,0 +1,212 @@
+#include <boost/test/unit_test.hpp>
+#include "client/Client.hpp"
+#include "client/SocketFactory.hpp"
+#include "server/CoreServer.hpp"
+#include "server/StaticFiles.hpp"
+#include "util/File.hpp"
+#include "net/Cert.hpp"
+#include "Error.hpp"
+#include "Response.hpp"
+#include "Time.hpp"
+#include "../TestThread.hpp"
+#include <cstdio>
+#include <fstream>
+#include <sstream>
+
+using namespace http;
+
+BOOST_AUTO_TEST_SUITE(TestStaticFiles)
+
+static const uint16_t BASE_PORT = 5200;
+
+std::string read_file(const std::string &path)
+{
+    std::ifstream is(path, std::ios::binary);
+    std::stringstream ss;
+    ss << is.rdbuf();
+    return ss.str();
+}
+
+Response get(const StaticFiles &files, const std::string &path, const Headers &headers = Headers())
+{
+    Request req;
+    req.method = GET;
+    req.raw_url = path;
+    req.url = Url::parse_request(path);
+    req.headers = headers;
+    PathParams params;
+    return files(req, params);
+}
+
+BOOST_AUTO_TEST_CASE(paths)
+{
+    StaticFiles files("/files/", ".");
+
+    auto resp = get(files, "/files/localhost.crt");
+    BOOST_CHECK_EQUAL(200, resp.status.code);
+    BOOST_REQUIRE(resp.body_file);
+    BOOST_CHECK(resp.body.empty());
+    BOOST_CHECK_EQUAL(read_file("localhost.crt").size(), resp.body_file->size());
+    BOOST_CHECK_EQUAL("application/octet-stream", resp.headers.get("Content-Type"));
+
+    resp = get(files, "/files/tests/%73erver/StaticFiles.cpp");
+    BOOST_CHECK_EQUAL(200, resp.status.code);
+    BOOST_CHECK_EQUAL("application/octet-stream", resp.headers.get("Content-Type"));
+    files.set_content_type("cpp", "text/x-c");
+    resp = get(files, "/files//tests/server/StaticFiles.cpp");
+    BOOST_CHECK_EQUAL("text/x-c", resp.headers.get("Content-Type"));
+
+    BOOST_CHECK_THROW(get(files, "/files/not-found.txt"), NotFound);
+    BOOST_CHECK_THROW(get(files, "/files/tests"), NotFound);
+    BOOST_CHECK_THROW(get(files, "/files/"), NotFound);
+    BOOST_CHECK_THROW(get(files, "/files/tests/../localhost.crt"), NotFound);
+    BOOST_CHECK_THROW(get(files, "/files/tests/%2E%2E/localhost.crt"), NotFound);
+    BOOST_CHECK_THROW(get(files, "/files/tests%2F..%2Flocalhost.crt"), NotFound);
+    BOOST_CHECK_THROW(get(files, "/other/localhost.crt"), NotFound);
+    BOOST_CHECK_THROW(get(files, "/fileslocalhost.crt"), NotFound);
+    BOOST_CHECK_THROW(get(files, "/files./localhost.crt"), NotFound);
+
+    // The URL is decoded once, so file names may contain '%'
+    const char *percent_path = "static-files-100%.txt";
+    {
+        std::ofstream os(percent_path, std::ios::binary);
+        os << "percent";
+    }
+    resp = get(files, "/files/static-files-100%25.txt");
+    BOOST_REQUIRE(resp.body_file);
+    BOOST_CHECK_EQUAL(7U, resp.body_file->size());
+    BOOST_CHECK_THROW(get(files, "/files/static-files-100%2525.txt"), NotFound);
+    std::remove(percent_path);
+}
+
+BOOST_AUTO_TEST_CASE(conditional)
+{
+    StaticFiles files("/files", ".");
+    FileInfo info;
+    BOOST_REQUIRE(File::stat("localhost.crt", &info));
+    auto etag = StaticFiles::make_etag(info.size, info.mtime);
+
+    auto resp = get(files, "/files/localhost.crt");
+    BOOST_CHECK_EQUAL(etag, resp.headers.get("ETag"));
+    BOOST_CHECK_EQUAL(format_time(info.mtime), resp.headers.get("Last-Modified"));
+
+    Headers headers;
+    headers.add("If-None-Match", "\"other\", " + etag);
+    resp = get(files, "/files/localhost.crt", headers);
+    BOOST_CHECK_EQUAL(304, resp.status.code);
+    BOOST_CHECK(!resp.body_file);
+    BOOST_CHECK_EQUAL(etag, resp.headers.get("ETag"));
+
+    headers = Headers();
+    headers.add("If-None-Match", "W/" + etag);
+    BOOST_CHECK_EQUAL(304, get(files, "/files/localhost.crt", headers).status.code);
+
+    headers = Headers();
+    headers.add("If-None-Match", "\"other\"");
+    // If-None-Match takes precedence
+    headers.add("If-Modified-Since", format_time(info.mtime));
+    BOOST_CHECK_EQUAL(200, get(files, "/files/localhost.crt", headers).status.code);
+
+    headers = Headers();
+    headers.add("If-Modified-Since", format_time(info.mtime));
+    BOOST_CHECK_EQUAL(304, get(files, "/files/localhost.crt", headers).status.code);
+
+    headers = Headers();
+    headers.add("If-Modified-Since", format_time(info.mtime - 1));
+    BOOST_CHECK_EQUAL(200, get(files, "/files/localhost.crt", headers).status.code);
+
+    headers = Headers();
+    headers.add("If-Modified-Since", "invalid");
+    BOOST_CHECK_EQUAL(200, get(files, "/files/localhost.crt", headers).status.code);
+}
+
+BOOST_AUTO_TEST_CASE(cache)
+{
+    const char *path = "static-files-test.txt";
+    {
+        std::ofstream os(path, std::ios::binary);
+        os << "first";
+    }
+    StaticFiles files("/files", ".");
+    files.set_revalidate_interval(std::chrono::hours(1));
+
+    auto resp = get(files, "/files/static-files-test.txt");
+    BOOST_CHECK_EQUAL("text/plain", resp.headers.get("Content-Type"));
+    BOOST_CHECK_EQUAL(5U, resp.body_file->size());
+    auto first_file = resp.body_file;
+    // Copies share the cached open file
+    StaticFiles files2 = files;
+    BOOST_CHECK_EQUAL(first_file, get(files2, "/files/static-files-test.txt").body_file);
+
+    {
+        std::ofstream os(path, std::ios::binary);
+        os << "second version";
+    }
+    // Not revalidated yet
+    BOOST_CHECK_EQUAL(first_file, get(files, "/files/static-files-test.txt").body_file);
+
+    files.set_revalidate_interval(std::chrono::seconds(0));
+    resp = get(files, "/files/static-files-test.txt");
+    BOOST_CHECK_EQUAL(14U, resp.body_file->size());
+    char buffer[32];
+    BOOST_CHECK_EQUAL(14U, resp.body_file->read(buffer, sizeof(buffer), 0));
+    BOOST_CHECK_EQUAL("second version", std::string(buffer, 14));
+    BOOST_CHECK_EQUAL(7U, resp.body_file->read(buffer, sizeof(buffer), 7));
+    BOOST_CHECK_EQUAL("version", std::string(buffer, 7));
+
+    std::remove(path);
+    BOOST_CHECK_THROW(get(files, "/files/static-files-test.txt"), NotFound);
+}
+
+class Server : public CoreServer
+{
+public:
+    Server() : files("/files", ".") {}
+protected:
+    StaticFiles files;
+
+    virtual Response handle_request(Request &req)override
+    {
+        PathParams params;
+        return files(req, params);
+    }
+    virtual Response parser_error_page(const ParserError &)override
+    {
+        throw std::runtime_error("Unexpected parser_error_page");
+    }
+};
+
+BOOST_AUTO_TEST_CASE(server)
+{
+    TestThread server_thread;
+    Server server;
+    server.add_tcp_listener("127.0.0.1", BASE_PORT + 0);
+    server.add_tls_listener("127.0.0.1", BASE_PORT + 1, load_pfx_cert("localhost.pfx", "password"));
+    server_thread = TestThread(std::bind(&Server::run, &server));
+
+    DefaultSocketFactory socket_factory;
+    auto expected = read_file("tests/server/StaticFiles.cpp");
+    for (uint16_t port = BASE_PORT; port <= BASE_PORT + 1; ++port)
+    {
+        Request req;
+        req.method = GET;
+        req.headers.add("Host", "localhost");
+        req.raw_url = "/files/tests/server/StaticFiles.cpp";
+
+        Client client("localhost", port, port != BASE_PORT, &socket_factory);
+        auto resp = client.make_request(req);
+        BOOST_CHECK_EQUAL(200, resp.status.code);
+        BOOST_CHECK(resp.body == expected);
+
+        req.method = HEAD;
+        resp = client.make_request(req);
+        BOOST_CHECK_EQUAL(200, resp.status.code);
+        BOOST_CHECK_EQUAL(std::to_string(expected.size()), resp.headers.get("Content-Length"));
+        BOOST_CHECK(resp.body.empty());
+    }
+
+    server.exit();
+    server_thread.join();
+}
+
+BOOST_AUTO_TEST_SUITE_END()
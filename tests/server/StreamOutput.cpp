@@ -0,0 +1,80 @@
+#include <boost/test/unit_test.hpp>
+#include "server/StreamOutput.hpp"
+
+using namespace http;
+
+BOOST_AUTO_TEST_SUITE(TestStreamOutput)
+
+static std::shared_ptr<const std::string> data(size_t len, char c = 'x')
+{
+    return std::make_shared<std::string>(len, c);
+}
+
+BOOST_AUTO_TEST_CASE(batching)
+{
+    StreamOutput output;
+    int notified = 0;
+    output.attach([&notified]() { ++notified; });
+    BOOST_CHECK(!output.take());
+
+    auto large = data(StreamOutput::BATCH_SIZE);
+    BOOST_CHECK_EQUAL(StreamOutput::QUEUED, output.queue(large));
+    BOOST_CHECK_EQUAL(StreamOutput::QUEUED, output.queue(data(1, 'a')));
+    BOOST_CHECK_EQUAL(StreamOutput::QUEUED, output.queue(data(2, 'b')));
+    BOOST_CHECK_EQUAL(1, notified); // Only when output was empty
+    BOOST_CHECK_EQUAL(StreamOutput::BATCH_SIZE + 3, output.buffered_amount());
+
+    // A full size buffer is not copied, and the small ones after it are combined
+    BOOST_CHECK(output.take() == large);
+    BOOST_CHECK_EQUAL("abb", *output.take());
+    BOOST_CHECK(!output.take());
+    BOOST_CHECK_EQUAL(0U, output.buffered_amount());
+}
+
+BOOST_AUTO_TEST_CASE(close)
+{
+    StreamOutput output;
+    int notified = 0;
+    output.attach([&notified]() { ++notified; });
+    BOOST_CHECK_EQUAL(StreamOutput::QUEUED, output.queue(data(4), true));
+    BOOST_CHECK(output.closed());
+    BOOST_CHECK(!output.is_open());
+    BOOST_CHECK_EQUAL(StreamOutput::CLOSED, output.queue(data(4)));
+    BOOST_CHECK(!output.close());
+    BOOST_CHECK_EQUAL(1, notified);
+    BOOST_CHECK_EQUAL(4U, output.take()->size());
+
+    StreamOutput idle;
+    idle.attach([&notified]() { ++notified; });
+    BOOST_CHECK(idle.close());
+    BOOST_CHECK_EQUAL(2, notified);
+
+    StreamOutput detached;
+    detached.queue(data(4));
+    detached.detach();
+    BOOST_CHECK(!detached.is_open());
+    BOOST_CHECK(!detached.closed());
+    BOOST_CHECK(!detached.take());
+    BOOST_CHECK_EQUAL(StreamOutput::CLOSED, detached.queue(data(4)));
+}
+
+BOOST_AUTO_TEST_CASE(max_bytes)
+{
+    StreamOutput dropping(10);
+    BOOST_CHECK_EQUAL(StreamOutput::QUEUED, dropping.queue(data(6)));
+    BOOST_CHECK_EQUAL(StreamOutput::FULL, dropping.queue(data(6)));
+    BOOST_CHECK_EQUAL(StreamOutput::QUEUED, dropping.queue(data(4)));
+    BOOST_CHECK_EQUAL(1U, dropping.dropped());
+    BOOST_CHECK(dropping.is_open());
+    dropping.take();
+    BOOST_CHECK_EQUAL(StreamOutput::QUEUED, dropping.queue(data(6)));
+
+    StreamOutput closing(10, true);
+    BOOST_CHECK_EQUAL(StreamOutput::QUEUED, closing.queue(data(6)));
+    BOOST_CHECK_EQUAL(StreamOutput::FULL, closing.queue(data(6)));
+    BOOST_CHECK(closing.closed());
+    BOOST_CHECK_EQUAL(StreamOutput::CLOSED, closing.queue(data(1)));
+    BOOST_CHECK_EQUAL(6U, closing.take()->size());
+}
+
+BOOST_AUTO_TEST_SUITE_END()
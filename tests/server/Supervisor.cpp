@@ -0,0 +1,186 @@
+#include <boost/test/unit_test.hpp>
+#include "server/Supervisor.hpp"
+#include "net/Net.hpp"
+#include "net/TcpSocket.hpp"
+#include "Response.hpp"
+#include "../TestThread.hpp"
+#include <chrono>
+#include <set>
+#include <thread>
+#ifndef _WIN32
+#include <signal.h>
+#include <unistd.h>
+
+using namespace http;
+
+BOOST_AUTO_TEST_SUITE(TestSupervisor)
+
+static const uint16_t BASE_PORT = 5330;
+
+/**Responds with the worker process ID.*/
+class PidServer : public CoreServer
+{
+protected:
+    virtual Response handle_request(Request &)override
+    {
+        Response resp;
+        resp.status_code(200);
+        resp.headers.add("Content-Type", "text/plain");
+        resp.body = std::to_string(getpid());
+        return resp;
+    }
+    virtual Response parser_error_page(const ParserError &)override
+    {
+        throw std::runtime_error("Unexpected parser_error_page");
+    }
+};
+/**Make a request, returning the body, or an empty string if no worker is listening.*/
+std::string get_body(uint16_t port, const std::string &path)
+{
+    try
+    {
+        TcpSocket sock("127.0.0.1", port);
+        std::string req = "GET " + path + " HTTP/1.1\r\nHost: localhost\r\nConnection: close\r\n\r\n";
+        sock.send_all(req.data(), req.size());
+        std::string resp;
+        char buffer[1024];
+        while (auto len = sock.recv(buffer, sizeof(buffer))) resp.append(buffer, len);
+        auto body = resp.find("\r\n\r\n");
+        return body == std::string::npos ? std::string() : resp.substr(body + 4);
+    }
+    catch (const NetworkError &)
+    {
+        return std::string();
+    }
+}
+std::string get_pid()
+{
+    return get_body(BASE_PORT, "/");
+}
+/**The http_requests_total value for 2xx responses in rendered metrics, or -1.*/
+int requests_2xx(const std::string &metrics)
+{
+    static const std::string SERIES = "http_requests_total{code=\"2xx\"} ";
+    auto pos = metrics.find(SERIES);
+    return pos == std::string::npos ? -1 : std::stoi(metrics.substr(pos + SERIES.size()));
+}
+template<class F> bool wait_until(F f)
+{
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(5);
+    while (!f())
+    {
+        if (std::chrono::steady_clock::now() > deadline) return false;
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+    return true;
+}
+
+BOOST_AUTO_TEST_CASE(workers)
+{
+    SupervisorOptions opts;
+    opts.workers = 2;
+    opts.restart_delay = std::chrono::milliseconds(100);
+    opts.drain_timeout = std::chrono::seconds(1);
+    opts.stats_interval = std::chrono::milliseconds(10);
+    Supervisor supervisor(opts, [](unsigned)
+    {
+        std::unique_ptr<CoreServer> server(new PidServer());
+        ListenerOptions listener;
+        listener.reuse_port = true;
+        server->add_tcp_listener("127.0.0.1", BASE_PORT, listener);
+        return server;
+    });
+    BOOST_CHECK_EQUAL(2U, supervisor.workers());
+    TestThread supervisor_thread(std::bind(&Supervisor::run, &supervisor));
+
+    // The OS spreads connections over both workers
+    std::set<std::string> pids;
+    BOOST_CHECK(wait_until([&pids]()
+    {
+        auto pid = get_pid();
+        if (!pid.empty()) pids.insert(pid);
+        return pids.size() == 2;
+    }));
+    auto stats = supervisor.stats();
+    BOOST_CHECK(pids.count(std::to_string(stats[0].pid)));
+    BOOST_CHECK(pids.count(std::to_string(stats[1].pid)));
+
+    // Stats are shared with the supervisor
+    {
+        TcpSocket idle("127.0.0.1", BASE_PORT);
+        BOOST_CHECK(wait_until([&supervisor]() { return supervisor.server_stats().connections == 1; }));
+    }
+
+    // A crashed worker is restarted
+    auto crashed = stats[0].pid;
+    kill(crashed, SIGKILL);
+    BOOST_CHECK(wait_until([&supervisor, crashed]()
+    {
+        auto worker = supervisor.stats()[0];
+        return worker.restarts == 1 && worker.pid && worker.pid != crashed;
+    }));
+    BOOST_CHECK_EQUAL(0U, supervisor.stats()[1].restarts);
+    BOOST_CHECK(wait_until([]() { return !get_pid().empty(); }));
+
+    supervisor.exit();
+    supervisor_thread.join();
+    for (auto &worker : supervisor.stats()) BOOST_CHECK_EQUAL(0, worker.pid);
+    BOOST_CHECK_EQUAL("", get_pid());
+}
+
+BOOST_AUTO_TEST_CASE(metrics)
+{
+    const uint16_t port = BASE_PORT + 1;
+    SupervisorOptions opts;
+    opts.workers = 2;
+    opts.drain_timeout = std::chrono::seconds(1);
+    opts.stats_interval = std::chrono::milliseconds(10);
+    Supervisor supervisor(opts, [port](unsigned)
+    {
+        // Never destroyed, as the worker process exits without returning
+        auto metrics = new Metrics();
+        std::unique_ptr<CoreServer> server(new PidServer());
+        server->set_metrics(metrics);
+        ListenerOptions listener;
+        listener.reuse_port = true;
+        server->add_tcp_listener("127.0.0.1", port, listener);
+        return server;
+    });
+    TestThread supervisor_thread(std::bind(&Supervisor::run, &supervisor));
+
+    // Spread over both workers
+    std::set<std::string> pids;
+    int requests = 0;
+    BOOST_CHECK(wait_until([&pids, &requests, port]()
+    {
+        auto pid = get_body(port, "/");
+        if (!pid.empty())
+        {
+            pids.insert(pid);
+            ++requests;
+        }
+        return pids.size() == 2;
+    }));
+    for (int i = 0; i < 10; ++i)
+    {
+        if (!get_body(port, "/").empty()) ++requests;
+    }
+    BOOST_CHECK(wait_until([&supervisor, requests]()
+    {
+        return requests_2xx(supervisor.metrics().render()) == requests;
+    }));
+
+    // Any worker serves the total. Scrapes are counted as well.
+    for (int i = 0; i < 4; ++i)
+    {
+        auto body = get_body(port, "/metrics");
+        BOOST_CHECK_MESSAGE(requests_2xx(body) >= requests, body);
+    }
+
+    supervisor.exit();
+    supervisor_thread.join();
+    BOOST_CHECK_EQUAL("", supervisor.metrics().render());
+}
+
+BOOST_AUTO_TEST_SUITE_END()
+#endif
@@ -0,0 +1,418 @@
+#include <boost/test/unit_test.hpp>
+#include "server/CoreServer.hpp"
+#include "server/Router.hpp"
+#include "server/WebSocket.hpp"
+#include "net/TcpSocket.hpp"
+#include "Error.hpp"
+#include "Response.hpp"
+#include "../TestThread.hpp"
+#include <vector>
+
+using namespace http;
+using namespace http::websocket;
+
+BOOST_AUTO_TEST_SUITE(TestWebSocket)
+
+static const uint16_t BASE_PORT = 5340;
+
+/**Frame as a client would, masking the payload.*/
+std::string client_frame(Opcode opcode, const std::string &payload, bool fin = true, bool rsv1 = false)
+{
+    FrameHeader header = { fin, rsv1, 0, opcode, true, { 0x12, 0x34, 0x56, 0x78 }, payload.size() };
+    std::string frame;
+    header.write(&frame);
+    auto start = frame.size();
+    frame += payload;
+    apply_mask((uint8_t*)&frame[start], payload.size(), header.mask);
+    return frame;
+}
+/**Turn an unmasked server frame into a client frame.*/
+std::string mask_frame(const std::string &frame)
+{
+    FrameHeader header;
+    auto len = FrameHeader::read((const uint8_t*)frame.data(), frame.size(), &header);
+    BOOST_REQUIRE(len);
+    return client_frame(header.opcode, frame.substr(len), header.fin, header.rsv1);
+}
+std::string close_payload(uint16_t code)
+{
+    return std::string{ (char)(code >> 8), (char)code };
+}
+
+/**Records the handler callbacks.*/
+struct Events
+{
+    std::vector<std::string> messages;
+    std::vector<Opcode> opcodes;
+    std::vector<const char*> pointers;
+    int opened = 0;
+    std::vector<uint16_t> closes;
+
+    WebSocketHandler handler()
+    {
+        WebSocketHandler handler;
+        handler.on_open = [this](const std::shared_ptr<WebSocket>&) { ++opened; };
+        handler.on_message = [this](const std::shared_ptr<WebSocket>&, Opcode opcode, const char *data, size_t len)
+        {
+            opcodes.push_back(opcode);
+            messages.emplace_back(data, len);
+            pointers.push_back(data);
+        };
+        handler.on_close = [this](const std::shared_ptr<WebSocket>&, uint16_t code, const std::string&)
+        {
+            closes.push_back(code);
+        };
+        return handler;
+    }
+};
+
+Request upgrade_request(const std::string &extensions = std::string())
+{
+    Request req;
+    req.method = GET;
+    req.raw_url = "/ws";
+    req.url = Url::parse_request(req.raw_url);
+    req.headers.add("Host", "localhost");
+    req.headers.add("Upgrade", "websocket");
+    req.headers.add("Connection", "keep-alive, Upgrade");
+    req.headers.add("Sec-WebSocket-Key", "dGhlIHNhbXBsZSBub25jZQ==");
+    req.headers.add("Sec-WebSocket-Version", "13");
+    if (!extensions.empty()) req.headers.add("Sec-WebSocket-Extensions", extensions);
+    return req;
+}
+std::shared_ptr<WebSocket> open_websocket(Events &events, const WebSocketOptions &options = WebSocketOptions(),
+    const std::string &extensions = std::string())
+{
+    auto req = upgrade_request(extensions);
+    PathParams params;
+    auto resp = websocket_upgrade(req, params, events.handler(), options);
+    BOOST_REQUIRE_EQUAL(101, resp.status.code);
+    resp.websocket->attach(nullptr);
+    resp.websocket->open();
+    return resp.websocket;
+}
+/**Pass data to the socket as if received into a buffer of capacity bytes.*/
+size_t receive(WebSocket &ws, std::string &data, size_t capacity = 8192)
+{
+    return ws.receive((uint8_t*)&data[0], data.size(), capacity);
+}
+std::string take_all(WebSocket &ws)
+{
+    std::string out;
+    while (auto data = ws.take_output()) out += *data;
+    return out;
+}
+
+BOOST_AUTO_TEST_CASE(upgrade)
+{
+    Events events;
+    WebSocketOptions options;
+    options.protocols = { "chat", "superchat" };
+    auto req = upgrade_request("x-unknown, permessage-deflate; client_max_window_bits");
+    req.headers.add("Sec-WebSocket-Protocol", "superchat, chat");
+    PathParams params = { { "id", "5" } };
+    auto resp = websocket_upgrade(req, params, events.handler(), options);
+    BOOST_CHECK_EQUAL(101, resp.status.code);
+    BOOST_CHECK_EQUAL("websocket", resp.headers.get("Upgrade"));
+    BOOST_CHECK_EQUAL("s3pPLMBiTxaQ9kYGzzhZRbK+xOo=", resp.headers.get("Sec-WebSocket-Accept"));
+    BOOST_CHECK_EQUAL("permessage-deflate; server_no_context_takeover", resp.headers.get("Sec-WebSocket-Extensions"));
+    BOOST_CHECK_EQUAL("chat", resp.headers.get("Sec-WebSocket-Protocol"));
+    BOOST_REQUIRE(resp.websocket);
+    BOOST_CHECK(resp.websocket->deflate());
+    BOOST_CHECK_EQUAL("chat", resp.websocket->protocol());
+    BOOST_CHECK_EQUAL("5", resp.websocket->path_params().at("id"));
+    BOOST_CHECK_EQUAL("/ws", resp.websocket->request().raw_url);
+
+    // Deflate is declined if the server window is limited, or disabled
+    req = upgrade_request("permessage-deflate; server_max_window_bits=10");
+    BOOST_CHECK(!websocket_upgrade(req, params, events.handler()).headers.has("Sec-WebSocket-Extensions"));
+    req = upgrade_request("permessage-deflate");
+    options.permessage_deflate = false;
+    BOOST_CHECK(!websocket_upgrade(req, params, events.handler(), options).websocket->deflate());
+
+    // Not an upgrade, or unsupported version
+    req = upgrade_request();
+    req.headers.remove("Upgrade");
+    BOOST_CHECK_EQUAL(426, websocket_upgrade(req, params, events.handler()).status.code);
+    req = upgrade_request();
+    req.headers.set("Sec-WebSocket-Version", "8");
+    auto rejected = websocket_upgrade(req, params, events.handler());
+    BOOST_CHECK_EQUAL(426, rejected.status.code);
+    BOOST_CHECK_EQUAL("13", rejected.headers.get("Sec-WebSocket-Version"));
+    BOOST_CHECK(!rejected.websocket);
+    req = upgrade_request();
+    req.headers.set("Sec-WebSocket-Key", "short");
+    BOOST_CHECK_THROW(websocket_upgrade(req, params, events.handler()), BadRequest);
+
+    // Router
+    Router router;
+    router.add_websocket("/ws/:id", events.handler());
+    auto route = router.get("GET", "/ws/7");
+    BOOST_REQUIRE(route);
+    req = upgrade_request();
+    resp = route.handler(req, route.path_params);
+    BOOST_CHECK_EQUAL(101, resp.status.code);
+    BOOST_CHECK_EQUAL("7", resp.websocket->path_params().at("id"));
+    BOOST_CHECK_EQUAL(0, events.opened);
+}
+
+BOOST_AUTO_TEST_CASE(messages)
+{
+    Events events;
+    auto ws = open_websocket(events);
+    BOOST_CHECK_EQUAL(1, events.opened);
+
+    // Complete frames are passed without copying, and a partial frame is left
+    std::string data = client_frame(OP_TEXT, "Hello") + client_frame(OP_BINARY, std::string("\0\1", 2));
+    auto second = client_frame(OP_TEXT, "World");
+    data += second.substr(0, 4);
+    BOOST_CHECK_EQUAL(data.size() - 4, receive(*ws, data));
+    BOOST_REQUIRE_EQUAL(2U, events.messages.size());
+    BOOST_CHECK_EQUAL("Hello", events.messages[0]);
+    BOOST_CHECK_EQUAL(OP_TEXT, events.opcodes[0]);
+    BOOST_CHECK(events.pointers[0] == data.data() + 6);
+    BOOST_CHECK_EQUAL(std::string("\0\1", 2), events.messages[1]);
+    BOOST_CHECK_EQUAL(OP_BINARY, events.opcodes[1]);
+    BOOST_CHECK_EQUAL(second.size(), receive(*ws, second));
+    BOOST_CHECK_EQUAL("World", events.messages[2]);
+
+    // Fragmented, with a ping between the fragments
+    data = client_frame(OP_TEXT, "frag", false) + client_frame(OP_PING, "p") +
+        client_frame(OP_CONTINUATION, "men", false) + client_frame(OP_CONTINUATION, "ted");
+    BOOST_CHECK_EQUAL(data.size(), receive(*ws, data));
+    BOOST_REQUIRE_EQUAL(4U, events.messages.size());
+    BOOST_CHECK_EQUAL("fragmented", events.messages[3]);
+    BOOST_CHECK_EQUAL(std::string("\x8A\x01p"), take_all(*ws));
+
+    // A frame larger than the buffer is received in parts
+    std::string large(1000, 'x');
+    auto frame = client_frame(OP_BINARY, large);
+    for (size_t i = 0; i < frame.size();)
+    {
+        auto part = frame.substr(i, 100);
+        auto used = ws->receive((uint8_t*)&part[0], part.size(), 100);
+        BOOST_REQUIRE(used > 0);
+        i += used;
+    }
+    BOOST_REQUIRE_EQUAL(5U, events.messages.size());
+    BOOST_CHECK_EQUAL(large, events.messages[4]);
+
+    BOOST_CHECK(!ws->wants_close());
+    BOOST_CHECK(events.closes.empty());
+}
+
+BOOST_AUTO_TEST_CASE(deflate)
+{
+    Events events;
+    WebSocketOptions options;
+    options.deflate_min_size = 10;
+    auto ws = open_websocket(events, options, "permessage-deflate");
+    BOOST_REQUIRE(ws->deflate());
+
+    std::string text;
+    for (int i = 0; i < 100; ++i) text += "compressible text ";
+    BOOST_CHECK(ws->send_text(text));
+    BOOST_CHECK(ws->send_text("short"));
+    auto out = take_all(*ws);
+    // The first frame is compressed, with RSV1 set
+    BOOST_CHECK_EQUAL(0xC1, (uint8_t)out[0]);
+    BOOST_CHECK(out.size() < text.size());
+
+    // Echo the frames back, with the client reusing the server's framing
+    FrameHeader header;
+    auto len = FrameHeader::read((const uint8_t*)out.data(), out.size(), &header);
+    auto first = out.substr(0, len + (size_t)header.length);
+    auto data = mask_frame(first) + mask_frame(out.substr(first.size()));
+    BOOST_CHECK_EQUAL(data.size(), receive(*ws, data));
+    BOOST_REQUIRE_EQUAL(2U, events.messages.size());
+    BOOST_CHECK_EQUAL(text, events.messages[0]);
+    BOOST_CHECK_EQUAL("short", events.messages[1]);
+
+    // Compressed messages must not exceed the limit once decompressed
+    options.max_message_size = 100;
+    auto limited = open_websocket(events, options, "permessage-deflate");
+    data = mask_frame(first);
+    receive(*limited, data);
+    BOOST_CHECK(limited->wants_close());
+    BOOST_CHECK_EQUAL(1009, events.closes.back());
+}
+
+BOOST_AUTO_TEST_CASE(close_handshake)
+{
+    {
+        // Client close is echoed
+        Events events;
+        auto ws = open_websocket(events);
+        auto data = client_frame(OP_CLOSE, close_payload(1000) + "bye") + client_frame(OP_TEXT, "ignored");
+        BOOST_CHECK_EQUAL(data.size(), receive(*ws, data));
+        BOOST_CHECK(events.messages.empty());
+        BOOST_CHECK(ws->wants_close());
+        BOOST_CHECK(!ws->is_open());
+        BOOST_CHECK_EQUAL(std::string("\x88\x02\x03\xE8", 4), take_all(*ws));
+        ws->detach();
+        BOOST_CHECK(events.closes == std::vector<uint16_t>{ 1000 });
+    }
+    {
+        // Server close waits for the client response
+        Events events;
+        auto ws = open_websocket(events);
+        BOOST_CHECK(ws->close(1001));
+        BOOST_CHECK(!ws->send_text("late"));
+        BOOST_CHECK_EQUAL(std::string("\x88\x02\x03\xE9", 4), take_all(*ws));
+        BOOST_CHECK(!ws->wants_close());
+        auto data = client_frame(OP_CLOSE, close_payload(1001));
+        receive(*ws, data);
+        BOOST_CHECK(ws->wants_close());
+        BOOST_CHECK_EQUAL("", take_all(*ws));
+        BOOST_CHECK(events.closes == std::vector<uint16_t>{ 1001 });
+    }
+    {
+        // Connection lost
+        Events events;
+        auto ws = open_websocket(events);
+        ws->detach();
+        BOOST_CHECK(!ws->send_text("late"));
+        BOOST_CHECK(events.closes == std::vector<uint16_t>{ 1006 });
+    }
+}
+
+BOOST_AUTO_TEST_CASE(protocol_errors)
+{
+    struct Case { std::string data; uint16_t code; };
+    std::string unmasked;
+    write_frame(&unmasked, OP_TEXT, "x", 1);
+    WebSocketOptions options;
+    options.max_message_size = 10;
+    std::vector<Case> cases =
+    {
+        { unmasked, 1002 },
+        { client_frame(OP_CONTINUATION, "x"), 1002 },
+        { client_frame(OP_TEXT, "x", false) + client_frame(OP_TEXT, "y"), 1002 },
+        { client_frame(OP_PING, "x", false), 1002 },
+        { client_frame(OP_TEXT, "x", true, true), 1002 }, // Compression not negotiated
+        { client_frame((Opcode)3, "x"), 1002 },
+        { client_frame(OP_CLOSE, close_payload(1005)), 1002 },
+        { client_frame(OP_TEXT, "\xC0\xAF"), 1007 },
+        { client_frame(OP_TEXT, "12345", false) + client_frame(OP_CONTINUATION, "678901"), 1009 }
+    };
+    for (auto &i : cases)
+    {
+        Events events;
+        auto ws = open_websocket(events, options);
+        BOOST_CHECK_EQUAL(i.data.size(), receive(*ws, i.data));
+        BOOST_CHECK(ws->wants_close());
+        BOOST_CHECK_EQUAL(close_payload(i.code), take_all(*ws).substr(2));
+        BOOST_CHECK(events.closes == std::vector<uint16_t>{ i.code });
+    }
+}
+
+BOOST_AUTO_TEST_CASE(broadcast)
+{
+    Events events;
+    WebSocketOptions options;
+    options.deflate_min_size = 10;
+    auto plain = open_websocket(events, options);
+    auto deflate = open_websocket(events, options, "permessage-deflate");
+    int notified = 0;
+    plain->attach([&notified]() { ++notified; });
+
+    WebSocketMessage message(OP_TEXT, std::string(1000, 'a'), options);
+    BOOST_CHECK(message.frame(true) != message.frame(false));
+    BOOST_CHECK_EQUAL(2U, WebSocket::broadcast({ plain, deflate }, message));
+    BOOST_CHECK_EQUAL(1, notified);
+    BOOST_CHECK_EQUAL(message.frame(false)->size(), plain->buffered_amount());
+    // The same frames are sent to every socket, without a copy
+    BOOST_CHECK(plain->take_output() == message.frame(false));
+    BOOST_CHECK(deflate->take_output() == message.frame(true));
+    BOOST_CHECK_EQUAL(0U, plain->buffered_amount());
+
+    // Small frames are combined
+    BOOST_CHECK(plain->send_text("a"));
+    BOOST_CHECK(plain->send_binary("b", 1));
+    BOOST_CHECK(plain->ping());
+    BOOST_CHECK_EQUAL(2, notified);
+    BOOST_CHECK_EQUAL(std::string("\x81\x01" "a" "\x82\x01" "b" "\x89\x00", 8), *plain->take_output());
+    BOOST_CHECK(!plain->take_output());
+}
+
+/**Accepts WebSockets at /echo, echoing each message.*/
+class EchoServer : public CoreServer
+{
+public:
+    EchoServer()
+    {
+        WebSocketHandler handler;
+        handler.on_message = [](const std::shared_ptr<WebSocket> &ws, Opcode opcode, const char *data, size_t len)
+        {
+            if (opcode == OP_TEXT) ws->send_text(std::string(data, len));
+            else ws->send_binary(data, len);
+        };
+        router.add_websocket("/echo", handler);
+    }
+protected:
+    Router router;
+
+    virtual Response handle_request(Request &request)override
+    {
+        auto route = router.get(to_string(request.method), request.url.path);
+        if (!route) throw NotFound(request.url.path);
+        return route.handler(request, route.path_params);
+    }
+    virtual Response parser_error_page(const ParserError &)override
+    {
+        throw std::runtime_error("Unexpected parser_error_page");
+    }
+};
+std::string recv_until(TcpSocket &sock, size_t len)
+{
+    std::string data;
+    char buffer[4096];
+    while (data.size() < len)
+    {
+        auto n = sock.recv(buffer, sizeof(buffer));
+        if (!n) break;
+        data.append(buffer, n);
+    }
+    return data;
+}
+
+BOOST_AUTO_TEST_CASE(server)
+{
+    TestThread server_thread;
+    EchoServer server;
+    server.add_tcp_listener("127.0.0.1", BASE_PORT);
+    server_thread = TestThread(std::bind(&EchoServer::run, &server));
+
+    TcpSocket sock("localhost", BASE_PORT);
+    std::string upgrade =
+        "GET /echo HTTP/1.1\r\nHost: localhost\r\nUpgrade: websocket\r\nConnection: Upgrade\r\n"
+        "Sec-WebSocket-Key: dGhlIHNhbXBsZSBub25jZQ==\r\nSec-WebSocket-Version: 13\r\n\r\n";
+    // The first message may arrive with the upgrade request
+    auto hello = client_frame(OP_TEXT, "Hello");
+    upgrade += hello;
+    sock.send_all(upgrade.data(), upgrade.size());
+    std::string resp;
+    while (resp.find("\r\n\r\n") == std::string::npos) resp += recv_until(sock, 1);
+    BOOST_CHECK_EQUAL(0U, resp.find("HTTP/1.1 101 Switching Protocols\r\n"));
+    BOOST_CHECK(resp.find("Sec-WebSocket-Accept: s3pPLMBiTxaQ9kYGzzhZRbK+xOo=\r\n") != std::string::npos);
+    BOOST_CHECK(resp.find("Content-Length") == std::string::npos);
+    auto received = resp.substr(resp.find("\r\n\r\n") + 4);
+
+    std::string large(100000, 'x');
+    auto data = client_frame(OP_BINARY, large);
+    sock.send_all(data.data(), data.size());
+    received += recv_until(sock, 7 + 10 + large.size() - received.size());
+    BOOST_CHECK_EQUAL(std::string("\x81\x05Hello"), received.substr(0, 7));
+    BOOST_CHECK_EQUAL(std::string("\x82\x7F\0\0\0\0\0\x01\x86\xA0", 10), received.substr(7, 10));
+    BOOST_CHECK(received.substr(17) == large);
+
+    // Close handshake, then the server closes the connection
+    data = client_frame(OP_CLOSE, close_payload(1000));
+    sock.send_all(data.data(), data.size());
+    BOOST_CHECK_EQUAL(std::string("\x88\x02\x03\xE8", 4), recv_until(sock, 100));
+
+    server.exit();
+    server_thread.join();
+}
+
+BOOST_AUTO_TEST_SUITE_END()
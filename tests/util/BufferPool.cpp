@@ -0,0 +1,66 @@
+#include <boost/test/unit_test.hpp>
+#include "util/BufferPool.hpp"
+#include <cstring>
+
+using namespace http;
+
+BOOST_AUTO_TEST_SUITE(TestBufferPool)
+
+BOOST_AUTO_TEST_CASE(size_classes)
+{
+    BOOST_CHECK_EQUAL(4096U, BufferPool::size_class(0));
+    BOOST_CHECK_EQUAL(4096U, BufferPool::size_class(4096));
+    BOOST_CHECK_EQUAL(8192U, BufferPool::size_class(4097));
+    BOOST_CHECK_EQUAL(65536U, BufferPool::size_class(40000));
+}
+
+BOOST_AUTO_TEST_CASE(reuse)
+{
+    BufferPool pool(16384, 2);
+    const char *first;
+    {
+        auto a = pool.get(100);
+        BOOST_CHECK_EQUAL(4096U, a.size());
+        BOOST_CHECK_EQUAL(1U, pool.in_use());
+        first = a.data();
+    }
+    BOOST_CHECK_EQUAL(0U, pool.in_use());
+    BOOST_CHECK_EQUAL(4096U, pool.free_bytes());
+    // Freed buffers are reused by the same size class
+    auto b = pool.get(4000);
+    BOOST_CHECK_EQUAL(first, b.data());
+    BOOST_CHECK_EQUAL(0U, pool.free_bytes());
+
+    // Only max_free buffers of each class are kept
+    {
+        auto c = pool.get(8192), d = pool.get(8192), e = pool.get(8192);
+    }
+    BOOST_CHECK_EQUAL(16384U, pool.free_bytes());
+    // Buffers over max_pooled_size are not kept
+    {
+        auto f = pool.get(65536);
+        BOOST_CHECK_EQUAL(65536U, f.size());
+    }
+    BOOST_CHECK_EQUAL(16384U, pool.free_bytes());
+
+    // Moving transfers ownership
+    PooledBuffer g = std::move(b);
+    BOOST_CHECK(!b);
+    BOOST_CHECK(g);
+    BOOST_CHECK_EQUAL(1U, pool.in_use());
+    g.reset();
+    BOOST_CHECK_EQUAL(0U, pool.in_use());
+}
+
+BOOST_AUTO_TEST_CASE(grow)
+{
+    BufferPool pool;
+    auto buffer = pool.get(10);
+    memcpy(buffer.data(), "abcdef", 6);
+    buffer = pool.grow(std::move(buffer), buffer.size() * 2, 6);
+    BOOST_CHECK_EQUAL(8192U, buffer.size());
+    BOOST_CHECK_EQUAL("abcdef", std::string(buffer.data(), 6));
+    BOOST_CHECK_EQUAL(1U, pool.in_use());
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,210 @@
+#include <boost/test/unit_test.hpp>
+#ifdef HTTP_USE_COROUTINES
+#include "util/Coroutine.hpp"
+#include "net/Awaitable.hpp"
+#include "net/TcpListenSocket.hpp"
+#include "net/TcpSocket.hpp"
+#include "server/CoreServer.hpp"
+#include "server/Router.hpp"
+#include "client/ClientConnection.hpp"
+#include "Response.hpp"
+#include "../TestThread.hpp"
+#include <future>
+#include <stdexcept>
+#include <thread>
+
+using namespace http;
+
+BOOST_AUTO_TEST_SUITE(TestCoroutine)
+
+static const uint16_t PORT = 5360;
+
+Task<int> add(int a, int b)
+{
+    co_return a + b;
+}
+Task<int> sum()
+{
+    int x = co_await add(1, 2);
+    int y = co_await add(x, 3);
+    co_return y;
+}
+Task<int> fail()
+{
+    throw std::runtime_error("failed");
+    co_return 0;
+}
+Task<void> run_sum(int *out)
+{
+    *out = co_await sum();
+}
+Task<void> run_fail(std::string *error)
+{
+    try
+    {
+        co_await fail();
+    }
+    catch (const std::runtime_error &e)
+    {
+        *error = e.what();
+    }
+}
+
+BOOST_AUTO_TEST_CASE(frame_allocator)
+{
+    auto frame = FrameAllocator::allocate(100);
+    FrameAllocator::deallocate(frame, 100);
+    BOOST_CHECK(FrameAllocator::free_frames() >= 1);
+    // Reused for any size in the same class
+    auto allocated = FrameAllocator::allocated_frames();
+    auto reused = FrameAllocator::allocate(90);
+    BOOST_CHECK_EQUAL(allocated, FrameAllocator::allocated_frames());
+    FrameAllocator::deallocate(reused, 90);
+
+    // Frames freed on one thread are reused by others
+    std::thread([]() { FrameAllocator::deallocate(FrameAllocator::allocate(100), 100); }).join();
+    BOOST_CHECK_EQUAL(allocated, FrameAllocator::allocated_frames());
+
+    auto large = FrameAllocator::allocate(FrameAllocator::MAX_POOLED_SIZE + 1);
+    auto free_frames = FrameAllocator::free_frames();
+    FrameAllocator::deallocate(large, FrameAllocator::MAX_POOLED_SIZE + 1);
+    BOOST_CHECK_EQUAL(free_frames, FrameAllocator::free_frames());
+}
+
+BOOST_AUTO_TEST_CASE(task)
+{
+    int result = 0;
+    spawn(run_sum(&result));
+    BOOST_CHECK_EQUAL(6, result);
+
+    // Once warm, frames come from the pool and are all returned to it
+    auto free_frames = FrameAllocator::free_frames();
+    result = 0;
+    spawn(run_sum(&result));
+    BOOST_CHECK_EQUAL(6, result);
+    BOOST_CHECK_EQUAL(free_frames, FrameAllocator::free_frames());
+
+    std::string error;
+    spawn(run_fail(&error));
+    BOOST_CHECK_EQUAL("failed", error);
+
+    // Tasks do not start until awaited
+    Task<int> lazy = add(1, 1);
+    BOOST_CHECK(lazy);
+}
+
+Task<void> echo(AsyncIo &aio, TcpSocket &sock, std::promise<std::string> *done)
+{
+    std::string received;
+    try
+    {
+        char buffer[256];
+        while (auto len = co_await co_recv(aio, sock, buffer, sizeof(buffer)))
+        {
+            received.append(buffer, len);
+            auto sent = co_await co_send_all(aio, sock, buffer, len);
+            BOOST_CHECK_EQUAL(len, sent);
+        }
+        done->set_value(received);
+    }
+    catch (const std::exception &)
+    {
+        done->set_exception(std::current_exception());
+    }
+}
+Task<void> wait_abort(AsyncIo &aio, TcpSocket &sock, std::promise<void> *done)
+{
+    try
+    {
+        co_await co_wait_recv(aio, sock);
+        done->set_value();
+    }
+    catch (const std::exception &)
+    {
+        done->set_exception(std::current_exception());
+    }
+}
+
+BOOST_AUTO_TEST_CASE(socket)
+{
+    AsyncIo aio;
+    TestThread aio_thread(std::bind(&AsyncIo::run, &aio));
+    TcpListenSocket listen("127.0.0.1", PORT);
+    TcpSocket client("127.0.0.1", PORT);
+    auto server = listen.accept();
+    server.set_non_blocking();
+
+    std::promise<std::string> echo_done;
+    spawn(echo(aio, server, &echo_done));
+    client.send_all("Hello", 5);
+    char buffer[5];
+    size_t received = 0;
+    while (received < sizeof(buffer)) received += client.recv(buffer + received, sizeof(buffer) - received);
+    BOOST_CHECK_EQUAL("Hello", std::string(buffer, sizeof(buffer)));
+    client.close();
+    BOOST_CHECK_EQUAL("Hello", echo_done.get_future().get());
+
+    // Pending operations throw once AsyncIo exits
+    TcpSocket client2("127.0.0.1", PORT);
+    auto server2 = listen.accept();
+    server2.set_non_blocking();
+    std::promise<void> abort_done;
+    auto abort_future = abort_done.get_future();
+    spawn(wait_abort(aio, server2, &abort_done));
+    aio.exit();
+    aio_thread.join();
+    BOOST_CHECK_THROW(abort_future.get(), AsyncAborted);
+}
+
+class RouterServer : public CoreServer
+{
+public:
+    RouterServer()
+    {
+        router.add_coroutine("GET", "/sum", [](Request &, PathParams) -> Task<Response>
+        {
+            Response resp;
+            resp.status_code(200);
+            resp.body = std::to_string(co_await sum());
+            co_return resp;
+        });
+    }
+protected:
+    Router router;
+
+    virtual void handle_request_async(Request &req, Responder responder)override
+    {
+        router.get(to_string(req.method), req.url.path).respond(req, std::move(responder));
+    }
+    virtual Response parser_error_page(const ParserError &)override
+    {
+        throw std::runtime_error("Unexpected parser_error_page");
+    }
+};
+
+BOOST_AUTO_TEST_CASE(server_frames)
+{
+    TestThread server_thread;
+    RouterServer server;
+    server.add_tcp_listener("127.0.0.1", PORT + 1);
+    server_thread = TestThread(std::bind(&RouterServer::run, &server));
+
+    Request req;
+    req.method = GET;
+    req.headers.add("Host", "localhost");
+    req.headers.add("Connection", "keep-alive");
+    req.raw_url = "/sum";
+    ClientConnection conn(std::unique_ptr<Socket>(new TcpSocket("localhost", PORT + 1)));
+    for (int i = 0; i < 3; ++i) BOOST_CHECK_EQUAL("6", conn.make_request(req).body);
+
+    // Each request runs on a new handler thread, but the frames of earlier ones are reused
+    auto allocated = FrameAllocator::allocated_frames();
+    for (int i = 0; i < 20; ++i) BOOST_CHECK_EQUAL("6", conn.make_request(req).body);
+    BOOST_CHECK(FrameAllocator::allocated_frames() - allocated < 5);
+
+    server.exit();
+    server_thread.join();
+}
+
+BOOST_AUTO_TEST_SUITE_END()
+#endif
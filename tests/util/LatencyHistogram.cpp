@@ -0,0 +1,70 @@
+#include <boost/test/unit_test.hpp>
+#include "util/LatencyHistogram.hpp"
+#include <stdexcept>
+
+using namespace http;
+
+BOOST_AUTO_TEST_SUITE(TestLatencyHistogram)
+
+BOOST_AUTO_TEST_CASE(percentiles)
+{
+    LatencyHistogram histogram;
+    BOOST_CHECK_EQUAL(0U, histogram.count());
+    BOOST_CHECK_EQUAL(0U, histogram.percentile(50));
+    BOOST_CHECK_EQUAL(0U, histogram.min());
+
+    for (uint64_t v = 1; v <= 10000; ++v) histogram.record(v * 1000);
+    BOOST_CHECK_EQUAL(10000U, histogram.count());
+    BOOST_CHECK_EQUAL(1000U, histogram.min());
+    BOOST_CHECK_EQUAL(10000000U, histogram.max());
+    BOOST_CHECK_CLOSE(5000500.0, histogram.mean(), 0.0001);
+    // Within the 1/1024 precision of the buckets
+    BOOST_CHECK_CLOSE(5000000.0, (double)histogram.percentile(50), 0.1);
+    BOOST_CHECK_CLOSE(9900000.0, (double)histogram.percentile(99), 0.1);
+    BOOST_CHECK_CLOSE(9990000.0, (double)histogram.percentile(99.9), 0.1);
+    BOOST_CHECK_EQUAL(10000000U, histogram.percentile(100));
+    BOOST_CHECK_CLOSE(1000.0, (double)histogram.percentile(0), 0.1);
+    // Small values are exact
+    LatencyHistogram small;
+    for (uint64_t v = 0; v < 100; ++v) small.record(v);
+    BOOST_CHECK_EQUAL(49U, small.percentile(50));
+    BOOST_CHECK_EQUAL(98U, small.percentile(99));
+
+    histogram.reset();
+    BOOST_CHECK_EQUAL(0U, histogram.count());
+    BOOST_CHECK_EQUAL(0U, histogram.max());
+}
+
+BOOST_AUTO_TEST_CASE(outliers)
+{
+    // A single slow value is reported by the high percentiles, not averaged away
+    LatencyHistogram histogram;
+    for (int i = 0; i < 9999; ++i) histogram.record(100000);
+    histogram.record(1000000000);
+    BOOST_CHECK_CLOSE(100000.0, (double)histogram.percentile(99.99), 0.1);
+    BOOST_CHECK_CLOSE(1000000000.0, (double)histogram.percentile(99.999), 0.1);
+
+    // Values past the range are recorded as the largest value
+    LatencyHistogram limited(20, 4);
+    limited.record(1 << 25);
+    BOOST_CHECK_EQUAL(1U, limited.saturated());
+    BOOST_CHECK_EQUAL((1U << 20) - 1, limited.max());
+}
+
+BOOST_AUTO_TEST_CASE(merge)
+{
+    LatencyHistogram a, b;
+    for (uint64_t v = 1; v <= 100; ++v) a.record(v);
+    for (uint64_t v = 101; v <= 200; ++v) b.record(v);
+    a.merge(b);
+    BOOST_CHECK_EQUAL(200U, a.count());
+    BOOST_CHECK_EQUAL(1U, a.min());
+    BOOST_CHECK_EQUAL(200U, a.max());
+    BOOST_CHECK_EQUAL(100U, a.percentile(50));
+
+    LatencyHistogram other(30, 10);
+    BOOST_CHECK_THROW(a.merge(other), std::invalid_argument);
+    BOOST_CHECK_THROW(LatencyHistogram(10, 10), std::invalid_argument);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
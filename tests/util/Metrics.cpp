@@ -0,0 +1,188 @@
+#include <boost/test/unit_test.hpp>
+#include "util/Metrics.hpp"
+#include <stdexcept>
+#include <thread>
+
+using namespace http;
+
+BOOST_AUTO_TEST_SUITE(TestMetrics)
+
+BOOST_AUTO_TEST_CASE(histogram_buckets)
+{
+    HistogramBuckets buckets(10, 2);
+    BOOST_CHECK_EQUAL(36U, buckets.count());
+    BOOST_CHECK_EQUAL(0U, buckets.index(0));
+    BOOST_CHECK_EQUAL(3U, buckets.index(3));
+    BOOST_CHECK_EQUAL(4U, buckets.index(4));
+    BOOST_CHECK_EQUAL(8U, buckets.index(8));
+    BOOST_CHECK_EQUAL(8U, buckets.index(9));
+    BOOST_CHECK_EQUAL(9U, buckets.index(10));
+    BOOST_CHECK_EQUAL(35U, buckets.index(1023));
+    BOOST_CHECK_EQUAL(36U, buckets.index(1024));
+    BOOST_CHECK_EQUAL(36U, buckets.index(UINT64_MAX));
+    BOOST_CHECK_EQUAL(1023U, buckets.upper_bound(35));
+    // Every value is within its bucket
+    for (uint64_t v = 0; v < 1024; ++v)
+    {
+        auto i = buckets.index(v);
+        BOOST_REQUIRE(buckets.upper_bound(i) >= v);
+        if (i > 0) BOOST_REQUIRE(buckets.upper_bound(i - 1) < v);
+    }
+
+    HistogramBuckets full(64, 3);
+    BOOST_CHECK_EQUAL(full.count() - 1, full.index(UINT64_MAX));
+    BOOST_CHECK_EQUAL(UINT64_MAX, full.upper_bound(full.count() - 1));
+}
+
+BOOST_AUTO_TEST_CASE(render)
+{
+    Metrics metrics;
+    auto requests_2xx = metrics.counter("requests_total", "Requests.", { { "code", "2xx" } });
+    auto requests_5xx = metrics.counter("requests_total", "Requests.", { { "code", "5xx" } });
+    auto connections = metrics.gauge("connections", "Open \\ connections\nnow.");
+    auto latency = metrics.histogram("latency_seconds", "Latency.", HistogramBuckets(2, 1, 0.5),
+        { { "path", "a\"b" } });
+
+    requests_2xx.inc();
+    requests_2xx.inc(2);
+    requests_5xx.inc();
+    connections.inc();
+    connections.inc();
+    connections.dec();
+    latency.observe(0);
+    latency.observe(3);
+    latency.observe(3);
+    latency.observe(100);
+
+    // Getting an existing series returns the same values
+    metrics.counter("requests_total", "Requests.", { { "code", "2xx" } }).inc();
+
+    BOOST_CHECK_EQUAL(
+        "# HELP requests_total Requests.\n"
+        "# TYPE requests_total counter\n"
+        "requests_total{code=\"2xx\"} 4\n"
+        "requests_total{code=\"5xx\"} 1\n"
+        "# HELP connections Open \\\\ connections\\nnow.\n"
+        "# TYPE connections gauge\n"
+        "connections 1\n"
+        "# HELP latency_seconds Latency.\n"
+        "# TYPE latency_seconds histogram\n"
+        "latency_seconds_bucket{path=\"a\\\"b\",le=\"0\"} 1\n"
+        "latency_seconds_bucket{path=\"a\\\"b\",le=\"0.5\"} 1\n"
+        "latency_seconds_bucket{path=\"a\\\"b\",le=\"1\"} 1\n"
+        "latency_seconds_bucket{path=\"a\\\"b\",le=\"1.5\"} 3\n"
+        "latency_seconds_bucket{path=\"a\\\"b\",le=\"+Inf\"} 4\n"
+        "latency_seconds_sum{path=\"a\\\"b\"} 53\n"
+        "latency_seconds_count{path=\"a\\\"b\"} 4\n",
+        metrics.render());
+
+    // Default constructed metrics do nothing
+    Counter().inc();
+    Gauge().dec();
+    Histogram().observe(5);
+}
+
+BOOST_AUTO_TEST_CASE(errors)
+{
+    Metrics metrics(10);
+    BOOST_CHECK_THROW(metrics.counter("", "Help."), std::invalid_argument);
+    BOOST_CHECK_THROW(metrics.counter("1abc", "Help."), std::invalid_argument);
+    BOOST_CHECK_THROW(metrics.counter("a-b", "Help."), std::invalid_argument);
+    BOOST_CHECK_THROW(metrics.counter("a", "Help.", { { "a:b", "x" } }), std::invalid_argument);
+    BOOST_CHECK_THROW(metrics.counter("a", "Help.", { { "__a", "x" } }), std::invalid_argument);
+    BOOST_CHECK_THROW(metrics.histogram("a", "Help.", HistogramBuckets(1, 2)), std::invalid_argument);
+
+    metrics.counter("a:b", "Help.", { { "x", "1" } });
+    BOOST_CHECK_THROW(metrics.gauge("a:b", "Help.", { { "x", "1" } }), std::invalid_argument);
+    BOOST_CHECK_THROW(metrics.counter("a:b", "Help.", { { "y", "1" } }), std::invalid_argument);
+    BOOST_CHECK_THROW(metrics.counter("a:b", "Help."), std::invalid_argument);
+
+    // Histograms use a value for each bucket, plus +Inf and the sum
+    metrics.histogram("h", "Help.", HistogramBuckets(2, 1));
+    BOOST_CHECK_THROW(metrics.histogram("h2", "Help.", HistogramBuckets(2, 1)), std::length_error);
+    metrics.gauge("g", "Help.");
+    metrics.gauge("g2", "Help.");
+    metrics.gauge("g3", "Help.");
+    BOOST_CHECK_THROW(metrics.gauge("g4", "Help."), std::length_error);
+}
+
+BOOST_AUTO_TEST_CASE(threads)
+{
+    Metrics metrics;
+    auto counter = metrics.counter("count", "Help.");
+    auto gauge = metrics.gauge("gauge", "Help.");
+    auto run_threads = [&]()
+    {
+        std::vector<std::thread> threads;
+        for (int i = 0; i < 8; ++i)
+        {
+            threads.emplace_back([&]()
+            {
+                for (int j = 0; j < 10000; ++j)
+                {
+                    counter.inc();
+                    gauge.dec();
+                }
+            });
+        }
+        for (auto &thread : threads) thread.join();
+    };
+    run_threads();
+    // Short lived threads, like a handler thread per request, share the same shards
+    for (int i = 0; i < 100; ++i) std::thread([&]() { counter.inc(); gauge.dec(); }).join();
+    run_threads();
+    BOOST_CHECK_EQUAL(
+        "# HELP count Help.\n"
+        "# TYPE count counter\n"
+        "count 160100\n"
+        "# HELP gauge Help.\n"
+        "# TYPE gauge gauge\n"
+        "gauge -160100\n",
+        metrics.render());
+}
+
+BOOST_AUTO_TEST_CASE(snapshot)
+{
+    // Registries in different processes may create the same series in a different order
+    Metrics a, b;
+    a.counter("requests_total", "Requests.", { { "code", "2xx" } }).inc(2);
+    a.gauge("connections", "Connections.").dec();
+    a.histogram("latency", "Latency.", HistogramBuckets(2, 1)).observe(1);
+    b.histogram("latency", "Latency.", HistogramBuckets(2, 1)).observe(3);
+    b.counter("requests_total", "Requests.", { { "code", "5xx" } }).inc();
+    b.counter("requests_total", "Requests.", { { "code", "2xx" } }).inc(3);
+
+    auto total = a.snapshot();
+    total.add(MetricsSnapshot::parse(b.snapshot().serialize()));
+    BOOST_CHECK_EQUAL(
+        "# HELP requests_total Requests.\n"
+        "# TYPE requests_total counter\n"
+        "requests_total{code=\"2xx\"} 5\n"
+        "requests_total{code=\"5xx\"} 1\n"
+        "# HELP connections Connections.\n"
+        "# TYPE connections gauge\n"
+        "connections -1\n"
+        "# HELP latency Latency.\n"
+        "# TYPE latency histogram\n"
+        "latency_bucket{le=\"0\"} 0\n"
+        "latency_bucket{le=\"1\"} 1\n"
+        "latency_bucket{le=\"2\"} 1\n"
+        "latency_bucket{le=\"3\"} 2\n"
+        "latency_bucket{le=\"+Inf\"} 2\n"
+        "latency_sum 4\n"
+        "latency_count 2\n",
+        total.render());
+    BOOST_CHECK_EQUAL(a.render(), a.snapshot().render());
+    BOOST_CHECK_EQUAL("", MetricsSnapshot().render());
+    BOOST_CHECK_EQUAL("", MetricsSnapshot::parse(MetricsSnapshot().serialize()).render());
+
+    Metrics other;
+    other.gauge("requests_total", "Requests.", { { "code", "2xx" } });
+    BOOST_CHECK_THROW(total.add(other.snapshot()), std::invalid_argument);
+    auto data = a.snapshot().serialize();
+    BOOST_CHECK_THROW(MetricsSnapshot::parse(data.substr(0, data.size() - 1)), std::invalid_argument);
+    BOOST_CHECK_THROW(MetricsSnapshot::parse(data + "x"), std::invalid_argument);
+    BOOST_CHECK_THROW(MetricsSnapshot::parse(""), std::invalid_argument);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,161 @@
+#include "client/LoadGenerator.hpp"
+#include "net/Net.hpp"
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+/**@file
+ * Command line load generator, built with "make loadgen".
+ *
+ * e.g. bin/loadgen --port 8080 --connections 16 --pipeline 4 --rate 50000 --duration 30
+ */
+using namespace http;
+
+namespace
+{
+    const double PERCENTILES[] = { 50, 75, 90, 99, 99.9, 99.99 };
+
+    const char USAGE[] =
+        "Usage: loadgen [options]\n"
+        "  --host HOST          Server host (default localhost)\n"
+        "  --port PORT          Server port (default 80)\n"
+        "  --tls                Connect with TLS\n"
+        "  --path PATH          Request path, may be repeated to send several in turn (default /)\n"
+        "  --method METHOD      Request method (default GET)\n"
+        "  --header 'K: V'      Add a request header, may be repeated\n"
+        "  --body DATA          Request body\n"
+        "  --connections N      Connections to open (default 1)\n"
+        "  --pipeline N         Requests outstanding per connection (default 1)\n"
+        "  --rate N             Requests per second for an open loop run, or 0 for closed loop\n"
+        "  --duration SECONDS   Length of the run (default 10)\n"
+        "  --warmup SECONDS     Time before recording latencies (default 0)\n"
+        "  --out FILE           Also write the results as JSON to FILE\n";
+
+    std::chrono::milliseconds seconds_arg(const std::string &value)
+    {
+        return std::chrono::milliseconds((long long)(std::atof(value.c_str()) * 1000));
+    }
+
+    LoadOptions parse_args(int argc, char *argv[], std::string *out)
+    {
+        LoadOptions options;
+        std::vector<std::string> paths;
+        std::string method = "GET", body;
+        Headers headers;
+        for (int i = 1; i < argc; ++i)
+        {
+            std::string arg = argv[i];
+            if (arg == "--tls")
+            {
+                options.tls = true;
+                continue;
+            }
+            if (i + 1 >= argc) throw std::runtime_error("Missing value for " + arg);
+            std::string value = argv[++i];
+            if (arg == "--host") options.host = value;
+            else if (arg == "--port") options.port = (uint16_t)std::atoi(value.c_str());
+            else if (arg == "--path") paths.push_back(value);
+            else if (arg == "--method") method = value;
+            else if (arg == "--header")
+            {
+                auto colon = value.find(':');
+                if (colon == std::string::npos) throw std::runtime_error("Invalid header " + value);
+                auto start = value.find_first_not_of(' ', colon + 1);
+                headers.add(value.substr(0, colon), start == std::string::npos ? "" : value.substr(start));
+            }
+            else if (arg == "--body") body = value;
+            else if (arg == "--connections") options.connections = (unsigned)std::atoi(value.c_str());
+            else if (arg == "--pipeline") options.pipeline = (unsigned)std::atoi(value.c_str());
+            else if (arg == "--rate") options.rate = std::atof(value.c_str());
+            else if (arg == "--duration") options.duration = seconds_arg(value);
+            else if (arg == "--warmup") options.warmup = seconds_arg(value);
+            else if (arg == "--out") *out = value;
+            else throw std::runtime_error("Unknown argument " + arg);
+        }
+        if (paths.empty()) paths.push_back("/");
+        for (auto &path : paths)
+        {
+            Request request;
+            request.method = method_from_string(method);
+            request.raw_url = path;
+            request.headers = headers;
+            request.body = body;
+            options.requests.push_back(request);
+        }
+        return options;
+    }
+
+    void print_result(const LoadOptions &options, const LoadResult &result)
+    {
+        printf("%s, %u connections, pipeline %u, %.1f seconds\n",
+            options.rate > 0 ? "Open loop" : "Closed loop",
+            options.connections, options.pipeline, result.elapsed);
+        printf("  Requests:   %llu completed, %llu status errors, %llu errors, %llu incomplete\n",
+            (unsigned long long)result.completed, (unsigned long long)result.status_errors,
+            (unsigned long long)result.errors, (unsigned long long)result.incomplete);
+        printf("  Throughput: %.1f requests/s, %.2f MB/s\n",
+            result.throughput(), (double)result.bytes_received / result.elapsed / 1e6);
+        printf("  Latency:    min %.1f us, mean %.1f us, max %.1f us\n",
+            (double)result.latency.min() / 1000, result.latency.mean() / 1000,
+            (double)result.latency.max() / 1000);
+        for (auto p : PERCENTILES)
+            printf("    p%-6g %12.1f us\n", p, (double)result.latency.percentile(p) / 1000);
+    }
+
+    void write_json(std::ostream &os, const LoadOptions &options, const LoadResult &result)
+    {
+        os << "{\n";
+        os << "  \"mode\": \"" << (options.rate > 0 ? "open" : "closed") << "\",\n";
+        os << "  \"connections\": " << options.connections << ",\n";
+        os << "  \"pipeline\": " << options.pipeline << ",\n";
+        os << "  \"rate\": " << options.rate << ",\n";
+        os << "  \"tls\": " << (options.tls ? "true" : "false") << ",\n";
+        os << "  \"elapsed\": " << result.elapsed << ",\n";
+        os << "  \"completed\": " << result.completed << ",\n";
+        os << "  \"status_errors\": " << result.status_errors << ",\n";
+        os << "  \"errors\": " << result.errors << ",\n";
+        os << "  \"incomplete\": " << result.incomplete << ",\n";
+        os << "  \"bytes_received\": " << result.bytes_received << ",\n";
+        os << "  \"requests_per_second\": " << result.throughput() << ",\n";
+        os << "  \"latency_ns\": {\"min\": " << result.latency.min();
+        os << ", \"mean\": " << result.latency.mean();
+        os << ", \"max\": " << result.latency.max();
+        for (auto p : PERCENTILES) os << ", \"p" << p << "\": " << result.latency.percentile(p);
+        os << "}\n}\n";
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    std::string out;
+    LoadOptions options;
+    try
+    {
+        options = parse_args(argc, argv, &out);
+    }
+    catch (const std::exception &e)
+    {
+        fprintf(stderr, "%s\n%s", e.what(), USAGE);
+        return 1;
+    }
+    try
+    {
+        init_net();
+        auto result = LoadGenerator(options).run();
+        print_result(options, result);
+        if (!out.empty())
+        {
+            std::ofstream file(out);
+            if (!file) throw std::runtime_error("Failed to open " + out);
+            write_json(file, options, result);
+        }
+        return 0;
+    }
+    catch (const std::exception &e)
+    {
+        fprintf(stderr, "%s\n", e.what());
+        return 1;
+    }
+}